@@ -0,0 +1,107 @@
+#ifndef KERNEL_ACPI_HEADER
+#define KERNEL_ACPI_HEADER
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ACPI_MAX_PROCESSORS 32
+
+/* where the BIOS leaves its tables: the first KB of the EBDA, and the BIOS ROM area */
+#define BIOS_EBDA_SEGMENT_POINTER 0x40E
+#define BIOS_ROM_START 0xE0000
+#define BIOS_ROM_END 0x100000
+#define BIOS_BASE_MEMORY_TOP 0xA0000
+
+/* root system description pointer, found on a 16 byte boundary */
+struct __attribute__((__packed__)) acpi_rsdp {
+    char signature[8]; /* "RSD PTR " */
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+};
+
+/* common header of every system description table */
+struct __attribute__((__packed__)) acpi_table_header {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+};
+
+/* the MADT ("APIC") is this header followed by variable length entries */
+struct __attribute__((__packed__)) acpi_madt {
+    struct acpi_table_header header;
+    uint32_t lapic_address;
+    uint32_t flags;
+};
+
+#define ACPI_MADT_LOCAL_APIC 0
+#define ACPI_MADT_LOCAL_APIC_ENABLED (1 << 0)
+#define ACPI_MADT_LOCAL_APIC_ONLINE_CAPABLE (1 << 1)
+
+struct __attribute__((__packed__)) acpi_madt_local_apic {
+    uint8_t type;
+    uint8_t length;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+};
+
+/* the older Intel MultiProcessor Specification tables, for machines without ACPI */
+struct __attribute__((__packed__)) mp_floating_pointer {
+    char signature[4]; /* "_MP_" */
+    uint32_t configuration_table;
+    uint8_t length; /* in 16 byte units */
+    uint8_t revision;
+    uint8_t checksum;
+    uint8_t features[5];
+};
+
+struct __attribute__((__packed__)) mp_configuration_table {
+    char signature[4]; /* "PCMP" */
+    uint16_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[8];
+    char product_id[12];
+    uint32_t oem_table;
+    uint16_t oem_table_size;
+    uint16_t entry_count;
+    uint32_t lapic_address;
+    uint16_t extended_length;
+    uint8_t extended_checksum;
+    uint8_t reserved;
+};
+
+#define MP_ENTRY_PROCESSOR 0
+#define MP_ENTRY_PROCESSOR_SIZE 20
+#define MP_ENTRY_OTHER_SIZE 8
+#define MP_PROCESSOR_ENABLED (1 << 0)
+
+struct __attribute__((__packed__)) mp_processor_entry {
+    uint8_t type;
+    uint8_t apic_id;
+    uint8_t apic_version;
+    uint8_t flags;
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+};
+
+/* the usable processors found by acpi_find_processors, boot CPU included */
+struct processor_list {
+    const char *source;
+    uint32_t lapic_address;
+    uint32_t count;
+    uint8_t apic_ids[ACPI_MAX_PROCESSORS];
+};
+
+bool acpi_find_processors(struct processor_list *processors);
+
+#endif
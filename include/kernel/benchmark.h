@@ -0,0 +1,25 @@
+#ifndef KERNEL_BENCHMARK_HEADER
+#define KERNEL_BENCHMARK_HEADER
+
+#include <stdbool.h>
+
+bool benchmark_string_self_test();
+void benchmark_string();
+void benchmark_terminal();
+void benchmark_format();
+void benchmark_klog();
+void benchmark_paging();
+void benchmark_kmalloc();
+void benchmark_initrd();
+void benchmark_page_faults();
+void benchmark_interrupts();
+void benchmark_syscalls();
+void benchmark_spawn();
+void benchmark_ipc();
+void benchmark_threads();
+void benchmark_fpu();
+void benchmark_smp();
+void benchmark_per_cpu();
+void benchmark_locks();
+
+#endif
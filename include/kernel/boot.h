@@ -0,0 +1,33 @@
+#ifndef KERNEL_BOOT_HEADER
+#define KERNEL_BOOT_HEADER
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kernel/multiboot.h>
+
+#define BOOT_PHASE_COUNT 32
+#define BOOT_COMMAND_LINE_LENGTH 256
+
+/* the end of one step of startup, as a TSC timestamp */
+struct boot_phase {
+    const char *name;
+    uint64_t timestamp;
+};
+
+/* written by early.S, on entry and once the global constructors have run */
+extern uint64_t boot_entry_tsc;
+extern uint64_t boot_init_tsc;
+
+extern char boot_command_line[BOOT_COMMAND_LINE_LENGTH];
+extern bool boot_fast;
+extern uint32_t boot_self_test_failures;
+
+void setup_boot_options(struct multiboot_info *multiboot_info);
+bool boot_option(const char *name);
+void boot_phase(const char *name);
+void boot_progress(const char *message);
+void boot_self_test(const char *name, bool passed);
+void boot_print_timeline();
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef KERNEL_ELF_HEADER
+#define KERNEL_ELF_HEADER
+
+#include <stdint.h>
+
+/* the parts of the 32 bit ELF format the process loader reads */
+
+#define ELF_IDENTITY_LENGTH 16
+#define ELF_CLASS 4 /* offsets in to the identity */
+#define ELF_DATA 5
+
+#define ELF_CLASS_32 1
+#define ELF_DATA_LITTLE_ENDIAN 1
+#define ELF_TYPE_EXECUTABLE 2
+#define ELF_MACHINE_386 3
+
+#define ELF_SEGMENT_LOAD 1
+
+#define ELF_SEGMENT_EXECUTE 0x1
+#define ELF_SEGMENT_WRITE 0x2
+#define ELF_SEGMENT_READ 0x4
+
+struct __attribute__((__packed__)) elf_header {
+    unsigned char identity[ELF_IDENTITY_LENGTH];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint32_t entry;
+    uint32_t program_header_offset;
+    uint32_t section_header_offset;
+    uint32_t flags;
+    uint16_t header_size;
+    uint16_t program_header_size;
+    uint16_t program_header_count;
+    uint16_t section_header_size;
+    uint16_t section_header_count;
+    uint16_t section_name_index;
+};
+
+struct __attribute__((__packed__)) elf_program_header {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t virtual_address;
+    uint32_t physical_address;
+    uint32_t file_size;
+    uint32_t memory_size;
+    uint32_t flags;
+    uint32_t alignment;
+};
+
+#endif
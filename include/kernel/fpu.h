@@ -0,0 +1,32 @@
+#ifndef KERNEL_FPU_HEADER
+#define KERNEL_FPU_HEADER
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kernel/smp.h>
+#include <kernel/thread.h>
+
+#define FPU_STATE_SIZE 512 /* the FXSAVE image */
+#define FPU_NO_CPU 0xFFFFFFFF
+#define FPU_DEFAULT_MXCSR 0x1F80 /* every SIMD exception masked, round to nearest */
+
+struct __attribute__((__aligned__(16))) fpu_state {
+    uint8_t image[FPU_STATE_SIZE];
+};
+
+extern bool fpu_available;
+
+void setup_fpu();
+void fpu_setup_cpu();
+void fpu_setup_threads();
+void setup_string_implementations();
+void fpu_switch(struct cpu *cpu, struct thread *previous, struct thread *next);
+void fpu_free_state(struct thread *thread);
+bool kernel_fpu_usable();
+uint32_t kernel_fpu_begin();
+void kernel_fpu_end(uint32_t flags);
+void fpu_print_statistics();
+bool fpu_self_test();
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef KERNEL_INITRD_HEADER
+#define KERNEL_INITRD_HEADER
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kernel/multiboot.h>
+
+#define INITRD_BLOCK_SIZE 512 /* tar headers and file data both start on these */
+#define INITRD_PATH_LENGTH 256 /* the longest path: the ustar prefix, a slash and the name, not counting the terminator */
+
+/* ustar header fields, as offsets in to the header block */
+#define INITRD_TAR_NAME 0
+#define INITRD_TAR_NAME_LENGTH 100
+#define INITRD_TAR_SIZE 124
+#define INITRD_TAR_SIZE_LENGTH 12
+#define INITRD_TAR_TYPE 156
+#define INITRD_TAR_MAGIC 257
+#define INITRD_TAR_PREFIX 345
+#define INITRD_TAR_PREFIX_LENGTH 155
+
+/* a regular file in the initrd. data points straight in to the module, which is never copied or freed */
+struct initrd_file {
+    const char *path; /* without any leading "./" or "/" */
+    const void *data;
+    uint32_t size;
+    uint32_t hash;
+};
+
+struct initrd_statistics {
+    uint32_t files;
+    uint32_t bytes;
+    uint32_t buckets;
+    uint32_t lookups;
+    uint32_t probes;
+};
+
+extern bool initrd_present;
+extern struct initrd_statistics initrd_statistics;
+
+void setup_initrd(struct multiboot_info *multiboot_info);
+const struct initrd_file *initrd_lookup(const char *path);
+const struct initrd_file *initrd_file(uint32_t index);
+uint32_t initrd_map(const struct initrd_file *file, uint32_t virtual_address, uint32_t flags);
+bool initrd_unmap(const struct initrd_file *file, uint32_t virtual_address);
+void initrd_print_statistics();
+bool initrd_self_test();
+
+#endif
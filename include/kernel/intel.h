@@ -1,6 +1,7 @@
 #ifndef KERNEL_CPU_HEADER
 #define KERNEL_CPU_HEADER
 
+#include <stdbool.h>
 #include <stdint.h>
 
 /*
@@ -123,9 +124,88 @@ struct __attribute__((__packed__)) tss_struct {
     uint16_t iomap;
 };
 
+#define GDT_ENTRY_COUNT 7
+#define GDT_TSS_SELECTOR 0x28
+#define GDT_PER_CPU_SELECTOR 0x30 /* loaded in to %gs, based at the CPU's struct cpu */
+
+/* the descriptor tables every CPU needs its own copy of. the TSS holds the CPU's ring 0 stack, so it can't be shared */
+struct cpu_tables {
+    struct gdt_entry_struct gdt_entries[GDT_ENTRY_COUNT];
+    struct gdt_pointer_struct gdt;
+    struct tss_struct tss;
+};
+
+/* CPUID leaf 1 feature bits */
+#define CPUID_FEATURE_EDX_FPU (1 << 0)
+#define CPUID_FEATURE_EDX_TSC (1 << 4)
+#define CPUID_FEATURE_EDX_MSR (1 << 5)
+#define CPUID_FEATURE_EDX_APIC (1 << 9)
+#define CPUID_FEATURE_EDX_SEP (1 << 11) /* SYSENTER and SYSEXIT */
+#define CPUID_FEATURE_EDX_FXSR (1 << 24) /* FXSAVE and FXRSTOR */
+#define CPUID_FEATURE_EDX_SSE (1 << 25)
+#define CPUID_FEATURE_EDX_SSE2 (1 << 26)
+
+/* eflags bits */
+#define EFLAGS_INTERRUPT_ENABLE (1 << 9)
+
+/* control register bits */
+#define CR0_MONITOR_COPROCESSOR (1 << 1) /* MP: wait and fwait trap on TS too */
+#define CR0_EMULATION (1 << 2) /* EM: every x87 and SSE instruction traps */
+#define CR0_TASK_SWITCHED (1 << 3) /* TS: the next x87 or SSE instruction raises device not available */
+#define CR0_NUMERIC_ERROR (1 << 5) /* NE: report x87 errors as exceptions rather than through the PIC */
+#define CR4_OSFXSR (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+
+/* qemu's isa-debug-exit device, see qemu_exit */
+#define QEMU_EXIT_PORT 0xF4
+#define QEMU_EXIT_SUCCESS 0 /* qemu exits with 1 */
+#define QEMU_EXIT_FAILURE 1 /* qemu exits with 3 */
+
+/* read the time stamp counter */
+static inline uint64_t read_tsc() {
+    uint32_t low, high;
+    __asm__ volatile ("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+/* disable interrupts, returning the previous eflags for interrupts_restore */
+static inline uint32_t interrupts_save_disable() {
+    uint32_t flags;
+    __asm__ volatile ("pushf\n\tpop %0\n\tcli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void interrupts_restore(uint32_t flags) {
+    __asm__ volatile ("push %0\n\tpopf" : : "r"(flags) : "memory", "cc");
+}
+
+static inline void interrupts_enable() {
+    __asm__ volatile ("sti" : : : "memory");
+}
+
+static inline bool interrupts_are_enabled() {
+    uint32_t flags;
+    __asm__ volatile ("pushf\n\tpop %0" : "=r"(flags));
+    return (flags & EFLAGS_INTERRUPT_ENABLE) != 0;
+}
+
 void outb(unsigned int port, unsigned char byte);
+unsigned char inb(unsigned int port);
 void halt();
+void qemu_exit(uint8_t status);
+uint64_t read_msr(uint32_t msr);
+void write_msr(uint32_t msr, uint64_t value);
+void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx);
+bool cpu_has_feature(uint32_t edx_feature_bit);
+uint32_t read_cr0();
+uint32_t read_cr2();
+uint32_t read_cr3();
+uint32_t read_cr4();
+void write_cr0(uint32_t value);
+void write_cr4(uint32_t value);
 void setup_gdt();
 void setup_idt();
+void load_cpu_tables(struct cpu_tables *tables, void *per_cpu_data, uint32_t per_cpu_size);
+void load_idt();
 
 #endif
@@ -0,0 +1,61 @@
+#ifndef KERNEL_INTERRUPTS_HEADER
+#define KERNEL_INTERRUPTS_HEADER
+
+#include <stdint.h>
+
+#define INTERRUPT_VECTOR_COUNT 256
+#define INTERRUPT_EXCEPTION_COUNT 32
+
+/* the 8259 PICs are remapped so IRQs 0-15 arrive on these vectors, clear of the CPU exceptions */
+#define IRQ_BASE_VECTOR 0x20
+#define IRQ_COUNT 16
+#define IRQ_VECTOR(irq) (IRQ_BASE_VECTOR + (irq))
+
+#define INTERRUPT_VECTOR_SYSCALL 0x80
+
+/* the stack as left by the stubs in interrupts.S, lowest address first */
+struct __attribute__((__packed__)) interrupt_frame {
+    uint32_t gs;
+    uint32_t fs;
+    uint32_t es;
+    uint32_t ds;
+
+    /* pushal */
+    uint32_t edi;
+    uint32_t esi;
+    uint32_t ebp;
+    uint32_t esp; /* esp at the time of the pushal, not useful for much */
+    uint32_t ebx;
+    uint32_t edx;
+    uint32_t ecx;
+    uint32_t eax;
+
+    uint32_t vector;
+    uint32_t error_code; /* 0 for vectors where the CPU doesn't push one */
+
+    /* pushed by the CPU */
+    uint32_t eip;
+    uint32_t cs;
+    uint32_t eflags;
+    uint32_t user_esp; /* only present on a switch from ring 3 */
+    uint32_t user_ss;
+};
+
+typedef void (*interrupt_handler)(struct interrupt_frame *frame);
+
+struct interrupt_statistics {
+    uint32_t count;
+    uint64_t total_cycles;
+    uint32_t maximum_cycles;
+};
+
+extern uint32_t interrupt_stub_table[INTERRUPT_VECTOR_COUNT];
+
+void setup_pic();
+void register_interrupt_handler(uint8_t vector, interrupt_handler handler);
+void unhandled_exception(struct interrupt_frame *frame);
+void interrupt_dispatch(struct interrupt_frame *frame, uint64_t entry_timestamp);
+struct interrupt_statistics interrupt_get_statistics(uint8_t vector);
+void interrupt_print_statistics();
+
+#endif
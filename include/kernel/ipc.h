@@ -0,0 +1,89 @@
+#ifndef KERNEL_IPC_HEADER
+#define KERNEL_IPC_HEADER
+
+#define IPC_CHANNEL_COUNT 8
+#define IPC_CHANNEL_CAPACITY 16 /* messages queued per channel before sends fail */
+#define IPC_MAXIMUM_PAGES 256 /* the largest message is 1M */
+
+/* results from the channel calls. successful calls return 0, or a length, which is always below these */
+#define IPC_ERROR_CHANNEL 0xFFFFFFF0 /* no such channel */
+#define IPC_ERROR_EMPTY 0xFFFFFFF1 /* nothing to receive, receives never wait */
+#define IPC_ERROR_FULL 0xFFFFFFF2
+#define IPC_ERROR_ADDRESS 0xFFFFFFF3 /* the buffer isn't all mapped, or isn't page aligned where it has to be */
+#define IPC_ERROR_SIZE 0xFFFFFFF4 /* too big to send, too big for the buffer, or not a register message */
+#define IPC_ERROR_MEMORY 0xFFFFFFF5
+#define IPC_ERROR_FIRST IPC_ERROR_CHANNEL
+
+/*
+src/user/ipc.S, packed in to the initrd by the makefile, sends or receives IPC_TEST_MESSAGES messages on the channel
+its argument names and exits with the cycles that took, or IPC_TEST_FAILED. The argument is made of these.
+*/
+#define IPC_TEST_PATH "bin/ipc"
+#define IPC_TEST_SEND 0x1 /* otherwise receive */
+#define IPC_TEST_SHORT 0x2 /* register messages, otherwise IPC_TEST_PAGES(n) pages from a buffer */
+#define IPC_TEST_COPY 0x4 /* send copies, otherwise the pages themselves */
+#define IPC_TEST_SYSENTER 0x8 /* otherwise int 0x80 */
+#define IPC_TEST_CHANNEL(channel) ((channel) << 4)
+#define IPC_TEST_PAGES(pages) ((pages) << 8)
+#define IPC_TEST_MESSAGES IPC_CHANNEL_CAPACITY
+#define IPC_TEST_BUFFER_PAGES 64
+#define IPC_TEST_FAILED 0xFFFFFFFF
+
+#ifndef __ASSEMBLER__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kernel/syscall.h>
+
+#define IPC_MESSAGE_SHORT 0
+#define IPC_MESSAGE_COPY 1 /* frames holding a copy of the data, freed on receipt */
+#define IPC_MESSAGE_PAGES 2 /* shares of the sender's own pages, mapped by the receiver */
+
+#define IPC_SHORT_LENGTH 8
+
+struct ipc_message {
+    uint32_t kind;
+    uint32_t length; /* in bytes */
+    uint32_t words[2]; /* a register message */
+    uint32_t *pages; /* frames, from process_share_pages for IPC_MESSAGE_PAGES */
+    uint32_t page_count;
+};
+
+/* a ring of messages */
+struct ipc_channel {
+    bool open;
+    uint32_t head;
+    uint32_t count;
+    struct ipc_message messages[IPC_CHANNEL_CAPACITY];
+};
+
+struct ipc_statistics {
+    uint32_t short_messages;
+    uint32_t copied_messages;
+    uint32_t page_messages;
+    uint32_t bytes_copied; /* each way, so a copied message counts twice */
+    uint32_t pages_mapped; /* received by mapping rather than copying */
+};
+
+extern struct ipc_statistics ipc_statistics;
+
+uint32_t ipc_channel_open();
+void ipc_channel_close(uint32_t channel);
+uint32_t ipc_send_short(uint32_t channel, uint32_t first, uint32_t second);
+uint32_t ipc_receive_short(uint32_t channel, uint32_t *first, uint32_t *second);
+
+/* syscall table entries, for the current process */
+uint32_t ipc_syscall_send_short(struct syscall_registers *registers);
+uint32_t ipc_syscall_receive_short(struct syscall_registers *registers);
+uint32_t ipc_syscall_send_copy(struct syscall_registers *registers);
+uint32_t ipc_syscall_send_pages(struct syscall_registers *registers);
+uint32_t ipc_syscall_receive(struct syscall_registers *registers);
+
+bool ipc_run_test(uint32_t argument, uint32_t *send_cycles, uint32_t *receive_cycles);
+void ipc_print_statistics();
+bool ipc_self_test();
+
+#endif
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef KERNEL_KLOG_HEADER
+#define KERNEL_KLOG_HEADER
+
+#include <stdint.h>
+
+#define KLOG_ENTRY_COUNT 256 /* must be a power of two */
+#define KLOG_ARGUMENT_COUNT 6
+
+#define KLOG_DEBUG 0
+#define KLOG_INFO 1
+#define KLOG_WARNING 2
+#define KLOG_ERROR 3
+
+/*
+
+A binary log record. Formatting is deferred until the ring is drained, so only the format string pointer and the raw 32
+bit argument words are stored. The format string must therefore be a literal (or otherwise outlive the record), any %s
+arguments must still be valid when the ring is drained, and 64 bit arguments are not supported.
+
+committed works like a seqlock's sequence. A writer sets it to 0 before touching the other fields and to sequence + 1
+of the record once they are all written, so a reader can tell a finished record from one that is still being written,
+including one being overwritten by a writer which has lapped the ring, and can tell if that happened while it copied.
+
+*/
+struct klog_entry {
+    uint32_t committed;
+    uint8_t level;
+    uint8_t argument_count;
+    char *format;
+    uint64_t timestamp;
+    uint32_t arguments[KLOG_ARGUMENT_COUNT];
+};
+
+/*
+Count the format string plus its arguments at compile time. This counts well past KLOG_ARGUMENT_COUNT so that klog can
+refuse a call with too many, rather than the count coming out wrong.
+*/
+#define KLOG_COUNT_ARGUMENTS(...) KLOG_COUNT_ARGUMENTS_(__VA_ARGS__, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define KLOG_COUNT_ARGUMENTS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, count, ...) count
+
+/* record a log message, e.g. klog(KLOG_INFO, "found %u frames\n", count). cheap and safe from interrupt context */
+#define klog(level, ...) do { \
+    _Static_assert(KLOG_COUNT_ARGUMENTS(__VA_ARGS__) - 1 <= KLOG_ARGUMENT_COUNT, "too many arguments for klog"); \
+    klog_record(level, KLOG_COUNT_ARGUMENTS(__VA_ARGS__) - 1, __VA_ARGS__); \
+} while (0)
+
+extern uint8_t klog_console_level;
+
+void klog_record(uint8_t level, uint32_t argument_count, char *format, ...);
+void klog_drain();
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef KERNEL_KPRINTF_HEADER
+#define KERNEL_KPRINTF_HEADER
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* an output device for kprintf. write may be called many times per kprintf call, flush once at the end */
+struct kprintf_sink {
+    void (*write)(const char *string, unsigned int length, void *context);
+    void (*flush)(void *context);
+    void *context;
+};
+
+bool kprintf_register_sink(struct kprintf_sink *sink);
+void kprintf_unregister_sink(struct kprintf_sink *sink);
+void kprintf_begin_batch();
+void kprintf_end_batch();
+void kprintf_enable_locking();
+
+int kprintf(char *format, ...);
+int vkprintf(char *format, va_list arguments);
+int kprintf_to(struct kprintf_sink *sink, char *format, ...);
+
+#endif
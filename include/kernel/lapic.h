@@ -0,0 +1,59 @@
+#ifndef KERNEL_LAPIC_HEADER
+#define KERNEL_LAPIC_HEADER
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LAPIC_DEFAULT_ADDRESS 0xFEE00000
+#define MSR_APIC_BASE 0x1B
+#define MSR_APIC_BASE_ENABLE (1 << 11)
+
+/* register offsets from the local APIC base */
+#define LAPIC_ID 0x020
+#define LAPIC_VERSION 0x030
+#define LAPIC_TASK_PRIORITY 0x080
+#define LAPIC_END_OF_INTERRUPT 0x0B0
+#define LAPIC_SPURIOUS 0x0F0
+#define LAPIC_INTERRUPT_COMMAND_LOW 0x300
+#define LAPIC_INTERRUPT_COMMAND_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_LINT1 0x360
+#define LAPIC_LVT_ERROR 0x370
+#define LAPIC_TIMER_INITIAL_COUNT 0x380
+#define LAPIC_TIMER_CURRENT_COUNT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+#define LAPIC_SPURIOUS_ENABLE (1 << 8)
+#define LAPIC_LVT_MASKED (1 << 16)
+#define LAPIC_LVT_TIMER_PERIODIC (1 << 17)
+#define LAPIC_TIMER_DIVIDE_BY_16 0x3
+
+/* interrupt command register: delivery mode, level and the busy bit */
+#define LAPIC_ICR_FIXED 0x000
+#define LAPIC_ICR_INIT 0x500
+#define LAPIC_ICR_STARTUP 0x600
+#define LAPIC_ICR_DELIVERY_PENDING (1 << 12)
+#define LAPIC_ICR_ASSERT (1 << 14)
+#define LAPIC_ICR_LEVEL_TRIGGERED (1 << 15)
+
+/* vectors raised by the local APIC itself, above everything routed through the PICs */
+#define LAPIC_FIRST_VECTOR 0xF0
+#define INTERRUPT_VECTOR_LAPIC_TIMER 0xF0
+#define INTERRUPT_VECTOR_RESCHEDULE 0xF1
+#define INTERRUPT_VECTOR_LAPIC_SPURIOUS 0xFF
+
+#define LAPIC_CALIBRATION_MICROSECONDS 10000
+
+extern bool lapic_available;
+
+bool setup_lapic(uint32_t physical_address);
+void lapic_enable(bool boot_cpu);
+uint8_t lapic_id();
+void lapic_end_of_interrupt();
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector);
+void lapic_send_init(uint8_t apic_id);
+void lapic_send_startup(uint8_t apic_id, uint32_t address);
+void lapic_start_timer(uint32_t frequency);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef KERNEL_MULTIBOOT_HEADER
+#define KERNEL_MULTIBOOT_HEADER
+
+#include <stdint.h>
+
+/* value left in eax by a multiboot compliant loader */
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+
+/* multiboot_info flags, saying which of the fields below are valid */
+#define MULTIBOOT_INFO_MEMORY (1 << 0)
+#define MULTIBOOT_INFO_COMMAND_LINE (1 << 2)
+#define MULTIBOOT_INFO_MODULES (1 << 3)
+#define MULTIBOOT_INFO_MEMORY_MAP (1 << 6)
+
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+
+struct __attribute__((__packed__)) multiboot_info {
+    uint32_t flags;
+    uint32_t memory_lower; /* kilobytes below 1M */
+    uint32_t memory_upper; /* kilobytes above 1M */
+    uint32_t boot_device;
+    uint32_t command_line;
+    uint32_t modules_count;
+    uint32_t modules_address;
+    uint32_t symbols[4];
+    uint32_t memory_map_length;
+    uint32_t memory_map_address;
+    uint32_t drives_length;
+    uint32_t drives_address;
+    uint32_t config_table;
+    uint32_t boot_loader_name;
+    uint32_t apm_table;
+};
+
+/* size does not count itself, so the next entry is at (address of entry) + size + 4 */
+struct __attribute__((__packed__)) multiboot_memory_map_entry {
+    uint32_t size;
+    uint64_t base_address;
+    uint64_t length;
+    uint32_t type;
+};
+
+struct __attribute__((__packed__)) multiboot_module {
+    uint32_t start;
+    uint32_t end;
+    uint32_t string;
+    uint32_t reserved;
+};
+
+#endif
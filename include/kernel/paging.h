@@ -0,0 +1,65 @@
+#ifndef KERNEL_PAGING_HEADER
+#define KERNEL_PAGING_HEADER
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+
+Page directory and page table entry bits
+----------------------------------------
+
++----+----+----+----+----+----+----+----+----+----+----+----+
+| 11 - 9  |  8 |  7 |  6 |  5 |  4 |  3 |  2 |  1 |  0 |
++----+----+----+----+----+----+----+----+----+----+----+----+
+| Avail   |  G | PS |  D |  A | CD | WT | US | RW |  P |
++----+----+----+----+----+----+----+----+----+----+----+----+
+
+PS = in a directory entry, the entry maps a 4M page directly (needs CR4.PSE)
+G = global, survives CR3 reloads (needs CR4.PGE)
+Avail = ignored by the CPU. process address spaces use two of these bits for copy on write
+
+*/
+
+#define PAGE_PRESENT 0x001
+#define PAGE_WRITABLE 0x002
+#define PAGE_USER 0x004
+#define PAGE_WRITE_THROUGH 0x008
+#define PAGE_CACHE_DISABLE 0x010
+#define PAGE_ACCESSED 0x020
+#define PAGE_DIRTY 0x040
+#define PAGE_LARGE 0x080
+#define PAGE_GLOBAL 0x100
+#define PAGE_COPY_ON_WRITE 0x200 /* read only until written, then the writer gets a copy */
+#define PAGE_BORROWED 0x400 /* the frame isn't the address space's own, e.g. the zero page or an initrd page */
+#define PAGE_FLAGS_MASK 0xFFF
+
+#define PAGE_SIZE 4096
+#define LARGE_PAGE_SIZE 0x400000
+
+/* the part of the address space which holds the active process, one directory entry per 4M */
+#define PAGING_USER_BASE 0x80000000
+#define PAGING_USER_END 0xC0000000
+#define PAGING_USER_TABLE_COUNT ((PAGING_USER_END - PAGING_USER_BASE) / LARGE_PAGE_SIZE)
+
+/* above this many pages a range change flushes the whole TLB instead of issuing one invlpg per page */
+#define PAGING_INVLPG_LIMIT 32
+
+#define CPUID_FEATURE_EDX_PSE (1 << 3)
+#define CPUID_FEATURE_EDX_PGE (1 << 13)
+
+#define CR0_WRITE_PROTECT (1 << 16)
+#define CR0_PAGING (1u << 31)
+#define CR4_PSE (1 << 4)
+#define CR4_PGE (1 << 7)
+
+void setup_paging();
+bool map_range(uint32_t virtual_address, uint32_t physical_address, uint32_t length, uint32_t flags);
+bool unmap_range(uint32_t virtual_address, uint32_t length);
+uint32_t paging_translate(uint32_t virtual_address);
+uint32_t *paging_entry(uint32_t virtual_address, bool create);
+void paging_invalidate(uint32_t virtual_address);
+void paging_flush_tlb();
+void paging_switch_user_tables(const uint32_t *directory_entries);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef KERNEL_PIT_HEADER
+#define KERNEL_PIT_HEADER
+
+/* 8253/8254 programmable interval timer */
+#define PIT_FREQUENCY 1193182
+
+#define PIT_CHANNEL_0 0x40
+#define PIT_CHANNEL_2 0x42
+#define PIT_COMMAND 0x43
+
+/* command byte fields */
+#define PIT_SELECT_CHANNEL_0 0x00
+#define PIT_SELECT_CHANNEL_2 0x80
+#define PIT_ACCESS_LOW_HIGH 0x30
+#define PIT_MODE_TERMINAL_COUNT 0x00 /* mode 0, output goes high when the count runs out */
+#define PIT_MODE_RATE_GENERATOR 0x04 /* mode 2, periodic */
+
+/* channel 2's gate and output are wired to the speaker control port */
+#define PIT_SPEAKER_CONTROL 0x61
+#define PIT_SPEAKER_CONTROL_GATE_2 0x01
+#define PIT_SPEAKER_CONTROL_SPEAKER 0x02
+#define PIT_SPEAKER_CONTROL_OUTPUT_2 0x20
+
+#endif
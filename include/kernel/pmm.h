@@ -0,0 +1,40 @@
+#ifndef KERNEL_PMM_HEADER
+#define KERNEL_PMM_HEADER
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kernel/multiboot.h>
+
+#define FRAME_SIZE 4096
+#define FRAME_SHIFT 12
+#define PMM_MAX_ORDER 10 /* largest block is 2^10 frames, 4M */
+
+/* address of a block handed out by the allocator, or 0 (frame 0 is never handed out) */
+typedef uint32_t physical_address;
+
+struct pmm_statistics {
+    uint32_t total_frames;
+    uint32_t free_frames;
+    uint32_t allocations;
+    uint32_t frees;
+    uint64_t allocation_cycles;
+    uint64_t free_cycles;
+};
+
+extern struct pmm_statistics pmm_statistics;
+
+void pmm_reserve(physical_address start, physical_address end);
+void setup_pmm(struct multiboot_info *multiboot_info);
+physical_address pmm_alloc_frames(unsigned int order);
+void pmm_free_frames(physical_address address, unsigned int order);
+physical_address pmm_alloc_frame();
+void pmm_free_frame(physical_address address);
+bool pmm_share_frame(physical_address address);
+bool pmm_frame_shared(physical_address address);
+bool pmm_release_frame(physical_address address);
+physical_address pmm_highest_address();
+void pmm_print_statistics();
+bool pmm_self_test();
+
+#endif
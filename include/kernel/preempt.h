@@ -0,0 +1,19 @@
+#ifndef KERNEL_PREEMPT_HEADER
+#define KERNEL_PREEMPT_HEADER
+
+#include <kernel/smp.h>
+
+/*
+Keep the running thread on this CPU and stop the scheduler switching away from it, while leaving interrupts on. Nests.
+A switch wanted in the meantime is not lost, it happens at the first interrupt after the count is back to 0. The
+thread must not block or yield until then.
+*/
+static inline void preempt_disable() {
+    this_cpu_add(preempt_count, 1);
+}
+
+static inline void preempt_enable() {
+    this_cpu_add(preempt_count, -1);
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef KERNEL_PROCESS_HEADER
+#define KERNEL_PROCESS_HEADER
+
+#define PROCESS_STACK_SIZE 0x10000 /* read as zero, each page copied from the zero page as the stack grows in to it */
+#define PROCESS_NAME_LENGTH 32
+
+/* src/user/test.S, packed in to the initrd by the makefile, starts with this in its data */
+#define PROCESS_TEST_PATH "bin/test"
+#define PROCESS_TEST_VALUE 0x1000
+
+#ifndef __ASSEMBLER__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kernel/paging.h>
+
+/* processes live in the process window, with the stack at the top of it */
+#define PROCESS_STACK_TOP PAGING_USER_END
+
+/* a process's half of the page directory: 0, or a page table of its own, for each 4M of the process window */
+struct address_space {
+    uint32_t tables[PAGING_USER_TABLE_COUNT];
+};
+
+struct process {
+    uint32_t id;
+    char name[PROCESS_NAME_LENGTH];
+    uint32_t entry;
+    struct address_space space;
+};
+
+struct process_statistics {
+    uint32_t spawns;
+    uint32_t forks;
+    uint32_t pages_mapped; /* ELF pages mapped straight from the image rather than copied */
+    uint32_t pages_copied; /* when loading, when a share count is full at fork, and on copy on write faults */
+    uint32_t copy_on_write_faults;
+    uint32_t pages_reclaimed; /* writes to a page whose other owners had all gone, made writable without a copy */
+    uint32_t zero_fills; /* writes to a page showing the zero page */
+    uint32_t owned_frames; /* page tables and pages held by address spaces, each frame counted once however shared */
+    uint64_t spawn_cycles;
+    uint64_t fork_cycles;
+    uint64_t fault_cycles;
+};
+
+extern struct process_statistics process_statistics;
+
+void setup_processes();
+struct process *process_load(const char *name, const void *image, uint32_t size);
+struct process *process_spawn(const char *path);
+struct process *process_fork(struct process *parent);
+uint32_t process_run(struct process *process, uint32_t argument);
+void process_destroy(struct process *process);
+struct process *process_current();
+bool process_read(struct process *process, uint32_t address, void *destination, uint32_t length);
+bool process_write(struct process *process, uint32_t address, const void *source, uint32_t length);
+bool process_share_pages(struct process *process, uint32_t address, uint32_t page_count, uint32_t *pages);
+bool process_map_pages(struct process *process, uint32_t address, uint32_t page_count, const uint32_t *pages);
+void process_release_pages(const uint32_t *pages, uint32_t page_count);
+bool process_fault(uint32_t page, uint32_t error_code);
+void process_print_statistics();
+bool process_self_test();
+
+#endif
+
+#endif
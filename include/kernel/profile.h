@@ -0,0 +1,16 @@
+#ifndef KERNEL_PROFILE_HEADER
+#define KERNEL_PROFILE_HEADER
+
+#include <kernel/kprintf.h>
+
+/* one histogram bucket per 16 bytes of .text, which is enough to tell functions apart */
+#define PROFILE_BUCKET_SHIFT 4
+#define PROFILE_MAXIMUM_TEXT_SIZE 0x20000 /* .text beyond this is counted as outside */
+#define PROFILE_BUCKET_COUNT (PROFILE_MAXIMUM_TEXT_SIZE >> PROFILE_BUCKET_SHIFT)
+
+void setup_profile();
+void profile_start();
+void profile_stop();
+void profile_dump(struct kprintf_sink *sink);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef KERNEL_RCU_HEADER
+#define KERNEL_RCU_HEADER
+
+#include <stdint.h>
+
+#include <kernel/preempt.h>
+#include <kernel/smp.h>
+
+/*
+Read-copy-update, done with epochs. A reader only disables preemption, so it can't be on any CPU but the one it started
+on and can't be halfway through a read section while that CPU runs something else. A CPU which switches threads, or
+takes a tick with preemption enabled, has finished every read it started before, and says so by copying the global
+epoch in to its struct cpu.
+
+A writer publishes a new version with rcu_assign_pointer, then synchronize_rcu moves the epoch on and waits until every
+other online CPU has caught up with it. After that no reader can still hold the old version and it can be freed.
+
+Read sections must not block or yield, and synchronize_rcu must not be called from inside one or with interrupts off.
+*/
+extern volatile uint32_t rcu_global_epoch;
+
+static inline void rcu_read_lock() {
+    preempt_disable();
+}
+
+static inline void rcu_read_unlock() {
+    preempt_enable();
+}
+
+/* called by the scheduler on each CPU whenever it knows the CPU is outside any read section */
+static inline void rcu_quiescent_state() {
+    this_cpu_write(rcu_epoch, __atomic_load_n(&rcu_global_epoch, __ATOMIC_ACQUIRE));
+}
+
+/* the store is ordered after everything that filled in the new version, so a reader can't see it half built */
+#define rcu_assign_pointer(pointer, value) __atomic_store_n(&(pointer), (value), __ATOMIC_RELEASE)
+#define rcu_dereference(pointer) __atomic_load_n(&(pointer), __ATOMIC_CONSUME)
+
+void synchronize_rcu();
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef KERNEL_SEQLOCK_HEADER
+#define KERNEL_SEQLOCK_HEADER
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kernel/spinlock.h>
+
+/*
+A sequence lock, for small read-mostly data. Writers serialise on an ordinary spinlock and make the sequence odd while
+they work. Readers take no lock and write nothing, so they never bounce the cache line between CPUs: they copy the
+data out and go round again if the sequence was odd or moved underneath them.
+
+    uint32_t sequence;
+    do {
+        sequence = seqlock_read_begin(&lock);
+        copy = data;
+    } while (seqlock_read_retry(&lock, sequence));
+
+A reader may see a half written copy before it retries, so it must not follow pointers out of the data or act on it
+in any way until seqlock_read_retry has said it is good. Data written from interrupt handlers needs the irqsave writer
+calls, otherwise a reader interrupted by a writer on its own CPU spins for ever.
+*/
+struct seqlock {
+    volatile uint32_t sequence;
+    struct spinlock writer;
+};
+
+#define SEQLOCK_INIT {0, SPINLOCK_INIT}
+#define SEQLOCK_INIT_WITH_STATISTICS(statistics) {0, SPINLOCK_INIT_WITH_STATISTICS(statistics)}
+
+static inline uint32_t seqlock_read_begin(struct seqlock *lock) {
+    uint32_t sequence;
+
+    while ((sequence = __atomic_load_n(&lock->sequence, __ATOMIC_ACQUIRE)) & 1) {
+        __asm__ volatile ("pause");
+    }
+
+    return sequence;
+}
+
+/* true if a writer got in since seqlock_read_begin returned sequence, and everything read since must be thrown away */
+static inline bool seqlock_read_retry(struct seqlock *lock, uint32_t sequence) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&lock->sequence, __ATOMIC_RELAXED) != sequence;
+}
+
+static inline void seqlock_write_begin(struct seqlock *lock) {
+    spinlock_acquire(&lock->writer);
+    __atomic_store_n(&lock->sequence, lock->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seqlock_write_end(struct seqlock *lock) {
+    __atomic_store_n(&lock->sequence, lock->sequence + 1, __ATOMIC_RELEASE);
+    spinlock_release(&lock->writer);
+}
+
+static inline uint32_t seqlock_write_begin_irqsave(struct seqlock *lock) {
+    uint32_t flags = interrupts_save_disable();
+    seqlock_write_begin(lock);
+    return flags;
+}
+
+static inline void seqlock_write_end_irqrestore(struct seqlock *lock, uint32_t flags) {
+    seqlock_write_end(lock);
+    interrupts_restore(flags);
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef KERNEL_SERIAL_HEADER
+#define KERNEL_SERIAL_HEADER
+
+#include <stdbool.h>
+
+#include <kernel/interrupts.h>
+#include <kernel/kprintf.h>
+
+#define SERIAL_COM1_PORT 0x3F8
+#define SERIAL_COM1_IRQ 4
+#define SERIAL_TRANSMIT_BUFFER_SIZE 4096 /* must be a power of two */
+
+#define DEBUG_PORT 0xE9
+
+extern struct kprintf_sink serial_sink;
+extern struct kprintf_sink debug_port_sink;
+
+bool serial_init();
+void serial_write(const char *string, unsigned int length);
+void serial_flush();
+void serial_wait_idle();
+void serial_enable_interrupts();
+void serial_interrupt(struct interrupt_frame *frame);
+
+bool debug_port_present();
+
+#endif
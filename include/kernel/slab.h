@@ -0,0 +1,48 @@
+#ifndef KERNEL_SLAB_HEADER
+#define KERNEL_SLAB_HEADER
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CACHE_LINE_SIZE 64
+#define SLAB_SIZE 4096
+#define KMEM_CACHE_NAME_LENGTH 24
+
+/* kmem_cache_create flags */
+#define KMEM_CACHE_ALIGN 1 /* start every object on its own cache line */
+
+/* kmalloc size classes are powers of two from 2^KMALLOC_MIN_SHIFT to 2^KMALLOC_MAX_SHIFT, bigger requests get whole pages */
+#define KMALLOC_MIN_SHIFT 4
+#define KMALLOC_MAX_SHIFT 10
+
+struct slab;
+
+struct kmem_cache {
+    char name[KMEM_CACHE_NAME_LENGTH];
+    uint32_t object_size;
+    uint32_t stride; /* object_size rounded up for alignment */
+    uint32_t objects_per_slab;
+
+    struct slab *partial_slabs;
+    struct slab *full_slabs;
+    struct slab *empty_slabs;
+
+    uint32_t allocations;
+    uint32_t frees;
+    uint32_t slab_count;
+    uint32_t objects_in_use;
+
+    struct kmem_cache *next;
+};
+
+void setup_slab();
+struct kmem_cache *kmem_cache_create(char *name, uint32_t object_size, uint32_t flags);
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *object);
+void *kmalloc(size_t size);
+void kfree(void *pointer);
+void slab_print_statistics();
+bool slab_self_test();
+
+#endif
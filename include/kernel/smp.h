@@ -0,0 +1,123 @@
+#ifndef KERNEL_SMP_HEADER
+#define KERNEL_SMP_HEADER
+
+#define SMP_MAX_CPUS 8
+
+/* application processors start in real mode here. page aligned and below 1M, as the startup IPI carries a page number */
+#define SMP_TRAMPOLINE_ADDRESS 0x8000
+
+#define SMP_INIT_DELAY_MICROSECONDS 10000
+#define SMP_STARTUP_DELAY_MICROSECONDS 200
+#define SMP_START_TIMEOUT_MILLISECONDS 100
+
+/* offsets in to the trampoline's data block, filled in by setup_smp before each startup IPI */
+#define SMP_TRAMPOLINE_GDT 0
+#define SMP_TRAMPOLINE_CR0 8
+#define SMP_TRAMPOLINE_CR3 12
+#define SMP_TRAMPOLINE_CR4 16
+#define SMP_TRAMPOLINE_STACK 20
+#define SMP_TRAMPOLINE_ENTRY 24
+#define SMP_TRAMPOLINE_ARGUMENT 28
+
+#ifndef __ASSEMBLER__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kernel/intel.h>
+#include <kernel/pmm.h>
+#include <kernel/slab.h>
+#include <kernel/thread.h>
+
+struct __attribute__((__packed__)) smp_trampoline_data {
+    uint16_t gdt_limit;
+    uint32_t gdt_base;
+    uint16_t padding;
+    uint32_t cr0;
+    uint32_t cr3;
+    uint32_t cr4;
+    uint32_t stack;
+    uint32_t entry;
+    uint32_t argument;
+};
+
+/*
+Everything that exists once per CPU. Cache line aligned so CPUs don't share lines for their own state. Each CPU's %gs
+is based at its own struct cpu (see load_cpu_tables), so the running CPU's fields are reached with one %gs-relative
+instruction through the accessors below, with no CPU number lookup and nothing for a migration to land in the middle of.
+*/
+struct __attribute__((__aligned__(CACHE_LINE_SIZE))) cpu {
+    struct cpu *self; /* for this_cpu(), when a pointer is wanted rather than one field */
+    uint32_t index;
+    uint8_t apic_id;
+    volatile bool online;
+
+    struct cpu_tables tables;
+    physical_address idle_stack; /* the stack the CPU was started on, which its idle thread keeps */
+
+    /* scheduler state, see thread.c. only this CPU touches it, apart from the run queue under its lock */
+    struct run_queue run_queue;
+    struct thread *current_thread;
+    struct thread *idle_thread;
+    struct thread *switched_from; /* set across context_switch, so the new thread can release the old one */
+    volatile bool need_reschedule;
+    uint32_t switch_count;
+    uint32_t preemption_count;
+    uint32_t steal_count;
+    uint32_t preempt_count; /* see preempt.h. thread_preempt leaves the running thread alone while it is non-zero */
+
+    volatile uint32_t rcu_epoch; /* the global RCU epoch as of this CPU's last quiescent state, see rcu.h */
+
+    /* see syscall.c */
+    uint32_t syscall_stack_top; /* this CPU's SYSENTER stack */
+    uint32_t user_mode_saved_esp; /* where user_mode_return goes back to */
+    bool user_mode_active;
+
+    /* see fpu.c */
+    struct thread *fpu_owner; /* the thread whose state was last loaded in to this CPU's x87/SSE registers, if still there */
+    bool fpu_in_kernel; /* inside kernel_fpu_begin/end */
+    uint32_t fpu_traps; /* device not available faults taken */
+};
+
+extern struct cpu cpus[SMP_MAX_CPUS];
+extern uint32_t online_cpu_count;
+extern volatile uint32_t smp_active_cpus;
+
+/* read, write or add to a field of the running CPU's struct cpu. fields must be 1, 2 or 4 bytes */
+#define this_cpu_read(field) ({ \
+    __typeof__(((struct cpu *)0)->field) this_cpu_value; \
+    __asm__ volatile ("mov %%gs:%c1, %0" : "=q"(this_cpu_value) : "i"(offsetof(struct cpu, field)) : "memory"); \
+    this_cpu_value; \
+})
+
+#define this_cpu_write(field, value) do { \
+    __typeof__(((struct cpu *)0)->field) this_cpu_value = (value); \
+    __asm__ volatile ("mov %0, %%gs:%c1" : : "q"(this_cpu_value), "i"(offsetof(struct cpu, field)) : "memory"); \
+} while (0)
+
+#define this_cpu_add(field, value) do { \
+    __typeof__(((struct cpu *)0)->field) this_cpu_value = (value); \
+    __asm__ volatile ("add %0, %%gs:%c1" : : "q"(this_cpu_value), "i"(offsetof(struct cpu, field)) : "memory", "cc"); \
+} while (0)
+
+/*
+The running CPU. Valid from setup_gdt on. The pointer stays right only while the caller can't move, i.e. with
+interrupts off or from a pinned thread. Single fields are better read with this_cpu_read, which can't be split by a
+migration.
+*/
+static inline struct cpu *this_cpu() {
+    return this_cpu_read(self);
+}
+
+void setup_smp();
+struct cpu *smp_cpu_by_apic_id(uint8_t apic_id);
+
+/* trampoline.S */
+extern char smp_trampoline_start;
+extern char smp_trampoline_data;
+extern char smp_trampoline_end;
+
+#endif
+
+#endif
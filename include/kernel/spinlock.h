@@ -0,0 +1,161 @@
+#ifndef KERNEL_SPINLOCK_HEADER
+#define KERNEL_SPINLOCK_HEADER
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kernel/intel.h>
+#include <kernel/slab.h>
+
+/*
+Optional per lock counters. A lock pointing at one of these takes a timestamp when it is acquired and released, and
+keeps the totals below. Everything is only written with the lock held, so plain increments are enough. Define them
+with LOCK_STATISTICS, e.g. static LOCK_STATISTICS(pmm_lock_statistics, "pmm"), so lock_print_statistics can find them.
+They are walked as an array, so the alignment is fixed here rather than left to the compiler, which pads large objects.
+*/
+struct __attribute__((__aligned__(CACHE_LINE_SIZE))) lock_statistics {
+    const char *name;
+    uint32_t acquisitions;
+    uint32_t contended; /* acquisitions that had to wait */
+    uint64_t wait_cycles;
+    uint64_t hold_cycles;
+    uint32_t maximum_wait_cycles;
+    uint32_t maximum_hold_cycles;
+    uint64_t acquired_at;
+};
+
+#define LOCK_STATISTICS(variable, lock_name) \
+    struct lock_statistics variable __attribute__((__section__(".lock_statistics"), __used__)) = {.name = lock_name}
+
+void lock_statistics_acquired(struct lock_statistics *statistics, uint64_t wait_start);
+void lock_statistics_released(struct lock_statistics *statistics);
+void lock_statistics_print(struct lock_statistics *statistics);
+void lock_statistics_reset(struct lock_statistics *statistics);
+void lock_print_statistics();
+
+/*
+A ticket lock, for short critical sections shared between CPUs. Waiters are served in the order they arrived, so no CPU
+can be starved by others which happen to win the cache line more often, but they all spin on the same now_serving word
+and every release sends it round all of them. For locks with many waiters see struct mcs_lock.
+*/
+struct spinlock {
+    volatile uint16_t now_serving;
+    volatile uint16_t next_ticket;
+    struct lock_statistics *statistics; /* 0 for none */
+};
+
+#define SPINLOCK_INIT {0, 0, 0}
+#define SPINLOCK_INIT_WITH_STATISTICS(statistics) {0, 0, statistics}
+
+static inline void spinlock_acquire(struct spinlock *lock) {
+    uint16_t ticket = __atomic_fetch_add(&lock->next_ticket, 1, __ATOMIC_RELAXED);
+    uint64_t wait_start = 0;
+
+    if (__atomic_load_n(&lock->now_serving, __ATOMIC_ACQUIRE) != ticket) {
+        if (lock->statistics) {
+            wait_start = read_tsc();
+        }
+        while (__atomic_load_n(&lock->now_serving, __ATOMIC_ACQUIRE) != ticket) {
+            __asm__ volatile ("pause");
+        }
+    }
+
+    if (lock->statistics) {
+        lock_statistics_acquired(lock->statistics, wait_start);
+    }
+}
+
+/* only the holder writes now_serving, so it can be bumped with a plain store */
+static inline void spinlock_release(struct spinlock *lock) {
+    if (lock->statistics) {
+        lock_statistics_released(lock->statistics);
+    }
+
+    __atomic_store_n(&lock->now_serving, (uint16_t)(lock->now_serving + 1), __ATOMIC_RELEASE);
+}
+
+/* for data also touched from interrupt handlers: interrupts stay off while the lock is held */
+static inline uint32_t spinlock_acquire_irqsave(struct spinlock *lock) {
+    uint32_t flags = interrupts_save_disable();
+    spinlock_acquire(lock);
+    return flags;
+}
+
+static inline void spinlock_release_irqrestore(struct spinlock *lock, uint32_t flags) {
+    spinlock_release(lock);
+    interrupts_restore(flags);
+}
+
+/*
+An MCS queue lock. Each waiter spins on its own node, which the holder before it hands the lock to directly, so a
+release touches one other CPU's cache line however many are waiting. The caller provides the node, normally on its
+stack, and must pass the same one to release.
+*/
+struct mcs_node {
+    struct mcs_node *volatile next;
+    volatile bool waiting;
+};
+
+struct mcs_lock {
+    struct mcs_node *volatile tail; /* the last waiter, or the holder if nobody is waiting. 0 when free */
+    struct lock_statistics *statistics;
+};
+
+#define MCS_LOCK_INIT {0, 0}
+#define MCS_LOCK_INIT_WITH_STATISTICS(statistics) {0, statistics}
+
+static inline void mcs_lock_acquire(struct mcs_lock *lock, struct mcs_node *node) {
+    uint64_t wait_start = 0;
+
+    node->next = 0;
+    node->waiting = true;
+
+    struct mcs_node *previous = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+    if (previous) {
+        if (lock->statistics) {
+            wait_start = read_tsc();
+        }
+        __atomic_store_n(&previous->next, node, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&node->waiting, __ATOMIC_ACQUIRE)) {
+            __asm__ volatile ("pause");
+        }
+    }
+
+    if (lock->statistics) {
+        lock_statistics_acquired(lock->statistics, wait_start);
+    }
+}
+
+static inline void mcs_lock_release(struct mcs_lock *lock, struct mcs_node *node) {
+    if (lock->statistics) {
+        lock_statistics_released(lock->statistics);
+    }
+
+    struct mcs_node *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+    if (!next) {
+        struct mcs_node *expected = node;
+        if (__atomic_compare_exchange_n(&lock->tail, &expected, 0, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+
+        /* someone has swapped themselves in to the tail but not linked up behind us yet */
+        while (!(next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE))) {
+            __asm__ volatile ("pause");
+        }
+    }
+
+    __atomic_store_n(&next->waiting, false, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t mcs_lock_acquire_irqsave(struct mcs_lock *lock, struct mcs_node *node) {
+    uint32_t flags = interrupts_save_disable();
+    mcs_lock_acquire(lock, node);
+    return flags;
+}
+
+static inline void mcs_lock_release_irqrestore(struct mcs_lock *lock, struct mcs_node *node, uint32_t flags) {
+    mcs_lock_release(lock, node);
+    interrupts_restore(flags);
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef KERNEL_SYSCALL_HEADER
+#define KERNEL_SYSCALL_HEADER
+
+/*
+
+System call ABI
+---------------
+
+Both int 0x80 and SYSENTER take the call number in eax and up to three arguments in ebx, esi and edi, and return the
+result in eax. SYSENTER callers also pass the address to return to in edx and their stack pointer in ecx, so those two
+are lost across a SYSENTER call. Everything else is preserved by both paths, apart from ebx, esi and edi in the calls
+which say they return something there, like SYSCALL_RECEIVE_SHORT: both paths hand the four registers to the call as a
+struct syscall_registers and load them back from it on the way out.
+
+*/
+
+#define SYSCALL_EXIT 0 /* leave user mode, enter_user_mode returns the first argument */
+#define SYSCALL_NULL 1 /* does nothing, for measuring entry and exit */
+#define SYSCALL_DEBUG 2 /* log the three arguments */
+#define SYSCALL_SEND_SHORT 3 /* channel, two words: queue a message held in registers */
+#define SYSCALL_RECEIVE_SHORT 4 /* channel: take a register message, its words come back in esi and edi */
+#define SYSCALL_SEND_COPY 5 /* channel, address, length: queue a copy of a buffer */
+#define SYSCALL_SEND_PAGES 6 /* channel, page aligned address, length: queue the buffer's pages themselves */
+#define SYSCALL_RECEIVE 7 /* channel, address, capacity: take any message in to a buffer, returning its length */
+#define SYSCALL_COUNT 8
+
+#define SYSCALL_INVALID 0xFFFFFFFF
+
+/* where the .user_text section and the user stack are mapped for ring 3 */
+#define USER_TEXT_ADDRESS 0xD0000000
+#define USER_STACK_TOP 0xD0800000
+
+#define SYSCALL_KERNEL_STACK_SIZE 16384
+
+/* SYSENTER model specific registers */
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+/* user_syscall_benchmark selects its entry path from the argument */
+#define SYSCALL_BENCHMARK_SYSENTER 0
+#define SYSCALL_BENCHMARK_INTERRUPT 1
+#define SYSCALL_BENCHMARK_CALLS 1024
+
+#ifndef __ASSEMBLER__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* in the order sysenter_entry pushes them */
+struct syscall_registers {
+    uint32_t eax;
+    uint32_t ebx;
+    uint32_t esi;
+    uint32_t edi;
+};
+
+typedef uint32_t (*syscall_function)(struct syscall_registers *registers);
+
+void setup_syscalls();
+void syscall_setup_cpu();
+bool syscall_sysenter_available();
+void syscall_dispatch(struct syscall_registers *registers);
+uint32_t enter_user_mode(uint32_t eip, uint32_t esp, uint32_t argument);
+uint32_t run_in_user_mode(void (*entry)(), uint32_t argument);
+
+/* syscall.S */
+void sysenter_entry();
+uint32_t user_mode_enter(uint32_t eip, uint32_t esp, uint32_t argument, uint32_t *saved_esp);
+void user_mode_return(uint32_t value, uint32_t saved_esp) __attribute__((__noreturn__));
+void user_syscall_benchmark();
+
+#endif
+
+#endif
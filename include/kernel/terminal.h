@@ -4,12 +4,21 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <kernel/kprintf.h>
+
+extern struct kprintf_sink terminal_sink;
+
 uint8_t vga_color(uint8_t foreground, uint8_t background);
 uint16_t vga_character(char character);
 uint16_t vga_cursor_memory_index();
 void vga_move_cursor(uint8_t row, uint8_t column);
+void vga_update_hardware_cursor();
+void vga_update_display_start();
 
 void terminal_clear();
+void terminal_put_character(char character);
+void terminal_flush();
+void terminal_scroll_view(size_t rows_back);
 void terminal_write(char *string);
 void terminal_hexdump(void *memory, size_t byte_count);
 
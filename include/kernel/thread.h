@@ -0,0 +1,82 @@
+#ifndef KERNEL_THREAD_HEADER
+#define KERNEL_THREAD_HEADER
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kernel/interrupts.h>
+#include <kernel/pmm.h>
+#include <kernel/spinlock.h>
+
+#define THREAD_STACK_ORDER 1 /* 8k kernel stacks */
+#define THREAD_STACK_SIZE (FRAME_SIZE << THREAD_STACK_ORDER)
+#define THREAD_NAME_LENGTH 16
+
+/* one run queue per priority, found through a bitmap in a single word. higher numbers run first */
+#define THREAD_PRIORITY_COUNT 32
+#define THREAD_PRIORITY_IDLE 0
+#define THREAD_PRIORITY_NORMAL 16
+#define THREAD_PRIORITY_HIGH 24
+
+#define THREAD_TIME_SLICE_TICKS 10
+
+#define THREAD_READY 0
+#define THREAD_RUNNING 1
+#define THREAD_BLOCKED 2
+#define THREAD_DEAD 3
+
+struct fpu_state;
+
+struct thread {
+    uint32_t saved_esp; /* only meaningful while switched out. context_switch relies on this being first */
+    uint32_t kernel_stack_top; /* loaded in to the CPU's tss.esp0 while this thread runs */
+    physical_address stack; /* 0 for the boot thread, which runs on the early stack */
+
+    uint32_t id;
+    char name[THREAD_NAME_LENGTH];
+    uint8_t priority;
+    uint8_t state;
+    uint32_t time_slice; /* ticks left before preemption */
+    uint32_t switches_in;
+
+    uint32_t cpu; /* index of the CPU it last ran on, where it is queued when woken */
+    bool pinned; /* never taken by another CPU's work stealing */
+    volatile bool on_cpu; /* still on some CPU's stack, so no other CPU can switch to it yet */
+    bool wake_pending; /* woken while not blocked, so the next thread_block returns straight away */
+    struct spinlock lock; /* guards state and wake_pending between thread_block and thread_wake */
+
+    struct fpu_state *fpu_state; /* allocated the first time the thread uses x87 or SSE, see fpu.c */
+    uint32_t fpu_cpu; /* the CPU whose registers last had fpu_state loaded, or FPU_NO_CPU */
+
+    void (*entry)(void *argument);
+    void *argument;
+
+    struct thread *next; /* run queue */
+};
+
+/* a CPU's ready threads, FIFO per priority */
+struct run_queue {
+    struct spinlock lock;
+    struct thread *heads[THREAD_PRIORITY_COUNT];
+    struct thread *tails[THREAD_PRIORITY_COUNT];
+    uint32_t bitmap; /* a bit set for each priority with anything queued */
+    volatile uint32_t length; /* read without the lock by CPUs looking for work to steal */
+};
+
+void setup_threads();
+struct thread *thread_create(char *name, uint8_t priority, void (*entry)(void *argument), void *argument);
+struct thread *thread_current();
+void thread_yield();
+void thread_block();
+void thread_wake(struct thread *thread);
+void thread_exit() __attribute__((__noreturn__));
+void thread_preempt();
+void thread_timer_tick(struct interrupt_frame *frame);
+void thread_run_idle(physical_address stack) __attribute__((__noreturn__));
+void thread_print_statistics();
+bool thread_self_test();
+
+/* switch.S */
+void context_switch(uint32_t *save_esp, uint32_t load_esp);
+
+#endif
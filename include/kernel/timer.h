@@ -0,0 +1,20 @@
+#ifndef KERNEL_TIMER_HEADER
+#define KERNEL_TIMER_HEADER
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kernel/interrupts.h>
+
+#define TIMER_IRQ 0
+#define TIMER_FREQUENCY 1000 /* ticks per second */
+#define TIMER_CALLBACK_LIMIT 4
+
+typedef void (*timer_callback)(struct interrupt_frame *frame);
+
+extern volatile uint64_t timer_ticks;
+
+void setup_timer(uint32_t frequency);
+bool timer_register_callback(timer_callback callback);
+
+#endif
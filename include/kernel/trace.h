@@ -0,0 +1,65 @@
+#ifndef KERNEL_TRACE_HEADER
+#define KERNEL_TRACE_HEADER
+
+#include <stdint.h>
+
+#include <kernel/intel.h>
+
+#define TRACE_EVENT_COUNT 4096 /* must be a power of two */
+#define TRACE_NAME_LIMIT 128 /* distinct names in one binary dump, any more are written as unknown */
+
+#define TRACE_SUBSYSTEM_BOOT 0
+#define TRACE_SUBSYSTEM_CPU 1
+#define TRACE_SUBSYSTEM_TERMINAL 2
+#define TRACE_SUBSYSTEM_MEMORY 3
+#define TRACE_SUBSYSTEM_COUNT 4
+
+#define TRACE_EVENT_BEGIN 0
+#define TRACE_EVENT_END 1
+#define TRACE_EVENT_INSTANT 2
+
+/* binary dump framing, see trace_dump_binary */
+#define TRACE_BINARY_MAGIC "VTRC"
+#define TRACE_BINARY_VERSION 1
+
+/* committed is 0 while the event is being written and sequence + 1 once it is done, the same as struct klog_entry */
+struct trace_event {
+    uint32_t committed;
+    uint8_t type;
+    uint8_t subsystem;
+    const char *name;
+    uint64_t timestamp;
+};
+
+/* per subsystem totals. cycles are inclusive, so a scope nested in another of the same subsystem is counted twice */
+struct trace_counters {
+    uint32_t scopes;
+    uint64_t total_cycles;
+    uint32_t maximum_cycles;
+};
+
+struct trace_scope {
+    uint8_t subsystem;
+    const char *name;
+    uint64_t start;
+};
+
+#define TRACE_CONCATENATE_(first, second) first##second
+#define TRACE_CONCATENATE(first, second) TRACE_CONCATENATE_(first, second)
+
+/*
+Trace from here to the end of the enclosing block, e.g. TRACE_SCOPE(TRACE_SUBSYSTEM_CPU, "setup_gdt"). The end event is
+recorded by a cleanup handler, so early returns are covered. name must be a literal, it is kept as a pointer.
+*/
+#define TRACE_SCOPE(subsystem, name) \
+    struct trace_scope TRACE_CONCATENATE(trace_scope_, __LINE__) __attribute__((__cleanup__(trace_scope_end))) = trace_scope_begin(subsystem, name)
+
+#define TRACE_INSTANT(subsystem, name) trace_record(subsystem, TRACE_EVENT_INSTANT, name, read_tsc())
+
+void trace_record(uint8_t subsystem, uint8_t type, const char *name, uint64_t timestamp);
+struct trace_scope trace_scope_begin(uint8_t subsystem, const char *name);
+void trace_scope_end(struct trace_scope *scope);
+void trace_print_summary();
+void trace_dump_binary(void (*write)(const char *data, unsigned int length));
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef KERNEL_TSC_HEADER
+#define KERNEL_TSC_HEADER
+
+#include <stdint.h>
+
+#define TSC_CALIBRATION_MILLISECONDS 10
+#define TSC_CALIBRATION_RUNS 3
+
+extern uint32_t tsc_frequency_khz;
+
+void setup_tsc();
+uint32_t tsc_cycles_to_microseconds(uint64_t cycles);
+void tsc_delay_microseconds(uint32_t microseconds);
+
+/*
+Average cycles from a running total, for statistics. There is no libgcc for a 64 bit division, so a total past 32 bits
+saturates, and no count averages to 0.
+*/
+static inline uint32_t tsc_average_cycles(uint64_t total_cycles, uint32_t count) {
+    if (count == 0) {
+        return 0;
+    }
+    if (total_cycles >> 32) {
+        return 0xFFFFFFFF;
+    }
+    return (uint32_t)total_cycles / count;
+}
+
+#endif
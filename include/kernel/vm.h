@@ -0,0 +1,45 @@
+#ifndef KERNEL_VM_HEADER
+#define KERNEL_VM_HEADER
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kernel/pmm.h>
+
+/* lazily backed regions are handed out between these, above the identity map and the process window and below the user mappings */
+#define VM_KERNEL_BASE 0xC0000000
+#define VM_KERNEL_END 0xD0000000
+
+/* the error code the CPU pushes for a page fault */
+#define PAGE_FAULT_PRESENT 0x1 /* the page was present, so this is a protection fault */
+#define PAGE_FAULT_WRITE 0x2
+#define PAGE_FAULT_USER 0x4
+
+/* a reserved range of addresses, backed a page at a time as it is touched. flags are PAGE_WRITABLE and PAGE_USER */
+struct vm_region {
+    uint32_t start;
+    uint32_t end;
+    uint32_t flags;
+    struct vm_region *next;
+};
+
+struct vm_statistics {
+    uint32_t faults;
+    uint32_t zero_page_maps; /* reads of untouched pages, which get the shared zero page */
+    uint32_t zero_fills; /* first writes, which get a zeroed frame of their own */
+    uint32_t spurious; /* already dealt with on another CPU, only this CPU's TLB was out of date */
+    uint32_t committed_pages;
+    uint64_t fault_cycles;
+    uint32_t maximum_fault_cycles;
+};
+
+extern struct vm_statistics vm_statistics;
+
+void setup_vm();
+physical_address vm_zero_page();
+uint32_t vm_reserve(uint32_t length, uint32_t flags);
+bool vm_release(uint32_t start);
+void vm_print_statistics();
+bool vm_self_test();
+
+#endif
@@ -33,6 +33,10 @@
 
 #include <stdarg.h>
 
+typedef void (*mini_printf_emit)(const char *s, unsigned int len, void *context);
+
+char *mini_utoa(unsigned long long value, unsigned int radix, unsigned int uppercase, char *end);
+int mini_vformat(mini_printf_emit emit, void *context, char *fmt, va_list va);
 int mini_vsnprintf(char* buffer, unsigned int buffer_len, char *fmt, va_list va);
 int mini_snprintf(char* buffer, unsigned int buffer_len, char *fmt, ...);
 
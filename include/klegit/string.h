@@ -1,7 +1,24 @@
 #ifndef KLEGIT_STRING_HEADER
 #define KLEGIT_STRING_HEADER
 
+#include <stddef.h>
+
 void* memcpy(void *destination_pointer, const void *source_pointer, size_t length);
+void* memmove(void *destination_pointer, const void *source_pointer, size_t length);
 void* memset(void* destination_pointer, unsigned char character_to_write, size_t length);
+int memcmp(const void *first_pointer, const void *second_pointer, size_t length);
+size_t strlen(const char *string);
+int strcmp(const char *first, const char *second);
+
+/* SSE2 variants. these clobber xmm0-xmm3, so they are only safe to use once the kernel has enabled SSE, and only
+between kernel_fpu_begin and kernel_fpu_end */
+void* memcpy_sse2(void *destination_pointer, const void *source_pointer, size_t length);
+void* memset_sse2(void* destination_pointer, unsigned char character_to_write, size_t length);
+
+/* rep string variants, which never use the large implementations */
+void* memcpy_rep(void *destination_pointer, const void *source_pointer, size_t length);
+void* memset_rep(void* destination_pointer, unsigned char character_to_write, size_t length);
+
+void string_set_large_implementations(void* (*copy)(void*, const void*, size_t), void* (*fill)(void*, unsigned char, size_t));
 
 #endif
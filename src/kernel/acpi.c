@@ -0,0 +1,170 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kernel/acpi.h>
+#include <kernel/intel.h>
+#include <kernel/lapic.h>
+#include <kernel/paging.h>
+
+#include <klegit/string.h>
+
+/* firmware tables can sit above the identity map, e.g. in an ACPI region past the top of RAM. map them read only */
+static void make_accessible(uint32_t address, uint32_t length) {
+    if (!(read_cr0() & CR0_PAGING)) {
+        return;
+    }
+
+    for (uint32_t page = address & ~(PAGE_SIZE - 1); page < address + length; page += PAGE_SIZE) {
+        if (paging_translate(page) == 0) {
+            map_range(page, page, PAGE_SIZE, PAGE_GLOBAL);
+        }
+    }
+}
+
+/* every BIOS table sums to zero over its length */
+static bool checksum_valid(const void *table, uint32_t length) {
+    const uint8_t *bytes = table;
+    uint8_t sum = 0;
+
+    for (uint32_t index = 0; index < length; index++) {
+        sum += bytes[index];
+    }
+
+    return sum == 0;
+}
+
+/* find a signature on a 16 byte boundary with a valid checksum over length bytes. 0 if not there */
+static const void *scan_for(const char *signature, uint32_t signature_length, uint32_t checksum_length, uint32_t start, uint32_t end) {
+    for (uint32_t address = start; address + checksum_length <= end; address += 16) {
+        if (memcmp((const void *)address, signature, signature_length) == 0 && checksum_valid((const void *)address, checksum_length)) {
+            return (const void *)address;
+        }
+    }
+
+    return 0;
+}
+
+/* the first KB of the extended BIOS data area, then the BIOS ROM */
+static const void *scan_bios_areas(const char *signature, uint32_t signature_length, uint32_t checksum_length) {
+    uint32_t ebda = (uint32_t)*(volatile uint16_t *)BIOS_EBDA_SEGMENT_POINTER << 4;
+    const void *found = 0;
+
+    if (ebda >= 0x80000 && ebda < BIOS_BASE_MEMORY_TOP) {
+        found = scan_for(signature, signature_length, checksum_length, ebda, ebda + 1024);
+    }
+    if (!found) {
+        found = scan_for(signature, signature_length, checksum_length, BIOS_BASE_MEMORY_TOP - 1024, BIOS_BASE_MEMORY_TOP);
+    }
+    if (!found) {
+        found = scan_for(signature, signature_length, checksum_length, BIOS_ROM_START, BIOS_ROM_END);
+    }
+
+    return found;
+}
+
+static void add_processor(struct processor_list *processors, uint8_t apic_id) {
+    if (processors->count < ACPI_MAX_PROCESSORS) {
+        processors->apic_ids[processors->count++] = apic_id;
+    }
+}
+
+static const struct acpi_table_header *map_table(uint32_t address) {
+    make_accessible(address, sizeof(struct acpi_table_header));
+    const struct acpi_table_header *table = (const struct acpi_table_header *)address;
+    make_accessible(address, table->length);
+
+    return checksum_valid(table, table->length) ? table : 0;
+}
+
+/* ACPI: RSDP, then the RSDT, then the MADT, which lists one local APIC entry per processor */
+static bool find_in_madt(struct processor_list *processors) {
+    const struct acpi_rsdp *rsdp = scan_bios_areas("RSD PTR ", 8, sizeof(struct acpi_rsdp));
+    if (!rsdp) {
+        return false;
+    }
+
+    const struct acpi_table_header *rsdt = map_table(rsdp->rsdt_address);
+    if (!rsdt || memcmp(rsdt->signature, "RSDT", 4) != 0) {
+        return false;
+    }
+
+    const uint32_t *entries = (const uint32_t *)(rsdt + 1);
+    uint32_t entry_count = (rsdt->length - sizeof(*rsdt)) / sizeof(uint32_t);
+
+    for (uint32_t index = 0; index < entry_count; index++) {
+        const struct acpi_table_header *table = map_table(entries[index]);
+        if (!table || memcmp(table->signature, "APIC", 4) != 0) {
+            continue;
+        }
+
+        const struct acpi_madt *madt = (const struct acpi_madt *)table;
+        const uint8_t *entry = (const uint8_t *)(madt + 1);
+        const uint8_t *end = (const uint8_t *)madt + madt->header.length;
+
+        processors->source = "ACPI MADT";
+        processors->lapic_address = madt->lapic_address;
+
+        while (entry + 2 <= end && entry[1] >= 2) {
+            const struct acpi_madt_local_apic *local_apic = (const struct acpi_madt_local_apic *)entry;
+
+            if (local_apic->type == ACPI_MADT_LOCAL_APIC && (local_apic->flags & ACPI_MADT_LOCAL_APIC_ENABLED)) {
+                add_processor(processors, local_apic->apic_id);
+            }
+            entry += local_apic->length;
+        }
+
+        return processors->count > 0;
+    }
+
+    return false;
+}
+
+/* MP specification: the floating pointer leads to a configuration table with one entry per processor */
+static bool find_in_mp_table(struct processor_list *processors) {
+    const struct mp_floating_pointer *pointer = scan_bios_areas("_MP_", 4, sizeof(struct mp_floating_pointer));
+    if (!pointer || pointer->configuration_table == 0) {
+        return false;
+    }
+
+    make_accessible(pointer->configuration_table, sizeof(struct mp_configuration_table));
+    const struct mp_configuration_table *table = (const struct mp_configuration_table *)pointer->configuration_table;
+    make_accessible(pointer->configuration_table, table->length);
+    if (memcmp(table->signature, "PCMP", 4) != 0 || !checksum_valid(table, table->length)) {
+        return false;
+    }
+
+    processors->source = "MP table";
+    processors->lapic_address = table->lapic_address;
+
+    const uint8_t *entry = (const uint8_t *)(table + 1);
+    for (uint32_t index = 0; index < table->entry_count; index++) {
+        if (*entry == MP_ENTRY_PROCESSOR) {
+            const struct mp_processor_entry *processor = (const struct mp_processor_entry *)entry;
+
+            if (processor->flags & MP_PROCESSOR_ENABLED) {
+                add_processor(processors, processor->apic_id);
+            }
+            entry += MP_ENTRY_PROCESSOR_SIZE;
+        } else {
+            entry += MP_ENTRY_OTHER_SIZE;
+        }
+    }
+
+    return processors->count > 0;
+}
+
+/* list the processors the firmware says are usable, from the ACPI MADT or failing that the MP table */
+bool acpi_find_processors(struct processor_list *processors) {
+    memset(processors, 0, sizeof(*processors));
+    processors->lapic_address = LAPIC_DEFAULT_ADDRESS;
+
+    if (find_in_madt(processors)) {
+        return true;
+    }
+
+    memset(processors, 0, sizeof(*processors));
+    processors->lapic_address = LAPIC_DEFAULT_ADDRESS;
+
+    return find_in_mp_table(processors);
+}
@@ -0,0 +1,1202 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kernel/benchmark.h>
+#include <kernel/boot.h>
+#include <kernel/fpu.h>
+#include <kernel/initrd.h>
+#include <kernel/intel.h>
+#include <kernel/ipc.h>
+#include <kernel/interrupts.h>
+#include <kernel/klog.h>
+#include <kernel/lapic.h>
+#include <kernel/kprintf.h>
+#include <kernel/paging.h>
+#include <kernel/pmm.h>
+#include <kernel/preempt.h>
+#include <kernel/process.h>
+#include <kernel/rcu.h>
+#include <kernel/seqlock.h>
+#include <kernel/serial.h>
+#include <kernel/slab.h>
+#include <kernel/smp.h>
+#include <kernel/spinlock.h>
+#include <kernel/syscall.h>
+#include <kernel/terminal.h>
+#include <kernel/thread.h>
+#include <kernel/tsc.h>
+#include <kernel/vm.h>
+
+#include <klegit/mini-printf.h>
+#include <klegit/string.h>
+
+#define BENCHMARK_RESULT_NAME_LENGTH 48
+#define STRING_BUFFER_SIZE 8192
+#define STRING_SELF_TEST_MAX_LENGTH 80 /* every length up to this, then a few past STRING_LARGE_THRESHOLD */
+#define STRING_SELF_TEST_SLACK 32 /* bytes checked past the end of each call, covering the offsets too */
+#define STRING_BENCHMARK_ITERATIONS 64
+#define TERMINAL_BENCHMARK_LINES 8
+#define FORMAT_BENCHMARK_VALUES 1024
+#define KLOG_BENCHMARK_RECORDS 64
+#define KLOG_BENCHMARK_PRINTS 4
+#define PAGING_BENCHMARK_ADDRESS 0xE0000000
+#define PAGING_BENCHMARK_BLOCKS 4 /* 4M each */
+#define PAGING_BENCHMARK_PASSES 4
+#define KMALLOC_BENCHMARK_OBJECTS 256
+#define KMALLOC_BENCHMARK_ROUNDS 4
+#define INITRD_BENCHMARK_ROUNDS 16
+#define PAGE_FAULT_BENCHMARK_PAGES 256
+#define PAGE_FAULT_BENCHMARK_RESERVATION (64 * 1024 * 1024)
+#define SPAWN_BENCHMARK_ROUNDS 32
+#define IPC_BENCHMARK_SIZES 4 /* 1, 4, 16 and 64 pages */
+#define INTERRUPT_BENCHMARK_VECTOR 0x81
+#define INTERRUPT_BENCHMARK_CALLS 1024
+#define THREAD_BENCHMARK_ROUNDS 1024
+#define PER_CPU_BENCHMARK_READS 4096
+#define FPU_BENCHMARK_ROUNDS 1024
+#define SMP_BENCHMARK_WORKERS 8
+#define SMP_BENCHMARK_ITERATIONS (1 << 22) /* split between the workers */
+#define LOCK_BENCHMARK_ROUNDS 4096 /* per worker */
+#define LOCK_BENCHMARK_SEQLOCK_WRITE_INTERVAL 16 /* seqlock workers write once in this many rounds and read the rest */
+#define LOCK_BENCHMARK_RCU_WRITE_INTERVAL 512 /* the first RCU worker publishes a new version once in this many rounds */
+
+static unsigned char source_buffer[STRING_BUFFER_SIZE];
+static unsigned char destination_buffer[STRING_BUFFER_SIZE];
+static unsigned char reference_buffer[STRING_BUFFER_SIZE];
+
+static uint32_t random_state = 0x2545F491;
+
+/* xorshift32, plenty random enough to shake out alignment bugs */
+static uint32_t random_next() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static void random_fill(unsigned char* buffer, size_t length) {
+    for (size_t index = 0; index < length; index++) {
+        buffer[index] = random_next() & 0xFF;
+    }
+}
+
+/*
+Write one result to COM1 as "BENCH name value" for tools/harness.py, alongside the human readable line. Values are
+all costs in cycles, so lower is better. Spaces in the name become underscores to keep it one field.
+*/
+static void benchmark_result(const char *name, uint32_t value) {
+    char key[BENCHMARK_RESULT_NAME_LENGTH];
+    size_t length = 0;
+
+    for (; name[length] && length < BENCHMARK_RESULT_NAME_LENGTH - 1; length++) {
+        key[length] = name[length] == ' ' ? '_' : name[length];
+    }
+    key[length] = '\0';
+
+    kprintf_to(&serial_sink, "BENCH %s %u\n", key, value);
+}
+
+/* the original byte at a time memcpy, kept as a correctness reference and a benchmark baseline */
+static void* bytewise_copy(void* destination_pointer, const void* source_pointer, size_t length) {
+    unsigned char* destination = (unsigned char*)destination_pointer;
+    const unsigned char* source = (const unsigned char*)source_pointer;
+
+    for (size_t index = 0; index < length; index++) {
+        destination[index] = source[index];
+    }
+
+    return destination_pointer;
+}
+
+static bool buffers_equal(const unsigned char* first, const unsigned char* second, size_t length) {
+    for (size_t index = 0; index < length; index++) {
+        if (first[index] != second[index]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void report_failure(char* function, size_t length, size_t destination_offset, size_t source_offset) {
+    kprintf("string self-test: %s failed, length %u offsets %u/%u\n", function, length, destination_offset, source_offset);
+}
+
+/* memcpy, memcmp and memmove of length bytes at these offsets against byte-wise references */
+static bool string_self_test_copy(size_t length, size_t destination_offset, size_t source_offset) {
+    size_t span = length + STRING_SELF_TEST_SLACK;
+
+    /* memcpy, checking the bytes either side are left alone */
+    random_fill(source_buffer, span);
+    random_fill(destination_buffer, span);
+    bytewise_copy(reference_buffer, destination_buffer, span);
+    bytewise_copy(reference_buffer + destination_offset, source_buffer + source_offset, length);
+    memcpy(destination_buffer + destination_offset, source_buffer + source_offset, length);
+    if (!buffers_equal(destination_buffer, reference_buffer, span)) {
+        report_failure("memcpy", length, destination_offset, source_offset);
+        return false;
+    }
+
+    /* memcmp should agree on equality and on the sign of a single differing byte */
+    if (memcmp(destination_buffer + destination_offset, source_buffer + source_offset, length) != 0) {
+        report_failure("memcmp", length, destination_offset, source_offset);
+        return false;
+    }
+    if (length > 0) {
+        size_t difference = random_next() % length;
+        destination_buffer[destination_offset + difference] = source_buffer[source_offset + difference] + 1;
+        int expected = destination_buffer[destination_offset + difference] - source_buffer[source_offset + difference];
+        int result = memcmp(destination_buffer + destination_offset, source_buffer + source_offset, length);
+        if ((expected < 0) != (result < 0) || result == 0) {
+            report_failure("memcmp", length, destination_offset, source_offset);
+            return false;
+        }
+    }
+
+    /* overlapping memmove in both directions, using a separate copy of the source as the reference */
+    random_fill(destination_buffer, span);
+    bytewise_copy(reference_buffer, destination_buffer, span);
+    bytewise_copy(source_buffer, destination_buffer + source_offset, length);
+    bytewise_copy(reference_buffer + destination_offset, source_buffer, length);
+    memmove(destination_buffer + destination_offset, destination_buffer + source_offset, length);
+    if (!buffers_equal(destination_buffer, reference_buffer, span)) {
+        report_failure("memmove", length, destination_offset, source_offset);
+        return false;
+    }
+
+    return true;
+}
+
+/* memset and strlen of length bytes at this offset against byte-wise references */
+static bool string_self_test_fill(size_t length, size_t destination_offset) {
+    size_t span = length + STRING_SELF_TEST_SLACK;
+
+    /* memset */
+    unsigned char character = random_next() & 0xFF;
+    random_fill(destination_buffer, span);
+    bytewise_copy(reference_buffer, destination_buffer, span);
+    for (size_t index = 0; index < length; index++) {
+        reference_buffer[destination_offset + index] = character;
+    }
+    memset(destination_buffer + destination_offset, character, length);
+    if (!buffers_equal(destination_buffer, reference_buffer, span)) {
+        report_failure("memset", length, destination_offset, 0);
+        return false;
+    }
+
+    /* strlen */
+    for (size_t index = 0; index < length; index++) {
+        destination_buffer[destination_offset + index] = 'a' + index % 26;
+    }
+    destination_buffer[destination_offset + length] = 0;
+    if (strlen((char*)destination_buffer + destination_offset) != length) {
+        report_failure("strlen", length, destination_offset, 0);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+Compare the klegit string functions against byte-wise references over every small length and alignment, then over
+lengths either side of STRING_LARGE_THRESHOLD at odd alignments, which go through the SSE2 versions once boot has
+installed them.
+*/
+bool benchmark_string_self_test() {
+    static const size_t large_lengths[] = {255, 256, 257, 301, 1021, 4093};
+    static const size_t large_offsets[] = {0, 1, 7, 8, 13, 15};
+
+    for (size_t length = 0; length <= STRING_SELF_TEST_MAX_LENGTH; length++) {
+        for (size_t destination_offset = 0; destination_offset < 4; destination_offset++) {
+            for (size_t source_offset = 0; source_offset < 4; source_offset++) {
+                if (!string_self_test_copy(length, destination_offset, source_offset)) {
+                    return false;
+                }
+            }
+            if (!string_self_test_fill(length, destination_offset)) {
+                return false;
+            }
+        }
+    }
+
+    for (size_t length_index = 0; length_index < sizeof(large_lengths) / sizeof(large_lengths[0]); length_index++) {
+        size_t length = large_lengths[length_index];
+        for (size_t destination_index = 0; destination_index < sizeof(large_offsets) / sizeof(large_offsets[0]); destination_index++) {
+            size_t destination_offset = large_offsets[destination_index];
+            for (size_t source_index = 0; source_index < sizeof(large_offsets) / sizeof(large_offsets[0]); source_index++) {
+                if (!string_self_test_copy(length, destination_offset, large_offsets[source_index])) {
+                    return false;
+                }
+            }
+            if (!string_self_test_fill(length, destination_offset)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/* average cycles per call of a copy function over a few iterations */
+static uint32_t time_copy(void* (*copy)(void*, const void*, size_t), size_t length, size_t destination_offset, size_t source_offset) {
+    uint64_t start = read_tsc();
+
+    for (size_t iteration = 0; iteration < STRING_BENCHMARK_ITERATIONS; iteration++) {
+        copy(destination_buffer + destination_offset, source_buffer + source_offset, length);
+    }
+
+    return (uint32_t)(read_tsc() - start) / STRING_BENCHMARK_ITERATIONS;
+}
+
+static uint32_t time_fill(size_t length, size_t destination_offset) {
+    uint64_t start = read_tsc();
+
+    for (size_t iteration = 0; iteration < STRING_BENCHMARK_ITERATIONS; iteration++) {
+        memset(destination_buffer + destination_offset, iteration & 0xFF, length);
+    }
+
+    return (uint32_t)(read_tsc() - start) / STRING_BENCHMARK_ITERATIONS;
+}
+
+/* self-test the string functions then print cycles per call across sizes and alignments, against the old byte-wise copy */
+void benchmark_string() {
+    static const size_t lengths[] = {8, 64, 512, 4096};
+    static const size_t offsets[][2] = {{0, 0}, {1, 3}};
+
+    char name[BENCHMARK_RESULT_NAME_LENGTH];
+
+    boot_self_test("string", benchmark_string_self_test());
+
+    kprintf("  bytes  dst/src  bytewise    memcpy    memset (cycles per call)\n");
+    for (size_t length_index = 0; length_index < sizeof(lengths) / sizeof(lengths[0]); length_index++) {
+        for (size_t offset_index = 0; offset_index < sizeof(offsets) / sizeof(offsets[0]); offset_index++) {
+            size_t length = lengths[length_index];
+            size_t destination_offset = offsets[offset_index][0];
+            size_t source_offset = offsets[offset_index][1];
+
+            uint32_t bytewise_cycles = time_copy(bytewise_copy, length, destination_offset, source_offset);
+            uint32_t memcpy_cycles = time_copy(memcpy, length, destination_offset, source_offset);
+            uint32_t memset_cycles = time_fill(length, destination_offset);
+
+            kprintf("  %5u  %u/%u      %8u  %8u  %8u\n", length, destination_offset, source_offset, bytewise_cycles, memcpy_cycles, memset_cycles);
+            mini_snprintf(name, sizeof(name), "memcpy %u %u/%u", length, destination_offset, source_offset);
+            benchmark_result(name, memcpy_cycles);
+            mini_snprintf(name, sizeof(name), "memset %u %u", length, destination_offset);
+            benchmark_result(name, memset_cycles);
+        }
+    }
+}
+
+/* how many times a second something taking this many cycles can happen, as khz * 1000 / cycles split to stay in 32 bits */
+static uint32_t per_second(uint32_t cycles) {
+    if (cycles == 0) {
+        cycles = 1;
+    }
+
+    return (tsc_frequency_khz / cycles) * 1000 + ((tsc_frequency_khz % cycles) * 1000) / cycles;
+}
+
+/* cycles per character for terminal output when the hardware cursor is moved after every character (the old behaviour) versus once per write */
+void benchmark_terminal() {
+    static char line[] = "The quick brown fox jumps over the lazy dog. 0123456789 ABCDEFGHIJKLMNOPQRS\n";
+    uint32_t character_count = TERMINAL_BENCHMARK_LINES * (sizeof(line) - 1);
+
+    uint64_t start = read_tsc();
+    for (size_t iteration = 0; iteration < TERMINAL_BENCHMARK_LINES; iteration++) {
+        for (size_t index = 0; line[index] != 0; index++) {
+            terminal_put_character(line[index]);
+            terminal_flush();
+        }
+    }
+    uint32_t per_character_cycles = (uint32_t)(read_tsc() - start) / character_count;
+
+    start = read_tsc();
+    for (size_t iteration = 0; iteration < TERMINAL_BENCHMARK_LINES; iteration++) {
+        terminal_write(line);
+    }
+    uint32_t batched_cycles = (uint32_t)(read_tsc() - start) / character_count;
+
+    kprintf("terminal: %u cycles/char (%u chars/s) flushing per character, %u cycles/char (%u chars/s) batched\n",
+        per_character_cycles, per_second(per_character_cycles), batched_cycles, per_second(batched_cycles));
+    benchmark_result("terminal per character", per_character_cycles);
+    benchmark_result("terminal batched", batched_cycles);
+}
+
+/* the original mini_itoa from mini-printf, kept as the baseline for the division-free converters */
+static unsigned int reference_itoa(int value, unsigned int radix, unsigned int uppercase, unsigned int unsig, char *buffer, unsigned int zero_pad) {
+    char *pbuffer = buffer;
+    int negative = 0;
+    unsigned int i, len;
+
+    if (radix > 16) {
+        return 0;
+    }
+
+    if (value < 0 && !unsig) {
+        negative = 1;
+        value = -value;
+    }
+
+    do {
+        int digit = value % radix;
+        *(pbuffer++) = (digit < 10 ? '0' + digit : (uppercase ? 'A' : 'a') + digit - 10);
+        value /= radix;
+    } while (value > 0);
+
+    for (i = (pbuffer - buffer); i < zero_pad; i++) {
+        *(pbuffer++) = '0';
+    }
+
+    if (negative) {
+        *(pbuffer++) = '-';
+    }
+
+    *(pbuffer) = '\0';
+
+    len = (pbuffer - buffer);
+    for (i = 0; i < len / 2; i++) {
+        char j = buffer[i];
+        buffer[i] = buffer[len - i - 1];
+        buffer[len - i - 1] = j;
+    }
+
+    return len;
+}
+
+/* check mini_utoa against the old converter (which only handles values below 2^31) and against some known 64 bit values */
+static bool format_self_test(uint32_t *values) {
+    static const struct {
+        unsigned long long value;
+        unsigned int radix;
+        char *expected;
+    } known[] = {
+        {18446744073709551615ULL, 10, "18446744073709551615"},
+        {10000000000ULL, 10, "10000000000"},
+        {4294967296ULL, 10, "4294967296"},
+        {4294967295ULL, 10, "4294967295"},
+        {0x123456789ABCDEFULL, 16, "123456789abcdef"},
+        {01777777777777777777777ULL, 8, "1777777777777777777777"},
+        {0, 10, "0"},
+    };
+    static const unsigned int radixes[] = {8, 10, 16};
+    char reference[24];
+    char buffer[24];
+    char *end = buffer + sizeof(buffer);
+
+    for (size_t index = 0; index < FORMAT_BENCHMARK_VALUES; index++) {
+        for (size_t radix_index = 0; radix_index < sizeof(radixes) / sizeof(radixes[0]); radix_index++) {
+            unsigned int radix = radixes[radix_index];
+            unsigned int length = reference_itoa(values[index], radix, 0, 1, reference, 0);
+            char *digits = mini_utoa(values[index], radix, 0, end);
+
+            if ((unsigned int)(end - digits) != length || memcmp(digits, reference, length) != 0) {
+                kprintf("format self-test: %u in radix %u failed\n", values[index], radix);
+                return false;
+            }
+        }
+    }
+
+    for (size_t index = 0; index < sizeof(known) / sizeof(known[0]); index++) {
+        char *digits = mini_utoa(known[index].value, known[index].radix, 0, end);
+        size_t length = strlen(known[index].expected);
+
+        if ((size_t)(end - digits) != length || memcmp(digits, known[index].expected, length) != 0) {
+            kprintf("format self-test: expected %s\n", known[index].expected);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* cycles per conversion for the old divide-per-digit mini_itoa against mini_utoa, in decimal and hex */
+void benchmark_format() {
+    static uint32_t values[FORMAT_BENCHMARK_VALUES];
+    char buffer[24];
+    char *end = buffer + sizeof(buffer);
+    uint32_t cycles[4];
+
+    /* a spread of magnitudes, all below 2^31 so the old signed converter gets them right */
+    for (size_t index = 0; index < FORMAT_BENCHMARK_VALUES; index++) {
+        values[index] = random_next() >> (1 + index % 31);
+    }
+
+    boot_self_test("format", format_self_test(values));
+
+    for (unsigned int radix_index = 0; radix_index < 2; radix_index++) {
+        unsigned int radix = radix_index ? 16 : 10;
+
+        uint64_t start = read_tsc();
+        for (size_t index = 0; index < FORMAT_BENCHMARK_VALUES; index++) {
+            reference_itoa(values[index], radix, 0, 1, buffer, 0);
+        }
+        cycles[radix_index * 2] = (uint32_t)(read_tsc() - start) / FORMAT_BENCHMARK_VALUES;
+
+        start = read_tsc();
+        for (size_t index = 0; index < FORMAT_BENCHMARK_VALUES; index++) {
+            mini_utoa(values[index], radix, 0, end);
+        }
+        cycles[radix_index * 2 + 1] = (uint32_t)(read_tsc() - start) / FORMAT_BENCHMARK_VALUES;
+    }
+
+    kprintf("format: decimal %u -> %u cycles, hex %u -> %u cycles (old mini_itoa -> mini_utoa)\n", cycles[0], cycles[1], cycles[2], cycles[3]);
+    benchmark_result("format decimal", cycles[1]);
+    benchmark_result("format hex", cycles[3]);
+}
+
+/* cycles per call for a deferred klog record against formatting the same message synchronously with kprintf */
+void benchmark_klog() {
+    uint64_t start = read_tsc();
+    for (uint32_t index = 0; index < KLOG_BENCHMARK_RECORDS; index++) {
+        klog(KLOG_DEBUG, "klog benchmark record %u of %u at %p\n", index, KLOG_BENCHMARK_RECORDS, &index);
+    }
+    uint32_t klog_cycles = (uint32_t)(read_tsc() - start) / KLOG_BENCHMARK_RECORDS;
+
+    start = read_tsc();
+    for (uint32_t index = 0; index < KLOG_BENCHMARK_PRINTS; index++) {
+        kprintf("kprintf benchmark line %u of %u at %p\n", index, KLOG_BENCHMARK_PRINTS, &index);
+    }
+    uint32_t kprintf_cycles = (uint32_t)(read_tsc() - start) / KLOG_BENCHMARK_PRINTS;
+
+    /* the debug records are below the console level, so this just retires them */
+    klog_drain();
+
+    kprintf("klog: %u cycles per record, kprintf: %u cycles per line\n", klog_cycles, kprintf_cycles);
+    benchmark_result("klog record", klog_cycles);
+    benchmark_result("kprintf line", kprintf_cycles);
+}
+
+/* read one word from every 4K page of each block, PAGING_BENCHMARK_PASSES times over, returning cycles per page touched */
+static uint32_t time_page_walk(uint32_t *block_addresses) {
+    uint32_t pages_per_block = LARGE_PAGE_SIZE / PAGE_SIZE;
+    volatile uint32_t sum = 0;
+
+    uint64_t start = read_tsc();
+    for (uint32_t pass = 0; pass < PAGING_BENCHMARK_PASSES; pass++) {
+        for (uint32_t block = 0; block < PAGING_BENCHMARK_BLOCKS; block++) {
+            for (uint32_t page = 0; page < pages_per_block; page++) {
+                sum += *(volatile uint32_t*)(block_addresses[block] + page * PAGE_SIZE);
+            }
+        }
+    }
+
+    return (uint32_t)(read_tsc() - start) / (PAGING_BENCHMARK_PASSES * PAGING_BENCHMARK_BLOCKS * pages_per_block);
+}
+
+/*
+Touch 16M once through the 4M identity mapping and once through an alias of the same frames mapped with 4K pages. The
+large page walk needs four TLB entries, the small page walk needs 4096 and so misses on nearly every page.
+*/
+void benchmark_paging() {
+    uint32_t large_addresses[PAGING_BENCHMARK_BLOCKS];
+    uint32_t small_addresses[PAGING_BENCHMARK_BLOCKS];
+    uint32_t page_count = PAGING_BENCHMARK_BLOCKS * (LARGE_PAGE_SIZE / PAGE_SIZE);
+
+    for (uint32_t block = 0; block < PAGING_BENCHMARK_BLOCKS; block++) {
+        large_addresses[block] = pmm_alloc_frames(PMM_MAX_ORDER);
+        small_addresses[block] = PAGING_BENCHMARK_ADDRESS + block * LARGE_PAGE_SIZE;
+
+        if (large_addresses[block] == 0) {
+            kprintf("paging benchmark: not enough memory\n");
+            while (block-- > 0) {
+                pmm_free_frames(large_addresses[block], PMM_MAX_ORDER);
+            }
+            return;
+        }
+    }
+
+    uint64_t start = read_tsc();
+    for (uint32_t block = 0; block < PAGING_BENCHMARK_BLOCKS; block++) {
+        map_range(small_addresses[block], large_addresses[block], LARGE_PAGE_SIZE, PAGE_WRITABLE);
+    }
+    uint32_t map_cycles = (uint32_t)(read_tsc() - start) / page_count;
+
+    uint32_t large_cycles = time_page_walk(large_addresses);
+    uint32_t small_cycles = time_page_walk(small_addresses);
+
+    start = read_tsc();
+    unmap_range(PAGING_BENCHMARK_ADDRESS, PAGING_BENCHMARK_BLOCKS * LARGE_PAGE_SIZE);
+    uint32_t unmap_cycles = (uint32_t)(read_tsc() - start) / page_count;
+
+    for (uint32_t block = 0; block < PAGING_BENCHMARK_BLOCKS; block++) {
+        pmm_free_frames(large_addresses[block], PMM_MAX_ORDER);
+    }
+
+    kprintf("paging: %u cycles/page through 4M pages, %u through 4K pages; map %u, unmap %u cycles/page\n", large_cycles, small_cycles, map_cycles, unmap_cycles);
+    benchmark_result("paging 4M walk", large_cycles);
+    benchmark_result("paging 4K walk", small_cycles);
+    benchmark_result("paging map", map_cycles);
+    benchmark_result("paging unmap", unmap_cycles);
+}
+
+/* cycles per kmalloc and kfree for a few size classes, allocating a batch then freeing it so slabs are created and reused */
+void benchmark_kmalloc() {
+    static const size_t sizes[] = {16, 64, 200, 1024, 6000};
+    void *objects[KMALLOC_BENCHMARK_OBJECTS];
+    char name[BENCHMARK_RESULT_NAME_LENGTH];
+
+    kprintf_begin_batch();
+    for (size_t size_index = 0; size_index < sizeof(sizes) / sizeof(sizes[0]); size_index++) {
+        uint64_t allocation_cycles = 0;
+        uint64_t free_cycles = 0;
+
+        for (uint32_t round = 0; round < KMALLOC_BENCHMARK_ROUNDS; round++) {
+            uint64_t start = read_tsc();
+            for (uint32_t index = 0; index < KMALLOC_BENCHMARK_OBJECTS; index++) {
+                objects[index] = kmalloc(sizes[size_index]);
+            }
+            allocation_cycles += read_tsc() - start;
+
+            start = read_tsc();
+            for (uint32_t index = 0; index < KMALLOC_BENCHMARK_OBJECTS; index++) {
+                kfree(objects[index]);
+            }
+            free_cycles += read_tsc() - start;
+        }
+
+        uint32_t allocation_average = (uint32_t)allocation_cycles / (KMALLOC_BENCHMARK_OBJECTS * KMALLOC_BENCHMARK_ROUNDS);
+        uint32_t free_average = (uint32_t)free_cycles / (KMALLOC_BENCHMARK_OBJECTS * KMALLOC_BENCHMARK_ROUNDS);
+
+        kprintf("kmalloc(%u): %u cycles, kfree: %u cycles\n", sizes[size_index], allocation_average, free_average);
+        mini_snprintf(name, sizeof(name), "kmalloc %u", sizes[size_index]);
+        benchmark_result(name, allocation_average);
+        mini_snprintf(name, sizeof(name), "kfree %u", sizes[size_index]);
+        benchmark_result(name, free_average);
+    }
+    kprintf_end_batch();
+}
+
+/* cycles per page to read every page of a demand paged region, write it, and write it again, against the cycles to reserve it */
+static void time_page_faults(uint32_t start, uint32_t *read_cycles, uint32_t *write_cycles, uint32_t *mapped_cycles) {
+    volatile uint32_t *words = (volatile uint32_t*)start;
+    uint32_t words_per_page = PAGE_SIZE / sizeof(uint32_t);
+    uint32_t sum = 0;
+
+    uint64_t begin = read_tsc();
+    for (uint32_t page = 0; page < PAGE_FAULT_BENCHMARK_PAGES; page++) {
+        sum += words[page * words_per_page];
+    }
+    *read_cycles = (uint32_t)(read_tsc() - begin) / PAGE_FAULT_BENCHMARK_PAGES;
+
+    begin = read_tsc();
+    for (uint32_t page = 0; page < PAGE_FAULT_BENCHMARK_PAGES; page++) {
+        words[page * words_per_page] = sum;
+    }
+    *write_cycles = (uint32_t)(read_tsc() - begin) / PAGE_FAULT_BENCHMARK_PAGES;
+
+    begin = read_tsc();
+    for (uint32_t page = 0; page < PAGE_FAULT_BENCHMARK_PAGES; page++) {
+        words[page * words_per_page] = page;
+    }
+    *mapped_cycles = (uint32_t)(read_tsc() - begin) / PAGE_FAULT_BENCHMARK_PAGES;
+}
+
+/*
+The cost of a large reservation, which should be the same as a small one, then the latency of the two kinds of fault:
+a first read mapping the zero page and a first write taking a fresh frame, against a write to an already backed page.
+*/
+void benchmark_page_faults() {
+    uint64_t start = read_tsc();
+    uint32_t region = vm_reserve(PAGE_FAULT_BENCHMARK_RESERVATION, PAGE_WRITABLE);
+    uint32_t reserve_cycles = (uint32_t)(read_tsc() - start);
+
+    if (!region) {
+        kprintf("page fault benchmark: could not reserve %u MB\n", PAGE_FAULT_BENCHMARK_RESERVATION >> 20);
+        return;
+    }
+
+    uint32_t read_cycles, write_cycles, mapped_cycles;
+    time_page_faults(region, &read_cycles, &write_cycles, &mapped_cycles);
+
+    start = read_tsc();
+    vm_release(region);
+    uint32_t release_cycles = (uint32_t)(read_tsc() - start) / PAGE_FAULT_BENCHMARK_PAGES;
+
+    kprintf("page faults: reserving %u MB %u cycles; zero page read %u, zero fill write %u, backed write %u, release %u cycles/page\n",
+        PAGE_FAULT_BENCHMARK_RESERVATION >> 20, reserve_cycles, read_cycles, write_cycles, mapped_cycles, release_cycles);
+    benchmark_result("vm reserve", reserve_cycles);
+    benchmark_result("page fault zero page", read_cycles);
+    benchmark_result("page fault zero fill", write_cycles);
+    benchmark_result("vm release per page", release_cycles);
+}
+
+/* cycles per initrd path lookup, looking up every file in the archive and a path that isn't there */
+void benchmark_initrd() {
+    const struct initrd_file *file;
+    uint32_t lookups = 0;
+
+    if (!initrd_present) {
+        return;
+    }
+
+    uint64_t start = read_tsc();
+    for (uint32_t round = 0; round < INITRD_BENCHMARK_ROUNDS; round++) {
+        for (uint32_t index = 0; (file = initrd_file(index)); index++) {
+            initrd_lookup(file->path);
+            lookups++;
+        }
+    }
+    uint32_t hit_cycles = (uint32_t)(read_tsc() - start) / lookups;
+
+    start = read_tsc();
+    for (uint32_t round = 0; round < INITRD_BENCHMARK_ROUNDS; round++) {
+        initrd_lookup("no/such/file");
+    }
+    uint32_t miss_cycles = (uint32_t)(read_tsc() - start) / INITRD_BENCHMARK_ROUNDS;
+
+    kprintf("initrd: %u cycles per lookup, %u for a missing path\n", hit_cycles, miss_cycles);
+    benchmark_result("initrd lookup", hit_cycles);
+    benchmark_result("initrd lookup missing", miss_cycles);
+}
+
+/*
+Process creation: loading the test program from the initrd, then forking it after it has run and dirtied its pages,
+and the child's first run, which is where the copying a fork would otherwise do happens instead. Each is given with
+the pages it copied, which should be none for the fork and only the pages written for the child.
+*/
+void benchmark_spawn() {
+    uint64_t spawn_cycles = 0, fork_cycles = 0, run_cycles = 0;
+    uint32_t spawn_copies = 0, fork_copies = 0, run_copies = 0;
+
+    if (!initrd_lookup(PROCESS_TEST_PATH)) {
+        return;
+    }
+
+    for (uint32_t round = 0; round < SPAWN_BENCHMARK_ROUNDS; round++) {
+        uint32_t copied = process_statistics.pages_copied;
+        uint64_t start = read_tsc();
+        struct process *parent = process_spawn(PROCESS_TEST_PATH);
+        spawn_cycles += read_tsc() - start;
+        spawn_copies += process_statistics.pages_copied - copied;
+
+        if (!parent) {
+            return;
+        }
+        process_run(parent, round);
+
+        copied = process_statistics.pages_copied;
+        start = read_tsc();
+        struct process *child = process_fork(parent);
+        fork_cycles += read_tsc() - start;
+        fork_copies += process_statistics.pages_copied - copied;
+
+        if (child) {
+            copied = process_statistics.pages_copied;
+            start = read_tsc();
+            process_run(child, round);
+            run_cycles += read_tsc() - start;
+            run_copies += process_statistics.pages_copied - copied;
+
+            process_destroy(child);
+        }
+        process_destroy(parent);
+    }
+
+    uint32_t spawn = (uint32_t)spawn_cycles / SPAWN_BENCHMARK_ROUNDS;
+    uint32_t fork = (uint32_t)fork_cycles / SPAWN_BENCHMARK_ROUNDS;
+    uint32_t run = (uint32_t)run_cycles / SPAWN_BENCHMARK_ROUNDS;
+
+    kprintf("processes: spawn %u cycles (%u pages copied), fork %u cycles (%u copied), child's first run %u cycles (%u copied)\n",
+        spawn, spawn_copies / SPAWN_BENCHMARK_ROUNDS, fork, fork_copies / SPAWN_BENCHMARK_ROUNDS, run, run_copies / SPAWN_BENCHMARK_ROUNDS);
+    benchmark_result("process spawn", spawn);
+    benchmark_result("process fork", fork);
+    benchmark_result("process child first run", run);
+    benchmark_result("process spawn pages copied", spawn_copies / SPAWN_BENCHMARK_ROUNDS);
+    benchmark_result("process fork pages copied", fork_copies / SPAWN_BENCHMARK_ROUNDS);
+    benchmark_result("process child pages copied", run_copies / SPAWN_BENCHMARK_ROUNDS);
+}
+
+/* cycles per message for a run of the IPC test program as sender then receiver, or 0 if it failed */
+static uint32_t time_ipc(uint32_t channel, uint32_t argument) {
+    uint32_t send_cycles, receive_cycles;
+
+    if (!ipc_run_test(IPC_TEST_CHANNEL(channel) | argument, &send_cycles, &receive_cycles)) {
+        return 0;
+    }
+
+    return (send_cycles + receive_cycles) / IPC_TEST_MESSAGES;
+}
+
+/*
+Message passing between two processes: register messages, then each size of message sent as a copy and as the pages
+themselves. Each is the cycles to send and receive one message, both sides from ring 3, and for the larger messages
+the bytes that moved per cycle. A copy should cost in proportion to its size, and a page message by its page count
+only, and much less per page.
+*/
+void benchmark_ipc() {
+    if (!initrd_lookup(IPC_TEST_PATH)) {
+        return;
+    }
+
+    uint32_t channel = ipc_channel_open();
+    if (channel >= IPC_ERROR_FIRST) {
+        return;
+    }
+
+    uint32_t short_cycles = time_ipc(channel, IPC_TEST_SHORT);
+    kprintf("ipc: register message %u cycles\n", short_cycles);
+    benchmark_result("ipc short", short_cycles);
+
+    for (uint32_t size = 0; size < IPC_BENCHMARK_SIZES; size++) {
+        uint32_t pages = 1 << (size * 2);
+        uint32_t bytes = pages * PAGE_SIZE;
+        uint32_t copy_cycles = time_ipc(channel, IPC_TEST_COPY | IPC_TEST_PAGES(pages));
+        uint32_t remap_cycles = time_ipc(channel, IPC_TEST_PAGES(pages));
+        uint32_t copy_rate = copy_cycles ? bytes * 100 / copy_cycles : 0;
+        uint32_t remap_rate = remap_cycles ? bytes * 100 / remap_cycles : 0;
+        char name[32];
+
+        kprintf("ipc: %uK copied %u cycles (%u.%02u bytes/cycle), remapped %u cycles (%u.%02u bytes/cycle)\n", bytes >> 10,
+            copy_cycles, copy_rate / 100, copy_rate % 100, remap_cycles, remap_rate / 100, remap_rate % 100);
+        mini_snprintf(name, sizeof(name), "ipc copy %uK", bytes >> 10);
+        benchmark_result(name, copy_cycles);
+        mini_snprintf(name, sizeof(name), "ipc remap %uK", bytes >> 10);
+        benchmark_result(name, remap_cycles);
+    }
+
+    ipc_channel_close(channel);
+}
+
+static void benchmark_interrupt_handler(struct interrupt_frame *frame) {
+    (void)frame;
+}
+
+/* round trip cost of a software interrupt to an empty handler, against the part of it the dispatcher measures itself */
+void benchmark_interrupts() {
+    register_interrupt_handler(INTERRUPT_BENCHMARK_VECTOR, benchmark_interrupt_handler);
+    struct interrupt_statistics before = interrupt_get_statistics(INTERRUPT_BENCHMARK_VECTOR);
+
+    uint64_t start = read_tsc();
+    for (uint32_t index = 0; index < INTERRUPT_BENCHMARK_CALLS; index++) {
+        __asm__ volatile ("int %0" : : "i"(INTERRUPT_BENCHMARK_VECTOR) : "memory");
+    }
+    uint32_t round_trip_cycles = (uint32_t)(read_tsc() - start) / INTERRUPT_BENCHMARK_CALLS;
+
+    struct interrupt_statistics after = interrupt_get_statistics(INTERRUPT_BENCHMARK_VECTOR);
+    register_interrupt_handler(INTERRUPT_BENCHMARK_VECTOR, 0);
+
+    uint32_t dispatch_cycles = (uint32_t)(after.total_cycles - before.total_cycles) / (after.count - before.count);
+
+    kprintf("interrupts: %u cycles round trip, %u of them in dispatch\n", round_trip_cycles, dispatch_cycles);
+    benchmark_result("interrupt round trip", round_trip_cycles);
+    benchmark_result("interrupt dispatch", dispatch_cycles);
+}
+
+/* round trip cycles for a null syscall from ring 3, through SYSENTER/SYSEXIT and through int 0x80/iret */
+void benchmark_syscalls() {
+    uint32_t interrupt_cycles = run_in_user_mode(user_syscall_benchmark, SYSCALL_BENCHMARK_INTERRUPT) / SYSCALL_BENCHMARK_CALLS;
+
+    if (syscall_sysenter_available()) {
+        uint32_t sysenter_cycles = run_in_user_mode(user_syscall_benchmark, SYSCALL_BENCHMARK_SYSENTER) / SYSCALL_BENCHMARK_CALLS;
+        kprintf("syscalls: %u cycles through sysenter, %u through int 0x80\n", sysenter_cycles, interrupt_cycles);
+        benchmark_result("syscall sysenter", sysenter_cycles);
+    } else {
+        kprintf("syscalls: %u cycles through int 0x80\n", interrupt_cycles);
+    }
+    benchmark_result("syscall int 0x80", interrupt_cycles);
+}
+
+/*
+The fixed costs of the lazy FPU scheme, from the boot thread: a kernel_fpu_begin/end pair around nothing, and the same
+followed by an fwait, which with TS set takes the device not available fault and reloads this thread's state, which the
+next kernel_fpu_begin then has to save again.
+*/
+void benchmark_fpu() {
+    if (!fpu_available) {
+        return;
+    }
+
+    uint64_t start = read_tsc();
+    for (uint32_t round = 0; round < FPU_BENCHMARK_ROUNDS; round++) {
+        kernel_fpu_end(kernel_fpu_begin());
+    }
+    uint32_t section_cycles = (uint32_t)(read_tsc() - start) / FPU_BENCHMARK_ROUNDS;
+
+    start = read_tsc();
+    for (uint32_t round = 0; round < FPU_BENCHMARK_ROUNDS; round++) {
+        kernel_fpu_end(kernel_fpu_begin());
+        __asm__ volatile ("fwait");
+    }
+    uint32_t trap_cycles = (uint32_t)(read_tsc() - start) / FPU_BENCHMARK_ROUNDS - section_cycles;
+
+    kprintf("fpu: %u cycles per kernel_fpu_begin/end, %u more with a fault, restore and save\n", section_cycles, trap_cycles);
+    benchmark_result("fpu section", section_cycles);
+    benchmark_result("fpu trap", trap_cycles);
+}
+
+static struct thread *benchmark_thread_pair[2];
+static volatile uint32_t benchmark_threads_finished;
+
+static void yield_benchmark_thread(void *argument) {
+    (void)argument;
+
+    for (uint32_t round = 0; round < THREAD_BENCHMARK_ROUNDS; round++) {
+        thread_yield();
+    }
+
+    __atomic_fetch_add(&benchmark_threads_finished, 1, __ATOMIC_RELAXED);
+}
+
+/* wake the partner and sleep until it wakes us back. a wake up before the partner blocks is kept, so every block is matched */
+static void ping_pong_benchmark_thread(void *argument) {
+    struct thread *partner = benchmark_thread_pair[(uint32_t)argument ^ 1];
+
+    for (uint32_t round = 0; round < THREAD_BENCHMARK_ROUNDS; round++) {
+        thread_wake(partner);
+        thread_block();
+    }
+
+    __atomic_fetch_add(&benchmark_threads_finished, 1, __ATOMIC_RELAXED);
+}
+
+/* start two threads above the caller's priority and return the cycles until both have finished */
+static uint32_t time_thread_pair(void (*entry)(void *argument)) {
+    uint32_t flags = interrupts_save_disable();
+
+    benchmark_threads_finished = 0;
+    benchmark_thread_pair[0] = thread_create("benchmark 0", THREAD_PRIORITY_HIGH, entry, (void *)0);
+    benchmark_thread_pair[1] = thread_create("benchmark 1", THREAD_PRIORITY_HIGH, entry, (void *)1);
+
+    interrupts_restore(flags);
+
+    if (!benchmark_thread_pair[0] || !benchmark_thread_pair[1]) {
+        return 0;
+    }
+
+    uint64_t start = read_tsc();
+    while (benchmark_threads_finished < 2) {
+        thread_yield();
+    }
+
+    return (uint32_t)(read_tsc() - start);
+}
+
+/*
+Context switch latency from two threads yielding to each other, and ping-pong throughput from two threads waking each
+other and blocking. A ping-pong round trip is two switches plus the wake and block bookkeeping. Work stealing is held
+off for the duration, so both threads stay on this CPU and every yield really switches.
+*/
+void benchmark_threads() {
+    uint32_t active_cpus = smp_active_cpus;
+
+    smp_active_cpus = 1;
+    uint32_t yield_cycles = time_thread_pair(yield_benchmark_thread) / (2 * THREAD_BENCHMARK_ROUNDS);
+    uint32_t round_trip_cycles = time_thread_pair(ping_pong_benchmark_thread) / THREAD_BENCHMARK_ROUNDS;
+    smp_active_cpus = active_cpus;
+
+    if (yield_cycles == 0 || round_trip_cycles == 0) {
+        kprintf("thread benchmark: could not create threads\n");
+        return;
+    }
+
+    kprintf("threads: %u cycles per yield and switch, ping-pong %u cycles per round trip (%u per second)\n",
+        yield_cycles, round_trip_cycles, per_second(round_trip_cycles));
+    benchmark_result("thread yield", yield_cycles);
+    benchmark_result("thread ping-pong", round_trip_cycles);
+}
+
+static struct thread *smp_benchmark_waiter;
+static volatile uint32_t smp_benchmark_finished;
+static volatile uint32_t smp_benchmark_sink;
+
+/* a fixed slice of pure ALU work, with nothing shared between workers until the end */
+static void smp_benchmark_worker(void *argument) {
+    uint32_t state = (uint32_t)argument + 1;
+
+    for (uint32_t iteration = 0; iteration < SMP_BENCHMARK_ITERATIONS / SMP_BENCHMARK_WORKERS; iteration++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+    }
+    smp_benchmark_sink = state;
+
+    if (__atomic_add_fetch(&smp_benchmark_finished, 1, __ATOMIC_RELEASE) == SMP_BENCHMARK_WORKERS) {
+        thread_wake(smp_benchmark_waiter);
+    }
+}
+
+/* cycles for SMP_BENCHMARK_WORKERS workers to finish, with only the first cpu_limit CPUs allowed to take them. 0 on failure */
+static uint32_t time_smp_workers(uint32_t cpu_limit) {
+    smp_active_cpus = cpu_limit;
+    smp_benchmark_finished = 0;
+    smp_benchmark_waiter = thread_current();
+
+    uint64_t start = read_tsc();
+    for (uint32_t index = 0; index < SMP_BENCHMARK_WORKERS; index++) {
+        if (!thread_create("smp worker", THREAD_PRIORITY_NORMAL, smp_benchmark_worker, (void *)index)) {
+            return 0;
+        }
+    }
+
+    while (__atomic_load_n(&smp_benchmark_finished, __ATOMIC_ACQUIRE) < SMP_BENCHMARK_WORKERS) {
+        thread_block();
+    }
+
+    return (uint32_t)(read_tsc() - start);
+}
+
+/*
+The same CPU bound work spread over 1, 2, 4 and 8 CPUs, as far as there are CPUs online. The workers are all created on
+this CPU, so anything beyond one CPU is down to work stealing, and the speedup shows what stealing and the per-CPU
+queues cost against a perfect split.
+*/
+void benchmark_smp() {
+    uint32_t active_cpus = smp_active_cpus;
+    uint32_t single_kilocycles = 0;
+    char name[BENCHMARK_RESULT_NAME_LENGTH];
+
+    for (uint32_t cpu_limit = 1; cpu_limit <= SMP_MAX_CPUS && cpu_limit <= online_cpu_count; cpu_limit *= 2) {
+        uint32_t kilocycles = time_smp_workers(cpu_limit) / 1000;
+
+        if (kilocycles == 0) {
+            kprintf("smp scaling: could not create threads\n");
+            break;
+        }
+        if (cpu_limit == 1) {
+            single_kilocycles = kilocycles;
+        }
+
+        uint32_t speedup = single_kilocycles * 100 / kilocycles;
+        kprintf("smp scaling: %u CPUs, %u kcycles, %u.%02ux speedup\n", cpu_limit, kilocycles, speedup / 100, speedup % 100);
+        mini_snprintf(name, sizeof(name), "smp %u cpus kcycles", cpu_limit);
+        benchmark_result(name, kilocycles);
+    }
+
+    smp_active_cpus = active_cpus;
+}
+
+/*
+Reading the current thread through %gs against indexing cpus[]: once with the index already known, which is the floor
+for any array scheme, and once finding it from the local APIC ID with interrupts held off, which is what an array
+needs to give the right answer on a CPU a thread can be moved off.
+*/
+static volatile uintptr_t per_cpu_benchmark_sink;
+
+void benchmark_per_cpu() {
+    volatile struct cpu *cpu_array = cpus; /* so the load isn't hoisted out of the loop */
+    uintptr_t sum = 0;
+
+    uint64_t start = read_tsc();
+    for (uint32_t read = 0; read < PER_CPU_BENCHMARK_READS; read++) {
+        sum += (uintptr_t)this_cpu_read(current_thread);
+    }
+    uint32_t segment_cycles = (uint32_t)(read_tsc() - start);
+
+    volatile uint32_t index = this_cpu_read(index);
+    start = read_tsc();
+    for (uint32_t read = 0; read < PER_CPU_BENCHMARK_READS; read++) {
+        sum += (uintptr_t)cpu_array[index].current_thread;
+    }
+    uint32_t indexed_cycles = (uint32_t)(read_tsc() - start);
+
+    uint32_t lookup_cycles = 0;
+    if (lapic_available) {
+        start = read_tsc();
+        for (uint32_t read = 0; read < PER_CPU_BENCHMARK_READS; read++) {
+            uint32_t flags = interrupts_save_disable();
+            sum += (uintptr_t)smp_cpu_by_apic_id(lapic_id())->current_thread;
+            interrupts_restore(flags);
+        }
+        lookup_cycles = (uint32_t)(read_tsc() - start);
+    }
+
+    per_cpu_benchmark_sink = sum;
+
+    kprintf("per-CPU reads: %u cycles through gs, %u indexing cpus[] with a known index, %u looking the index up from the local APIC ID\n",
+        segment_cycles / PER_CPU_BENCHMARK_READS, indexed_cycles / PER_CPU_BENCHMARK_READS, lookup_cycles / PER_CPU_BENCHMARK_READS);
+    benchmark_result("per-cpu gs read", segment_cycles / PER_CPU_BENCHMARK_READS);
+}
+
+#define LOCK_BENCHMARK_TICKET 0
+#define LOCK_BENCHMARK_TICKET_IRQSAVE 1
+#define LOCK_BENCHMARK_MCS 2
+#define LOCK_BENCHMARK_MCS_IRQSAVE 3
+#define LOCK_BENCHMARK_SEQLOCK 4
+#define LOCK_BENCHMARK_RCU 5
+#define LOCK_BENCHMARK_KIND_COUNT 6
+
+static const char *lock_benchmark_names[LOCK_BENCHMARK_KIND_COUNT] = {"ticket", "ticket irqsave", "mcs", "mcs irqsave", "seqlock", "rcu"};
+
+/* shared by whichever lock is being measured, and reset before each */
+static LOCK_STATISTICS(lock_benchmark_statistics, "benchmark");
+static struct spinlock lock_benchmark_ticket = SPINLOCK_INIT_WITH_STATISTICS(&lock_benchmark_statistics);
+static struct mcs_lock lock_benchmark_mcs = MCS_LOCK_INIT_WITH_STATISTICS(&lock_benchmark_statistics);
+static struct seqlock lock_benchmark_seqlock = SEQLOCK_INIT_WITH_STATISTICS(&lock_benchmark_statistics);
+
+/* the protected data. two words written one after the other, so a reader or writer let in at the wrong time sees them disagree */
+struct lock_benchmark_data {
+    uint32_t value;
+    uint32_t check; /* always ~value */
+};
+
+static struct lock_benchmark_data lock_benchmark_data;
+static struct lock_benchmark_data lock_benchmark_versions[2];
+static struct lock_benchmark_data *lock_benchmark_current; /* published through rcu_assign_pointer */
+
+static uint32_t lock_benchmark_kind;
+static struct thread *lock_benchmark_waiter;
+static volatile uint32_t lock_benchmark_finished;
+static volatile uint32_t lock_benchmark_errors;
+
+static inline void lock_benchmark_update(struct lock_benchmark_data *data) {
+    if (data->check != ~data->value) {
+        __atomic_fetch_add(&lock_benchmark_errors, 1, __ATOMIC_RELAXED);
+    }
+    data->value++;
+    data->check = ~data->value;
+}
+
+static void lock_benchmark_seqlock_round(uint32_t round) {
+    if (round % LOCK_BENCHMARK_SEQLOCK_WRITE_INTERVAL == 0) {
+        seqlock_write_begin(&lock_benchmark_seqlock);
+        lock_benchmark_update(&lock_benchmark_data);
+        seqlock_write_end(&lock_benchmark_seqlock);
+        return;
+    }
+
+    struct lock_benchmark_data copy;
+    uint32_t sequence;
+    do {
+        sequence = seqlock_read_begin(&lock_benchmark_seqlock);
+        copy = lock_benchmark_data;
+    } while (seqlock_read_retry(&lock_benchmark_seqlock, sequence));
+
+    if (copy.check != ~copy.value) {
+        __atomic_fetch_add(&lock_benchmark_errors, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* only the first worker writes, so the version not currently published is free once synchronize_rcu has returned */
+static void lock_benchmark_rcu_round(uint32_t worker, uint32_t round) {
+    if (worker == 0 && round % LOCK_BENCHMARK_RCU_WRITE_INTERVAL == 0) {
+        struct lock_benchmark_data *old = lock_benchmark_current;
+        struct lock_benchmark_data *new = old == &lock_benchmark_versions[0] ? &lock_benchmark_versions[1] : &lock_benchmark_versions[0];
+
+        new->value = old->value + 1;
+        new->check = ~new->value;
+        rcu_assign_pointer(lock_benchmark_current, new);
+        synchronize_rcu();
+
+        /* nobody can be reading the old version now, so scribbling on it must go unseen */
+        old->check = old->value;
+        return;
+    }
+
+    rcu_read_lock();
+    struct lock_benchmark_data *data = rcu_dereference(lock_benchmark_current);
+    if (data->check != ~data->value) {
+        __atomic_fetch_add(&lock_benchmark_errors, 1, __ATOMIC_RELAXED);
+    }
+    rcu_read_unlock();
+}
+
+/*
+Every round takes the lock being measured with interrupts left on, unless it is an irqsave kind, so timer ticks and
+reschedule IPIs land inside the critical sections too. Preemption is held off around the plain kinds, otherwise a
+holder switched out for a whole time slice would stall every other worker behind it.
+*/
+static void lock_benchmark_worker(void *argument) {
+    uint32_t worker = (uint32_t)argument;
+
+    for (uint32_t round = 0; round < LOCK_BENCHMARK_ROUNDS; round++) {
+        struct mcs_node node;
+        uint32_t flags;
+
+        switch (lock_benchmark_kind) {
+        case LOCK_BENCHMARK_TICKET:
+            preempt_disable();
+            spinlock_acquire(&lock_benchmark_ticket);
+            lock_benchmark_update(&lock_benchmark_data);
+            spinlock_release(&lock_benchmark_ticket);
+            preempt_enable();
+            break;
+        case LOCK_BENCHMARK_TICKET_IRQSAVE:
+            flags = spinlock_acquire_irqsave(&lock_benchmark_ticket);
+            lock_benchmark_update(&lock_benchmark_data);
+            spinlock_release_irqrestore(&lock_benchmark_ticket, flags);
+            break;
+        case LOCK_BENCHMARK_MCS:
+            preempt_disable();
+            mcs_lock_acquire(&lock_benchmark_mcs, &node);
+            lock_benchmark_update(&lock_benchmark_data);
+            mcs_lock_release(&lock_benchmark_mcs, &node);
+            preempt_enable();
+            break;
+        case LOCK_BENCHMARK_MCS_IRQSAVE:
+            flags = mcs_lock_acquire_irqsave(&lock_benchmark_mcs, &node);
+            lock_benchmark_update(&lock_benchmark_data);
+            mcs_lock_release_irqrestore(&lock_benchmark_mcs, &node, flags);
+            break;
+        case LOCK_BENCHMARK_SEQLOCK:
+            preempt_disable();
+            lock_benchmark_seqlock_round(round);
+            preempt_enable();
+            break;
+        case LOCK_BENCHMARK_RCU:
+            lock_benchmark_rcu_round(worker, round);
+            break;
+        }
+    }
+
+    if (__atomic_add_fetch(&lock_benchmark_finished, 1, __ATOMIC_RELEASE) == online_cpu_count) {
+        thread_wake(lock_benchmark_waiter);
+    }
+}
+
+/* cycles for one worker per online CPU to get through their rounds of one kind of lock. 0 on failure */
+static uint32_t time_lock_workers(uint32_t kind) {
+    lock_benchmark_kind = kind;
+    lock_benchmark_finished = 0;
+    lock_benchmark_waiter = thread_current();
+
+    uint64_t start = read_tsc();
+    for (uint32_t index = 0; index < online_cpu_count; index++) {
+        if (!thread_create("lock worker", THREAD_PRIORITY_NORMAL, lock_benchmark_worker, (void *)index)) {
+            return 0;
+        }
+    }
+
+    while (__atomic_load_n(&lock_benchmark_finished, __ATOMIC_ACQUIRE) < online_cpu_count) {
+        thread_block();
+    }
+
+    return (uint32_t)(read_tsc() - start);
+}
+
+/*
+One worker per online CPU hammering each kind of lock in turn, with a count of the times the protected data was seen
+half updated, which should always be 0. The per lock statistics give the contended share and the wait and hold times
+behind each cycles per round figure. With one CPU this measures the uncontended cost.
+*/
+void benchmark_locks() {
+    char name[BENCHMARK_RESULT_NAME_LENGTH];
+
+    lock_benchmark_versions[0].check = ~0u;
+    lock_benchmark_current = &lock_benchmark_versions[0];
+
+    for (uint32_t kind = 0; kind < LOCK_BENCHMARK_KIND_COUNT; kind++) {
+        lock_benchmark_data.value = 0;
+        lock_benchmark_data.check = ~0u;
+        lock_benchmark_errors = 0;
+        lock_statistics_reset(&lock_benchmark_statistics);
+
+        uint32_t cycles = time_lock_workers(kind);
+        if (cycles == 0) {
+            kprintf("lock benchmark: could not create threads\n");
+            return;
+        }
+
+        kprintf("locks: %s, %u CPUs, %u cycles per round, %u errors\n", lock_benchmark_names[kind], online_cpu_count,
+            cycles / (LOCK_BENCHMARK_ROUNDS * online_cpu_count), lock_benchmark_errors);
+        mini_snprintf(name, sizeof(name), "lock %s", lock_benchmark_names[kind]);
+        benchmark_result(name, cycles / (LOCK_BENCHMARK_ROUNDS * online_cpu_count));
+        if (kind <= LOCK_BENCHMARK_MCS_IRQSAVE && lock_benchmark_data.value != LOCK_BENCHMARK_ROUNDS * online_cpu_count) {
+            kprintf("locks: %s lost updates, %u of %u\n", lock_benchmark_names[kind], lock_benchmark_data.value, LOCK_BENCHMARK_ROUNDS * online_cpu_count);
+        }
+        if (lock_benchmark_statistics.acquisitions) {
+            lock_statistics_print(&lock_benchmark_statistics);
+        }
+    }
+
+    lock_statistics_reset(&lock_benchmark_statistics);
+}
@@ -0,0 +1,124 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kernel/boot.h>
+#include <kernel/kprintf.h>
+#include <kernel/multiboot.h>
+#include <kernel/trace.h>
+#include <kernel/tsc.h>
+
+#include <klegit/string.h>
+
+uint64_t boot_entry_tsc = 0;
+uint64_t boot_init_tsc = 0;
+
+char boot_command_line[BOOT_COMMAND_LINE_LENGTH];
+
+/* set by "fastboot" on the command line: no diagnostic output, self-tests, benchmarks or profiler, just get to ready */
+bool boot_fast = false;
+
+uint32_t boot_self_test_failures = 0;
+
+static struct boot_phase phases[BOOT_PHASE_COUNT];
+static uint32_t phase_count = 0;
+static uint32_t phases_dropped = 0;
+
+static void record_phase(const char *name, uint64_t timestamp) {
+    trace_record(TRACE_SUBSYSTEM_BOOT, TRACE_EVENT_INSTANT, name, timestamp);
+
+    if (phase_count == BOOT_PHASE_COUNT) {
+        phases_dropped++;
+        return;
+    }
+    phases[phase_count].name = name;
+    phases[phase_count].timestamp = timestamp;
+    phase_count++;
+}
+
+/*
+Copy the command line out of the multiboot structures, which setup_pmm doesn't keep, and pick the options out of it.
+This is the first thing main does, so it also starts the timeline with the two timestamps early.S took.
+*/
+void setup_boot_options(struct multiboot_info *multiboot_info) {
+    record_phase("entry", boot_entry_tsc);
+    record_phase("_init", boot_init_tsc);
+
+    if (multiboot_info->flags & MULTIBOOT_INFO_COMMAND_LINE) {
+        const char *command_line = (const char*)multiboot_info->command_line;
+        size_t length = strlen(command_line);
+
+        if (length >= BOOT_COMMAND_LINE_LENGTH) {
+            length = BOOT_COMMAND_LINE_LENGTH - 1;
+        }
+        memcpy(boot_command_line, command_line, length);
+        boot_command_line[length] = '\0';
+    }
+
+    boot_fast = boot_option("fastboot");
+}
+
+/* true if name appears as a whole word on the command line. GRUB passes the kernel's own path as the first word */
+bool boot_option(const char *name) {
+    size_t name_length = strlen(name);
+    const char *word = boot_command_line;
+
+    while (*word) {
+        while (*word == ' ') {
+            word++;
+        }
+
+        size_t word_length = 0;
+        while (word[word_length] && word[word_length] != ' ') {
+            word_length++;
+        }
+
+        if (word_length == name_length && memcmp(word, name, name_length) == 0) {
+            return true;
+        }
+        word += word_length;
+    }
+
+    return false;
+}
+
+/* mark the end of a step of startup. only the boot CPU calls this, and the name must be a string constant */
+void boot_phase(const char *name) {
+    record_phase(name, read_tsc());
+}
+
+/* the "Setting up..." chatter, which fastboot leaves out */
+void boot_progress(const char *message) {
+    if (!boot_fast) {
+        kprintf("%s\n", message);
+    }
+}
+
+/* print a self-test result and count the failures. under fastboot only failures are printed */
+void boot_self_test(const char *name, bool passed) {
+    if (!passed) {
+        boot_self_test_failures++;
+        kprintf("%s self-test FAILED.\n", name);
+    } else if (!boot_fast) {
+        kprintf("%s self-test passed.\n", name);
+    }
+}
+
+/* each phase with the time since early.S was entered and how long it took, in microseconds */
+void boot_print_timeline() {
+    kprintf_begin_batch();
+    kprintf("Boot timeline%s: phase, at us, took us\n", boot_fast ? " (fastboot)" : "");
+
+    for (uint32_t index = 0; index < phase_count; index++) {
+        uint64_t previous = index ? phases[index - 1].timestamp : boot_entry_tsc;
+
+        kprintf("  %-20s %10u %10u\n", phases[index].name,
+            tsc_cycles_to_microseconds(phases[index].timestamp - boot_entry_tsc),
+            tsc_cycles_to_microseconds(phases[index].timestamp - previous));
+    }
+    if (phases_dropped) {
+        kprintf("  %u more phases were not kept\n", phases_dropped);
+    }
+
+    kprintf_end_batch();
+}
@@ -0,0 +1,297 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kernel/fpu.h>
+#include <kernel/intel.h>
+#include <kernel/interrupts.h>
+#include <kernel/kprintf.h>
+#include <kernel/slab.h>
+#include <kernel/smp.h>
+#include <kernel/thread.h>
+
+#include <klegit/string.h>
+
+#define INTERRUPT_VECTOR_DEVICE_NOT_AVAILABLE 7
+#define FPU_SELF_TEST_ROUNDS 256
+#define FPU_SELF_TEST_COPY_SIZE 1024
+
+bool fpu_available = false;
+
+static struct kmem_cache *fpu_state_cache;
+
+/* what a thread's registers hold the first time it touches them: after fninit, default MXCSR, every xmm register zero */
+static struct fpu_state initial_state;
+
+static inline void fxsave(struct fpu_state *state) {
+    __asm__ volatile ("fxsave %0" : "=m"(*state));
+}
+
+static inline void fxrstor(struct fpu_state *state) {
+    __asm__ volatile ("fxrstor %0" : : "m"(*state));
+}
+
+static inline void clts() {
+    __asm__ volatile ("clts" : : : "memory");
+}
+
+static inline void stts() {
+    write_cr0(read_cr0() | CR0_TASK_SWITCHED);
+}
+
+/*
+Lazy switching. TS is left set whenever the registers might not belong to the running thread, so its first x87 or SSE
+instruction faults here, and only then is its state loaded. A thread which never touches them costs nothing and gets
+no state. Each CPU remembers whose state it last loaded, and as fpu_switch saves an owner's state on the way out, the
+registers never hold anything that is not also in memory once the thread has gone. If the owner comes back to the
+same CPU and nobody else has touched the registers, fpu_switch just clears TS.
+*/
+static void device_not_available(struct interrupt_frame *frame) {
+    (void)frame;
+
+    struct cpu *cpu = this_cpu();
+    struct thread *thread = cpu->current_thread;
+
+    clts();
+    cpu->fpu_traps++;
+
+    /* before setup_threads, or a kernel_fpu section somehow left TS set: there is no thread state to keep apart */
+    if (!thread || cpu->fpu_in_kernel) {
+        return;
+    }
+
+    if (!thread->fpu_state) {
+        thread->fpu_state = kmem_cache_alloc(fpu_state_cache);
+        if (!thread->fpu_state) {
+            kprintf("fpu: out of memory for the state of thread %u (%s)\n", thread->id, thread->name);
+            halt();
+        }
+        memcpy(thread->fpu_state, &initial_state, sizeof(initial_state));
+    }
+
+    fxrstor(thread->fpu_state);
+    cpu->fpu_owner = thread;
+    thread->fpu_cpu = cpu->index;
+}
+
+/* turn on the x87 and SSE for the calling CPU, with nothing loaded in them */
+void fpu_setup_cpu() {
+    if (!fpu_available) {
+        return;
+    }
+
+    uint32_t cr0 = read_cr0();
+    cr0 &= ~(CR0_EMULATION | CR0_TASK_SWITCHED);
+    cr0 |= CR0_MONITOR_COPROCESSOR | CR0_NUMERIC_ERROR;
+    write_cr0(cr0);
+    write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+
+    __asm__ volatile ("fninit");
+
+    /* TS stays clear until fpu_switch sets it at this CPU's first thread switch */
+    this_cpu_write(fpu_owner, 0);
+    this_cpu_write(fpu_in_kernel, false);
+}
+
+/*
+Check for FXSAVE and SSE2, and turn them on for the boot CPU. Until the first thread switch there is only the one
+thread of control, so there is nothing to trap. Needs setup_gdt for the per-CPU fields, and must run before
+setup_string_implementations.
+*/
+void setup_fpu() {
+    if (!cpu_has_feature(CPUID_FEATURE_EDX_FPU) || !cpu_has_feature(CPUID_FEATURE_EDX_FXSR) ||
+        !cpu_has_feature(CPUID_FEATURE_EDX_SSE) || !cpu_has_feature(CPUID_FEATURE_EDX_SSE2)) {
+        kprintf("fpu: no FXSAVE or SSE2, staying with scalar code\n");
+        return;
+    }
+
+    fpu_available = true;
+    fpu_setup_cpu();
+
+    uint32_t mxcsr = FPU_DEFAULT_MXCSR;
+    __asm__ volatile (
+        "ldmxcsr %0\n\t"
+        "xorps %%xmm0, %%xmm0\n\t"
+        "xorps %%xmm1, %%xmm1\n\t"
+        "xorps %%xmm2, %%xmm2\n\t"
+        "xorps %%xmm3, %%xmm3\n\t"
+        "xorps %%xmm4, %%xmm4\n\t"
+        "xorps %%xmm5, %%xmm5\n\t"
+        "xorps %%xmm6, %%xmm6\n\t"
+        "xorps %%xmm7, %%xmm7"
+        :
+        : "m"(mxcsr)
+    );
+    fxsave(&initial_state);
+
+    register_interrupt_handler(INTERRUPT_VECTOR_DEVICE_NOT_AVAILABLE, device_not_available);
+}
+
+/* the per thread state cache. called by setup_threads, as no thread can fault before then */
+void fpu_setup_threads() {
+    if (fpu_available) {
+        fpu_state_cache = kmem_cache_create("fpu state", sizeof(struct fpu_state), KMEM_CACHE_ALIGN);
+    }
+}
+
+/* called by schedule with interrupts off, just before switching from previous to next */
+void fpu_switch(struct cpu *cpu, struct thread *previous, struct thread *next) {
+    if (!fpu_available) {
+        return;
+    }
+
+    uint32_t cr0 = read_cr0();
+
+    if (!(cr0 & CR0_TASK_SWITCHED) && cpu->fpu_owner == previous && previous->state != THREAD_DEAD) {
+        fxsave(previous->fpu_state);
+    }
+
+    bool still_loaded = cpu->fpu_owner == next && next->fpu_cpu == cpu->index;
+    if (still_loaded && (cr0 & CR0_TASK_SWITCHED)) {
+        clts();
+    } else if (!still_loaded && !(cr0 & CR0_TASK_SWITCHED)) {
+        write_cr0(cr0 | CR0_TASK_SWITCHED);
+    }
+}
+
+/* called as a thread is freed. a CPU still naming it as owner is harmless, as a new thread starts with fpu_cpu unset */
+void fpu_free_state(struct thread *thread) {
+    if (thread->fpu_state) {
+        kmem_cache_free(fpu_state_cache, thread->fpu_state);
+        thread->fpu_state = 0;
+    }
+}
+
+/* SSE can't be used from inside another kernel_fpu section, e.g. by a fault handler which interrupted one */
+bool kernel_fpu_usable() {
+    return fpu_available && !this_cpu_read(fpu_in_kernel);
+}
+
+/*
+Let kernel code use the x87 and SSE registers until kernel_fpu_end, which must be passed what this returns. The running
+thread's state is saved first if it is loaded, and the CPU forgets its owner so whoever's state was there reloads it
+on their next use. Interrupts stay off for the duration, so keep it short and check kernel_fpu_usable first.
+*/
+uint32_t kernel_fpu_begin() {
+    uint32_t flags = interrupts_save_disable();
+    struct cpu *cpu = this_cpu();
+
+    if (read_cr0() & CR0_TASK_SWITCHED) {
+        clts();
+    } else if (cpu->fpu_owner && cpu->fpu_owner == cpu->current_thread) {
+        fxsave(cpu->fpu_owner->fpu_state);
+    }
+
+    cpu->fpu_owner = 0;
+    cpu->fpu_in_kernel = true;
+
+    return flags;
+}
+
+/* before setup_threads there is no thread state to protect, so TS is left clear and the next section is cheaper */
+void kernel_fpu_end(uint32_t flags) {
+    struct cpu *cpu = this_cpu();
+
+    cpu->fpu_in_kernel = false;
+    if (cpu->current_thread) {
+        stts();
+    }
+
+    interrupts_restore(flags);
+}
+
+static void *memcpy_kernel_fpu(void *destination, const void *source, size_t length) {
+    if (!kernel_fpu_usable()) {
+        return memcpy_rep(destination, source, length);
+    }
+
+    uint32_t flags = kernel_fpu_begin();
+    memcpy_sse2(destination, source, length);
+    kernel_fpu_end(flags);
+
+    return destination;
+}
+
+static void *memset_kernel_fpu(void *destination, unsigned char character, size_t length) {
+    if (!kernel_fpu_usable()) {
+        return memset_rep(destination, character, length);
+    }
+
+    uint32_t flags = kernel_fpu_begin();
+    memset_sse2(destination, character, length);
+    kernel_fpu_end(flags);
+
+    return destination;
+}
+
+/* pick the fastest memcpy/memset the CPU supports. the SSE2 versions go through kernel_fpu_begin/end, so they can't disturb any thread's registers */
+void setup_string_implementations() {
+    if (fpu_available) {
+        string_set_large_implementations(memcpy_kernel_fpu, memset_kernel_fpu);
+    } else {
+        string_set_large_implementations(0, 0);
+    }
+}
+
+void fpu_print_statistics() {
+    if (!fpu_available) {
+        return;
+    }
+
+    kprintf_begin_batch();
+    for (uint32_t index = 0; index < online_cpu_count; index++) {
+        kprintf("fpu: cpu %u took %u device not available faults\n", index, cpus[index].fpu_traps);
+    }
+    kprintf_end_batch();
+}
+
+static volatile uint32_t self_test_finished;
+static volatile uint32_t self_test_failures;
+static unsigned char self_test_buffers[2][FPU_SELF_TEST_COPY_SIZE];
+
+/*
+Leave a value of our own in xmm0 and an x87 register, then yield and copy memory through the SSE2 memcpy over and over.
+Another copy of this thread doing the same with a different value, and the copies themselves, must never show through.
+*/
+__attribute__((__target__("sse2")))
+static void self_test_thread(void *argument) {
+    uint32_t value = 0x5EED0000 | (uint32_t)argument;
+
+    __asm__ volatile ("movd %0, %%xmm0\n\tfildl %1" : : "r"(value), "m"(value) : "xmm0");
+
+    for (uint32_t round = 0; round < FPU_SELF_TEST_ROUNDS; round++) {
+        thread_yield();
+        memcpy(self_test_buffers[(uint32_t)argument], self_test_buffers[(uint32_t)argument ^ 1], FPU_SELF_TEST_COPY_SIZE);
+    }
+
+    uint32_t xmm_value;
+    uint32_t x87_value;
+    __asm__ volatile ("movd %%xmm0, %0\n\tfistpl %1" : "=r"(xmm_value), "=m"(x87_value));
+
+    if (xmm_value != value || x87_value != value) {
+        __atomic_fetch_add(&self_test_failures, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&self_test_finished, 1, __ATOMIC_RELEASE);
+}
+
+/* two threads keep their own x87 and SSE registers across switches, migrations and kernel SSE2 copies */
+bool fpu_self_test() {
+    if (!fpu_available) {
+        return true;
+    }
+
+    self_test_finished = 0;
+    self_test_failures = 0;
+
+    for (uint32_t index = 0; index < 2; index++) {
+        if (!thread_create("fpu test", thread_current()->priority, self_test_thread, (void *)index)) {
+            return false;
+        }
+    }
+
+    while (__atomic_load_n(&self_test_finished, __ATOMIC_ACQUIRE) < 2) {
+        thread_yield();
+    }
+
+    return self_test_failures == 0;
+}
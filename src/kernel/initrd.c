@@ -0,0 +1,311 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kernel/boot.h>
+#include <kernel/initrd.h>
+#include <kernel/kprintf.h>
+#include <kernel/multiboot.h>
+#include <kernel/paging.h>
+#include <kernel/slab.h>
+#include <kernel/trace.h>
+
+#include <klegit/string.h>
+
+#define FNV_OFFSET_BASIS 0x811C9DC5
+#define FNV_PRIME 0x01000193
+#define INITRD_SELF_TEST_ADDRESS 0xE0000000 /* somewhere above the identity map to map files at */
+
+/*
+
+The initrd is a ustar archive loaded as the first multiboot module. It is read where GRUB put it: setup_pmm keeps the
+module's frames back and the identity map already covers them, so a file's data is just a pointer in to the archive.
+
+One pass over the headers at boot builds an array of the regular files and an open addressing hash table over their
+paths, twice as many buckets as files so probe chains stay short. A lookup is then one hash of the path and, nearly
+always, one string compare, rather than a walk over every header in the archive.
+
+*/
+
+bool initrd_present = false;
+struct initrd_statistics initrd_statistics;
+
+static const unsigned char *archive_start;
+static const unsigned char *archive_end;
+
+static struct initrd_file *files;
+static uint32_t *buckets; /* index in to files plus one, 0 for an empty bucket */
+static uint32_t bucket_mask;
+
+/* FNV-1a, stopping at the end of the string */
+static uint32_t hash_path(const char *path) {
+    uint32_t hash = FNV_OFFSET_BASIS;
+
+    for (; *path; path++) {
+        hash = (hash ^ (unsigned char)*path) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/* paths are indexed and looked up without any leading "./" or "/", so all three spellings find the same file */
+static const char *strip_path(const char *path) {
+    while (true) {
+        if (path[0] == '/') {
+            path++;
+        } else if (path[0] == '.' && path[1] == '/') {
+            path += 2;
+        } else {
+            return path;
+        }
+    }
+}
+
+/* tar sizes are octal text, space or NUL terminated */
+static uint32_t parse_octal(const unsigned char *field, size_t length) {
+    uint32_t value = 0;
+
+    for (size_t index = 0; index < length && field[index] >= '0' && field[index] <= '7'; index++) {
+        value = (value << 3) | (field[index] - '0');
+    }
+
+    return value;
+}
+
+static bool is_header(const unsigned char *header) {
+    return header + INITRD_BLOCK_SIZE <= archive_end && memcmp(header + INITRD_TAR_MAGIC, "ustar", 5) == 0;
+}
+
+/* call visit for each header block until the end of archive marker or the end of the module, returning how many there were */
+static uint32_t for_each_header(void (*visit)(const unsigned char *header, uint32_t size)) {
+    uint32_t count = 0;
+
+    for (const unsigned char *header = archive_start; is_header(header);) {
+        uint32_t size = parse_octal(header + INITRD_TAR_SIZE, INITRD_TAR_SIZE_LENGTH);
+
+        if (visit) {
+            visit(header, size);
+        }
+        count++;
+
+        header += INITRD_BLOCK_SIZE + ((size + INITRD_BLOCK_SIZE - 1) & ~(INITRD_BLOCK_SIZE - 1));
+    }
+
+    return count;
+}
+
+/* the name fields aren't terminated when full, so the path is put together in a buffer of its own */
+static char *header_path(const unsigned char *header) {
+    char path[INITRD_PATH_LENGTH + 1];
+    size_t length = 0;
+
+    for (size_t index = 0; index < INITRD_TAR_PREFIX_LENGTH && header[INITRD_TAR_PREFIX + index]; index++) {
+        path[length++] = header[INITRD_TAR_PREFIX + index];
+    }
+    if (length) {
+        path[length++] = '/';
+    }
+    for (size_t index = 0; index < INITRD_TAR_NAME_LENGTH && header[INITRD_TAR_NAME + index]; index++) {
+        path[length++] = header[INITRD_TAR_NAME + index];
+    }
+    path[length] = '\0';
+
+    const char *stripped = strip_path(path);
+    size_t stripped_length = strlen(stripped);
+    char *copy = kmalloc(stripped_length + 1);
+
+    if (copy) {
+        memcpy(copy, stripped, stripped_length + 1);
+    }
+
+    return copy;
+}
+
+static void index_header(const unsigned char *header, uint32_t size) {
+    /* regular files only: old tars write NUL rather than '0' */
+    if (header[INITRD_TAR_TYPE] != '0' && header[INITRD_TAR_TYPE] != '\0') {
+        return;
+    }
+
+    char *path = header_path(header);
+    if (!path) {
+        return;
+    }
+
+    uint32_t index = initrd_statistics.files++;
+    struct initrd_file *file = &files[index];
+
+    file->path = path;
+    file->data = header + INITRD_BLOCK_SIZE;
+    file->size = size;
+    file->hash = hash_path(path);
+    initrd_statistics.bytes += size;
+
+    /* a later copy of the same path in the archive wins, as it would if the archive were unpacked */
+    uint32_t bucket = file->hash & bucket_mask;
+    while (buckets[bucket]) {
+        struct initrd_file *other = &files[buckets[bucket] - 1];
+
+        if (other->hash == file->hash && strcmp(other->path, path) == 0) {
+            break;
+        }
+        bucket = (bucket + 1) & bucket_mask;
+    }
+    buckets[bucket] = index + 1;
+}
+
+/* index the first multiboot module, if there is one and it is a tar archive. needs setup_pmm to have kept it back and setup_slab */
+void setup_initrd(struct multiboot_info *multiboot_info) {
+    TRACE_SCOPE(TRACE_SUBSYSTEM_MEMORY, "setup_initrd");
+
+    if (!(multiboot_info->flags & MULTIBOOT_INFO_MODULES) || multiboot_info->modules_count == 0) {
+        kprintf("initrd: no modules loaded\n");
+        return;
+    }
+
+    struct multiboot_module *module = (struct multiboot_module*)multiboot_info->modules_address;
+    archive_start = (const unsigned char*)module->start;
+    archive_end = (const unsigned char*)module->end;
+
+    if (!is_header(archive_start)) {
+        kprintf("initrd: module at 0x%08x is not a ustar archive\n", module->start);
+        return;
+    }
+
+    /* one pass to size the tables, one to fill them. headers are counted rather than files, which is an overestimate */
+    uint32_t headers = for_each_header(0);
+    if (headers == 0) {
+        kprintf("initrd: the archive is empty\n");
+        return;
+    }
+
+    uint32_t bucket_count = 1;
+    while (bucket_count < headers * 2) {
+        bucket_count <<= 1;
+    }
+
+    files = kmalloc(headers * sizeof(struct initrd_file));
+    buckets = kmalloc(bucket_count * sizeof(uint32_t));
+    if (!files || !buckets) {
+        kprintf("initrd: out of memory for the index of %u entries\n", headers);
+        return;
+    }
+    memset(buckets, 0, bucket_count * sizeof(uint32_t));
+    bucket_mask = bucket_count - 1;
+    initrd_statistics.buckets = bucket_count;
+
+    for_each_header(index_header);
+    initrd_present = true;
+
+    if (!boot_fast) {
+        kprintf("initrd: %u files, %u KB at 0x%08x, served in place\n", initrd_statistics.files, initrd_statistics.bytes >> 10, module->start);
+    }
+}
+
+/* the file at path, or 0 if there isn't one */
+const struct initrd_file *initrd_lookup(const char *path) {
+    if (!initrd_present) {
+        return 0;
+    }
+
+    path = strip_path(path);
+    uint32_t hash = hash_path(path);
+    const struct initrd_file *found = 0;
+    uint32_t probes = 0;
+
+    for (uint32_t bucket = hash & bucket_mask; buckets[bucket]; bucket = (bucket + 1) & bucket_mask) {
+        const struct initrd_file *file = &files[buckets[bucket] - 1];
+
+        probes++;
+        if (file->hash == hash && strcmp(file->path, path) == 0) {
+            found = file;
+            break;
+        }
+    }
+
+    /* the index is read only after boot, so lookups share nothing but these counts, which may drop the odd racing update */
+    initrd_statistics.lookups++;
+    initrd_statistics.probes += probes;
+
+    return found;
+}
+
+/* files in archive order, for listing them. 0 past the end */
+const struct initrd_file *initrd_file(uint32_t index) {
+    return index < initrd_statistics.files ? &files[index] : 0;
+}
+
+/*
+Map a file's pages at the page aligned virtual_address, e.g. read only in to a user address space, and return the
+address its first byte ends up at. The data keeps its offset within the page, which is 0 for archives packed by
+tools/pack-initrd.py, and whatever shares the first and last pages with it is visible too. Returns 0 if the page tables
+couldn't be allocated.
+*/
+uint32_t initrd_map(const struct initrd_file *file, uint32_t virtual_address, uint32_t flags) {
+    uint32_t offset = (uint32_t)file->data & (PAGE_SIZE - 1);
+
+    if (!map_range(virtual_address + offset, (uint32_t)file->data, file->size, flags & ~PAGE_LARGE)) {
+        return 0;
+    }
+
+    return virtual_address + offset;
+}
+
+bool initrd_unmap(const struct initrd_file *file, uint32_t virtual_address) {
+    return unmap_range(virtual_address, ((uint32_t)file->data & (PAGE_SIZE - 1)) + file->size);
+}
+
+void initrd_print_statistics() {
+    if (!initrd_present) {
+        return;
+    }
+
+    uint32_t lookups = initrd_statistics.lookups;
+    uint32_t probes = initrd_statistics.probes;
+
+    kprintf("initrd: %u files in %u buckets, %u lookups, %u.%02u probes each\n", initrd_statistics.files, initrd_statistics.buckets,
+        lookups, lookups ? probes / lookups : 0, lookups ? probes * 100 / lookups % 100 : 0);
+}
+
+/*
+Every file must be found under its own path and under "/" and "./" spellings of it, a path that isn't there must not be,
+and the bytes read through a fresh mapping of each file must be the ones in the archive.
+*/
+bool initrd_self_test() {
+    char path[INITRD_PATH_LENGTH + 3]; /* "./", the path and its terminator */
+
+    if (!initrd_present) {
+        return true;
+    }
+
+    for (uint32_t index = 0; index < initrd_statistics.files; index++) {
+        const struct initrd_file *file = &files[index];
+        const struct initrd_file *found = initrd_lookup(file->path);
+
+        /* the last copy of a path is the one indexed */
+        if (!found || strcmp(found->path, file->path) != 0 || found < file) {
+            kprintf("initrd self-test: %s not found\n", file->path);
+            return false;
+        }
+
+        path[0] = '.';
+        path[1] = '/';
+        memcpy(path + 2, file->path, strlen(file->path) + 1);
+        if (initrd_lookup(path) != found || initrd_lookup(path + 1) != found) {
+            kprintf("initrd self-test: %s not found with a leading / or ./\n", file->path);
+            return false;
+        }
+
+        uint32_t mapped = initrd_map(file, INITRD_SELF_TEST_ADDRESS, 0);
+        bool same = mapped && memcmp((const void*)mapped, file->data, file->size) == 0;
+        if (mapped) {
+            initrd_unmap(file, INITRD_SELF_TEST_ADDRESS);
+        }
+        if (!same) {
+            kprintf("initrd self-test: %s reads differently through a mapping\n", file->path);
+            return false;
+        }
+    }
+
+    return initrd_lookup("initrd self-test: no such file") == 0;
+}
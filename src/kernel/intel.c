@@ -1,38 +1,20 @@
 #include <stdbool.h>
 
+#include <kernel/boot.h>
 #include <kernel/intel.h>
+#include <kernel/interrupts.h>
+#include <kernel/kprintf.h>
+#include <kernel/serial.h>
+#include <kernel/smp.h>
 #include <kernel/terminal.h>
+#include <kernel/trace.h>
 
 #include <klegit/string.h>
 
-#define GDT_ENTRY_COUNT 6
 #define IDT_ENTRY_COUNT 256
 
-#define START_INTERRUPT_LABEL(interrupt_number)\
-__asm__ goto ( \
-    "mov $%l1, %%eax\n\t" \
-    "mov %%eax, (%%ebx)" \
-    : \
-    : "b"(&handlers[interrupt_number]) \
-    : "memory", "eax" \
-    : start_of_interrupt_handler##interrupt_number \
-); \
-__asm__ goto ( \
-    "jmp $0x8, $%l0" \
-    : \
-    : \
-    : \
-    : end_of_interrupt_handler##interrupt_number \
-); \
-start_of_interrupt_handler##interrupt_number:
-
-#define END_INTERRUPT_LABEL(interrupt_number)\
-end_of_interrupt_handler##interrupt_number:
-
-struct gdt_entry_struct gdt_entries[GDT_ENTRY_COUNT];
+/* one IDT shared by every CPU. the GDT and TSS are per CPU, in struct cpu */
 struct idt_entry_struct idt_entries[IDT_ENTRY_COUNT];
-struct tss_struct tss;
-struct gdt_pointer_struct gdt;
 struct idt_pointer_struct idt;
 
 /* bochs magic breakpoint */
@@ -45,18 +27,98 @@ void outb(unsigned int port, unsigned char byte) {
    __asm__ volatile ("outb %%al, %%dx" : : "d" (port), "a" (byte));
 }
 
+/* read a byte from an IO port */
+unsigned char inb(unsigned int port) {
+    unsigned char byte;
+    __asm__ volatile ("inb %%dx, %%al" : "=a" (byte) : "d" (port));
+    return byte;
+}
+
+/* read and write model specific registers */
+uint64_t read_msr(uint32_t msr) {
+    uint32_t low, high;
+    __asm__ volatile ("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((uint64_t)high << 32) | low;
+}
+
+void write_msr(uint32_t msr, uint64_t value) {
+    __asm__ volatile ("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+/* execute cpuid for the given leaf */
+void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    __asm__ volatile ("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+/* test one of the leaf 1 edx feature bits */
+bool cpu_has_feature(uint32_t edx_feature_bit) {
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+
+    return (edx & edx_feature_bit) != 0;
+}
+
+uint32_t read_cr0() {
+    uint32_t value;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+/* the address a page fault was raised for */
+uint32_t read_cr2() {
+    uint32_t value;
+    __asm__ volatile ("mov %%cr2, %0" : "=r"(value));
+    return value;
+}
+
+uint32_t read_cr3() {
+    uint32_t value;
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(value));
+    return value;
+}
+
+uint32_t read_cr4() {
+    uint32_t value;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+void write_cr0(uint32_t value) {
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(value) : "memory");
+}
+
+void write_cr4(uint32_t value) {
+    __asm__ volatile ("mov %0, %%cr4" : : "r"(value) : "memory");
+}
+
 /* halt the CPU in a way that hopefully doesn't cause it to catch fire */
 void halt() {
-    terminal_write("Halting CPU.");
-
+    /* interrupts go off first so the sinks push the message out synchronously */
     __asm__ volatile ("cli");
 
+    kprintf("Halting CPU.");
+
     /* call hlt forever. the first call should halt the CPU indefinitely as interrupts are off, but just in case... */
     while (true) {
         __asm__ volatile ("hlt");
     }
 }
 
+/*
+Power off qemu through its isa-debug-exit device (-device isa-debug-exit,iobase=0xf4,iosize=0x04), which makes qemu
+exit with (status << 1) | 1. Serial output is drained first so nothing is lost. Without the device this just halts.
+*/
+void qemu_exit(uint8_t status) {
+    __asm__ volatile ("cli");
+
+    kprintf("Exiting with status %u.\n", status);
+    serial_wait_idle();
+    outb(QEMU_EXIT_PORT, status);
+
+    halt();
+}
+
 /* build and return a GDT entry with the given base_address, limit_address, access and granularity flags */
 struct gdt_entry_struct gdt_entry(uint32_t base_address, uint32_t limit_address, uint8_t access_flags, uint8_t granularity_flags) {
     struct gdt_entry_struct entry;
@@ -126,43 +188,68 @@ struct idt_entry_struct idt_entry(uint32_t offset, uint16_t code_selector, uint8
     return entry;
 }
 
+/* point every vector at its stub from interrupts.S, remap the PICs and load the IDT. interrupts stay off */
 void setup_idt() {
-    uint32_t handlers[IDT_ENTRY_COUNT];
+    TRACE_SCOPE(TRACE_SUBSYSTEM_CPU, "setup_idt");
 
     idt.limit = sizeof(struct idt_entry_struct) * IDT_ENTRY_COUNT - 1;
     idt.base = (uint32_t)&idt_entries;
-    memset(&idt_entries, 0, sizeof(idt_entries));
 
-    START_INTERRUPT_LABEL(128);
-        terminal_write("Syscall interrupt fired.\n");
-        bochs_break();
-    END_INTERRUPT_LABEL(128);
+    setup_pic();
 
-    /* software interrupts */
-    idt_entries[0x80] = idt_entry(handlers[0x80], 0x8, 0xe);
+    for (unsigned int vector = 0; vector < IDT_ENTRY_COUNT; vector++) {
+        idt_entries[vector] = idt_entry(interrupt_stub_table[vector], 0x8, 0xe);
+    }
 
-    terminal_write("This IDT was built (first 8 entries):\n");
-    terminal_hexdump(idt_entries, sizeof(struct idt_entry_struct) * 8);
+    /* software interrupts, the handler is registered by setup_syscalls */
+    idt_entries[INTERRUPT_VECTOR_SYSCALL] = idt_entry(interrupt_stub_table[INTERRUPT_VECTOR_SYSCALL], 0x8, 0x6e); /* DPL 3 */
+
+    if (!boot_fast) {
+        kprintf("This IDT was built (first 8 entries):\n");
+        terminal_hexdump(idt_entries, sizeof(struct idt_entry_struct) * 8);
+    }
 
     switch_to_idt(&idt);
+}
 
-    terminal_write("Calling test interrupt...\n");
-    __asm__ volatile (
-        "int $0x80"
-    );     
+/* load the shared IDT on this CPU, for application processors once the boot CPU has built it */
+void load_idt() {
+    switch_to_idt(&idt);
 }
 
-void setup_gdt() {
-    gdt.limit = sizeof(struct gdt_entry_struct) * GDT_ENTRY_COUNT - 1;
-    gdt.base = (uint32_t)&gdt_entries;
+/*
+Build a GDT and TSS in the given tables and load them on this CPU. %gs is left pointing at per_cpu_data through its own
+descriptor, which is what this_cpu_read and this_cpu_write go through. %fs stays flat.
+*/
+void load_cpu_tables(struct cpu_tables *tables, void *per_cpu_data, uint32_t per_cpu_size) {
+    tables->gdt.limit = sizeof(struct gdt_entry_struct) * GDT_ENTRY_COUNT - 1;
+    tables->gdt.base = (uint32_t)&tables->gdt_entries;
 
     /* construct a basic GDT which maps all of memory */
-    gdt_entries[0] = gdt_entry(0, 0, 0, 0);
-    gdt_entries[1] = gdt_entry(0, 0xFFFFFFFF, 0x9A, 0xC0); /* ring 0 code segment */
-    gdt_entries[2] = gdt_entry(0, 0xFFFFFFFF, 0x92, 0xC0); /* ring 0 data segment */
-    gdt_entries[3] = gdt_entry(0, 0xFFFFFFFF, 0xFA, 0xC0); /* ring 3 code segment */
-    gdt_entries[4] = gdt_entry(0, 0xFFFFFFFF, 0xF2, 0xC0); /* ring 3 code segment */
-    gdt_entries[5] = gdt_entry((uint32_t)&tss, sizeof(tss), 0x89, 0xC0); /* TSS for later multitasking */
-
-    switch_to_gdt(&gdt);
+    tables->gdt_entries[0] = gdt_entry(0, 0, 0, 0);
+    tables->gdt_entries[1] = gdt_entry(0, 0xFFFFFFFF, 0x9A, 0xC0); /* ring 0 code segment */
+    tables->gdt_entries[2] = gdt_entry(0, 0xFFFFFFFF, 0x92, 0xC0); /* ring 0 data segment */
+    tables->gdt_entries[3] = gdt_entry(0, 0xFFFFFFFF, 0xFA, 0xC0); /* ring 3 code segment */
+    tables->gdt_entries[4] = gdt_entry(0, 0xFFFFFFFF, 0xF2, 0xC0); /* ring 3 code segment */
+    tables->gdt_entries[5] = gdt_entry((uint32_t)&tables->tss, sizeof(tables->tss) - 1, 0x89, 0x00); /* TSS, only used for the ring 0 stack on entry from ring 3 */
+    tables->gdt_entries[6] = gdt_entry((uint32_t)per_cpu_data, per_cpu_size - 1, 0x92, 0x40); /* ring 0 data segment over the per-CPU block, byte granular */
+
+    /* no I/O permission bitmap: the offset points past the end of the TSS */
+    tables->tss.ss0 = 0x10;
+    tables->tss.iomap = sizeof(tables->tss);
+
+    switch_to_gdt(&tables->gdt);
+
+    __asm__ volatile ("ltr %w0" : : "r"(GDT_TSS_SELECTOR));
+    __asm__ volatile ("movw %w0, %%gs" : : "r"(GDT_PER_CPU_SELECTOR) : "memory");
+}
+
+/* the boot CPU's tables. this_cpu() works from here on */
+void setup_gdt() {
+    TRACE_SCOPE(TRACE_SUBSYSTEM_CPU, "setup_gdt");
+
+    cpus[0].self = &cpus[0];
+    load_cpu_tables(&cpus[0].tables, &cpus[0], sizeof(cpus[0]));
+    cpus[0].online = true; /* ap_main does this for the others */
+    kprintf_enable_locking();
 }
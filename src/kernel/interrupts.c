@@ -0,0 +1,189 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kernel/interrupts.h>
+#include <kernel/intel.h>
+#include <kernel/klog.h>
+#include <kernel/kprintf.h>
+#include <kernel/lapic.h>
+#include <kernel/smp.h>
+#include <kernel/thread.h>
+#include <kernel/tsc.h>
+
+/* 8259 PIC ports and commands */
+#define PIC_MASTER_COMMAND 0x20
+#define PIC_MASTER_DATA 0x21
+#define PIC_SLAVE_COMMAND 0xA0
+#define PIC_SLAVE_DATA 0xA1
+
+#define PIC_ICW1_INIT_WITH_ICW4 0x11
+#define PIC_ICW4_8086 0x01
+#define PIC_CASCADE_IRQ 2
+#define PIC_READ_IN_SERVICE 0x0B
+#define PIC_END_OF_INTERRUPT 0x20
+
+#define PIC_SPURIOUS_IRQ 7 /* the lowest priority line on each PIC, raised when an IRQ goes away before it is acknowledged */
+
+static const char *exception_names[INTERRUPT_EXCEPTION_COUNT] = {
+    "divide error", "debug", "non-maskable interrupt", "breakpoint", "overflow", "bound range exceeded",
+    "invalid opcode", "device not available", "double fault", "coprocessor segment overrun", "invalid TSS",
+    "segment not present", "stack-segment fault", "general protection fault", "page fault", "reserved",
+    "x87 floating point error", "alignment check", "machine check", "SIMD floating point error", "virtualisation",
+    "control protection", "reserved", "reserved", "reserved", "reserved", "reserved", "reserved",
+    "hypervisor injection", "VMM communication", "security exception", "reserved"
+};
+
+static interrupt_handler handlers[INTERRUPT_VECTOR_COUNT];
+/* per CPU, each only updated by its own CPU with interrupts off, and summed by interrupt_get_statistics */
+static struct interrupt_statistics statistics[SMP_MAX_CPUS][INTERRUPT_VECTOR_COUNT];
+
+/* all lines start masked, registering a handler for an IRQ vector unmasks it */
+static uint16_t irq_mask = 0xFFFF & ~(1 << PIC_CASCADE_IRQ);
+
+static void pic_write_mask() {
+    outb(PIC_MASTER_DATA, irq_mask & 0xFF);
+    outb(PIC_SLAVE_DATA, (irq_mask >> 8) & 0xFF);
+}
+
+/* move the PICs off vectors 0x08-0x0F, where the BIOS left them on top of the CPU exceptions */
+void setup_pic() {
+    outb(PIC_MASTER_COMMAND, PIC_ICW1_INIT_WITH_ICW4);
+    outb(PIC_SLAVE_COMMAND, PIC_ICW1_INIT_WITH_ICW4);
+    outb(PIC_MASTER_DATA, IRQ_BASE_VECTOR);
+    outb(PIC_SLAVE_DATA, IRQ_BASE_VECTOR + 8);
+    outb(PIC_MASTER_DATA, 1 << PIC_CASCADE_IRQ); /* the slave hangs off this line */
+    outb(PIC_SLAVE_DATA, PIC_CASCADE_IRQ); /* and this is its cascade identity */
+    outb(PIC_MASTER_DATA, PIC_ICW4_8086);
+    outb(PIC_SLAVE_DATA, PIC_ICW4_8086);
+
+    pic_write_mask();
+}
+
+/* route a vector to a handler, or pass 0 to remove it. IRQ lines are unmasked and masked to match */
+void register_interrupt_handler(uint8_t vector, interrupt_handler handler) {
+    uint32_t flags = interrupts_save_disable();
+
+    handlers[vector] = handler;
+
+    if (vector >= IRQ_BASE_VECTOR && vector < IRQ_BASE_VECTOR + IRQ_COUNT) {
+        uint8_t irq = vector - IRQ_BASE_VECTOR;
+
+        if (handler) {
+            irq_mask &= ~(1 << irq);
+        } else {
+            irq_mask |= 1 << irq;
+        }
+        pic_write_mask();
+    }
+
+    interrupts_restore(flags);
+}
+
+/* a line 7 interrupt with no bit set in the PIC's in-service register was spurious and must not be acknowledged */
+static bool irq_is_spurious(uint8_t irq) {
+    if ((irq & 7) != PIC_SPURIOUS_IRQ) {
+        return false;
+    }
+
+    unsigned int command_port = irq < 8 ? PIC_MASTER_COMMAND : PIC_SLAVE_COMMAND;
+    outb(command_port, PIC_READ_IN_SERVICE);
+    if (inb(command_port) & (1 << PIC_SPURIOUS_IRQ)) {
+        return false;
+    }
+
+    /* the master did see the cascade line from a spurious slave interrupt, so it still needs its EOI */
+    if (irq >= 8) {
+        outb(PIC_MASTER_COMMAND, PIC_END_OF_INTERRUPT);
+    }
+    return true;
+}
+
+static void irq_end_of_interrupt(uint8_t irq) {
+    if (irq >= 8) {
+        outb(PIC_SLAVE_COMMAND, PIC_END_OF_INTERRUPT);
+    }
+    outb(PIC_MASTER_COMMAND, PIC_END_OF_INTERRUPT);
+}
+
+/* print the registers and halt. also the last resort of handlers for exceptions they can only sometimes deal with */
+void unhandled_exception(struct interrupt_frame *frame) {
+    kprintf("\nUnhandled exception 0x%02x (%s), error code 0x%x\n", frame->vector, exception_names[frame->vector], frame->error_code);
+    kprintf("eip 0x%08x cs 0x%04x eflags 0x%08x\n", frame->eip, frame->cs, frame->eflags);
+    kprintf("eax 0x%08x ebx 0x%08x ecx 0x%08x edx 0x%08x\n", frame->eax, frame->ebx, frame->ecx, frame->edx);
+    kprintf("esi 0x%08x edi 0x%08x ebp 0x%08x\n", frame->esi, frame->edi, frame->ebp);
+    halt();
+}
+
+/* called from interrupt_common in interrupts.S with interrupts off. entry_timestamp was read just after the registers were saved */
+void interrupt_dispatch(struct interrupt_frame *frame, uint64_t entry_timestamp) {
+    uint8_t vector = frame->vector;
+    bool is_irq = vector >= IRQ_BASE_VECTOR && vector < IRQ_BASE_VECTOR + IRQ_COUNT;
+    bool is_lapic = vector >= LAPIC_FIRST_VECTOR && vector != INTERRUPT_VECTOR_LAPIC_SPURIOUS;
+
+    if (is_irq && irq_is_spurious(vector - IRQ_BASE_VECTOR)) {
+        return;
+    }
+
+    if (handlers[vector]) {
+        handlers[vector](frame);
+    } else if (vector < INTERRUPT_EXCEPTION_COUNT) {
+        unhandled_exception(frame);
+    } else {
+        klog(KLOG_WARNING, "Unhandled interrupt 0x%02x.\n", vector);
+    }
+
+    if (is_irq) {
+        irq_end_of_interrupt(vector - IRQ_BASE_VECTOR);
+    } else if (is_lapic) {
+        lapic_end_of_interrupt();
+    }
+
+    uint32_t cycles = read_tsc() - entry_timestamp;
+    struct interrupt_statistics *vector_statistics = &statistics[this_cpu_read(index)][vector];
+    vector_statistics->count++;
+    vector_statistics->total_cycles += cycles;
+    if (cycles > vector_statistics->maximum_cycles) {
+        vector_statistics->maximum_cycles = cycles;
+    }
+
+    /* only once the interrupt is acknowledged, as the next thread may run for a long time before this one resumes */
+    if (is_irq || is_lapic) {
+        thread_preempt();
+    }
+}
+
+/* the totals for a vector across every CPU, the maximum being the largest of any one */
+struct interrupt_statistics interrupt_get_statistics(uint8_t vector) {
+    struct interrupt_statistics total = {0, 0, 0};
+
+    uint32_t flags = interrupts_save_disable();
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        struct interrupt_statistics *cpu_statistics = &statistics[cpu][vector];
+        total.count += cpu_statistics->count;
+        total.total_cycles += cpu_statistics->total_cycles;
+        if (cpu_statistics->maximum_cycles > total.maximum_cycles) {
+            total.maximum_cycles = cpu_statistics->maximum_cycles;
+        }
+    }
+    interrupts_restore(flags);
+
+    return total;
+}
+
+/* hit count and time spent between the stub saving registers and the dispatcher returning, for every vector seen so far */
+void interrupt_print_statistics() {
+    kprintf_begin_batch();
+    kprintf("Interrupts: vector, hits, average cycles, maximum cycles\n");
+
+    for (unsigned int vector = 0; vector < INTERRUPT_VECTOR_COUNT; vector++) {
+        struct interrupt_statistics vector_statistics = interrupt_get_statistics(vector);
+
+        if (vector_statistics.count) {
+            kprintf("  0x%02x %10u %10u %10u\n", vector, vector_statistics.count,
+                tsc_average_cycles(vector_statistics.total_cycles, vector_statistics.count), vector_statistics.maximum_cycles);
+        }
+    }
+
+    kprintf_end_batch();
+}
@@ -0,0 +1,453 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kernel/initrd.h>
+#include <kernel/ipc.h>
+#include <kernel/kprintf.h>
+#include <kernel/paging.h>
+#include <kernel/pmm.h>
+#include <kernel/process.h>
+#include <kernel/slab.h>
+#include <kernel/spinlock.h>
+#include <kernel/syscall.h>
+
+#include <klegit/string.h>
+
+/*
+
+Message channels between processes, and kernel threads for register messages.
+
+A channel is a fixed ring of messages in the kernel. Sends fail when it is full and receives when it is empty, rather
+than waiting, as a process runs to its exit and can't be put to sleep. There are three kinds of message:
+
+Register messages are two words which travel in registers on the way in and on the way out: SYSCALL_SEND_SHORT takes
+them in esi and edi, and SYSCALL_RECEIVE_SHORT hands them back in the same registers. No user memory is touched, so
+the cost is the system call entry and exit and the queue.
+
+Copied messages are copied a page at a time in to frames of the kernel's by SYSCALL_SEND_COPY, and out of them again
+by the receive, the same as a pipe would.
+
+Page messages move the sender's pages themselves. SYSCALL_SEND_PAGES takes a share of every page in a page aligned
+buffer, as a fork does, and the receive maps them in to the receiver's buffer copy on write, replacing what was there.
+Nothing is copied unless one side writes to a page while the other still has it, and then only that page. The sender
+sees whole pages, so the rest of the last page goes too. A receive buffer which isn't page aligned gets a copy.
+
+User buffers are read and written through the identity map to their frames, see process_read and process_write, so a
+bad address in a system call fails the call instead of faulting in the kernel. Locks are taken in the order ipc_lock,
+process_lock, then the PMM's.
+
+*/
+
+struct ipc_statistics ipc_statistics;
+
+/* guards the channels */
+static LOCK_STATISTICS(ipc_lock_statistics, "ipc");
+static struct spinlock ipc_lock = SPINLOCK_INIT_WITH_STATISTICS(&ipc_lock_statistics);
+
+static struct ipc_channel channels[IPC_CHANNEL_COUNT];
+
+static inline uint32_t pages_for(uint32_t length) {
+    return (length + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+/* give back whatever a message holds. its frames for a copied message, its page shares for a page message */
+static void free_message(struct ipc_message *message) {
+    if (message->kind == IPC_MESSAGE_COPY) {
+        for (uint32_t index = 0; index < message->page_count; index++) {
+            pmm_free_frame(message->pages[index]);
+        }
+    } else if (message->kind == IPC_MESSAGE_PAGES) {
+        process_release_pages(message->pages, message->page_count);
+    }
+
+    kfree(message->pages);
+    message->pages = 0;
+}
+
+/* a channel with an empty queue, or IPC_ERROR_CHANNEL if all of them are open */
+uint32_t ipc_channel_open() {
+    uint32_t flags = spinlock_acquire_irqsave(&ipc_lock);
+
+    for (uint32_t channel = 0; channel < IPC_CHANNEL_COUNT; channel++) {
+        if (!channels[channel].open) {
+            memset(&channels[channel], 0, sizeof(struct ipc_channel));
+            channels[channel].open = true;
+            spinlock_release_irqrestore(&ipc_lock, flags);
+            return channel;
+        }
+    }
+
+    spinlock_release_irqrestore(&ipc_lock, flags);
+    return IPC_ERROR_CHANNEL;
+}
+
+/* close a channel, dropping any messages still queued on it */
+void ipc_channel_close(uint32_t channel) {
+    if (channel >= IPC_CHANNEL_COUNT) {
+        return;
+    }
+
+    uint32_t flags = spinlock_acquire_irqsave(&ipc_lock);
+    struct ipc_channel *queue = &channels[channel];
+
+    for (; queue->count; queue->count--) {
+        free_message(&queue->messages[queue->head]);
+        queue->head = (queue->head + 1) % IPC_CHANNEL_CAPACITY;
+    }
+    queue->open = false;
+
+    spinlock_release_irqrestore(&ipc_lock, flags);
+}
+
+/* whether a send could go through now, so work isn't done for a message which has nowhere to go */
+static uint32_t check_room(uint32_t channel) {
+    if (channel >= IPC_CHANNEL_COUNT || !channels[channel].open) {
+        return IPC_ERROR_CHANNEL;
+    }
+
+    return channels[channel].count == IPC_CHANNEL_CAPACITY ? IPC_ERROR_FULL : 0;
+}
+
+/* put a message on the end of a channel's queue. the channel owns whatever it holds if this returns 0 */
+static uint32_t enqueue(uint32_t channel, const struct ipc_message *message) {
+    if (channel >= IPC_CHANNEL_COUNT) {
+        return IPC_ERROR_CHANNEL;
+    }
+
+    uint32_t flags = spinlock_acquire_irqsave(&ipc_lock);
+    uint32_t result = check_room(channel);
+
+    if (result == 0) {
+        struct ipc_channel *queue = &channels[channel];
+
+        queue->messages[(queue->head + queue->count) % IPC_CHANNEL_CAPACITY] = *message;
+        queue->count++;
+
+        if (message->kind == IPC_MESSAGE_SHORT) {
+            ipc_statistics.short_messages++;
+        } else if (message->kind == IPC_MESSAGE_COPY) {
+            ipc_statistics.copied_messages++;
+        } else {
+            ipc_statistics.page_messages++;
+        }
+    }
+
+    spinlock_release_irqrestore(&ipc_lock, flags);
+
+    return result;
+}
+
+/* take the message at the head of a channel's queue if it fits in capacity bytes, and if short_only is set, is a register message */
+static uint32_t dequeue(uint32_t channel, struct ipc_message *message, bool short_only, uint32_t capacity) {
+    if (channel >= IPC_CHANNEL_COUNT) {
+        return IPC_ERROR_CHANNEL;
+    }
+
+    uint32_t flags = spinlock_acquire_irqsave(&ipc_lock);
+    struct ipc_channel *queue = &channels[channel];
+    uint32_t result = 0;
+
+    if (!queue->open) {
+        result = IPC_ERROR_CHANNEL;
+    } else if (queue->count == 0) {
+        result = IPC_ERROR_EMPTY;
+    } else if ((short_only && queue->messages[queue->head].kind != IPC_MESSAGE_SHORT) || queue->messages[queue->head].length > capacity) {
+        result = IPC_ERROR_SIZE;
+    } else {
+        *message = queue->messages[queue->head];
+        queue->head = (queue->head + 1) % IPC_CHANNEL_CAPACITY;
+        queue->count--;
+    }
+
+    spinlock_release_irqrestore(&ipc_lock, flags);
+
+    return result;
+}
+
+/* put a message which couldn't be delivered back at the head of its queue, or drop it if the queue has gone or filled up */
+static void requeue(uint32_t channel, struct ipc_message *message) {
+    uint32_t flags = spinlock_acquire_irqsave(&ipc_lock);
+    struct ipc_channel *queue = &channels[channel];
+
+    if (queue->open && queue->count < IPC_CHANNEL_CAPACITY) {
+        queue->head = (queue->head + IPC_CHANNEL_CAPACITY - 1) % IPC_CHANNEL_CAPACITY;
+        queue->messages[queue->head] = *message;
+        queue->count++;
+        message = 0;
+    }
+
+    spinlock_release_irqrestore(&ipc_lock, flags);
+
+    if (message) {
+        free_message(message);
+    }
+}
+
+uint32_t ipc_send_short(uint32_t channel, uint32_t first, uint32_t second) {
+    struct ipc_message message = { .kind = IPC_MESSAGE_SHORT, .length = IPC_SHORT_LENGTH, .words = { first, second } };
+
+    return enqueue(channel, &message);
+}
+
+uint32_t ipc_receive_short(uint32_t channel, uint32_t *first, uint32_t *second) {
+    struct ipc_message message;
+    uint32_t result = dequeue(channel, &message, true, IPC_SHORT_LENGTH);
+
+    if (result == 0) {
+        *first = message.words[0];
+        *second = message.words[1];
+    }
+
+    return result;
+}
+
+uint32_t ipc_syscall_send_short(struct syscall_registers *registers) {
+    return ipc_send_short(registers->ebx, registers->esi, registers->edi);
+}
+
+uint32_t ipc_syscall_receive_short(struct syscall_registers *registers) {
+    return ipc_receive_short(registers->ebx, &registers->esi, &registers->edi);
+}
+
+/* channel in ebx, buffer address in esi, length in edi */
+uint32_t ipc_syscall_send_copy(struct syscall_registers *registers) {
+    struct process *process = process_current();
+    uint32_t address = registers->esi;
+    uint32_t length = registers->edi;
+
+    if (!process) {
+        return IPC_ERROR_ADDRESS;
+    }
+    if (length > IPC_MAXIMUM_PAGES * PAGE_SIZE) {
+        return IPC_ERROR_SIZE;
+    }
+    uint32_t result = check_room(registers->ebx);
+    if (result) {
+        return result;
+    }
+
+    struct ipc_message message = { .kind = IPC_MESSAGE_COPY, .length = length };
+    uint32_t page_count = pages_for(length);
+
+    message.pages = page_count ? kmalloc(page_count * sizeof(uint32_t)) : 0;
+    if (page_count && !message.pages) {
+        return IPC_ERROR_MEMORY;
+    }
+
+    for (; message.page_count < page_count; message.page_count++) {
+        uint32_t offset = message.page_count * PAGE_SIZE;
+        physical_address frame = pmm_alloc_frame();
+
+        if (!frame) {
+            result = IPC_ERROR_MEMORY;
+            break;
+        }
+        message.pages[message.page_count] = frame;
+
+        if (!process_read(process, address + offset, (void*)frame, length - offset < PAGE_SIZE ? length - offset : PAGE_SIZE)) {
+            message.page_count++;
+            result = IPC_ERROR_ADDRESS;
+            break;
+        }
+    }
+
+    if (result == 0) {
+        result = enqueue(registers->ebx, &message);
+    }
+    if (result) {
+        free_message(&message);
+    } else {
+        __atomic_fetch_add(&ipc_statistics.bytes_copied, length, __ATOMIC_RELAXED);
+    }
+
+    return result;
+}
+
+/* channel in ebx, page aligned buffer address in esi, length in edi */
+uint32_t ipc_syscall_send_pages(struct syscall_registers *registers) {
+    struct process *process = process_current();
+    uint32_t address = registers->esi;
+    uint32_t length = registers->edi;
+
+    if (!process || (address & (PAGE_SIZE - 1))) {
+        return IPC_ERROR_ADDRESS;
+    }
+    if (length > IPC_MAXIMUM_PAGES * PAGE_SIZE) {
+        return IPC_ERROR_SIZE;
+    }
+    uint32_t result = check_room(registers->ebx);
+    if (result) {
+        return result;
+    }
+
+    struct ipc_message message = { .kind = IPC_MESSAGE_PAGES, .length = length, .page_count = pages_for(length) };
+
+    if (message.page_count) {
+        message.pages = kmalloc(message.page_count * sizeof(uint32_t));
+        if (!message.pages) {
+            return IPC_ERROR_MEMORY;
+        }
+        if (!process_share_pages(process, address, message.page_count, message.pages)) {
+            kfree(message.pages);
+            return IPC_ERROR_ADDRESS;
+        }
+    }
+
+    result = enqueue(registers->ebx, &message);
+    if (result) {
+        free_message(&message);
+    }
+
+    return result;
+}
+
+/* copy a copied or page message's data out of its frames in to a process's buffer */
+static bool copy_out(struct process *process, uint32_t address, const struct ipc_message *message) {
+    for (uint32_t index = 0; index < message->page_count; index++) {
+        uint32_t offset = index * PAGE_SIZE;
+        uint32_t chunk = message->length - offset < PAGE_SIZE ? message->length - offset : PAGE_SIZE;
+
+        if (!process_write(process, address + offset, (const void*)(message->pages[index] & ~PAGE_FLAGS_MASK), chunk)) {
+            return false;
+        }
+    }
+
+    __atomic_fetch_add(&ipc_statistics.bytes_copied, message->length, __ATOMIC_RELAXED);
+    return true;
+}
+
+/* channel in ebx, buffer address in esi, capacity in edi. returns the message's length */
+uint32_t ipc_syscall_receive(struct syscall_registers *registers) {
+    struct process *process = process_current();
+    uint32_t address = registers->esi;
+    uint32_t capacity = registers->edi;
+    struct ipc_message message;
+
+    if (!process) {
+        return IPC_ERROR_ADDRESS;
+    }
+    uint32_t result = dequeue(registers->ebx, &message, false, capacity);
+    if (result) {
+        return result;
+    }
+
+    bool delivered;
+    if (message.kind == IPC_MESSAGE_SHORT) {
+        delivered = process_write(process, address, message.words, IPC_SHORT_LENGTH);
+    } else if (message.kind == IPC_MESSAGE_PAGES && !(address & (PAGE_SIZE - 1)) && capacity / PAGE_SIZE >= message.page_count &&
+        process_map_pages(process, address, message.page_count, message.pages)) {
+        /* the shares now belong to the receiver's page tables */
+        __atomic_fetch_add(&ipc_statistics.pages_mapped, message.page_count, __ATOMIC_RELAXED);
+        message.page_count = 0;
+        delivered = true;
+    } else {
+        delivered = copy_out(process, address, &message);
+    }
+
+    if (!delivered) {
+        requeue(registers->ebx, &message);
+        return IPC_ERROR_ADDRESS;
+    }
+
+    uint32_t length = message.length;
+    free_message(&message);
+
+    return length;
+}
+
+void ipc_print_statistics() {
+    kprintf("ipc: %u register, %u copied and %u page messages, %u KB copied, %u pages mapped\n",
+        ipc_statistics.short_messages, ipc_statistics.copied_messages, ipc_statistics.page_messages, ipc_statistics.bytes_copied >> 10,
+        ipc_statistics.pages_mapped);
+}
+
+/*
+Run the IPC test program twice on the channel in argument, once to send IPC_TEST_MESSAGES messages and once to receive
+them, each in a fresh process. Returns false if either side failed, otherwise the cycles each side's loop took.
+*/
+bool ipc_run_test(uint32_t argument, uint32_t *send_cycles, uint32_t *receive_cycles) {
+    struct process *sender = process_spawn(IPC_TEST_PATH);
+    struct process *receiver = process_spawn(IPC_TEST_PATH);
+    bool passed = sender && receiver;
+
+    if (syscall_sysenter_available()) {
+        argument |= IPC_TEST_SYSENTER;
+    }
+
+    if (passed) {
+        *send_cycles = process_run(sender, argument | IPC_TEST_SEND);
+        *receive_cycles = process_run(receiver, argument & ~IPC_TEST_SEND);
+        passed = *send_cycles != IPC_TEST_FAILED && *receive_cycles != IPC_TEST_FAILED;
+    }
+
+    if (sender) {
+        process_destroy(sender);
+    }
+    if (receiver) {
+        process_destroy(receiver);
+    }
+
+    return passed;
+}
+
+/*
+Register messages from the kernel must come out in order and fill the channel at IPC_CHANNEL_CAPACITY. Then the test
+program sends and receives each kind of message between two processes, checking what arrives, and page messages must
+get there without a single page being copied. Once the processes are gone every frame they took must be back.
+*/
+bool ipc_self_test() {
+    uint32_t channel = ipc_channel_open();
+    uint32_t first, second;
+    bool passed = true;
+
+    if (channel >= IPC_ERROR_FIRST) {
+        kprintf("ipc self-test: no free channel\n");
+        return false;
+    }
+
+    for (uint32_t index = 0; index < IPC_CHANNEL_CAPACITY; index++) {
+        passed &= ipc_send_short(channel, index, ~index) == 0;
+    }
+    passed &= ipc_send_short(channel, 0, 0) == IPC_ERROR_FULL;
+    for (uint32_t index = 0; index < IPC_CHANNEL_CAPACITY; index++) {
+        passed &= ipc_receive_short(channel, &first, &second) == 0 && first == index && second == ~index;
+    }
+    passed &= ipc_receive_short(channel, &first, &second) == IPC_ERROR_EMPTY;
+    if (!passed) {
+        kprintf("ipc self-test: register messages from the kernel went wrong\n");
+    }
+
+    if (initrd_lookup(IPC_TEST_PATH)) {
+        uint32_t owned_before = process_statistics.owned_frames;
+        uint32_t send_cycles, receive_cycles;
+
+        if (!ipc_run_test(IPC_TEST_CHANNEL(channel) | IPC_TEST_SHORT, &send_cycles, &receive_cycles)) {
+            kprintf("ipc self-test: register messages between processes went wrong\n");
+            passed = false;
+        }
+        if (!ipc_run_test(IPC_TEST_CHANNEL(channel) | IPC_TEST_COPY | IPC_TEST_PAGES(4), &send_cycles, &receive_cycles)) {
+            kprintf("ipc self-test: copied messages went wrong\n");
+            passed = false;
+        }
+
+        uint32_t copied_before = process_statistics.pages_copied;
+        if (!ipc_run_test(IPC_TEST_CHANNEL(channel) | IPC_TEST_PAGES(4), &send_cycles, &receive_cycles)) {
+            kprintf("ipc self-test: page messages went wrong\n");
+            passed = false;
+        }
+        if (process_statistics.pages_copied != copied_before) {
+            kprintf("ipc self-test: page messages copied %u pages\n", process_statistics.pages_copied - copied_before);
+            passed = false;
+        }
+
+        if (process_statistics.owned_frames != owned_before) {
+            kprintf("ipc self-test: %u frames not given back\n", process_statistics.owned_frames - owned_before);
+            passed = false;
+        }
+    }
+
+    ipc_channel_close(channel);
+
+    return passed;
+}
@@ -0,0 +1,93 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kernel/intel.h>
+#include <kernel/klog.h>
+#include <kernel/kprintf.h>
+
+static struct klog_entry entries[KLOG_ENTRY_COUNT];
+
+/* next sequence number to hand out, and the next one the drain will print */
+static uint32_t head = 0;
+static uint32_t tail = 0;
+
+/* records below this level are dropped when draining rather than printed */
+uint8_t klog_console_level = KLOG_INFO;
+
+static char *level_names[] = {"debug", "info", "warning", "error"};
+
+/*
+Claim a slot with a single atomic increment and fill it in. There is no lock, so an interrupt handler which logs while
+another record is half written simply claims the next slot. When the ring is full the oldest records are overwritten.
+*/
+void klog_record(uint8_t level, uint32_t argument_count, char *format, ...) {
+    uint32_t sequence = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    struct klog_entry *entry = &entries[sequence & (KLOG_ENTRY_COUNT - 1)];
+    va_list arguments;
+
+    /* mark the slot as being written before any field changes, so a drain copying an older record from it notices */
+    __atomic_store_n(&entry->committed, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    entry->timestamp = read_tsc();
+    entry->level = level;
+    entry->format = format;
+    entry->argument_count = argument_count;
+
+    va_start(arguments, format);
+    for (uint32_t index = 0; index < argument_count; index++) {
+        entry->arguments[index] = va_arg(arguments, uint32_t);
+    }
+    va_end(arguments);
+
+    __atomic_store_n(&entry->committed, sequence + 1, __ATOMIC_RELEASE);
+}
+
+/* format and print everything recorded since the last drain. this is the slow part, and belongs off the hot path */
+void klog_drain() {
+    uint32_t lost = 0;
+
+    kprintf_begin_batch();
+
+    while (tail != __atomic_load_n(&head, __ATOMIC_ACQUIRE)) {
+        struct klog_entry *slot = &entries[tail & (KLOG_ENTRY_COUNT - 1)];
+        uint32_t committed = __atomic_load_n(&slot->committed, __ATOMIC_ACQUIRE);
+
+        if (committed != tail + 1) {
+            /* a newer record has lapped this one, or is being written over it. otherwise the writer hasn't finished yet */
+            bool lapped = committed ? (int32_t)(committed - (tail + 1)) > 0
+                                    : __atomic_load_n(&head, __ATOMIC_ACQUIRE) - tail > KLOG_ENTRY_COUNT;
+            if (lapped) {
+                lost++;
+                tail++;
+                continue;
+            }
+            break;
+        }
+
+        /* take a copy, then make sure no writer started on the slot while copying */
+        struct klog_entry entry = *slot;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->committed, __ATOMIC_RELAXED) != committed) {
+            lost++;
+            tail++;
+            continue;
+        }
+        tail++;
+
+        if (entry.level < klog_console_level) {
+            continue;
+        }
+
+        /* unused argument words are passed too, printf ignores surplus arguments */
+        kprintf("[%llu] %s: ", entry.timestamp, level_names[entry.level & 3]);
+        kprintf(entry.format, entry.arguments[0], entry.arguments[1], entry.arguments[2], entry.arguments[3], entry.arguments[4], entry.arguments[5]);
+    }
+
+    if (lost) {
+        kprintf("klog: %u records lost\n", lost);
+    }
+
+    kprintf_end_batch();
+}
@@ -0,0 +1,167 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <kernel/intel.h>
+#include <kernel/kprintf.h>
+#include <kernel/preempt.h>
+#include <kernel/smp.h>
+#include <kernel/spinlock.h>
+#include <klegit/mini-printf.h>
+
+#define KPRINTF_SINK_COUNT 4
+#define KPRINTF_NO_OWNER 0xFFFFFFFF
+
+static struct kprintf_sink *sinks[KPRINTF_SINK_COUNT];
+
+/* while non-zero, flushing is put off until the outermost kprintf_end_batch */
+static unsigned int batch_depth = 0;
+
+/*
+Keeps output from different CPUs apart, and with it the terminal's cursor and the batch depth. It is held with
+preemption off but interrupts on, so the serial ring keeps draining through a long batch. An interrupt handler which
+prints on the CPU already holding it is let straight in, as waiting would never end. Off until setup_gdt has given
+this CPU its per-CPU segment, as there is only the one CPU before then anyway.
+*/
+static LOCK_STATISTICS(console_lock_statistics, "console");
+static struct spinlock console_lock = SPINLOCK_INIT_WITH_STATISTICS(&console_lock_statistics);
+static volatile uint32_t console_owner = KPRINTF_NO_OWNER; /* index of the CPU holding console_lock */
+static uint32_t console_depth = 0;
+static bool console_locking = false;
+
+/* interrupts are held off only while ownership changes hands, so a handler can't find the lock taken but not yet owned */
+static void console_acquire() {
+    if (!console_locking) {
+        return;
+    }
+
+    preempt_disable();
+
+    uint32_t flags = interrupts_save_disable();
+    uint32_t cpu = this_cpu_read(index);
+
+    if (console_owner == cpu) {
+        console_depth++;
+    } else {
+        spinlock_acquire(&console_lock);
+        console_owner = cpu;
+        console_depth = 1;
+    }
+    interrupts_restore(flags);
+}
+
+static void console_release() {
+    if (!console_locking) {
+        return;
+    }
+
+    uint32_t flags = interrupts_save_disable();
+    if (--console_depth == 0) {
+        console_owner = KPRINTF_NO_OWNER;
+        spinlock_release(&console_lock);
+    }
+    interrupts_restore(flags);
+
+    preempt_enable();
+}
+
+/* called by setup_gdt once this_cpu_read works */
+void kprintf_enable_locking() {
+    console_locking = true;
+}
+
+/* add an output device which receives everything passed to kprintf. returns false if there are no free slots */
+bool kprintf_register_sink(struct kprintf_sink *sink) {
+    for (size_t index = 0; index < KPRINTF_SINK_COUNT; index++) {
+        if (sinks[index] == 0) {
+            sinks[index] = sink;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void kprintf_unregister_sink(struct kprintf_sink *sink) {
+    for (size_t index = 0; index < KPRINTF_SINK_COUNT; index++) {
+        if (sinks[index] == sink) {
+            sinks[index] = 0;
+        }
+    }
+}
+
+/* fan a run of formatted output out to every registered sink */
+static void emit_to_sinks(const char *string, unsigned int length, void *context) {
+    (void)context;
+
+    for (size_t index = 0; index < KPRINTF_SINK_COUNT; index++) {
+        if (sinks[index]) {
+            sinks[index]->write(string, length, sinks[index]->context);
+        }
+    }
+}
+
+static void flush_sinks() {
+    for (size_t index = 0; index < KPRINTF_SINK_COUNT; index++) {
+        if (sinks[index] && sinks[index]->flush) {
+            sinks[index]->flush(sinks[index]->context);
+        }
+    }
+}
+
+/* group several kprintf calls so the sinks are only flushed once, e.g. to move the VGA cursor once for a whole hexdump. the console lock is held throughout, so the batch comes out in one piece and must not block */
+void kprintf_begin_batch() {
+    console_acquire();
+    batch_depth++;
+}
+
+void kprintf_end_batch() {
+    if (--batch_depth == 0) {
+        flush_sinks();
+    }
+    console_release();
+}
+
+/* format straight to the sinks, with no intermediate buffer */
+int vkprintf(char *format, va_list arguments) {
+    console_acquire();
+
+    int count = mini_vformat(emit_to_sinks, 0, format, arguments);
+
+    if (batch_depth == 0) {
+        flush_sinks();
+    }
+
+    console_release();
+
+    return count;
+}
+
+int kprintf(char *format, ...) {
+    va_list arguments;
+
+    va_start(arguments, format);
+    int count = vkprintf(format, arguments);
+    va_end(arguments);
+
+    return count;
+}
+
+/* format to one particular sink, registered or not */
+int kprintf_to(struct kprintf_sink *sink, char *format, ...) {
+    va_list arguments;
+
+    console_acquire();
+
+    va_start(arguments, format);
+    int count = mini_vformat(sink->write, sink->context, format, arguments);
+    va_end(arguments);
+
+    if (sink->flush) {
+        sink->flush(sink->context);
+    }
+
+    console_release();
+
+    return count;
+}
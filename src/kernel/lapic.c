@@ -0,0 +1,132 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kernel/boot.h>
+#include <kernel/interrupts.h>
+#include <kernel/intel.h>
+#include <kernel/kprintf.h>
+#include <kernel/lapic.h>
+#include <kernel/paging.h>
+#include <kernel/tsc.h>
+
+/* true once the boot CPU's local APIC is mapped and enabled */
+bool lapic_available = false;
+
+static volatile uint32_t *lapic_registers;
+
+/* timer ticks per millisecond with the divider at 16, measured once on the boot CPU. every local APIC runs off the same bus clock */
+static uint32_t lapic_timer_ticks_per_millisecond = 0;
+
+static inline uint32_t lapic_read(uint32_t offset) {
+    return lapic_registers[offset / sizeof(uint32_t)];
+}
+
+static inline void lapic_write(uint32_t offset, uint32_t value) {
+    lapic_registers[offset / sizeof(uint32_t)] = value;
+}
+
+/* nothing to do, and a spurious interrupt must not be acknowledged */
+static void lapic_spurious_interrupt(struct interrupt_frame *frame) {
+    (void)frame;
+}
+
+/* count timer ticks across a TSC-timed busy wait, with the timer masked so it doesn't fire */
+static void calibrate_timer() {
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_BY_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | INTERRUPT_VECTOR_LAPIC_TIMER);
+    lapic_write(LAPIC_TIMER_INITIAL_COUNT, 0xFFFFFFFF);
+
+    tsc_delay_microseconds(LAPIC_CALIBRATION_MICROSECONDS);
+
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT_COUNT);
+    lapic_write(LAPIC_TIMER_INITIAL_COUNT, 0);
+
+    lapic_timer_ticks_per_millisecond = elapsed / (LAPIC_CALIBRATION_MICROSECONDS / 1000);
+}
+
+/*
+Map the local APIC registers (the same physical address on every CPU, each CPU sees its own), enable the boot CPU's and
+calibrate its timer. Needs paging and the TSC. The PICs keep delivering through LINT0 in virtual wire mode, so the boot
+CPU's existing IRQs are unaffected.
+*/
+bool setup_lapic(uint32_t physical_address) {
+    if (!cpu_has_feature(CPUID_FEATURE_EDX_APIC) || !cpu_has_feature(CPUID_FEATURE_EDX_MSR)) {
+        return false;
+    }
+
+    if (!map_range(physical_address, physical_address, PAGE_SIZE, PAGE_WRITABLE | PAGE_CACHE_DISABLE | PAGE_GLOBAL)) {
+        return false;
+    }
+    lapic_registers = (volatile uint32_t *)physical_address;
+
+    uint64_t base = read_msr(MSR_APIC_BASE);
+    if (!(base & MSR_APIC_BASE_ENABLE)) {
+        write_msr(MSR_APIC_BASE, base | MSR_APIC_BASE_ENABLE);
+    }
+
+    register_interrupt_handler(INTERRUPT_VECTOR_LAPIC_SPURIOUS, lapic_spurious_interrupt);
+    lapic_enable(true);
+    calibrate_timer();
+
+    lapic_available = true;
+
+    if (!boot_fast) {
+        kprintf("lapic: version 0x%02x at 0x%08x, timer %u ticks per ms\n", lapic_read(LAPIC_VERSION) & 0xFF, physical_address, lapic_timer_ticks_per_millisecond);
+    }
+
+    return true;
+}
+
+/* software enable this CPU's local APIC. application processors also mask the legacy lines, which only the boot CPU uses */
+void lapic_enable(bool boot_cpu) {
+    if (!boot_cpu) {
+        lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+        lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_MASKED);
+    }
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_TASK_PRIORITY, 0);
+    lapic_write(LAPIC_SPURIOUS, LAPIC_SPURIOUS_ENABLE | INTERRUPT_VECTOR_LAPIC_SPURIOUS);
+}
+
+uint8_t lapic_id() {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_end_of_interrupt() {
+    lapic_write(LAPIC_END_OF_INTERRUPT, 0);
+}
+
+/* the destination goes in the high word first, writing the low word sends. waits for the previous command to go */
+static void send_command(uint8_t apic_id, uint32_t command) {
+    while (lapic_read(LAPIC_INTERRUPT_COMMAND_LOW) & LAPIC_ICR_DELIVERY_PENDING) {
+        __asm__ volatile ("pause");
+    }
+
+    lapic_write(LAPIC_INTERRUPT_COMMAND_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_INTERRUPT_COMMAND_LOW, command);
+}
+
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector) {
+    uint32_t flags = interrupts_save_disable();
+    send_command(apic_id, LAPIC_ICR_FIXED | LAPIC_ICR_ASSERT | vector);
+    interrupts_restore(flags);
+}
+
+/* assert then deassert INIT. current CPUs ignore the deassert, but the original local APICs needed it */
+void lapic_send_init(uint8_t apic_id) {
+    send_command(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT | LAPIC_ICR_LEVEL_TRIGGERED);
+    tsc_delay_microseconds(200);
+    send_command(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL_TRIGGERED);
+}
+
+/* start the CPU in real mode at address, which must be page aligned and below 1M */
+void lapic_send_startup(uint8_t apic_id, uint32_t address) {
+    send_command(apic_id, LAPIC_ICR_STARTUP | (address >> 12));
+}
+
+/* run this CPU's timer periodically at roughly the given frequency, on INTERRUPT_VECTOR_LAPIC_TIMER */
+void lapic_start_timer(uint32_t frequency) {
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_BY_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_TIMER_PERIODIC | INTERRUPT_VECTOR_LAPIC_TIMER);
+    lapic_write(LAPIC_TIMER_INITIAL_COUNT, lapic_timer_ticks_per_millisecond * 1000 / frequency);
+}
@@ -1,18 +1,215 @@
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+#include <kernel/benchmark.h>
+#include <kernel/boot.h>
+#include <kernel/fpu.h>
+#include <kernel/initrd.h>
 #include <kernel/intel.h>
+#include <kernel/interrupts.h>
+#include <kernel/klog.h>
+#include <kernel/kprintf.h>
+#include <kernel/multiboot.h>
+#include <kernel/paging.h>
+#include <kernel/pmm.h>
+#include <kernel/ipc.h>
+#include <kernel/process.h>
+#include <kernel/profile.h>
+#include <kernel/slab.h>
+#include <kernel/smp.h>
+#include <kernel/spinlock.h>
+#include <kernel/syscall.h>
+#include <kernel/serial.h>
 #include <kernel/terminal.h>
+#include <kernel/thread.h>
+#include <kernel/timer.h>
+#include <kernel/trace.h>
+#include <kernel/tsc.h>
+#include <kernel/vm.h>
+
+/*
+Entry point from early.S - at this point there is a 32k stack set up, but nothing else. Each step is marked with
+boot_phase for the timeline printed at the end. Under fastboot everything that is only there to be looked at is left
+out: the self-tests, benchmarks, statistics, profiler and dumps, as well as the chatter, so the timeline shows how long
+the kernel itself takes to get to ready.
+*/
+void main(uint32_t multiboot_magic, struct multiboot_info *multiboot_info) {
+    if (multiboot_magic == MULTIBOOT_BOOTLOADER_MAGIC) {
+        setup_boot_options(multiboot_info);
+    }
 
-/* entry point from early.S - at this point there is a 32k stack set up, but nothing else */
-void main() {
     terminal_clear();
-    terminal_write("Called kernel main().\n\n");
+    kprintf_register_sink(&terminal_sink);
+
+    bool serial_present = serial_init();
+    if (serial_present) {
+        kprintf_register_sink(&serial_sink);
+    }
+    if (debug_port_present()) {
+        kprintf_register_sink(&debug_port_sink);
+    }
+    boot_phase("console");
+
+    boot_progress("Called kernel main().\n");
 
-    terminal_write("Setting up the GDT...\n");
+    if (multiboot_magic != MULTIBOOT_BOOTLOADER_MAGIC) {
+        kprintf("Not loaded by a multiboot loader (magic 0x%08x).\n", multiboot_magic);
+        halt();
+    }
+    if (boot_fast) {
+        kprintf("Fast boot: %s\n", boot_command_line);
+    }
+
+    boot_progress("Calibrating the TSC...");
+    setup_tsc();
+    TRACE_INSTANT(TRACE_SUBSYSTEM_BOOT, "tsc calibrated");
+    boot_phase("tsc");
+    boot_progress("Setting up the GDT...");
     setup_gdt();
-    terminal_write("Setting up the IDT...\n");
+    boot_phase("gdt");
+    boot_progress("Setting up the IDT...");
     setup_idt();
+    boot_phase("idt");
+    boot_progress("Enabling the FPU and SSE...");
+    setup_fpu();
+    setup_string_implementations();
+    boot_phase("fpu");
+    if (!boot_fast) {
+        kprintf("Benchmarking interrupt dispatch...\n");
+        benchmark_interrupts();
+        boot_phase("interrupt benchmark");
+    }
+    boot_progress("Enabling interrupts and the profiler...");
+    register_interrupt_handler(IRQ_VECTOR(SERIAL_COM1_IRQ), serial_interrupt);
+    serial_enable_interrupts();
+    setup_timer(TIMER_FREQUENCY);
+    if (!boot_fast) {
+        setup_profile();
+        profile_start();
+    }
+    interrupts_enable();
+    TRACE_INSTANT(TRACE_SUBSYSTEM_BOOT, "interrupts enabled");
+    boot_phase("interrupts");
+    if (!boot_fast) {
+        kprintf("Benchmarking string functions...\n");
+        benchmark_string();
+        kprintf("Benchmarking terminal output...\n");
+        benchmark_terminal();
+        kprintf("Benchmarking integer formatting...\n");
+        benchmark_format();
+        kprintf("Benchmarking the kernel log...\n");
+        benchmark_klog();
+        boot_phase("output benchmarks");
+    }
+    boot_progress("Setting up the physical memory manager...");
+    setup_pmm(multiboot_info);
+    boot_phase("pmm");
+    if (!boot_fast) {
+        pmm_print_statistics();
+        boot_self_test("pmm", pmm_self_test());
+        pmm_print_statistics();
+        boot_phase("pmm self-test");
+    }
+    boot_progress("Setting up paging...");
+    setup_paging();
+    boot_phase("paging");
+    if (!boot_fast) {
+        kprintf("Benchmarking large and small pages...\n");
+        benchmark_paging();
+        boot_phase("paging benchmark");
+    }
+    boot_progress("Setting up the kernel heap...");
+    setup_slab();
+    boot_phase("slab");
+    if (!boot_fast) {
+        boot_self_test("slab", slab_self_test());
+        benchmark_kmalloc();
+        slab_print_statistics();
+        boot_phase("slab self-test");
+    }
+    boot_progress("Setting up demand paging...");
+    setup_vm();
+    boot_phase("vm");
+    if (!boot_fast) {
+        boot_self_test("vm", vm_self_test());
+        benchmark_page_faults();
+        vm_print_statistics();
+        boot_phase("vm self-test");
+    }
+    boot_progress("Indexing the initrd...");
+    setup_initrd(multiboot_info);
+    boot_phase("initrd");
+    if (!boot_fast) {
+        boot_self_test("initrd", initrd_self_test());
+        benchmark_initrd();
+        initrd_print_statistics();
+        boot_phase("initrd self-test");
+    }
+    boot_progress("Setting up system calls...");
+    setup_syscalls();
+    boot_phase("syscalls");
+    if (!boot_fast) {
+        kprintf("Benchmarking system calls...\n");
+        benchmark_syscalls();
+        boot_phase("syscall benchmark");
+    }
+    boot_progress("Setting up processes...");
+    setup_processes();
+    boot_phase("processes");
+    if (!boot_fast) {
+        boot_self_test("process", process_self_test());
+        benchmark_spawn();
+        process_print_statistics();
+        boot_phase("process self-test");
+        boot_self_test("ipc", ipc_self_test());
+        benchmark_ipc();
+        ipc_print_statistics();
+        boot_phase("ipc self-test");
+    }
+    boot_progress("Setting up threads...");
+    setup_threads();
+    boot_phase("threads");
+    boot_progress("Starting the other CPUs...");
+    setup_smp();
+    boot_phase("ready"); /* everything from here on is diagnostics */
+
+    if (!boot_fast) {
+        kprintf("Benchmarking per-CPU data access...\n");
+        benchmark_per_cpu();
+        boot_self_test("thread", thread_self_test());
+        boot_self_test("fpu", fpu_self_test());
+        benchmark_fpu();
+        kprintf("Benchmarking context switches...\n");
+        benchmark_threads();
+        kprintf("Benchmarking SMP scaling...\n");
+        benchmark_smp();
+        kprintf("Benchmarking locks...\n");
+        benchmark_locks();
+        boot_phase("thread benchmarks");
+        thread_print_statistics();
+        fpu_print_statistics();
+        lock_print_statistics();
+        profile_stop();
+    }
+    klog_drain();
+    boot_print_timeline();
+    if (!boot_fast) {
+        interrupt_print_statistics();
+        trace_print_summary();
+        if (serial_present) {
+            kprintf("Dumping the trace buffer and profile over serial...\n");
+            trace_dump_binary(serial_write);
+            profile_dump(&serial_sink);
+        } else if (debug_port_present()) {
+            profile_dump(&debug_port_sink);
+        }
+    }
+
+    /* the headless harness boots with "exit" and reads the outcome from qemu's exit status */
+    if (boot_option("exit")) {
+        qemu_exit(boot_self_test_failures ? QEMU_EXIT_FAILURE : QEMU_EXIT_SUCCESS);
+    }
 
     halt();
 }
@@ -0,0 +1,324 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kernel/intel.h>
+#include <kernel/kprintf.h>
+#include <kernel/paging.h>
+#include <kernel/pmm.h>
+#include <kernel/trace.h>
+
+#include <klegit/string.h>
+
+#define PAGE_TABLE_ENTRY_COUNT 1024
+
+static uint32_t kernel_page_directory[PAGE_TABLE_ENTRY_COUNT] __attribute__((__aligned__(PAGE_SIZE)));
+
+static bool large_pages_supported = false;
+static bool global_pages_supported = false;
+
+static inline uint32_t directory_index(uint32_t virtual_address) {
+    return virtual_address >> 22;
+}
+
+static inline uint32_t table_index(uint32_t virtual_address) {
+    return (virtual_address >> 12) & (PAGE_TABLE_ENTRY_COUNT - 1);
+}
+
+static inline void invlpg(uint32_t virtual_address) {
+    __asm__ volatile ("invlpg (%0)" : : "r"(virtual_address) : "memory");
+}
+
+static void write_cr3(uint32_t value) {
+    __asm__ volatile ("mov %0, %%cr3" : : "r"(value) : "memory");
+}
+
+/* flush every TLB entry. reloading CR3 leaves global pages behind, so with PGE on it has to be toggled instead */
+void paging_flush_tlb() {
+    if (global_pages_supported) {
+        uint32_t cr4 = read_cr4();
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+    } else {
+        write_cr3((uint32_t)kernel_page_directory);
+    }
+}
+
+/* the page table for a directory slot, creating it (or splitting a 4M page in to one) if needed. 0 if out of memory */
+static uint32_t *page_table_for(uint32_t virtual_address) {
+    uint32_t *directory_entry = &kernel_page_directory[directory_index(virtual_address)];
+
+    if ((*directory_entry & PAGE_PRESENT) && !(*directory_entry & PAGE_LARGE)) {
+        return (uint32_t*)(*directory_entry & ~PAGE_FLAGS_MASK);
+    }
+
+    /* page tables are reached through the identity map, so any frame will do */
+    uint32_t *table = (uint32_t*)pmm_alloc_frame();
+    if (table == 0) {
+        return 0;
+    }
+
+    if (*directory_entry & PAGE_PRESENT) {
+        /* split the large page in to 1024 small pages with the same flags */
+        uint32_t base = *directory_entry & ~(LARGE_PAGE_SIZE - 1);
+        uint32_t flags = *directory_entry & PAGE_FLAGS_MASK & ~PAGE_LARGE;
+
+        for (uint32_t index = 0; index < PAGE_TABLE_ENTRY_COUNT; index++) {
+            table[index] = (base + index * PAGE_SIZE) | flags;
+        }
+    } else {
+        memset(table, 0, PAGE_SIZE);
+    }
+
+    /* the directory entry is left permissive, the table entries carry the real protection */
+    bool was_large = *directory_entry & PAGE_PRESENT;
+    *directory_entry = (uint32_t)table | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+
+    /* any address inside a 4M page invalidates its TLB entry */
+    if (was_large && (read_cr0() & CR0_PAGING)) {
+        invlpg(virtual_address);
+    }
+
+    return table;
+}
+
+/*
+The page table entry for a virtual address, for code which edits single pages itself, like the page fault handler. With
+create set a missing table is allocated. Returns 0 if there is no table and create isn't set, if there is no memory for
+one, or if the address is inside a 4M page, which this never splits.
+*/
+uint32_t *paging_entry(uint32_t virtual_address, bool create) {
+    uint32_t directory_entry = kernel_page_directory[directory_index(virtual_address)];
+
+    if (directory_entry & PAGE_LARGE) {
+        return 0;
+    }
+    if (!(directory_entry & PAGE_PRESENT)) {
+        if (!create) {
+            return 0;
+        }
+        uint32_t *table = page_table_for(virtual_address);
+        return table ? &table[table_index(virtual_address)] : 0;
+    }
+
+    return &((uint32_t*)(directory_entry & ~PAGE_FLAGS_MASK))[table_index(virtual_address)];
+}
+
+/* drop this CPU's TLB entry for one page after its paging_entry has changed */
+void paging_invalidate(uint32_t virtual_address) {
+    invlpg(virtual_address);
+}
+
+/*
+Point the directory entries for [PAGING_USER_BASE, PAGING_USER_END) at a process's page tables, or clear them if
+directory_entries is 0. Reloading CR3 drops every non global TLB entry, which is all of the old process's. Every CPU
+shares the kernel page directory, so only one process can be switched in at a time.
+*/
+void paging_switch_user_tables(const uint32_t *directory_entries) {
+    uint32_t *user_entries = &kernel_page_directory[directory_index(PAGING_USER_BASE)];
+
+    if (directory_entries) {
+        memcpy(user_entries, directory_entries, PAGING_USER_TABLE_COUNT * sizeof(uint32_t));
+    } else {
+        memset(user_entries, 0, PAGING_USER_TABLE_COUNT * sizeof(uint32_t));
+    }
+
+    write_cr3((uint32_t)kernel_page_directory);
+}
+
+/* invalidate the TLB for a changed range: invlpg per page for small changes, one full flush for large ones */
+static void flush_range(uint32_t virtual_address, uint32_t page_count) {
+    if (!(read_cr0() & CR0_PAGING)) {
+        return;
+    }
+
+    if (page_count > PAGING_INVLPG_LIMIT) {
+        paging_flush_tlb();
+        return;
+    }
+
+    for (uint32_t index = 0; index < page_count; index++) {
+        invlpg(virtual_address + index * PAGE_SIZE);
+    }
+}
+
+/*
+Map [virtual_address, virtual_address + length) to the physical range at physical_address. Passing PAGE_LARGE allows 4M
+pages wherever both addresses are 4M aligned and at least 4M remains, everything else gets 4K pages. Addresses and
+length are rounded out to whole pages. Returns false if a page table could not be allocated.
+*/
+bool map_range(uint32_t virtual_address, uint32_t physical_address, uint32_t length, uint32_t flags) {
+    uint32_t offset = virtual_address & (PAGE_SIZE - 1);
+    uint32_t start = virtual_address - offset;
+    uint32_t pages = (length + offset + PAGE_SIZE - 1) / PAGE_SIZE;
+    bool large = (flags & PAGE_LARGE) && large_pages_supported;
+
+    physical_address -= offset;
+    flags = (flags & PAGE_FLAGS_MASK & ~PAGE_LARGE) | PAGE_PRESENT;
+    if (!global_pages_supported) {
+        flags &= ~PAGE_GLOBAL;
+    }
+
+    uint32_t address = start;
+    for (uint32_t remaining = pages; remaining > 0;) {
+        if (large && (address & (LARGE_PAGE_SIZE - 1)) == 0 && (physical_address & (LARGE_PAGE_SIZE - 1)) == 0 && remaining >= LARGE_PAGE_SIZE / PAGE_SIZE) {
+            uint32_t *directory_entry = &kernel_page_directory[directory_index(address)];
+
+            if ((*directory_entry & PAGE_PRESENT) && !(*directory_entry & PAGE_LARGE)) {
+                pmm_free_frame(*directory_entry & ~PAGE_FLAGS_MASK);
+            }
+            *directory_entry = physical_address | flags | PAGE_LARGE;
+
+            address += LARGE_PAGE_SIZE;
+            physical_address += LARGE_PAGE_SIZE;
+            remaining -= LARGE_PAGE_SIZE / PAGE_SIZE;
+            continue;
+        }
+
+        uint32_t *table = page_table_for(address);
+        if (table == 0) {
+            flush_range(start, pages);
+            return false;
+        }
+        table[table_index(address)] = physical_address | flags;
+
+        address += PAGE_SIZE;
+        physical_address += PAGE_SIZE;
+        remaining--;
+    }
+
+    flush_range(start, pages);
+    return true;
+}
+
+/*
+Free the page tables over [start, start + pages pages) which unmapping has left empty, so mapping and unmapping the same
+range over and over doesn't leak a table each time. The process window's tables belong to address spaces and are left
+alone.
+*/
+static void free_empty_tables(uint32_t start, uint32_t pages) {
+    if (pages == 0) {
+        return;
+    }
+
+    for (uint32_t slot = directory_index(start); slot <= directory_index(start + (pages - 1) * PAGE_SIZE); slot++) {
+        uint32_t address = slot << 22;
+        uint32_t *directory_entry = &kernel_page_directory[slot];
+
+        if (!(*directory_entry & PAGE_PRESENT) || (*directory_entry & PAGE_LARGE) || (address >= PAGING_USER_BASE && address < PAGING_USER_END)) {
+            continue;
+        }
+
+        uint32_t *table = (uint32_t*)(*directory_entry & ~PAGE_FLAGS_MASK);
+        uint32_t index = 0;
+        while (index < PAGE_TABLE_ENTRY_COUNT && table[index] == 0) {
+            index++;
+        }
+        if (index < PAGE_TABLE_ENTRY_COUNT) {
+            continue;
+        }
+
+        *directory_entry = 0;
+        /* invlpg also drops any cached copy of the directory entry, so the frame can't be walked after it is reused */
+        if (read_cr0() & CR0_PAGING) {
+            invlpg(address);
+        }
+        pmm_free_frame((physical_address)table);
+    }
+}
+
+/*
+Remove the mappings for a range. A 4M page which is only partly covered is split first. Page tables left empty are
+freed. Returns false if a split fails.
+*/
+bool unmap_range(uint32_t virtual_address, uint32_t length) {
+    uint32_t offset = virtual_address & (PAGE_SIZE - 1);
+    uint32_t start = virtual_address - offset;
+    uint32_t pages = (length + offset + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    uint32_t address = start;
+    for (uint32_t remaining = pages; remaining > 0;) {
+        uint32_t *directory_entry = &kernel_page_directory[directory_index(address)];
+
+        if (!(*directory_entry & PAGE_PRESENT)) {
+            /* nothing mapped in this 4M slot, skip to the next one */
+            uint32_t skip = (LARGE_PAGE_SIZE - (address & (LARGE_PAGE_SIZE - 1))) / PAGE_SIZE;
+            skip = skip < remaining ? skip : remaining;
+            address += skip * PAGE_SIZE;
+            remaining -= skip;
+            continue;
+        }
+
+        if ((*directory_entry & PAGE_LARGE) && (address & (LARGE_PAGE_SIZE - 1)) == 0 && remaining >= LARGE_PAGE_SIZE / PAGE_SIZE) {
+            *directory_entry = 0;
+            address += LARGE_PAGE_SIZE;
+            remaining -= LARGE_PAGE_SIZE / PAGE_SIZE;
+            continue;
+        }
+
+        uint32_t *table = page_table_for(address);
+        if (table == 0) {
+            flush_range(start, pages);
+            return false;
+        }
+        table[table_index(address)] = 0;
+
+        address += PAGE_SIZE;
+        remaining--;
+    }
+
+    flush_range(start, pages);
+    free_empty_tables(start, pages);
+    return true;
+}
+
+/* the physical address a virtual address maps to, or 0 if it is not mapped */
+uint32_t paging_translate(uint32_t virtual_address) {
+    uint32_t directory_entry = kernel_page_directory[directory_index(virtual_address)];
+
+    if (!(directory_entry & PAGE_PRESENT)) {
+        return 0;
+    }
+    if (directory_entry & PAGE_LARGE) {
+        return (directory_entry & ~(LARGE_PAGE_SIZE - 1)) | (virtual_address & (LARGE_PAGE_SIZE - 1));
+    }
+
+    uint32_t table_entry = ((uint32_t*)(directory_entry & ~PAGE_FLAGS_MASK))[table_index(virtual_address)];
+    if (!(table_entry & PAGE_PRESENT)) {
+        return 0;
+    }
+
+    return (table_entry & ~PAGE_FLAGS_MASK) | (virtual_address & (PAGE_SIZE - 1));
+}
+
+/*
+Identity map all of RAM (and everything below it, including the kernel, low memory and VGA) with global 4M pages where
+the CPU supports them, so the whole kernel working set needs only a handful of TLB entries. Then turn paging on, with
+write protection honoured in ring 0 as well.
+*/
+void setup_paging() {
+    TRACE_SCOPE(TRACE_SUBSYSTEM_MEMORY, "setup_paging");
+
+    large_pages_supported = cpu_has_feature(CPUID_FEATURE_EDX_PSE);
+    global_pages_supported = cpu_has_feature(CPUID_FEATURE_EDX_PGE);
+
+    uint32_t cr4 = read_cr4();
+    if (large_pages_supported) {
+        cr4 |= CR4_PSE;
+    }
+    if (global_pages_supported) {
+        cr4 |= CR4_PGE;
+    }
+    write_cr4(cr4);
+
+    uint32_t identity_end = (pmm_highest_address() + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+    if (!map_range(0, 0, identity_end, PAGE_WRITABLE | PAGE_GLOBAL | PAGE_LARGE)) {
+        kprintf("paging: out of memory building the identity map\n");
+        halt();
+    }
+
+    write_cr3((uint32_t)kernel_page_directory);
+    write_cr0(read_cr0() | CR0_PAGING | CR0_WRITE_PROTECT);
+
+    kprintf("paging: identity mapped %u MB with %s pages%s\n", identity_end >> 20, large_pages_supported ? "4M" : "4K", global_pages_supported ? ", global" : "");
+}
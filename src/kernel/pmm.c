@@ -0,0 +1,423 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kernel/intel.h>
+#include <kernel/kprintf.h>
+#include <kernel/multiboot.h>
+#include <kernel/pmm.h>
+#include <kernel/spinlock.h>
+#include <kernel/trace.h>
+#include <kernel/tsc.h>
+
+#include <klegit/string.h>
+
+#define PMM_RESERVED_RANGE_COUNT 16
+#define LOW_MEMORY_END 0x100000 /* BIOS data, VGA and ROMs live below 1M, so none of it is handed out */
+
+/*
+
+Buddy allocator over physical frames.
+
+Free blocks of each order sit on a doubly linked list threaded through the blocks themselves, so the allocator needs
+no memory of its own apart from one bitmap per order saying which blocks are free. That bitmap is what makes finding
+and unlinking a buddy O(1) when freeing. The bitmaps are carved out of the first free region big enough to hold them.
+
+Alongside the bitmaps is a share count per frame for copy on write: the number of owners a frame has beyond the one
+which allocated it. pmm_release_frame drops a share while there are any and only frees the frame once the last owner
+lets go, so nothing else needs to know whether a frame is shared.
+
+This relies on physical memory being addressable at its physical address, i.e. paging off or an identity map.
+
+*/
+
+struct free_block {
+    struct free_block *next;
+    struct free_block *previous;
+};
+
+struct reserved_range {
+    physical_address start;
+    physical_address end;
+};
+
+extern char kernel_start[];
+extern char kernel_end[];
+
+struct pmm_statistics pmm_statistics;
+
+static struct free_block *free_lists[PMM_MAX_ORDER + 1];
+static uint32_t free_block_counts[PMM_MAX_ORDER + 1];
+static uint32_t *free_bitmaps[PMM_MAX_ORDER + 1];
+static uint16_t *frame_shares;
+static uint32_t frame_count = 0;
+
+/* guards the free lists, bitmaps, share counts and statistics */
+static LOCK_STATISTICS(pmm_lock_statistics, "pmm");
+static struct spinlock pmm_lock = SPINLOCK_INIT_WITH_STATISTICS(&pmm_lock_statistics);
+
+static struct reserved_range reserved_ranges[PMM_RESERVED_RANGE_COUNT];
+static size_t reserved_range_count = 0;
+
+static inline bool block_is_free(unsigned int order, uint32_t index) {
+    return (free_bitmaps[order][index >> 5] >> (index & 31)) & 1;
+}
+
+static inline void set_block_free(unsigned int order, uint32_t index, bool free) {
+    if (free) {
+        free_bitmaps[order][index >> 5] |= 1u << (index & 31);
+    } else {
+        free_bitmaps[order][index >> 5] &= ~(1u << (index & 31));
+    }
+}
+
+static inline struct free_block *block_address(unsigned int order, uint32_t index) {
+    return (struct free_block*)((index << order) << FRAME_SHIFT);
+}
+
+static void push_free_block(unsigned int order, uint32_t index) {
+    struct free_block *block = block_address(order, index);
+
+    block->previous = 0;
+    block->next = free_lists[order];
+    if (block->next) {
+        block->next->previous = block;
+    }
+    free_lists[order] = block;
+
+    free_block_counts[order]++;
+    set_block_free(order, index, true);
+}
+
+static void unlink_free_block(unsigned int order, uint32_t index) {
+    struct free_block *block = block_address(order, index);
+
+    if (block->previous) {
+        block->previous->next = block->next;
+    } else {
+        free_lists[order] = block->next;
+    }
+    if (block->next) {
+        block->next->previous = block->previous;
+    }
+
+    free_block_counts[order]--;
+    set_block_free(order, index, false);
+}
+
+/* keep a range of physical memory away from the allocator. only has an effect before setup_pmm */
+void pmm_reserve(physical_address start, physical_address end) {
+    if (reserved_range_count < PMM_RESERVED_RANGE_COUNT) {
+        reserved_ranges[reserved_range_count].start = start & ~(FRAME_SIZE - 1);
+        reserved_ranges[reserved_range_count].end = (end + FRAME_SIZE - 1) & ~(FRAME_SIZE - 1);
+        reserved_range_count++;
+    }
+}
+
+/* hand the frames in [start, end) to the allocator as the largest aligned blocks that fit */
+static void free_frame_range(uint32_t start, uint32_t end) {
+    while (start < end) {
+        unsigned int order = 0;
+
+        while (order < PMM_MAX_ORDER && (start & ((2u << order) - 1)) == 0 && start + (2u << order) <= end) {
+            order++;
+        }
+
+        push_free_block(order, start >> order);
+        pmm_statistics.free_frames += 1u << order;
+        start += 1u << order;
+    }
+}
+
+/* free [start, end) minus any reserved ranges which overlap it */
+static void free_available_range(uint32_t start, uint32_t end) {
+    while (start < end) {
+        uint32_t next_reserved_start = end;
+        uint32_t next_reserved_end = end;
+
+        for (size_t index = 0; index < reserved_range_count; index++) {
+            uint32_t reserved_start = reserved_ranges[index].start >> FRAME_SHIFT;
+            uint32_t reserved_end = reserved_ranges[index].end >> FRAME_SHIFT;
+
+            if (reserved_end > start && reserved_start < next_reserved_start) {
+                next_reserved_start = reserved_start > start ? reserved_start : start;
+                next_reserved_end = reserved_end;
+            }
+        }
+
+        free_frame_range(start, next_reserved_start < end ? next_reserved_start : end);
+        start = next_reserved_end;
+    }
+}
+
+/* call fn for each usable region in the memory map, clipped to whole frames below 4G */
+static void for_each_available_region(struct multiboot_info *multiboot_info, void (*fn)(uint32_t start_frame, uint32_t end_frame)) {
+    if (!(multiboot_info->flags & MULTIBOOT_INFO_MEMORY_MAP)) {
+        /* no map, fall back to the single upper memory figure */
+        fn(LOW_MEMORY_END >> FRAME_SHIFT, (LOW_MEMORY_END >> FRAME_SHIFT) + (multiboot_info->memory_upper >> 2));
+        return;
+    }
+
+    uint32_t address = multiboot_info->memory_map_address;
+    while (address < multiboot_info->memory_map_address + multiboot_info->memory_map_length) {
+        struct multiboot_memory_map_entry *entry = (struct multiboot_memory_map_entry*)address;
+        uint64_t start = entry->base_address;
+        uint64_t end = entry->base_address + entry->length;
+
+        if (entry->type == MULTIBOOT_MEMORY_AVAILABLE && start < 0x100000000ULL) {
+            if (end > 0x100000000ULL) {
+                end = 0x100000000ULL;
+            }
+            fn((uint32_t)((start + FRAME_SIZE - 1) >> FRAME_SHIFT), (uint32_t)(end >> FRAME_SHIFT));
+        }
+
+        address += entry->size + 4;
+    }
+}
+
+static void count_frames(uint32_t start_frame, uint32_t end_frame) {
+    (void)start_frame;
+
+    if (end_frame > frame_count) {
+        frame_count = end_frame;
+    }
+}
+
+static physical_address bitmap_location = 0;
+static uint32_t bitmap_bytes = 0;
+
+/* find the first available stretch above the kernel which can hold the bitmaps */
+static void place_bitmaps(uint32_t start_frame, uint32_t end_frame) {
+    uint32_t kernel_end_frame = ((physical_address)kernel_end + FRAME_SIZE - 1) >> FRAME_SHIFT;
+    uint32_t bitmap_frames = (bitmap_bytes + FRAME_SIZE - 1) >> FRAME_SHIFT;
+
+    if (bitmap_location != 0) {
+        return;
+    }
+    if (start_frame < kernel_end_frame) {
+        start_frame = kernel_end_frame;
+    }
+
+    /* step over anything already reserved, e.g. the multiboot structures */
+    for (size_t index = 0; index < reserved_range_count; index++) {
+        uint32_t reserved_start = reserved_ranges[index].start >> FRAME_SHIFT;
+        uint32_t reserved_end = reserved_ranges[index].end >> FRAME_SHIFT;
+
+        if (reserved_start < start_frame + bitmap_frames && reserved_end > start_frame) {
+            start_frame = reserved_end;
+            index = (size_t)-1;
+        }
+    }
+
+    if (start_frame + bitmap_frames <= end_frame) {
+        bitmap_location = start_frame << FRAME_SHIFT;
+    }
+}
+
+static void free_region(uint32_t start_frame, uint32_t end_frame) {
+    free_available_range(start_frame, end_frame);
+}
+
+/* build the free lists from the multiboot memory map, keeping back low memory, the kernel image, the multiboot data and the modules */
+void setup_pmm(struct multiboot_info *multiboot_info) {
+    TRACE_SCOPE(TRACE_SUBSYSTEM_MEMORY, "setup_pmm");
+
+    pmm_reserve(0, LOW_MEMORY_END);
+    pmm_reserve((physical_address)kernel_start, (physical_address)kernel_end);
+    pmm_reserve((physical_address)multiboot_info, (physical_address)multiboot_info + sizeof(struct multiboot_info));
+    if (multiboot_info->flags & MULTIBOOT_INFO_MEMORY_MAP) {
+        pmm_reserve(multiboot_info->memory_map_address, multiboot_info->memory_map_address + multiboot_info->memory_map_length);
+    }
+    /* the modules are served in place by the initrd, so they, their list and their strings stay put for good */
+    if (multiboot_info->flags & MULTIBOOT_INFO_MODULES) {
+        struct multiboot_module *modules = (struct multiboot_module*)multiboot_info->modules_address;
+
+        pmm_reserve(multiboot_info->modules_address, multiboot_info->modules_address + multiboot_info->modules_count * sizeof(struct multiboot_module));
+        for (uint32_t index = 0; index < multiboot_info->modules_count; index++) {
+            pmm_reserve(modules[index].start, modules[index].end);
+            if (modules[index].string) {
+                pmm_reserve(modules[index].string, modules[index].string + strlen((const char*)modules[index].string) + 1);
+            }
+        }
+    }
+
+    for_each_available_region(multiboot_info, count_frames);
+
+    /* one bit per block per order, each order's bitmap rounded up to whole words */
+    for (unsigned int order = 0; order <= PMM_MAX_ORDER; order++) {
+        bitmap_bytes += (((frame_count >> order) + 32) >> 5) * 4;
+    }
+    bitmap_bytes += frame_count * sizeof(uint16_t);
+    for_each_available_region(multiboot_info, place_bitmaps);
+    if (bitmap_location == 0) {
+        kprintf("pmm: no room for the allocator bitmaps\n");
+        halt();
+    }
+
+    memset((void*)bitmap_location, 0, bitmap_bytes);
+    uint32_t *bitmap = (uint32_t*)bitmap_location;
+    for (unsigned int order = 0; order <= PMM_MAX_ORDER; order++) {
+        free_bitmaps[order] = bitmap;
+        bitmap += ((frame_count >> order) + 32) >> 5;
+    }
+    frame_shares = (uint16_t*)bitmap;
+    pmm_reserve(bitmap_location, bitmap_location + bitmap_bytes);
+
+    for_each_available_region(multiboot_info, free_region);
+    pmm_statistics.total_frames = pmm_statistics.free_frames;
+}
+
+/* allocate 2^order contiguous frames, aligned to their size. returns 0 when nothing big enough is free */
+physical_address pmm_alloc_frames(unsigned int order) {
+    uint64_t start = read_tsc();
+    uint32_t flags = spinlock_acquire_irqsave(&pmm_lock);
+    unsigned int found_order = order;
+
+    while (found_order <= PMM_MAX_ORDER && free_lists[found_order] == 0) {
+        found_order++;
+    }
+    if (found_order > PMM_MAX_ORDER) {
+        spinlock_release_irqrestore(&pmm_lock, flags);
+        return 0;
+    }
+
+    uint32_t index = ((physical_address)free_lists[found_order] >> FRAME_SHIFT) >> found_order;
+    unlink_free_block(found_order, index);
+
+    /* split the block down, putting the upper half of each split back on the next list down */
+    while (found_order > order) {
+        found_order--;
+        index <<= 1;
+        push_free_block(found_order, index + 1);
+    }
+
+    pmm_statistics.free_frames -= 1u << order;
+    pmm_statistics.allocations++;
+    pmm_statistics.allocation_cycles += read_tsc() - start;
+    spinlock_release_irqrestore(&pmm_lock, flags);
+
+    return (index << order) << FRAME_SHIFT;
+}
+
+/* return a block to the allocator, merging it with its buddy for as long as the buddy is free too */
+void pmm_free_frames(physical_address address, unsigned int order) {
+    uint64_t start = read_tsc();
+    uint32_t flags = spinlock_acquire_irqsave(&pmm_lock);
+    uint32_t index = (address >> FRAME_SHIFT) >> order;
+
+    pmm_statistics.free_frames += 1u << order;
+    pmm_statistics.frees++;
+
+    while (order < PMM_MAX_ORDER && ((index ^ 1) << order) < frame_count && block_is_free(order, index ^ 1)) {
+        unlink_free_block(order, index ^ 1);
+        index >>= 1;
+        order++;
+    }
+    push_free_block(order, index);
+
+    pmm_statistics.free_cycles += read_tsc() - start;
+    spinlock_release_irqrestore(&pmm_lock, flags);
+}
+
+physical_address pmm_alloc_frame() {
+    return pmm_alloc_frames(0);
+}
+
+void pmm_free_frame(physical_address address) {
+    pmm_free_frames(address, 0);
+}
+
+/* add an owner to an allocated frame. false if it already has as many as the count can hold, the caller must copy it then */
+bool pmm_share_frame(physical_address address) {
+    uint32_t flags = spinlock_acquire_irqsave(&pmm_lock);
+    uint16_t *shares = &frame_shares[address >> FRAME_SHIFT];
+    bool shared = *shares != UINT16_MAX;
+
+    if (shared) {
+        (*shares)++;
+    }
+    spinlock_release_irqrestore(&pmm_lock, flags);
+
+    return shared;
+}
+
+/* whether a frame has more than one owner, i.e. a write through one of them must go to a copy */
+bool pmm_frame_shared(physical_address address) {
+    return __atomic_load_n(&frame_shares[address >> FRAME_SHIFT], __ATOMIC_RELAXED) != 0;
+}
+
+/* drop an owner of a frame, freeing it if that was the last. returns true if the frame was freed */
+bool pmm_release_frame(physical_address address) {
+    uint32_t flags = spinlock_acquire_irqsave(&pmm_lock);
+    uint16_t *shares = &frame_shares[address >> FRAME_SHIFT];
+    bool last = *shares == 0;
+
+    if (!last) {
+        (*shares)--;
+    }
+    spinlock_release_irqrestore(&pmm_lock, flags);
+
+    if (last) {
+        pmm_free_frame(address);
+    }
+
+    return last;
+}
+
+/* the end of the highest usable frame, i.e. how much of the address space holds RAM */
+physical_address pmm_highest_address() {
+    return frame_count << FRAME_SHIFT;
+}
+
+void pmm_print_statistics() {
+    kprintf("pmm: %u of %u frames free (%u KB), %u allocations (%u cycles avg), %u frees (%u cycles avg)\n",
+        pmm_statistics.free_frames, pmm_statistics.total_frames, pmm_statistics.free_frames * (FRAME_SIZE / 1024),
+        pmm_statistics.allocations, tsc_average_cycles(pmm_statistics.allocation_cycles, pmm_statistics.allocations),
+        pmm_statistics.frees, tsc_average_cycles(pmm_statistics.free_cycles, pmm_statistics.frees));
+
+    kprintf("pmm: free blocks by order:");
+    for (unsigned int order = 0; order <= PMM_MAX_ORDER; order++) {
+        kprintf(" %u", free_block_counts[order]);
+    }
+    kprintf("\n");
+}
+
+/*
+Allocate every free frame one at a time, chaining them together through their first word, then free them all again.
+The frame count and the per-order free block counts should come back exactly as they were, which shows nothing leaked
+and every buddy merged back up.
+*/
+bool pmm_self_test() {
+    uint32_t counts_before[PMM_MAX_ORDER + 1];
+    uint32_t free_before = pmm_statistics.free_frames;
+    physical_address chain = 0;
+    uint32_t allocated = 0;
+
+    memcpy(counts_before, free_block_counts, sizeof(counts_before));
+
+    uint32_t allocations_before = pmm_statistics.allocations;
+    uint64_t allocation_cycles_before = pmm_statistics.allocation_cycles;
+
+    for (physical_address frame = pmm_alloc_frame(); frame != 0; frame = pmm_alloc_frame()) {
+        *(physical_address*)frame = chain;
+        chain = frame;
+        allocated++;
+    }
+
+    uint32_t allocation_cycles = tsc_average_cycles(pmm_statistics.allocation_cycles - allocation_cycles_before, pmm_statistics.allocations - allocations_before);
+    uint32_t frees_before = pmm_statistics.frees;
+    uint64_t free_cycles_before = pmm_statistics.free_cycles;
+
+    while (chain != 0) {
+        physical_address next = *(physical_address*)chain;
+        pmm_free_frame(chain);
+        chain = next;
+    }
+
+    uint32_t free_cycles = tsc_average_cycles(pmm_statistics.free_cycles - free_cycles_before, pmm_statistics.frees - frees_before);
+
+    kprintf("pmm self-test: allocated %u frames (%u MB) at %u cycles each, freed at %u cycles each\n",
+        allocated, allocated >> (20 - FRAME_SHIFT), allocation_cycles, free_cycles);
+
+    return allocated == free_before && pmm_statistics.free_frames == free_before && memcmp(counts_before, free_block_counts, sizeof(counts_before)) == 0;
+}
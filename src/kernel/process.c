@@ -0,0 +1,751 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kernel/elf.h>
+#include <kernel/initrd.h>
+#include <kernel/intel.h>
+#include <kernel/kprintf.h>
+#include <kernel/paging.h>
+#include <kernel/pmm.h>
+#include <kernel/process.h>
+#include <kernel/slab.h>
+#include <kernel/spinlock.h>
+#include <kernel/syscall.h>
+#include <kernel/trace.h>
+#include <kernel/tsc.h>
+#include <kernel/vm.h>
+
+#include <klegit/string.h>
+
+#define PAGE_TABLE_ENTRY_COUNT 1024
+
+/*
+
+Ring 3 processes loaded from static ELF executables, with fork style cloning of their address spaces.
+
+Each process owns the page tables for the process window, [PAGING_USER_BASE, PAGING_USER_END), and everything else is
+the kernel's and shared. Running a process points the window's directory entries at its tables, so switching costs
+one copy of those entries and a CR3 reload, and the kernel half of the TLB, made of global pages, survives it.
+
+Loading copies as little as it can. An image in the initrd has its pages aligned by tools/pack-initrd.py, so a segment
+whose file offset and address agree within a page is mapped straight from the archive: read only pages as they are,
+writable ones copy on write. Pages of bss, and the stack, show the zero page copy on write. Only pages mixing file data
+with bss, or segments which aren't aligned with the file, are copied at load.
+
+Forking shares every page between parent and child, bumping its share count in the PMM and taking write access away on
+both sides, so creating a process copies nothing but page tables. The first write to a shared page takes a fault and
+gets a copy, unless every other owner has gone by then, in which case it simply gets the frame back writable.
+
+Pages flagged PAGE_BORROWED belong to neither side, they are the zero page or initrd pages, so they are never counted,
+shared or freed, and always copied when written. Every CPU shares the one process window, so only one process runs at
+a time, as with run_in_user_mode.
+
+*/
+
+struct process_statistics process_statistics;
+
+/* guards the address spaces, which process, if any, is switched in, and the statistics */
+static LOCK_STATISTICS(process_lock_statistics, "process");
+static struct spinlock process_lock = SPINLOCK_INIT_WITH_STATISTICS(&process_lock_statistics);
+
+static struct kmem_cache *process_cache;
+static uint32_t next_process_id = 1;
+static struct process *active_process; /* switched in to the process window */
+
+static inline uint32_t table_slot(uint32_t virtual_address) {
+    return (virtual_address - PAGING_USER_BASE) / LARGE_PAGE_SIZE;
+}
+
+static inline uint32_t table_index(uint32_t virtual_address) {
+    return (virtual_address >> 12) & (PAGE_TABLE_ENTRY_COUNT - 1);
+}
+
+static inline uint32_t *table_address(uint32_t directory_entry) {
+    return (uint32_t*)(directory_entry & ~PAGE_FLAGS_MASK);
+}
+
+/* the entry for an address in the process window, creating its page table if create is set. 0 if there isn't one */
+static uint32_t *space_entry(struct address_space *space, uint32_t virtual_address, bool create) {
+    uint32_t *directory_entry = &space->tables[table_slot(virtual_address)];
+
+    if (!*directory_entry) {
+        if (!create) {
+            return 0;
+        }
+
+        physical_address table = pmm_alloc_frame();
+        if (!table) {
+            return 0;
+        }
+        memset((void*)table, 0, PAGE_SIZE);
+        *directory_entry = table | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+        process_statistics.owned_frames++;
+    }
+
+    return &table_address(*directory_entry)[table_index(virtual_address)];
+}
+
+/* give back every page and page table the address space owns or has a share of. process_lock must be held */
+static void free_space(struct address_space *space) {
+    for (uint32_t slot = 0; slot < PAGING_USER_TABLE_COUNT; slot++) {
+        if (!space->tables[slot]) {
+            continue;
+        }
+
+        uint32_t *table = table_address(space->tables[slot]);
+        for (uint32_t index = 0; index < PAGE_TABLE_ENTRY_COUNT; index++) {
+            if ((table[index] & PAGE_PRESENT) && !(table[index] & PAGE_BORROWED) && pmm_release_frame(table[index] & ~PAGE_FLAGS_MASK)) {
+                process_statistics.owned_frames--;
+            }
+        }
+
+        pmm_free_frame((physical_address)table);
+        process_statistics.owned_frames--;
+        space->tables[slot] = 0;
+    }
+}
+
+/* a fresh copy of a page for an address space, or 0 if out of memory */
+static physical_address copy_page(physical_address source) {
+    physical_address copy = pmm_alloc_frame();
+
+    if (copy) {
+        memcpy((void*)copy, (const void*)source, PAGE_SIZE);
+        process_statistics.pages_copied++;
+        process_statistics.owned_frames++;
+    }
+
+    return copy;
+}
+
+/* the ELF header, if image is an i386 executable whose loadable segments all fit in the process window below the stack */
+static const struct elf_header *check_image(const char *name, const unsigned char *image, uint32_t size) {
+    const struct elf_header *header = (const struct elf_header*)image;
+    uint32_t limit = PROCESS_STACK_TOP - PROCESS_STACK_SIZE;
+
+    if (size < sizeof(struct elf_header) || memcmp(header->identity, "\x7F" "ELF", 4) != 0 || header->identity[ELF_CLASS] != ELF_CLASS_32 ||
+        header->identity[ELF_DATA] != ELF_DATA_LITTLE_ENDIAN || header->type != ELF_TYPE_EXECUTABLE || header->machine != ELF_MACHINE_386) {
+        kprintf("process: %s is not an i386 ELF executable\n", name);
+        return 0;
+    }
+
+    if (header->program_header_size != sizeof(struct elf_program_header) || header->program_header_offset > size ||
+        (size - header->program_header_offset) / sizeof(struct elf_program_header) < header->program_header_count) {
+        kprintf("process: %s has a damaged program header table\n", name);
+        return 0;
+    }
+
+    if (header->entry < PAGING_USER_BASE || header->entry >= limit) {
+        kprintf("process: %s starts at 0x%08x, outside the process window\n", name, header->entry);
+        return 0;
+    }
+
+    const struct elf_program_header *segments = (const struct elf_program_header*)(image + header->program_header_offset);
+    for (uint32_t index = 0; index < header->program_header_count; index++) {
+        const struct elf_program_header *segment = &segments[index];
+
+        if (segment->type != ELF_SEGMENT_LOAD || segment->memory_size == 0) {
+            continue;
+        }
+        if (segment->virtual_address < PAGING_USER_BASE || segment->virtual_address > limit || segment->memory_size > limit - segment->virtual_address ||
+            segment->file_size > segment->memory_size || segment->offset > size || segment->file_size > size - segment->offset) {
+            kprintf("process: %s has a segment at 0x%08x which doesn't fit\n", name, segment->virtual_address);
+            return 0;
+        }
+    }
+
+    return header;
+}
+
+/*
+Map the pages of one loadable segment. A page comes straight from the image if the segment's file offset and address
+agree within a page, the image's page is aligned, and no bss shares the page. Pages entirely of bss show the zero page.
+Anything else is copied. process_lock must be held, and false means out of memory or two segments sharing a page.
+*/
+static bool load_segment(struct address_space *space, const unsigned char *image, const struct elf_program_header *segment) {
+    uint32_t start = segment->virtual_address & ~(PAGE_SIZE - 1);
+    uint32_t file_end = segment->virtual_address + segment->file_size;
+    uint32_t memory_end = segment->virtual_address + segment->memory_size;
+    bool writable = segment->flags & ELF_SEGMENT_WRITE;
+
+    /* where the segment's first page sits in the image, if the offset and address agree */
+    uint32_t source = (uint32_t)image + segment->offset - (segment->virtual_address - start);
+    bool direct = (source & (PAGE_SIZE - 1)) == 0;
+
+    uint32_t borrowed_flags = PAGE_PRESENT | PAGE_USER | PAGE_BORROWED | (writable ? PAGE_COPY_ON_WRITE : 0);
+
+    for (uint32_t page = start; page < memory_end; page += PAGE_SIZE) {
+        uint32_t *entry = space_entry(space, page, true);
+        if (!entry || *entry) {
+            return false;
+        }
+
+        if (page >= file_end) {
+            *entry = vm_zero_page() | borrowed_flags;
+            continue;
+        }
+
+        /* a page which ends past the file data must be bss there, unless the segment ends with the file data */
+        if (direct && (page + PAGE_SIZE <= file_end || memory_end == file_end)) {
+            *entry = (source + (page - start)) | borrowed_flags;
+            process_statistics.pages_mapped++;
+            continue;
+        }
+
+        physical_address frame = pmm_alloc_frame();
+        if (!frame) {
+            return false;
+        }
+        memset((void*)frame, 0, PAGE_SIZE);
+
+        uint32_t copy_start = page > segment->virtual_address ? page : segment->virtual_address;
+        uint32_t copy_end = page + PAGE_SIZE < file_end ? page + PAGE_SIZE : file_end;
+        memcpy((void*)(frame + (copy_start - page)), image + segment->offset + (copy_start - segment->virtual_address), copy_end - copy_start);
+
+        *entry = frame | PAGE_PRESENT | PAGE_USER | (writable ? PAGE_WRITABLE : 0);
+        process_statistics.pages_copied++;
+        process_statistics.owned_frames++;
+    }
+
+    return true;
+}
+
+/* the stack reads as zero and is copied from the zero page a page at a time as it is written. process_lock must be held */
+static bool map_stack(struct address_space *space) {
+    for (uint32_t page = PROCESS_STACK_TOP - PROCESS_STACK_SIZE; page < PROCESS_STACK_TOP; page += PAGE_SIZE) {
+        uint32_t *entry = space_entry(space, page, true);
+        if (!entry) {
+            return false;
+        }
+        *entry = vm_zero_page() | PAGE_PRESENT | PAGE_USER | PAGE_BORROWED | PAGE_COPY_ON_WRITE;
+    }
+
+    return true;
+}
+
+/*
+Give the child a share of every page of the parent's, with write access taken away from both so the first write to a
+page by either of them copies it. Borrowed pages are only ever copied, so the child takes the parent's entry as it is.
+process_lock must be held. On failure the child holds whatever it had been given so far, for free_space.
+*/
+static bool clone_space(struct address_space *parent, struct address_space *child) {
+    for (uint32_t slot = 0; slot < PAGING_USER_TABLE_COUNT; slot++) {
+        if (!parent->tables[slot]) {
+            continue;
+        }
+
+        uint32_t *parent_table = table_address(parent->tables[slot]);
+        uint32_t *child_table = space_entry(child, PAGING_USER_BASE + slot * LARGE_PAGE_SIZE, true);
+        if (!child_table) {
+            return false;
+        }
+
+        for (uint32_t index = 0; index < PAGE_TABLE_ENTRY_COUNT; index++) {
+            uint32_t entry = parent_table[index];
+
+            if (!(entry & PAGE_PRESENT) || (entry & PAGE_BORROWED)) {
+                child_table[index] = entry;
+                continue;
+            }
+
+            physical_address frame = entry & ~PAGE_FLAGS_MASK;
+            if (!pmm_share_frame(frame)) {
+                /* as many owners as the count holds, so this one gets a copy of its own */
+                physical_address copy = copy_page(frame);
+                if (!copy) {
+                    return false;
+                }
+                child_table[index] = copy | PAGE_PRESENT | PAGE_USER | ((entry & (PAGE_WRITABLE | PAGE_COPY_ON_WRITE)) ? PAGE_WRITABLE : 0);
+                continue;
+            }
+
+            if (entry & PAGE_WRITABLE) {
+                entry = (entry & ~PAGE_WRITABLE) | PAGE_COPY_ON_WRITE;
+                parent_table[index] = entry;
+            }
+            child_table[index] = entry;
+        }
+    }
+
+    return true;
+}
+
+static struct process *process_alloc(const char *name) {
+    struct process *process = kmem_cache_alloc(process_cache);
+    if (!process) {
+        return 0;
+    }
+
+    memset(process, 0, sizeof(*process));
+
+    size_t name_length = strlen(name);
+    if (name_length >= PROCESS_NAME_LENGTH) {
+        name_length = PROCESS_NAME_LENGTH - 1;
+    }
+    memcpy(process->name, name, name_length);
+
+    process->id = __atomic_fetch_add(&next_process_id, 1, __ATOMIC_RELAXED);
+
+    return process;
+}
+
+/* the process cache. needs the slab and setup_vm, which owns the page fault handler */
+void setup_processes() {
+    TRACE_SCOPE(TRACE_SUBSYSTEM_MEMORY, "setup_processes");
+
+    if (pmm_highest_address() > PAGING_USER_BASE) {
+        kprintf("process: RAM reaches past 0x%08x, the identity map overlaps the process window\n", PAGING_USER_BASE);
+        halt();
+    }
+
+    process_cache = kmem_cache_create("process", sizeof(struct process), 0);
+    if (!process_cache) {
+        kprintf("process: no cache for processes\n");
+        halt();
+    }
+}
+
+/*
+A process ready to run from the entry point of the ELF executable in image. The image must stay where it is for as long
+as any process made from it exists, and be in the identity map, as e.g. an initrd file is. Returns 0 if the image
+isn't a loadable executable or there is no memory for its page tables.
+*/
+struct process *process_load(const char *name, const void *image, uint32_t size) {
+    uint64_t start = read_tsc();
+
+    const struct elf_header *header = check_image(name, image, size);
+    if (!header) {
+        return 0;
+    }
+
+    struct process *process = process_alloc(name);
+    if (!process) {
+        return 0;
+    }
+    process->entry = header->entry;
+
+    const struct elf_program_header *segments = (const struct elf_program_header*)((const unsigned char*)image + header->program_header_offset);
+    uint32_t flags = spinlock_acquire_irqsave(&process_lock);
+    bool loaded = true;
+
+    for (uint32_t index = 0; loaded && index < header->program_header_count; index++) {
+        if (segments[index].type == ELF_SEGMENT_LOAD && segments[index].memory_size) {
+            loaded = load_segment(&process->space, image, &segments[index]);
+        }
+    }
+    loaded = loaded && map_stack(&process->space);
+
+    if (loaded) {
+        process_statistics.spawns++;
+        process_statistics.spawn_cycles += read_tsc() - start;
+    } else {
+        free_space(&process->space);
+    }
+    spinlock_release_irqrestore(&process_lock, flags);
+
+    if (!loaded) {
+        kprintf("process: could not load %s, out of memory or segments sharing a page\n", name);
+        kmem_cache_free(process_cache, process);
+        return 0;
+    }
+
+    return process;
+}
+
+/* a process running the executable at path in the initrd */
+struct process *process_spawn(const char *path) {
+    const struct initrd_file *file = initrd_lookup(path);
+    if (!file) {
+        kprintf("process: no %s in the initrd\n", path);
+        return 0;
+    }
+
+    return process_load(file->path, file->data, file->size);
+}
+
+/*
+A copy of the parent's address space, sharing every page copy on write. The child starts again at the entry point when
+run, as processes run to their exit and leave no user context behind to resume. Returns 0 if out of memory.
+*/
+struct process *process_fork(struct process *parent) {
+    uint64_t start = read_tsc();
+
+    struct process *child = process_alloc(parent->name);
+    if (!child) {
+        return 0;
+    }
+    child->entry = parent->entry;
+
+    uint32_t flags = spinlock_acquire_irqsave(&process_lock);
+    bool cloned = clone_space(&parent->space, &child->space);
+
+    /* the parent has just lost write access to its own pages */
+    if (parent == active_process) {
+        paging_switch_user_tables(parent->space.tables);
+    }
+
+    if (cloned) {
+        process_statistics.forks++;
+        process_statistics.fork_cycles += read_tsc() - start;
+    } else {
+        free_space(&child->space);
+    }
+    spinlock_release_irqrestore(&process_lock, flags);
+
+    if (!cloned) {
+        kmem_cache_free(process_cache, child);
+        return 0;
+    }
+
+    return child;
+}
+
+/* switch the process in and run it in ring 3 from its entry point until it makes SYSCALL_EXIT, returning the exit value */
+uint32_t process_run(struct process *process, uint32_t argument) {
+    uint32_t flags = spinlock_acquire_irqsave(&process_lock);
+    active_process = process;
+    paging_switch_user_tables(process->space.tables);
+    spinlock_release_irqrestore(&process_lock, flags);
+
+    uint32_t value = enter_user_mode(process->entry, PROCESS_STACK_TOP, argument);
+
+    flags = spinlock_acquire_irqsave(&process_lock);
+    active_process = 0;
+    paging_switch_user_tables(0);
+    spinlock_release_irqrestore(&process_lock, flags);
+
+    return value;
+}
+
+void process_destroy(struct process *process) {
+    uint32_t flags = spinlock_acquire_irqsave(&process_lock);
+
+    if (process == active_process) {
+        active_process = 0;
+        paging_switch_user_tables(0);
+    }
+    free_space(&process->space);
+
+    spinlock_release_irqrestore(&process_lock, flags);
+    kmem_cache_free(process_cache, process);
+}
+
+/* give the writer a page of its own, or back the frame it already has sole use of. process_lock must be held */
+static bool copy_on_write(struct address_space *space, uint32_t page) {
+    uint32_t *entry = space_entry(space, page, false);
+
+    if (!entry || !(*entry & PAGE_PRESENT)) {
+        return false;
+    }
+    if (*entry & PAGE_WRITABLE) {
+        /* already copied, only this CPU's TLB was out of date */
+        paging_invalidate(page);
+        return true;
+    }
+    if (!(*entry & PAGE_COPY_ON_WRITE)) {
+        return false;
+    }
+
+    physical_address frame = *entry & ~PAGE_FLAGS_MASK;
+    uint32_t flags = PAGE_PRESENT | PAGE_USER | PAGE_WRITABLE;
+    process_statistics.copy_on_write_faults++;
+
+    if (!(*entry & PAGE_BORROWED) && !pmm_frame_shared(frame)) {
+        *entry = frame | flags;
+        process_statistics.pages_reclaimed++;
+    } else if (frame == vm_zero_page()) {
+        physical_address copy = pmm_alloc_frame();
+        if (!copy) {
+            return false;
+        }
+        memset((void*)copy, 0, PAGE_SIZE);
+        *entry = copy | flags;
+        process_statistics.zero_fills++;
+        process_statistics.owned_frames++;
+    } else {
+        physical_address copy = copy_page(frame);
+        if (!copy) {
+            return false;
+        }
+        if (!(*entry & PAGE_BORROWED) && pmm_release_frame(frame)) {
+            process_statistics.owned_frames--;
+        }
+        *entry = copy | flags;
+    }
+
+    paging_invalidate(page);
+    return true;
+}
+
+/* the process switched in to the process window, i.e. the one making a system call, or 0 */
+struct process *process_current() {
+    return active_process;
+}
+
+/* whether [address, address + length) lies inside the process window */
+static bool in_window(uint32_t address, uint32_t length) {
+    return address >= PAGING_USER_BASE && address < PAGING_USER_END && length <= PAGING_USER_END - address;
+}
+
+/*
+Copy between a process's memory and a kernel buffer, going through the identity map to each page's frame so nothing can
+fault, whether or not the process is switched in. A write to a copy on write page copies the page first. Returns false,
+possibly part way through, if the range isn't all mapped or, for a write, isn't all writable.
+*/
+static bool transfer(struct process *process, uint32_t address, unsigned char *buffer, uint32_t length, bool write) {
+    if (!in_window(address, length)) {
+        return false;
+    }
+
+    uint32_t flags = spinlock_acquire_irqsave(&process_lock);
+    bool done = true;
+
+    while (length) {
+        uint32_t page = address & ~(PAGE_SIZE - 1);
+        uint32_t offset = address - page;
+        uint32_t chunk = PAGE_SIZE - offset < length ? PAGE_SIZE - offset : length;
+        uint32_t *entry = space_entry(&process->space, page, false);
+
+        if (!entry || !(*entry & PAGE_PRESENT) || (write && !(*entry & PAGE_WRITABLE) && !copy_on_write(&process->space, page))) {
+            done = false;
+            break;
+        }
+
+        unsigned char *frame = (unsigned char*)(*entry & ~PAGE_FLAGS_MASK) + offset;
+        if (write) {
+            memcpy(frame, buffer, chunk);
+        } else {
+            memcpy(buffer, frame, chunk);
+        }
+
+        address += chunk;
+        buffer += chunk;
+        length -= chunk;
+    }
+
+    spinlock_release_irqrestore(&process_lock, flags);
+
+    return done;
+}
+
+bool process_read(struct process *process, uint32_t address, void *destination, uint32_t length) {
+    return transfer(process, address, destination, length, false);
+}
+
+bool process_write(struct process *process, uint32_t address, const void *source, uint32_t length) {
+    return transfer(process, address, (unsigned char*)source, length, true);
+}
+
+/* drop pages taken by process_share_pages which were never mapped anywhere */
+void process_release_pages(const uint32_t *pages, uint32_t page_count) {
+    uint32_t flags = spinlock_acquire_irqsave(&process_lock);
+
+    for (uint32_t index = 0; index < page_count; index++) {
+        if (!(pages[index] & PAGE_BORROWED) && pmm_release_frame(pages[index] & ~PAGE_FLAGS_MASK)) {
+            process_statistics.owned_frames--;
+        }
+    }
+
+    spinlock_release_irqrestore(&process_lock, flags);
+}
+
+/*
+Take a share of each page in [address, address + page_count pages), for handing to another address space without
+copying. pages gets a frame per page, with PAGE_BORROWED for borrowed ones, and each share must go to process_map_pages
+or process_release_pages. The process keeps its pages but loses write access, exactly as at a fork. The address must
+be page aligned. Returns false, having taken nothing, if any page isn't mapped.
+*/
+bool process_share_pages(struct process *process, uint32_t address, uint32_t page_count, uint32_t *pages) {
+    if ((address & (PAGE_SIZE - 1)) || page_count > (PAGING_USER_END - PAGING_USER_BASE) / PAGE_SIZE || !in_window(address, page_count * PAGE_SIZE)) {
+        return false;
+    }
+
+    uint32_t flags = spinlock_acquire_irqsave(&process_lock);
+    bool active = process == active_process;
+    uint32_t shared = 0;
+
+    for (; shared < page_count; shared++) {
+        uint32_t page = address + shared * PAGE_SIZE;
+        uint32_t *entry = space_entry(&process->space, page, false);
+
+        if (!entry || !(*entry & PAGE_PRESENT)) {
+            break;
+        }
+
+        physical_address frame = *entry & ~PAGE_FLAGS_MASK;
+        if (*entry & PAGE_BORROWED) {
+            pages[shared] = frame | PAGE_BORROWED;
+            continue;
+        }
+        if (!pmm_share_frame(frame)) {
+            physical_address copy = copy_page(frame);
+            if (!copy) {
+                break;
+            }
+            pages[shared] = copy;
+            continue;
+        }
+
+        if (*entry & PAGE_WRITABLE) {
+            *entry = (*entry & ~PAGE_WRITABLE) | PAGE_COPY_ON_WRITE;
+            if (active) {
+                paging_invalidate(page);
+            }
+        }
+        pages[shared] = frame;
+    }
+
+    spinlock_release_irqrestore(&process_lock, flags);
+
+    if (shared < page_count) {
+        process_release_pages(pages, shared);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+Map pages from process_share_pages at the page aligned address, copy on write, replacing whatever was there. The shares
+pass to the process. Returns false, having mapped nothing, if the range is outside the process window or a page table
+couldn't be allocated, and the caller still holds the shares then.
+*/
+bool process_map_pages(struct process *process, uint32_t address, uint32_t page_count, const uint32_t *pages) {
+    if ((address & (PAGE_SIZE - 1)) || page_count > (PAGING_USER_END - PAGING_USER_BASE) / PAGE_SIZE || !in_window(address, page_count * PAGE_SIZE)) {
+        return false;
+    }
+
+    uint32_t flags = spinlock_acquire_irqsave(&process_lock);
+    bool new_tables = false;
+
+    /* every table first, so nothing after this can fail */
+    for (uint32_t index = 0; index < page_count; index++) {
+        uint32_t page = address + index * PAGE_SIZE;
+
+        new_tables |= !process->space.tables[table_slot(page)];
+        if (!space_entry(&process->space, page, true)) {
+            spinlock_release_irqrestore(&process_lock, flags);
+            return false;
+        }
+    }
+
+    for (uint32_t index = 0; index < page_count; index++) {
+        uint32_t page = address + index * PAGE_SIZE;
+        uint32_t *entry = space_entry(&process->space, page, false);
+
+        if ((*entry & PAGE_PRESENT) && !(*entry & PAGE_BORROWED) && pmm_release_frame(*entry & ~PAGE_FLAGS_MASK)) {
+            process_statistics.owned_frames--;
+        }
+        *entry = (pages[index] & ~PAGE_FLAGS_MASK) | PAGE_PRESENT | PAGE_USER | PAGE_COPY_ON_WRITE | (pages[index] & PAGE_BORROWED);
+    }
+
+    /* a new table has to reach the kernel page directory, and a reload is cheaper than many invlpgs anyway */
+    if (process == active_process) {
+        if (new_tables || page_count > PAGING_INVLPG_LIMIT) {
+            paging_switch_user_tables(process->space.tables);
+        } else {
+            for (uint32_t index = 0; index < page_count; index++) {
+                paging_invalidate(address + index * PAGE_SIZE);
+            }
+        }
+    }
+
+    spinlock_release_irqrestore(&process_lock, flags);
+
+    return true;
+}
+
+/* called by the page fault handler for faults in the process window. only writes to copy on write pages are resolved */
+bool process_fault(uint32_t page, uint32_t error_code) {
+    if ((error_code & (PAGE_FAULT_PRESENT | PAGE_FAULT_WRITE)) != (PAGE_FAULT_PRESENT | PAGE_FAULT_WRITE)) {
+        return false;
+    }
+
+    uint64_t start = read_tsc();
+    spinlock_acquire(&process_lock);
+    bool resolved = active_process && copy_on_write(&active_process->space, page);
+    process_statistics.fault_cycles += read_tsc() - start;
+    spinlock_release(&process_lock);
+
+    return resolved;
+}
+
+void process_print_statistics() {
+    uint32_t flags = spinlock_acquire_irqsave(&process_lock);
+    struct process_statistics copy = process_statistics;
+    spinlock_release_irqrestore(&process_lock, flags);
+
+    kprintf("process: %u spawns (%u cycles average), %u forks (%u cycles average), %u pages mapped from images, %u copied\n",
+        copy.spawns, tsc_average_cycles(copy.spawn_cycles, copy.spawns), copy.forks, tsc_average_cycles(copy.fork_cycles, copy.forks),
+        copy.pages_mapped, copy.pages_copied);
+    kprintf("process: %u copy on write faults (%u reclaimed, %u zero fill, %u cycles average), %u frames owned\n",
+        copy.copy_on_write_faults, copy.pages_reclaimed, copy.zero_fills, tsc_average_cycles(copy.fault_cycles, copy.copy_on_write_faults),
+        copy.owned_frames);
+}
+
+/*
+Run the test program, fork it, and run both sides again: each must see its own writes and not the other's, a fresh
+process must not see any of them, as they went to copies rather than the initrd, forking must copy nothing, and once
+every process is destroyed every frame they took must be back.
+*/
+bool process_self_test() {
+    if (!initrd_lookup(PROCESS_TEST_PATH)) {
+        kprintf("process self-test: no %s in the initrd, skipped\n", PROCESS_TEST_PATH);
+        return true;
+    }
+
+    uint32_t owned_before = process_statistics.owned_frames;
+    bool passed = true;
+
+    struct process *parent = process_spawn(PROCESS_TEST_PATH);
+    if (!parent) {
+        return false;
+    }
+    if (process_run(parent, 5) != PROCESS_TEST_VALUE) {
+        kprintf("process self-test: a fresh process saw the wrong data\n");
+        passed = false;
+    }
+
+    uint32_t copied_before = process_statistics.pages_copied;
+    struct process *child = process_fork(parent);
+    if (!child) {
+        process_destroy(parent);
+        return false;
+    }
+    if (process_statistics.pages_copied != copied_before) {
+        kprintf("process self-test: fork copied %u pages\n", process_statistics.pages_copied - copied_before);
+        passed = false;
+    }
+
+    /* value is now PROCESS_TEST_VALUE + 5 and count 1 on both sides */
+    uint32_t child_value = process_run(child, 7);
+    uint32_t parent_value = process_run(parent, 0);
+    if (child_value != PROCESS_TEST_VALUE + 6 || parent_value != PROCESS_TEST_VALUE + 6) {
+        kprintf("process self-test: after fork the child saw 0x%x and the parent 0x%x\n", child_value, parent_value);
+        passed = false;
+    }
+    if (process_run(child, 0) != PROCESS_TEST_VALUE + 14) {
+        kprintf("process self-test: the child lost its own writes\n");
+        passed = false;
+    }
+
+    struct process *fresh = process_spawn(PROCESS_TEST_PATH);
+    if (!fresh || process_run(fresh, 0) != PROCESS_TEST_VALUE) {
+        kprintf("process self-test: a write reached the initrd\n");
+        passed = false;
+    }
+
+    process_destroy(parent);
+    process_destroy(child);
+    if (fresh) {
+        process_destroy(fresh);
+    }
+
+    if (process_statistics.owned_frames != owned_before) {
+        kprintf("process self-test: %u frames not given back\n", process_statistics.owned_frames - owned_before);
+        passed = false;
+    }
+
+    return passed;
+}
@@ -0,0 +1,78 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kernel/interrupts.h>
+#include <kernel/kprintf.h>
+#include <kernel/profile.h>
+#include <kernel/timer.h>
+
+/* linker.ld */
+extern char text_start;
+extern char text_end;
+
+static uint32_t histogram[PROFILE_BUCKET_COUNT];
+static uint32_t samples = 0;
+static uint32_t user_samples = 0; /* taken while in ring 3 */
+static uint32_t outside_samples = 0; /* in the kernel but not in .text, or past PROFILE_MAXIMUM_TEXT_SIZE */
+
+static volatile bool sampling = false;
+
+/* timer callback: bump the bucket for wherever the interrupted code was */
+static void profile_sample(struct interrupt_frame *frame) {
+    if (!sampling) {
+        return;
+    }
+
+    samples++;
+
+    if ((frame->cs & 3) == 3) {
+        user_samples++;
+        return;
+    }
+
+    uint32_t offset = frame->eip - (uint32_t)&text_start;
+    if (frame->eip >= (uint32_t)&text_end || offset >= PROFILE_MAXIMUM_TEXT_SIZE) {
+        outside_samples++;
+        return;
+    }
+
+    histogram[offset >> PROFILE_BUCKET_SHIFT]++;
+}
+
+/* hook the profiler on to the timer. needs setup_timer */
+void setup_profile() {
+    timer_register_callback(profile_sample);
+}
+
+void profile_start() {
+    sampling = true;
+}
+
+void profile_stop() {
+    sampling = false;
+}
+
+/*
+Write the histogram to one sink as text, one "address count" line per non-empty bucket between PROFILE-BEGIN and
+PROFILE-END markers. tools/profile-report.py picks this out of a serial or debug port capture and symbolises it.
+*/
+void profile_dump(struct kprintf_sink *sink) {
+    bool was_sampling = sampling;
+    uint32_t bucket_count = ((uint32_t)&text_end - (uint32_t)&text_start + (1 << PROFILE_BUCKET_SHIFT) - 1) >> PROFILE_BUCKET_SHIFT;
+
+    if (bucket_count > PROFILE_BUCKET_COUNT) {
+        bucket_count = PROFILE_BUCKET_COUNT;
+    }
+
+    sampling = false;
+
+    kprintf_to(sink, "PROFILE-BEGIN %08x %u %u %u %u\n", (uint32_t)&text_start, 1 << PROFILE_BUCKET_SHIFT, samples, user_samples, outside_samples);
+    for (uint32_t bucket = 0; bucket < bucket_count; bucket++) {
+        if (histogram[bucket]) {
+            kprintf_to(sink, "%08x %u\n", (uint32_t)&text_start + (bucket << PROFILE_BUCKET_SHIFT), histogram[bucket]);
+        }
+    }
+    kprintf_to(sink, "PROFILE-END\n");
+
+    sampling = was_sampling;
+}
@@ -0,0 +1,37 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kernel/interrupts.h>
+#include <kernel/lapic.h>
+#include <kernel/rcu.h>
+#include <kernel/smp.h>
+#include <kernel/thread.h>
+
+volatile uint32_t rcu_global_epoch = 0;
+
+/*
+Start a new epoch and wait for every other online CPU to report a quiescent state in it. A reschedule IPI hurries along
+a CPU which is busy in one thread, otherwise it would only be seen at its next tick. The calling CPU is quiescent by
+definition, as it isn't in a read section. Comparisons are done on the difference so the epoch can wrap.
+*/
+void synchronize_rcu() {
+    uint32_t epoch = __atomic_add_fetch(&rcu_global_epoch, 1, __ATOMIC_SEQ_CST);
+    uint32_t self = this_cpu_read(index);
+
+    rcu_quiescent_state();
+
+    for (uint32_t index = 0; index < online_cpu_count; index++) {
+        struct cpu *cpu = &cpus[index];
+
+        if (index == self || !cpu->online || (int32_t)(cpu->rcu_epoch - epoch) >= 0) {
+            continue;
+        }
+
+        if (lapic_available) {
+            lapic_send_ipi(cpu->apic_id, INTERRUPT_VECTOR_RESCHEDULE);
+        }
+        while ((int32_t)(__atomic_load_n(&cpu->rcu_epoch, __ATOMIC_ACQUIRE) - epoch) < 0) {
+            __asm__ volatile ("pause");
+        }
+    }
+}
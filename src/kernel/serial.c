@@ -0,0 +1,168 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kernel/intel.h>
+#include <kernel/interrupts.h>
+#include <kernel/serial.h>
+#include <kernel/spinlock.h>
+
+/* 16550 registers, as offsets from the base port */
+#define UART_DATA 0 /* THR/RBR, or divisor low byte with DLAB set */
+#define UART_INTERRUPT_ENABLE 1 /* IER, or divisor high byte with DLAB set */
+#define UART_FIFO_CONTROL 2 /* FCR on write, IIR on read */
+#define UART_LINE_CONTROL 3
+#define UART_MODEM_CONTROL 4
+#define UART_LINE_STATUS 5
+
+#define UART_LINE_CONTROL_DLAB 0x80
+#define UART_LINE_CONTROL_8N1 0x03
+#define UART_FIFO_ENABLE_AND_CLEAR 0xC7 /* enable, clear both FIFOs, 14 byte receive trigger */
+#define UART_MODEM_CONTROL_DTR_RTS_OUT2 0x0B /* OUT2 gates the IRQ line on PC hardware */
+#define UART_INTERRUPT_TRANSMIT_EMPTY 0x02
+#define UART_LINE_STATUS_TRANSMIT_EMPTY 0x20
+#define UART_LINE_STATUS_TRANSMITTER_IDLE 0x40 /* the FIFO and the shift register are both empty */
+
+#define UART_FIFO_DEPTH 16
+#define UART_DIVISOR 1 /* 115200 baud, the fastest the divisor allows */
+
+static char transmit_buffer[SERIAL_TRANSMIT_BUFFER_SIZE];
+static uint32_t transmit_head = 0; /* next byte to be queued */
+static uint32_t transmit_tail = 0; /* next byte to go to the UART */
+
+/* guards the ring and the UART between writers and the interrupt handler, which may be on different CPUs */
+static struct spinlock serial_lock = SPINLOCK_INIT;
+
+static bool serial_present = false;
+static bool interrupts_enabled = false;
+
+/* move up to a FIFO's worth of queued bytes in to the UART. the transmitter must be known to be empty. serial_lock must be held */
+static void fill_fifo() {
+    for (unsigned int count = 0; count < UART_FIFO_DEPTH && transmit_tail != transmit_head; count++) {
+        outb(SERIAL_COM1_PORT + UART_DATA, transmit_buffer[transmit_tail++ & (SERIAL_TRANSMIT_BUFFER_SIZE - 1)]);
+    }
+}
+
+/* start the transmitter if it is idle. one LSR read per FIFO load rather than per byte */
+static void kick_transmitter() {
+    if (inb(SERIAL_COM1_PORT + UART_LINE_STATUS) & UART_LINE_STATUS_TRANSMIT_EMPTY) {
+        fill_fifo();
+    }
+}
+
+/* set up COM1 for 115200 8N1 with FIFOs on. returns false if there is no UART there */
+bool serial_init() {
+    outb(SERIAL_COM1_PORT + UART_INTERRUPT_ENABLE, 0);
+
+    outb(SERIAL_COM1_PORT + UART_LINE_CONTROL, UART_LINE_CONTROL_DLAB);
+    outb(SERIAL_COM1_PORT + UART_DATA, UART_DIVISOR & 0xFF);
+    outb(SERIAL_COM1_PORT + UART_INTERRUPT_ENABLE, (UART_DIVISOR >> 8) & 0xFF);
+    outb(SERIAL_COM1_PORT + UART_LINE_CONTROL, UART_LINE_CONTROL_8N1);
+
+    outb(SERIAL_COM1_PORT + UART_FIFO_CONTROL, UART_FIFO_ENABLE_AND_CLEAR);
+    outb(SERIAL_COM1_PORT + UART_MODEM_CONTROL, UART_MODEM_CONTROL_DTR_RTS_OUT2);
+
+    /* a floating bus reads back as all ones */
+    serial_present = inb(SERIAL_COM1_PORT + UART_LINE_STATUS) != 0xFF;
+
+    return serial_present;
+}
+
+/* queue bytes for transmission. only waits if the transmit ring is full */
+void serial_write(const char *string, unsigned int length) {
+    if (!serial_present) {
+        return;
+    }
+
+    while (length > 0) {
+        uint32_t flags = spinlock_acquire_irqsave(&serial_lock);
+        uint32_t space = SERIAL_TRANSMIT_BUFFER_SIZE - (transmit_head - transmit_tail);
+
+        if (space == 0) {
+            kick_transmitter();
+        }
+
+        for (; space > 0 && length > 0; space--, length--) {
+            transmit_buffer[transmit_head++ & (SERIAL_TRANSMIT_BUFFER_SIZE - 1)] = *(string++);
+        }
+
+        spinlock_release_irqrestore(&serial_lock, flags);
+    }
+
+    uint32_t flags = spinlock_acquire_irqsave(&serial_lock);
+    kick_transmitter();
+    spinlock_release_irqrestore(&serial_lock, flags);
+}
+
+/* without the transmit interrupt nothing else will drain the ring, so push it all out now. the same goes if interrupts are off */
+void serial_flush() {
+    if (!serial_present || (interrupts_enabled && interrupts_are_enabled())) {
+        return;
+    }
+
+    uint32_t flags = spinlock_acquire_irqsave(&serial_lock);
+    while (transmit_tail != transmit_head) {
+        kick_transmitter();
+    }
+    spinlock_release_irqrestore(&serial_lock, flags);
+}
+
+/* push out everything queued and wait for the last bit to leave the UART, e.g. before the machine goes away. interrupts must be off */
+void serial_wait_idle() {
+    if (!serial_present) {
+        return;
+    }
+
+    serial_flush();
+    while (!(inb(SERIAL_COM1_PORT + UART_LINE_STATUS) & UART_LINE_STATUS_TRANSMITTER_IDLE)) {
+        __asm__ volatile ("pause");
+    }
+}
+
+/* switch to interrupt driven transmission. the caller must have routed SERIAL_COM1_IRQ to serial_interrupt */
+void serial_enable_interrupts() {
+    if (!serial_present) {
+        return;
+    }
+
+    interrupts_enabled = true;
+    outb(SERIAL_COM1_PORT + UART_INTERRUPT_ENABLE, UART_INTERRUPT_TRANSMIT_EMPTY);
+}
+
+/* transmit holding register empty: refill the FIFO from the ring. reading IIR acknowledges the interrupt */
+void serial_interrupt(struct interrupt_frame *frame) {
+    (void)frame;
+
+    spinlock_acquire(&serial_lock);
+    inb(SERIAL_COM1_PORT + UART_FIFO_CONTROL);
+    kick_transmitter();
+    spinlock_release(&serial_lock);
+}
+
+static void serial_sink_write(const char *string, unsigned int length, void *context) {
+    (void)context;
+
+    serial_write(string, length);
+}
+
+static void serial_sink_flush(void *context) {
+    (void)context;
+
+    serial_flush();
+}
+
+struct kprintf_sink serial_sink = {serial_sink_write, serial_sink_flush, 0};
+
+/* bochs (port_e9_hack) and qemu (-debugcon) read back 0xE9 from the debug port */
+bool debug_port_present() {
+    return inb(DEBUG_PORT) == DEBUG_PORT;
+}
+
+/* the debug port has no FIFO or status to wait on, so a whole run goes out with one rep outsb */
+static void debug_port_sink_write(const char *string, unsigned int length, void *context) {
+    (void)context;
+
+    __asm__ volatile ("rep outsb" : "+S"(string), "+c"(length) : "d"(DEBUG_PORT) : "memory");
+}
+
+struct kprintf_sink debug_port_sink = {debug_port_sink_write, 0, 0};
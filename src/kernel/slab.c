@@ -0,0 +1,338 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kernel/intel.h>
+#include <kernel/kprintf.h>
+#include <kernel/pmm.h>
+#include <kernel/slab.h>
+#include <kernel/spinlock.h>
+#include <kernel/trace.h>
+
+#include <klegit/mini-printf.h>
+#include <klegit/string.h>
+
+#define SLAB_MAGIC 0x51AB51AB
+#define LARGE_ALLOCATION_MAGIC 0x1A63A110
+
+#define KMALLOC_CACHE_COUNT (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+#define SLAB_SELF_TEST_OBJECTS 1024
+
+/*
+
+Each slab is a single page from the physical memory manager, with this header in its first cache line and the objects
+after it. The header is found from any object by masking off the low bits of its address, so kfree needs no lookup.
+Free objects are chained through their first word, making allocation and free a list pop and push.
+
+Allocations too big for a size class get whole pages, with a large_allocation header in the first cache line instead.
+Both headers start with a magic number so kfree can tell them apart.
+
+*/
+struct slab {
+    uint32_t magic;
+    struct kmem_cache *cache;
+    struct slab *next;
+    struct slab *previous;
+    void *free_objects;
+    uint32_t objects_in_use;
+};
+
+struct large_allocation {
+    uint32_t magic;
+    uint32_t order;
+};
+
+#define SLAB_HEADER_SIZE ((sizeof(struct slab) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1))
+
+/* caches for kmem_cache structures themselves, and for the kmalloc size classes */
+static struct kmem_cache cache_cache;
+static struct kmem_cache *kmalloc_caches[KMALLOC_CACHE_COUNT];
+static struct kmem_cache *all_caches = 0;
+
+/* one lock for every cache, held across the list operations in alloc and free */
+static LOCK_STATISTICS(slab_lock_statistics, "slab");
+static struct spinlock slab_lock = SPINLOCK_INIT_WITH_STATISTICS(&slab_lock_statistics);
+
+static uint32_t large_allocations = 0;
+static uint32_t large_frees = 0;
+
+static void slab_list_remove(struct slab **list, struct slab *slab) {
+    if (slab->previous) {
+        slab->previous->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if (slab->next) {
+        slab->next->previous = slab->previous;
+    }
+}
+
+static void slab_list_push(struct slab **list, struct slab *slab) {
+    slab->previous = 0;
+    slab->next = *list;
+    if (slab->next) {
+        slab->next->previous = slab;
+    }
+    *list = slab;
+}
+
+static void cache_init(struct kmem_cache *cache, char *name, uint32_t object_size, uint32_t flags) {
+    memset(cache, 0, sizeof(struct kmem_cache));
+    mini_snprintf(cache->name, KMEM_CACHE_NAME_LENGTH, "%s", name);
+
+    /* objects hold the free list link while free, so need at least a pointer's worth of space */
+    cache->object_size = object_size;
+    cache->stride = object_size < sizeof(void*) ? sizeof(void*) : (object_size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    if (flags & KMEM_CACHE_ALIGN) {
+        cache->stride = (cache->stride + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+    }
+    cache->objects_per_slab = (SLAB_SIZE - SLAB_HEADER_SIZE) / cache->stride;
+
+    cache->next = all_caches;
+    all_caches = cache;
+}
+
+/* take a fresh page and thread all of its objects on to the slab's free list */
+static struct slab *cache_grow(struct kmem_cache *cache) {
+    struct slab *slab = (struct slab*)pmm_alloc_frame();
+
+    if (slab == 0) {
+        return 0;
+    }
+
+    slab->magic = SLAB_MAGIC;
+    slab->cache = cache;
+    slab->objects_in_use = 0;
+    slab->free_objects = 0;
+
+    /* chain back to front so objects are handed out in address order */
+    for (uint32_t index = cache->objects_per_slab; index > 0; index--) {
+        void **object = (void**)((uint32_t)slab + SLAB_HEADER_SIZE + (index - 1) * cache->stride);
+        *object = slab->free_objects;
+        slab->free_objects = object;
+    }
+
+    cache->slab_count++;
+    return slab;
+}
+
+/* make a named cache of fixed size objects. returns 0 if the objects would not fit in a slab */
+struct kmem_cache *kmem_cache_create(char *name, uint32_t object_size, uint32_t flags) {
+    if (object_size == 0 || object_size > SLAB_SIZE - SLAB_HEADER_SIZE) {
+        return 0;
+    }
+
+    struct kmem_cache *cache = kmem_cache_alloc(&cache_cache);
+    if (cache == 0) {
+        return 0;
+    }
+
+    uint32_t interrupt_flags = spinlock_acquire_irqsave(&slab_lock);
+    cache_init(cache, name, object_size, flags);
+    spinlock_release_irqrestore(&slab_lock, interrupt_flags);
+
+    return cache;
+}
+
+/* pop an object off the first partially used slab, falling back to an empty slab and then a new one */
+void *kmem_cache_alloc(struct kmem_cache *cache) {
+    uint32_t interrupt_flags = spinlock_acquire_irqsave(&slab_lock);
+    struct slab *slab = cache->partial_slabs;
+
+    if (slab == 0) {
+        slab = cache->empty_slabs;
+        if (slab) {
+            slab_list_remove(&cache->empty_slabs, slab);
+        } else {
+            slab = cache_grow(cache);
+            if (slab == 0) {
+                spinlock_release_irqrestore(&slab_lock, interrupt_flags);
+                return 0;
+            }
+        }
+        slab_list_push(&cache->partial_slabs, slab);
+    }
+
+    void **object = slab->free_objects;
+    slab->free_objects = *object;
+    slab->objects_in_use++;
+
+    if (slab->free_objects == 0) {
+        slab_list_remove(&cache->partial_slabs, slab);
+        slab_list_push(&cache->full_slabs, slab);
+    }
+
+    cache->allocations++;
+    cache->objects_in_use++;
+    spinlock_release_irqrestore(&slab_lock, interrupt_flags);
+
+    return object;
+}
+
+/* push an object back on to its slab. one empty slab is kept per cache, any more go back to the frame allocator */
+void kmem_cache_free(struct kmem_cache *cache, void *object) {
+    uint32_t interrupt_flags = spinlock_acquire_irqsave(&slab_lock);
+    struct slab *slab = (struct slab*)((uint32_t)object & ~(SLAB_SIZE - 1));
+
+    if (slab->free_objects == 0) {
+        slab_list_remove(&cache->full_slabs, slab);
+        slab_list_push(&cache->partial_slabs, slab);
+    }
+
+    *(void**)object = slab->free_objects;
+    slab->free_objects = object;
+    slab->objects_in_use--;
+
+    if (slab->objects_in_use == 0) {
+        slab_list_remove(&cache->partial_slabs, slab);
+        if (cache->empty_slabs) {
+            slab->magic = 0;
+            pmm_free_frame((physical_address)slab);
+            cache->slab_count--;
+        } else {
+            slab_list_push(&cache->empty_slabs, slab);
+        }
+    }
+
+    cache->frees++;
+    cache->objects_in_use--;
+    spinlock_release_irqrestore(&slab_lock, interrupt_flags);
+}
+
+/* set up the cache of caches and the kmalloc size classes */
+void setup_slab() {
+    TRACE_SCOPE(TRACE_SUBSYSTEM_MEMORY, "setup_slab");
+
+    char name[KMEM_CACHE_NAME_LENGTH];
+
+    cache_init(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), KMEM_CACHE_ALIGN);
+
+    for (uint32_t index = 0; index < KMALLOC_CACHE_COUNT; index++) {
+        uint32_t size = 1u << (KMALLOC_MIN_SHIFT + index);
+
+        mini_snprintf(name, KMEM_CACHE_NAME_LENGTH, "kmalloc-%u", size);
+        kmalloc_caches[index] = kmem_cache_create(name, size, 0);
+    }
+}
+
+/* allocate from the smallest size class that fits, or whole pages past the largest class */
+void *kmalloc(size_t size) {
+    if (size <= (1u << KMALLOC_MAX_SHIFT)) {
+        uint32_t index = 0;
+
+        while ((1u << (KMALLOC_MIN_SHIFT + index)) < size) {
+            index++;
+        }
+
+        return kmem_cache_alloc(kmalloc_caches[index]);
+    }
+
+    unsigned int order = 0;
+    while (((size_t)FRAME_SIZE << order) < size + CACHE_LINE_SIZE) {
+        order++;
+    }
+
+    struct large_allocation *allocation = (struct large_allocation*)pmm_alloc_frames(order);
+    if (allocation == 0) {
+        return 0;
+    }
+
+    allocation->magic = LARGE_ALLOCATION_MAGIC;
+    allocation->order = order;
+    __atomic_fetch_add(&large_allocations, 1, __ATOMIC_RELAXED);
+
+    return (void*)((uint32_t)allocation + CACHE_LINE_SIZE);
+}
+
+void kfree(void *pointer) {
+    if (pointer == 0) {
+        return;
+    }
+
+    struct slab *slab = (struct slab*)((uint32_t)pointer & ~(SLAB_SIZE - 1));
+
+    if (slab->magic == SLAB_MAGIC) {
+        kmem_cache_free(slab->cache, pointer);
+        return;
+    }
+
+    struct large_allocation *allocation = (struct large_allocation*)((uint32_t)pointer - CACHE_LINE_SIZE);
+    if (allocation->magic == LARGE_ALLOCATION_MAGIC) {
+        allocation->magic = 0;
+        __atomic_fetch_add(&large_frees, 1, __ATOMIC_RELAXED);
+        pmm_free_frames((physical_address)allocation, allocation->order);
+        return;
+    }
+
+    kprintf("kfree: 0x%08x was not allocated by kmalloc\n", (uint32_t)pointer);
+}
+
+/* per cache counters. fragmentation is the share of slab memory not holding live objects */
+void slab_print_statistics() {
+    kprintf_begin_batch();
+    kprintf("%-16s %6s %8s %8s %6s %6s\n", "cache", "size", "allocs", "frees", "slabs", "waste");
+
+    for (struct kmem_cache *cache = all_caches; cache; cache = cache->next) {
+        uint32_t slab_bytes = cache->slab_count * SLAB_SIZE;
+        uint32_t live_bytes = cache->objects_in_use * cache->object_size;
+
+        kprintf("%-16s %6u %8u %8u %6u %5u%%\n", cache->name, cache->object_size, cache->allocations, cache->frees,
+            cache->slab_count, slab_bytes ? 100 - live_bytes * 100 / slab_bytes : 0);
+    }
+
+    kprintf("large allocations: %u, frees: %u\n", large_allocations, large_frees);
+    kprintf_end_batch();
+}
+
+/*
+Stress kmalloc with a few thousand allocations of random sizes (including whole-page ones), freeing and reallocating at
+random, checking each object's fill pattern survives. Everything must be back to zero objects in use at the end.
+*/
+bool slab_self_test() {
+    void **objects = kmalloc(SLAB_SELF_TEST_OBJECTS * sizeof(void*));
+    uint32_t *sizes = kmalloc(SLAB_SELF_TEST_OBJECTS * sizeof(uint32_t));
+    uint32_t random = 0x9E3779B9;
+    bool passed = true;
+
+    if (objects == 0 || sizes == 0) {
+        return false;
+    }
+    memset(objects, 0, SLAB_SELF_TEST_OBJECTS * sizeof(void*));
+
+    for (uint32_t round = 0; round < 4 * SLAB_SELF_TEST_OBJECTS; round++) {
+        random = random * 1664525 + 1013904223;
+        uint32_t index = (random >> 8) % SLAB_SELF_TEST_OBJECTS;
+
+        if (objects[index]) {
+            for (uint32_t byte = 0; byte < sizes[index]; byte++) {
+                if (((unsigned char*)objects[index])[byte] != (unsigned char)index) {
+                    passed = false;
+                }
+            }
+            kfree(objects[index]);
+            objects[index] = 0;
+        } else {
+            sizes[index] = 1 + (random >> 20) % ((random & 0x10) ? 8192 : 512);
+            objects[index] = kmalloc(sizes[index]);
+            if (objects[index] == 0) {
+                passed = false;
+                continue;
+            }
+            memset(objects[index], index & 0xFF, sizes[index]);
+        }
+    }
+
+    for (uint32_t index = 0; index < SLAB_SELF_TEST_OBJECTS; index++) {
+        kfree(objects[index]);
+    }
+    kfree(objects);
+    kfree(sizes);
+
+    for (uint32_t index = 0; index < KMALLOC_CACHE_COUNT; index++) {
+        if (kmalloc_caches[index]->objects_in_use != 0) {
+            passed = false;
+        }
+    }
+
+    return passed && large_allocations == large_frees;
+}
@@ -0,0 +1,153 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kernel/acpi.h>
+#include <kernel/boot.h>
+#include <kernel/fpu.h>
+#include <kernel/intel.h>
+#include <kernel/klog.h>
+#include <kernel/kprintf.h>
+#include <kernel/lapic.h>
+#include <kernel/paging.h>
+#include <kernel/pmm.h>
+#include <kernel/smp.h>
+#include <kernel/syscall.h>
+#include <kernel/thread.h>
+#include <kernel/timer.h>
+#include <kernel/trace.h>
+#include <kernel/tsc.h>
+
+#include <klegit/string.h>
+
+#define SMP_NO_CPU 0xFF
+
+/* cpus[0] is the boot CPU, the rest are filled in as application processors come up */
+struct cpu cpus[SMP_MAX_CPUS];
+uint32_t online_cpu_count = 1;
+
+/* CPUs at or above this index don't take work from others. the scaling benchmark lowers it to leave some out */
+volatile uint32_t smp_active_cpus = 1;
+
+static uint8_t cpu_by_apic_id[256];
+
+/* the low memory page the trampoline is copied over, which the boot loader may still have something in */
+static uint8_t saved_trampoline_page[PAGE_SIZE];
+
+/* the CPU with a given local APIC ID, or 0 if it isn't online. this_cpu() is much cheaper for the running CPU */
+struct cpu *smp_cpu_by_apic_id(uint8_t apic_id) {
+    uint8_t index = cpu_by_apic_id[apic_id];
+
+    return index == SMP_NO_CPU ? 0 : &cpus[index];
+}
+
+/* application processors have no PIT of their own, the local APIC timer drives their time slices */
+static void ap_timer_interrupt(struct interrupt_frame *frame) {
+    thread_timer_tick(frame);
+}
+
+/* first C code on an application processor, called from the trampoline on the stack setup_smp gave it */
+static void __attribute__((__noreturn__)) ap_main(struct cpu *cpu) {
+    load_cpu_tables(&cpu->tables, cpu, sizeof(*cpu));
+    load_idt();
+    lapic_enable(false);
+    syscall_setup_cpu();
+    fpu_setup_cpu();
+    lapic_start_timer(TIMER_FREQUENCY);
+
+    __atomic_store_n(&cpu->online, true, __ATOMIC_RELEASE);
+    klog(KLOG_INFO, "CPU %u is online, APIC ID %u.\n", cpu->index, cpu->apic_id);
+
+    thread_run_idle(cpu->idle_stack);
+}
+
+/* INIT, then up to two startup IPIs as the MP specification recommends, then wait for ap_main to report in */
+static bool start_cpu(struct cpu *cpu) {
+    lapic_send_init(cpu->apic_id);
+    tsc_delay_microseconds(SMP_INIT_DELAY_MICROSECONDS);
+
+    for (unsigned int attempt = 0; attempt < 2 && !cpu->online; attempt++) {
+        lapic_send_startup(cpu->apic_id, SMP_TRAMPOLINE_ADDRESS);
+        tsc_delay_microseconds(SMP_STARTUP_DELAY_MICROSECONDS);
+    }
+
+    for (unsigned int waited = 0; waited < SMP_START_TIMEOUT_MILLISECONDS && !__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE); waited++) {
+        tsc_delay_microseconds(1000);
+    }
+
+    return cpu->online;
+}
+
+/*
+Find the other processors from the firmware tables, and start each one through the trampoline. Every CPU gets its own
+GDT and TSS built by load_cpu_tables, shares the boot CPU's IDT and page directory, and ends up as the idle thread of its
+own run queue. Needs paging, the slab, threads and the TSC.
+*/
+void setup_smp() {
+    TRACE_SCOPE(TRACE_SUBSYSTEM_CPU, "setup_smp");
+
+    struct processor_list processors;
+
+    memset(cpu_by_apic_id, SMP_NO_CPU, sizeof(cpu_by_apic_id));
+
+    if (!acpi_find_processors(&processors)) {
+        kprintf("smp: no ACPI or MP tables, running on one CPU\n");
+        return;
+    }
+    if (!setup_lapic(processors.lapic_address)) {
+        kprintf("smp: no usable local APIC, running on one CPU\n");
+        return;
+    }
+
+    cpus[0].apic_id = lapic_id();
+    cpu_by_apic_id[cpus[0].apic_id] = 0;
+
+    register_interrupt_handler(INTERRUPT_VECTOR_LAPIC_TIMER, ap_timer_interrupt);
+
+    memcpy(saved_trampoline_page, (void *)SMP_TRAMPOLINE_ADDRESS, PAGE_SIZE);
+    memcpy((void *)SMP_TRAMPOLINE_ADDRESS, &smp_trampoline_start, &smp_trampoline_end - &smp_trampoline_start);
+
+    struct smp_trampoline_data *data = (struct smp_trampoline_data *)(SMP_TRAMPOLINE_ADDRESS + (&smp_trampoline_data - &smp_trampoline_start));
+    data->gdt_limit = cpus[0].tables.gdt.limit;
+    data->gdt_base = cpus[0].tables.gdt.base;
+    data->cr0 = read_cr0();
+    data->cr3 = read_cr3();
+    data->cr4 = read_cr4();
+    data->entry = (uint32_t)ap_main;
+
+    for (uint32_t index = 0; index < processors.count && online_cpu_count < SMP_MAX_CPUS; index++) {
+        if (processors.apic_ids[index] == cpus[0].apic_id) {
+            continue;
+        }
+
+        struct cpu *cpu = &cpus[online_cpu_count];
+        physical_address stack = pmm_alloc_frames(THREAD_STACK_ORDER);
+        if (!stack) {
+            break;
+        }
+
+        cpu->self = cpu;
+        cpu->index = online_cpu_count;
+        cpu->apic_id = processors.apic_ids[index];
+        cpu->idle_stack = stack;
+        cpu_by_apic_id[cpu->apic_id] = cpu->index;
+
+        data->stack = stack + THREAD_STACK_SIZE;
+        data->argument = (uint32_t)cpu;
+
+        if (start_cpu(cpu)) {
+            online_cpu_count++;
+        } else {
+            kprintf("smp: CPU with APIC ID %u did not start\n", cpu->apic_id);
+            cpu_by_apic_id[cpu->apic_id] = SMP_NO_CPU;
+            pmm_free_frames(stack, THREAD_STACK_ORDER);
+        }
+    }
+
+    memcpy((void *)SMP_TRAMPOLINE_ADDRESS, saved_trampoline_page, PAGE_SIZE);
+
+    smp_active_cpus = online_cpu_count;
+
+    if (!boot_fast) {
+        kprintf("smp: %u of %u CPUs online, from the %s\n", online_cpu_count, processors.count, processors.source);
+    }
+}
@@ -0,0 +1,64 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kernel/intel.h>
+#include <kernel/kprintf.h>
+#include <kernel/spinlock.h>
+#include <kernel/tsc.h>
+#include <klegit/string.h>
+
+/* linker.ld */
+extern struct lock_statistics lock_statistics_start;
+extern struct lock_statistics lock_statistics_end;
+
+/* wait_start is when the lock was found taken, or 0 if it wasn't. runs with the lock held */
+void lock_statistics_acquired(struct lock_statistics *statistics, uint64_t wait_start) {
+    uint64_t now = read_tsc();
+
+    statistics->acquisitions++;
+    if (wait_start) {
+        uint32_t wait = (uint32_t)(now - wait_start);
+
+        statistics->contended++;
+        statistics->wait_cycles += wait;
+        if (wait > statistics->maximum_wait_cycles) {
+            statistics->maximum_wait_cycles = wait;
+        }
+    }
+
+    statistics->acquired_at = now;
+}
+
+/* runs just before the lock is handed on */
+void lock_statistics_released(struct lock_statistics *statistics) {
+    uint32_t hold = (uint32_t)(read_tsc() - statistics->acquired_at);
+
+    statistics->hold_cycles += hold;
+    if (hold > statistics->maximum_hold_cycles) {
+        statistics->maximum_hold_cycles = hold;
+    }
+}
+
+void lock_statistics_print(struct lock_statistics *statistics) {
+    kprintf("lock %s: %u acquisitions, %u contended, wait %u cycles avg (%u max), hold %u cycles avg (%u max)\n",
+        statistics->name, statistics->acquisitions, statistics->contended,
+        tsc_average_cycles(statistics->wait_cycles, statistics->contended), statistics->maximum_wait_cycles,
+        tsc_average_cycles(statistics->hold_cycles, statistics->acquisitions), statistics->maximum_hold_cycles);
+}
+
+/* start the counts again. the lock must not be in use */
+void lock_statistics_reset(struct lock_statistics *statistics) {
+    const char *name = statistics->name;
+
+    memset(statistics, 0, sizeof(*statistics));
+    statistics->name = name;
+}
+
+/* one line for every lock with statistics which has been taken at all. read without the locks, so a busy lock's line may be slightly off */
+void lock_print_statistics() {
+    for (struct lock_statistics *statistics = &lock_statistics_start; statistics < &lock_statistics_end; statistics++) {
+        if (statistics->acquisitions) {
+            lock_statistics_print(statistics);
+        }
+    }
+}
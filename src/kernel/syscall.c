@@ -0,0 +1,151 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kernel/boot.h>
+#include <kernel/interrupts.h>
+#include <kernel/intel.h>
+#include <kernel/ipc.h>
+#include <kernel/klog.h>
+#include <kernel/kprintf.h>
+#include <kernel/paging.h>
+#include <kernel/pmm.h>
+#include <kernel/smp.h>
+#include <kernel/syscall.h>
+#include <kernel/trace.h>
+
+/* linker.ld */
+extern char user_text_start;
+extern char user_text_end;
+
+/*
+Ring 0 stacks for entry from ring 3, one per CPU as two CPUs can be in SYSENTER at once. Each is the CPU's
+MSR_SYSENTER_ESP, and the boot CPU's is also the boot thread's TSS stack.
+*/
+static uint8_t __attribute__((__aligned__(16))) kernel_entry_stacks[SMP_MAX_CPUS][SYSCALL_KERNEL_STACK_SIZE];
+
+static bool sysenter_available = false;
+
+static uint32_t syscall_exit(struct syscall_registers *registers) {
+    struct cpu *cpu = this_cpu();
+
+    if (!cpu->user_mode_active) {
+        return SYSCALL_INVALID;
+    }
+
+    cpu->user_mode_active = false;
+    user_mode_return(registers->ebx, cpu->user_mode_saved_esp);
+}
+
+static uint32_t syscall_null(struct syscall_registers *registers) {
+    (void)registers;
+
+    return 0;
+}
+
+static uint32_t syscall_debug(struct syscall_registers *registers) {
+    klog(KLOG_INFO, "Debug syscall: 0x%08x 0x%08x 0x%08x.\n", registers->ebx, registers->esi, registers->edi);
+
+    return 0;
+}
+
+static const syscall_function syscall_table[SYSCALL_COUNT] = {
+    [SYSCALL_EXIT] = syscall_exit,
+    [SYSCALL_NULL] = syscall_null,
+    [SYSCALL_DEBUG] = syscall_debug,
+    [SYSCALL_SEND_SHORT] = ipc_syscall_send_short,
+    [SYSCALL_RECEIVE_SHORT] = ipc_syscall_receive_short,
+    [SYSCALL_SEND_COPY] = ipc_syscall_send_copy,
+    [SYSCALL_SEND_PAGES] = ipc_syscall_send_pages,
+    [SYSCALL_RECEIVE] = ipc_syscall_receive,
+};
+
+/* shared by both entry paths. the result goes in eax, and calls may write to the other registers too */
+void syscall_dispatch(struct syscall_registers *registers) {
+    if (registers->eax >= SYSCALL_COUNT) {
+        registers->eax = SYSCALL_INVALID;
+        return;
+    }
+
+    registers->eax = syscall_table[registers->eax](registers);
+}
+
+static void syscall_interrupt(struct interrupt_frame *frame) {
+    struct syscall_registers registers = { frame->eax, frame->ebx, frame->esi, frame->edi };
+
+    syscall_dispatch(&registers);
+
+    frame->eax = registers.eax;
+    frame->ebx = registers.ebx;
+    frame->esi = registers.esi;
+    frame->edi = registers.edi;
+}
+
+bool syscall_sysenter_available() {
+    return sysenter_available;
+}
+
+/* the SYSENTER MSRs are per CPU. application processors call this as they come up, each taking its own entry stack */
+void syscall_setup_cpu() {
+    struct cpu *cpu = this_cpu();
+
+    cpu->syscall_stack_top = (uint32_t)&kernel_entry_stacks[cpu->index][SYSCALL_KERNEL_STACK_SIZE];
+
+    if (sysenter_available) {
+        write_msr(MSR_SYSENTER_CS, 0x08);
+        write_msr(MSR_SYSENTER_ESP, cpu->syscall_stack_top);
+        write_msr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+    }
+}
+
+/*
+Register the int 0x80 handler and, where the CPU has them, program the SYSENTER MSRs. SYSENTER takes its code segment
+from MSR_SYSENTER_CS and assumes the stack segment follows it, and SYSEXIT assumes the ring 3 code and data segments
+follow those, which is exactly the 0x08, 0x10, 0x18, 0x20 layout built by setup_gdt.
+
+The .user_text section and a one page stack are also mapped for ring 3, for run_in_user_mode. Needs paging and the PMM.
+*/
+void setup_syscalls() {
+    TRACE_SCOPE(TRACE_SUBSYSTEM_CPU, "setup_syscalls");
+
+    register_interrupt_handler(INTERRUPT_VECTOR_SYSCALL, syscall_interrupt);
+
+    sysenter_available = cpu_has_feature(CPUID_FEATURE_EDX_SEP) && cpu_has_feature(CPUID_FEATURE_EDX_MSR);
+    syscall_setup_cpu();
+    this_cpu_write(tables.tss.esp0, this_cpu_read(syscall_stack_top));
+
+    uint32_t user_text_pages_start = (uint32_t)&user_text_start & ~(PAGE_SIZE - 1);
+    physical_address user_stack = pmm_alloc_frame();
+
+    bool mapped = user_stack != 0;
+    mapped = mapped && map_range(USER_TEXT_ADDRESS, user_text_pages_start, (uint32_t)&user_text_end - user_text_pages_start, PAGE_USER);
+    mapped = mapped && map_range(USER_STACK_TOP - PAGE_SIZE, user_stack, PAGE_SIZE, PAGE_USER | PAGE_WRITABLE);
+    if (!mapped) {
+        kprintf("syscall: out of memory mapping the user mode text and stack\n");
+        halt();
+    }
+
+    if (!boot_fast) {
+        kprintf("SYSENTER %s.\n", sysenter_available ? "available" : "not supported, int 0x80 only");
+    }
+}
+
+/*
+Run ring 3 code at eip, with its stack at esp and the argument in eax, until it makes SYSCALL_EXIT. Not reentrant, and
+the return is found through the CPU, so the calling thread must stay on this CPU, as the pinned boot thread does. The
+ring 3 side, run_in_user_mode's stack and the process window, is still shared between CPUs.
+*/
+uint32_t enter_user_mode(uint32_t eip, uint32_t esp, uint32_t argument) {
+    struct cpu *cpu = this_cpu();
+
+    cpu->user_mode_active = true;
+
+    return user_mode_enter(eip, esp, argument, &cpu->user_mode_saved_esp);
+}
+
+/* run a function from .user_text in ring 3 until it makes SYSCALL_EXIT, returning the exit value. not reentrant */
+uint32_t run_in_user_mode(void (*entry)(), uint32_t argument) {
+    uint32_t user_entry = USER_TEXT_ADDRESS + ((uint32_t)entry - ((uint32_t)&user_text_start & ~(PAGE_SIZE - 1)));
+
+    return enter_user_mode(user_entry, USER_STACK_TOP, argument);
+}
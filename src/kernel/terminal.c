@@ -2,11 +2,15 @@
 #include <stdint.h>
 
 #include <kernel/intel.h>
-#include <klegit/mini-printf.h>
+#include <kernel/kprintf.h>
+#include <kernel/terminal.h>
+#include <kernel/trace.h>
 #include <klegit/string.h>
 
 static const size_t VGA_HEIGHT = 25;
 static const size_t VGA_WIDTH = 80;
+static const size_t VGA_BUFFER_ROWS = 204; /* as many whole rows as fit in the 32k text window at 0xB8000 */
+static const size_t VGA_RETAINED_ROWS = 100; /* rows kept when the ring wraps: the screen plus 75 lines of scrollback */
 static const size_t HEXDUMP_WIDTH = 8;
 
 static const uint8_t VGA_FOREGROUND_COLOUR = 10; /* standard grey */
@@ -14,9 +18,22 @@ static const uint8_t VGA_BACKGROUND_COLOUR = 5; /* blue */
 
 static uint16_t* const VGA_MEMORY = (uint16_t*) 0xB8000;
 
+/* like everything else here, only changed with kprintf's console lock held, apart from early boot and benchmark_terminal */
 uint8_t cursor_row = 0;
 uint8_t cursor_column = 0;
 
+/*
+VGA memory is used as a ring of rows, and scrolling moves the CRTC display start address down one row rather than copying the
+screen. screen_top_row is the row of VGA memory at the top of the live screen, and the rows above it are scrollback.
+*/
+size_t screen_top_row = 0;
+static size_t scrollback_rows = 0;
+static size_t view_top_row = 0; /* differs from screen_top_row while paging through scrollback */
+
+/* where the hardware cursor and display start were last programmed, so redundant port writes can be skipped */
+static uint16_t hardware_cursor_index = 0xFFFF;
+static uint16_t hardware_display_start = 0xFFFF;
+
 /* produce a colour value suitable for VGA character memory */
 uint8_t vga_color(uint8_t foreground, uint8_t background)
 {
@@ -29,10 +46,43 @@ uint16_t vga_character(char character) {
 }
 
 uint16_t vga_cursor_memory_index() {
-    return cursor_row * VGA_WIDTH + cursor_column;
+    return (screen_top_row + cursor_row) * VGA_WIDTH + cursor_column;
 }
 
-void vga_move_cursor(uint8_t column, uint8_t row) {
+/* blank whole rows, two cells per store. rows are an even number of cells, so every row starts 4 byte aligned */
+static void blank_rows(size_t row, size_t count) {
+    uint32_t blank = vga_character(' ');
+    uint32_t *destination = (uint32_t*)(VGA_MEMORY + row * VGA_WIDTH);
+    size_t words = count * VGA_WIDTH / 2;
+
+    blank |= blank << 16;
+    __asm__ volatile ("rep stosl" : "+D"(destination), "+c"(words) : "a"(blank) : "memory");
+}
+
+/* scroll the live screen up by one line. this normally just blanks one row, the copy only happens when the ring wraps */
+static void scroll_screen() {
+    TRACE_SCOPE(TRACE_SUBSYSTEM_TERMINAL, "scroll_screen");
+
+    if (screen_top_row + VGA_HEIGHT >= VGA_BUFFER_ROWS) {
+        /* move the newest rows back to the start of VGA memory, once every VGA_BUFFER_ROWS - VGA_RETAINED_ROWS lines */
+        memcpy(VGA_MEMORY, VGA_MEMORY + (screen_top_row + VGA_HEIGHT - VGA_RETAINED_ROWS) * VGA_WIDTH, VGA_RETAINED_ROWS * VGA_WIDTH * 2);
+        screen_top_row = VGA_RETAINED_ROWS - VGA_HEIGHT;
+
+        if (scrollback_rows > screen_top_row) {
+            scrollback_rows = screen_top_row;
+        }
+    }
+
+    screen_top_row++;
+    scrollback_rows++;
+    blank_rows(screen_top_row + VGA_HEIGHT - 1, 1);
+
+    /* new output always snaps the view back to the live screen */
+    view_top_row = screen_top_row;
+}
+
+/* advance the logical cursor, wrapping at the right-most edge and scrolling when it falls off the bottom. does no port I/O */
+static void advance_cursor(uint8_t column, uint8_t row) {
     cursor_row = row;
     cursor_column = column;
 
@@ -42,69 +92,140 @@ void vga_move_cursor(uint8_t column, uint8_t row) {
         cursor_column = 0;
     }
 
-    /* scroll the screen if the cursor has fallen off the bottom XXX make this use memcpy once memcpy works */
+    /* scroll the screen if the cursor has fallen off the bottom */
     if (cursor_row > VGA_HEIGHT - 1) {
         cursor_row = VGA_HEIGHT - 1;
+        scroll_screen();
+    }
+}
 
-        /* scroll up VGA memory by one line */
-        memcpy(VGA_MEMORY, VGA_MEMORY + VGA_WIDTH, (VGA_HEIGHT * VGA_WIDTH - VGA_WIDTH) * 2);  
+/* poke the VGA ports to move the hardware cursor to the logical cursor, skipping the port I/O if it is already there */
+void vga_update_hardware_cursor() {
+    uint16_t index = vga_cursor_memory_index();
 
-        /* blank the freshly exposed bottom line */
-        for (size_t index = 0; index < VGA_WIDTH; index++) {
-            VGA_MEMORY[(VGA_HEIGHT - 1) * VGA_WIDTH + index] = vga_character(' ');
-        }
+    if (index == hardware_cursor_index) {
+        return;
     }
+    hardware_cursor_index = index;
 
-    /* poke the VGA ports to move the cursor XXX strictly the base port should be queried from the BIOS not hardcoded */
+    /* XXX strictly the base port should be queried from the BIOS not hardcoded */
     outb(0x3D4, 0x0F);
-    outb(0x3D5, (unsigned char)(vga_cursor_memory_index() & 0xFF));
+    outb(0x3D5, (unsigned char)(index & 0xFF));
     outb(0x3D4, 0x0E);
-    outb(0x3D5, (unsigned char )((vga_cursor_memory_index() >> 8) & 0xFF));
- }
+    outb(0x3D5, (unsigned char)((index >> 8) & 0xFF));
+}
 
-/* clear the terminal and move the cursor back to the top left */
-void terminal_clear() {
-    for (uint8_t row = 0; row < VGA_HEIGHT; row++) {
-        for (uint8_t column = 0; column < VGA_WIDTH; column++) {
-            VGA_MEMORY[row * VGA_WIDTH + column] = vga_character(' ');
-        }
+/* program the CRTC start address registers so the display begins at view_top_row */
+void vga_update_display_start() {
+    uint16_t start = view_top_row * VGA_WIDTH;
+
+    if (start == hardware_display_start) {
+        return;
     }
+    hardware_display_start = start;
+
+    outb(0x3D4, 0x0D);
+    outb(0x3D5, (unsigned char)(start & 0xFF));
+    outb(0x3D4, 0x0C);
+    outb(0x3D5, (unsigned char)((start >> 8) & 0xFF));
+}
+
+void vga_move_cursor(uint8_t column, uint8_t row) {
+    advance_cursor(column, row);
+    vga_update_hardware_cursor();
+}
+
+/* clear the terminal, drop the scrollback and move the cursor back to the top left */
+void terminal_clear() {
+    screen_top_row = 0;
+    scrollback_rows = 0;
+    view_top_row = 0;
+
+    blank_rows(0, VGA_HEIGHT);
     vga_move_cursor(0, 0);
+    vga_update_display_start();
+}
+
+/* page the display back through the scrollback by the given number of rows, 0 being the live screen. the cursor is left alone */
+void terminal_scroll_view(size_t rows_back) {
+    if (rows_back > scrollback_rows) {
+        rows_back = scrollback_rows;
+    }
+
+    view_top_row = screen_top_row - rows_back;
+    vga_update_display_start();
+}
+
+/* write a single character at the logical cursor without touching the hardware cursor. handles \n for newlines. */
+void terminal_put_character(char character) {
+    if (character == '\n') {
+        advance_cursor(0, cursor_row + 1);
+    } else {
+        VGA_MEMORY[vga_cursor_memory_index()] = vga_character(character);
+        advance_cursor(cursor_column + 1, cursor_row);
+    }
+}
+
+/* bring the hardware cursor and display start up to date with everything written so far */
+void terminal_flush() {
+    TRACE_SCOPE(TRACE_SUBSYSTEM_TERMINAL, "terminal_flush");
+
+    vga_update_display_start();
+    vga_update_hardware_cursor();
 }
 
-/* write a null terminated string at the current cursor position. handles \n for newlines. */
+/* write a null terminated string at the current cursor position, then move the hardware cursor once at the end */
 void terminal_write(char *string) {
     for (size_t index = 0; string[index] != 0; index++) {
-        if (string[index] == '\n') {
-            vga_move_cursor(0, ++cursor_row);
-        } else {
-            VGA_MEMORY[vga_cursor_memory_index()] = vga_character(string[index]);
-            vga_move_cursor(++cursor_column, cursor_row);
-        }
+        terminal_put_character(string[index]);
     }
+    terminal_flush();
 }
 
-/* dump an area of memory as hex to the terminal XXX fix to use "printf" rather than buffers + snprintf */
-void terminal_hexdump(void *memory, size_t byte_count) {
-    char buffer[256];
+/* kprintf sink for the VGA terminal */
+static void terminal_sink_write(const char *string, unsigned int length, void *context) {
+    TRACE_SCOPE(TRACE_SUBSYSTEM_TERMINAL, "terminal_write");
+    (void)context;
 
-    for (size_t index = 0; index < byte_count + ((byte_count % HEXDUMP_WIDTH) ? (HEXDUMP_WIDTH - byte_count % HEXDUMP_WIDTH) : 0); index++) {
-        /* print offset at line start */
-        if (index % HEXDUMP_WIDTH == 0) {
-            mini_snprintf(buffer, 256, "0x%06x: ", index);
-            terminal_write(buffer);
-        }
+    for (unsigned int index = 0; index < length; index++) {
+        terminal_put_character(string[index]);
+    }
+}
 
-        /* print hex data */
-        if (index < byte_count) {
-            mini_snprintf(buffer, 256, "%02x ", 0xFF & ((char*)memory)[index]);
-            terminal_write(buffer);                       
-        } else {
-            terminal_write("   ");                                              
-        }
+static void terminal_sink_flush(void *context) {
+    (void)context;
 
-        if (index % HEXDUMP_WIDTH == HEXDUMP_WIDTH - 1) {
-            terminal_write("\n");
+    terminal_flush();
+}
+
+struct kprintf_sink terminal_sink = {terminal_sink_write, terminal_sink_flush, 0};
+
+/* dump an area of memory as hex through kprintf, one call per line, flushing the sinks once at the end */
+void terminal_hexdump(void *memory, size_t byte_count) {
+    static const char digits[] = "0123456789abcdef";
+    char line[HEXDUMP_WIDTH * 3 + 1];
+
+    kprintf_begin_batch();
+
+    for (size_t offset = 0; offset < byte_count; offset += HEXDUMP_WIDTH) {
+        char *position = line;
+
+        for (size_t index = offset; index < offset + HEXDUMP_WIDTH; index++) {
+            /* the last line is padded out to the full width */
+            if (index < byte_count) {
+                unsigned char byte = ((unsigned char*)memory)[index];
+                *position++ = digits[byte >> 4];
+                *position++ = digits[byte & 0xF];
+            } else {
+                *position++ = ' ';
+                *position++ = ' ';
+            }
+            *position++ = ' ';
         }
+        *position = '\0';
+
+        kprintf("0x%06x: %s\n", offset, line);
     }
+
+    kprintf_end_batch();
 }
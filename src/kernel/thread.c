@@ -0,0 +1,533 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kernel/fpu.h>
+#include <kernel/intel.h>
+#include <kernel/kprintf.h>
+#include <kernel/lapic.h>
+#include <kernel/pmm.h>
+#include <kernel/preempt.h>
+#include <kernel/rcu.h>
+#include <kernel/slab.h>
+#include <kernel/smp.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
+#include <kernel/timer.h>
+
+#include <klegit/string.h>
+
+#define THREAD_SELF_TEST_TICKS 100
+
+/*
+
+Each CPU has its own run queue under its own lock, and its own idle thread which is never queued. A CPU with nothing
+left to run takes a thread from another CPU's queue before falling back to its idle thread, locking one queue at a
+time so no two run queue locks are ever held together. A woken thread goes back to the queue of the CPU it last ran
+on, and that CPU is sent a reschedule IPI if it should switch to it.
+
+A thread can be queued on one CPU before it has finished switching out on another, e.g. when it blocks and is woken
+straight away. on_cpu stays set until the CPU it was running on is off its stack, and a CPU switching to it waits for
+that first.
+
+*/
+
+static struct kmem_cache *thread_cache;
+static struct thread boot_thread;
+
+static uint32_t next_thread_id = 0;
+
+/* all of the run queue functions expect the queue's lock to be held */
+static void run_queue_push(struct run_queue *queue, struct thread *thread) {
+    thread->next = 0;
+    thread->state = THREAD_READY;
+
+    if (queue->tails[thread->priority]) {
+        queue->tails[thread->priority]->next = thread;
+    } else {
+        queue->heads[thread->priority] = thread;
+    }
+    queue->tails[thread->priority] = thread;
+    queue->bitmap |= 1u << thread->priority;
+    queue->length++;
+}
+
+static void run_queue_unlink(struct run_queue *queue, struct thread *thread, struct thread *previous) {
+    uint8_t priority = thread->priority;
+
+    if (previous) {
+        previous->next = thread->next;
+    } else {
+        queue->heads[priority] = thread->next;
+    }
+    if (queue->tails[priority] == thread) {
+        queue->tails[priority] = previous;
+    }
+    if (queue->heads[priority] == 0) {
+        queue->bitmap &= ~(1u << priority);
+    }
+    queue->length--;
+    thread->next = 0;
+}
+
+/* take the first thread from the highest priority non-empty queue, or 0 if there is nothing */
+static struct thread *run_queue_pop(struct run_queue *queue) {
+    if (queue->bitmap == 0) {
+        return 0;
+    }
+
+    uint32_t priority = 31 - __builtin_clz(queue->bitmap);
+    struct thread *thread = queue->heads[priority];
+
+    run_queue_unlink(queue, thread, 0);
+
+    return thread;
+}
+
+/* as run_queue_pop, but passing over pinned threads */
+static struct thread *run_queue_pop_unpinned(struct run_queue *queue) {
+    uint32_t bitmap = queue->bitmap;
+
+    while (bitmap) {
+        uint32_t priority = 31 - __builtin_clz(bitmap);
+        struct thread *previous = 0;
+
+        for (struct thread *thread = queue->heads[priority]; thread; previous = thread, thread = thread->next) {
+            if (!thread->pinned) {
+                run_queue_unlink(queue, thread, previous);
+                return thread;
+            }
+        }
+
+        bitmap &= ~(1u << priority);
+    }
+
+    return 0;
+}
+
+/* called with interrupts off. the thread was found in another CPU's queue, so it runs here from now on */
+static struct thread *steal_thread(struct cpu *cpu) {
+    if (cpu->index >= smp_active_cpus) {
+        return 0;
+    }
+
+    for (uint32_t offset = 1; offset < online_cpu_count; offset++) {
+        struct cpu *victim = &cpus[(cpu->index + offset) % online_cpu_count];
+
+        if (victim->run_queue.length == 0) {
+            continue;
+        }
+
+        spinlock_acquire(&victim->run_queue.lock);
+        struct thread *thread = run_queue_pop_unpinned(&victim->run_queue);
+        spinlock_release(&victim->run_queue.lock);
+
+        if (thread) {
+            cpu->steal_count++;
+            return thread;
+        }
+    }
+
+    return 0;
+}
+
+/* wake one idle CPU which could take work from this one, if there is any */
+static void kick_idle_cpu(struct cpu *self) {
+    for (uint32_t index = 0; index < online_cpu_count && index < smp_active_cpus; index++) {
+        struct cpu *cpu = &cpus[index];
+
+        if (cpu != self && cpu->current_thread == cpu->idle_thread) {
+            lapic_send_ipi(cpu->apic_id, INTERRUPT_VECTOR_RESCHEDULE);
+            return;
+        }
+    }
+}
+
+/* queue a ready thread on a CPU, and get that CPU's attention if the thread should run before whatever it is doing. interrupts must be off */
+static void enqueue(struct cpu *cpu, struct thread *thread) {
+    struct cpu *self = this_cpu();
+
+    spinlock_acquire(&cpu->run_queue.lock);
+    thread->cpu = cpu->index;
+    run_queue_push(&cpu->run_queue, thread);
+    spinlock_release(&cpu->run_queue.lock);
+
+    struct thread *running = cpu->current_thread;
+
+    if (running == cpu->idle_thread || thread->priority > running->priority) {
+        cpu->need_reschedule = true;
+        if (cpu != self) {
+            lapic_send_ipi(cpu->apic_id, INTERRUPT_VECTOR_RESCHEDULE);
+        }
+    } else if (cpu == self) {
+        kick_idle_cpu(self);
+    }
+}
+
+static void free_thread(struct thread *thread) {
+    /* wait out a thread_wake which may still be holding the lock */
+    spinlock_acquire(&thread->lock);
+
+    fpu_free_state(thread);
+    pmm_free_frames(thread->stack, THREAD_STACK_ORDER);
+    kmem_cache_free(thread_cache, thread);
+}
+
+/* run on the new thread's stack after every switch: the old thread is now free to run elsewhere, or to be freed */
+static void finish_switch() {
+    struct cpu *cpu = this_cpu();
+    struct thread *previous = cpu->switched_from;
+
+    cpu->switched_from = 0;
+    __atomic_store_n(&previous->on_cpu, false, __ATOMIC_RELEASE);
+
+    if (previous->state == THREAD_DEAD) {
+        free_thread(previous);
+    }
+}
+
+/* give up the CPU to the best runnable thread. a running thread goes to the back of its queue, any other state stays off it */
+static void schedule() {
+    uint32_t flags = interrupts_save_disable();
+    struct cpu *cpu = this_cpu();
+    struct thread *previous = cpu->current_thread;
+
+    cpu->need_reschedule = false;
+    rcu_quiescent_state();
+
+    spinlock_acquire(&cpu->run_queue.lock);
+    if (previous->state == THREAD_RUNNING && previous != cpu->idle_thread) {
+        run_queue_push(&cpu->run_queue, previous);
+    }
+    struct thread *next = run_queue_pop(&cpu->run_queue);
+    spinlock_release(&cpu->run_queue.lock);
+
+    if (!next) {
+        next = steal_thread(cpu);
+    }
+    if (!next) {
+        next = cpu->idle_thread;
+    }
+
+    if (next != previous) {
+        /* a thread just woken or stolen may still be switching out on another CPU */
+        while (__atomic_load_n(&next->on_cpu, __ATOMIC_ACQUIRE)) {
+            __asm__ volatile ("pause");
+        }
+        next->on_cpu = true;
+        next->cpu = cpu->index;
+    }
+
+    next->state = THREAD_RUNNING;
+    next->time_slice = THREAD_TIME_SLICE_TICKS;
+
+    if (next != previous) {
+        next->switches_in++;
+        cpu->switch_count++;
+        cpu->current_thread = next;
+        cpu->switched_from = previous;
+        cpu->tables.tss.esp0 = next->kernel_stack_top;
+        fpu_switch(cpu, previous, next);
+
+        context_switch(&previous->saved_esp, next->saved_esp);
+
+        /* back on the previous thread's stack, possibly much later and possibly on another CPU */
+        finish_switch();
+    }
+
+    interrupts_restore(flags);
+}
+
+/* first code run by every new thread, reached through the return address thread_create left on its stack */
+static void thread_start() {
+    finish_switch();
+    interrupts_enable();
+
+    struct thread *thread = thread_current();
+    thread->entry(thread->argument);
+
+    thread_exit();
+}
+
+/* wakes for every interrupt, and the tick or reschedule IPI that brings work switches away from it at the end of that interrupt */
+static void idle_thread_entry(void *argument) {
+    (void)argument;
+
+    while (true) {
+        __asm__ volatile ("hlt");
+        thread_yield();
+    }
+}
+
+/* timer callback: count down the running thread's time slice. an idle CPU looks for work to steal on every tick. a tick which didn't land in an RCU read section is a quiescent state */
+void thread_timer_tick(struct interrupt_frame *frame) {
+    (void)frame;
+
+    struct cpu *cpu = this_cpu();
+    struct thread *thread = cpu->current_thread;
+
+    if (!thread) {
+        return;
+    }
+
+    if (thread->time_slice > 0) {
+        thread->time_slice--;
+    }
+    if (thread->time_slice == 0 || thread == cpu->idle_thread) {
+        cpu->need_reschedule = true;
+    }
+    if (cpu->preempt_count == 0) {
+        rcu_quiescent_state();
+    }
+}
+
+/* sent by enqueue on another CPU. the switch itself happens in thread_preempt at the end of the interrupt */
+static void reschedule_interrupt(struct interrupt_frame *frame) {
+    (void)frame;
+
+    this_cpu_write(need_reschedule, true);
+}
+
+/*
+Called at the end of every IRQ and local APIC interrupt, once it has been acknowledged. Switching away here leaves the
+interrupted thread's state in its interrupt frame, and it carries on from there when it is next scheduled. A thread
+which has preemption disabled is left alone until a later interrupt finds it enabled again.
+*/
+void thread_preempt() {
+    if (this_cpu_read(current_thread) && this_cpu_read(need_reschedule) && this_cpu_read(preempt_count) == 0) {
+        this_cpu_add(preemption_count, 1);
+        schedule();
+    }
+}
+
+/* a thread with its stack built to start in thread_start, but not queued anywhere yet. returns 0 if out of memory */
+static struct thread *thread_alloc(char *name, uint8_t priority, void (*entry)(void *argument), void *argument) {
+    struct thread *thread = kmem_cache_alloc(thread_cache);
+    if (!thread) {
+        return 0;
+    }
+
+    memset(thread, 0, sizeof(*thread));
+    thread->stack = pmm_alloc_frames(THREAD_STACK_ORDER);
+    if (!thread->stack) {
+        kmem_cache_free(thread_cache, thread);
+        return 0;
+    }
+
+    size_t name_length = strlen(name);
+    if (name_length >= THREAD_NAME_LENGTH) {
+        name_length = THREAD_NAME_LENGTH - 1;
+    }
+    memcpy(thread->name, name, name_length);
+
+    thread->id = __atomic_fetch_add(&next_thread_id, 1, __ATOMIC_RELAXED);
+    thread->priority = priority < THREAD_PRIORITY_COUNT ? priority : THREAD_PRIORITY_COUNT - 1;
+    thread->entry = entry;
+    thread->argument = argument;
+    thread->fpu_cpu = FPU_NO_CPU;
+    thread->kernel_stack_top = thread->stack + THREAD_STACK_SIZE;
+
+    /* what context_switch expects to pop: edi, esi, ebx, ebp, then a return address in to thread_start */
+    uint32_t *stack = (uint32_t *)thread->kernel_stack_top;
+    *(--stack) = 0; /* thread_start's own return address, never used */
+    *(--stack) = (uint32_t)thread_start;
+    *(--stack) = 0;
+    *(--stack) = 0;
+    *(--stack) = 0;
+    *(--stack) = 0;
+    thread->saved_esp = (uint32_t)stack;
+
+    return thread;
+}
+
+/*
+Turn the code that called this in to the boot thread, pinned to the boot CPU as it owns the console, and start the
+boot CPU's idle thread and time slicing. Needs the slab and timer, and must run before setup_smp.
+*/
+void setup_threads() {
+    struct cpu *cpu = this_cpu();
+
+    thread_cache = kmem_cache_create("thread", sizeof(struct thread), KMEM_CACHE_ALIGN);
+    fpu_setup_threads();
+
+    memset(&boot_thread, 0, sizeof(boot_thread));
+    memcpy(boot_thread.name, "boot", 5);
+    boot_thread.id = __atomic_fetch_add(&next_thread_id, 1, __ATOMIC_RELAXED);
+    boot_thread.priority = THREAD_PRIORITY_NORMAL;
+    boot_thread.state = THREAD_RUNNING;
+    boot_thread.time_slice = THREAD_TIME_SLICE_TICKS;
+    boot_thread.kernel_stack_top = cpu->tables.tss.esp0; /* keep the entry stack set up by setup_syscalls */
+    boot_thread.cpu = cpu->index;
+    boot_thread.pinned = true;
+    boot_thread.on_cpu = true;
+    boot_thread.fpu_cpu = FPU_NO_CPU;
+
+    cpu->idle_thread = thread_alloc("idle", THREAD_PRIORITY_IDLE, idle_thread_entry, 0);
+    cpu->idle_thread->pinned = true;
+    cpu->current_thread = &boot_thread;
+
+    register_interrupt_handler(INTERRUPT_VECTOR_RESCHEDULE, reschedule_interrupt);
+    timer_register_callback(thread_timer_tick);
+}
+
+/* make the code running on a newly started CPU's stack in to that CPU's idle thread. called by ap_main, never returns */
+void thread_run_idle(physical_address stack) {
+    struct cpu *cpu = this_cpu();
+    struct thread *thread = kmem_cache_alloc(thread_cache);
+
+    if (!thread) {
+        halt();
+    }
+
+    memset(thread, 0, sizeof(*thread));
+    memcpy(thread->name, "idle", 5);
+    thread->id = __atomic_fetch_add(&next_thread_id, 1, __ATOMIC_RELAXED);
+    thread->priority = THREAD_PRIORITY_IDLE;
+    thread->state = THREAD_RUNNING;
+    thread->stack = stack;
+    thread->kernel_stack_top = stack + THREAD_STACK_SIZE;
+    thread->cpu = cpu->index;
+    thread->pinned = true;
+    thread->on_cpu = true;
+    thread->fpu_cpu = FPU_NO_CPU;
+
+    cpu->idle_thread = thread;
+    cpu->current_thread = thread;
+    cpu->tables.tss.esp0 = thread->kernel_stack_top;
+
+    interrupts_enable();
+    idle_thread_entry(0);
+
+    __builtin_unreachable();
+}
+
+/* make a new kernel thread, ready to run entry(argument) on this CPU or any that steals it. returns 0 if out of memory */
+struct thread *thread_create(char *name, uint8_t priority, void (*entry)(void *argument), void *argument) {
+    struct thread *thread = thread_alloc(name, priority, entry, argument);
+    if (!thread) {
+        return 0;
+    }
+
+    uint32_t flags = interrupts_save_disable();
+    enqueue(this_cpu(), thread);
+    interrupts_restore(flags);
+
+    return thread;
+}
+
+/* the thread running on this CPU. 0 before setup_threads. a single %gs-relative load, so a migration can't split it */
+struct thread *thread_current() {
+    return this_cpu_read(current_thread);
+}
+
+void thread_yield() {
+    schedule();
+}
+
+/*
+Stop running until thread_wake. A wake up which arrives before the block is remembered in wake_pending rather than lost,
+so the usual pattern of checking a condition and then blocking is safe without any other lock, even across CPUs.
+*/
+void thread_block() {
+    uint32_t flags = interrupts_save_disable();
+    struct thread *thread = this_cpu_read(current_thread);
+
+    spinlock_acquire(&thread->lock);
+    if (thread->wake_pending) {
+        thread->wake_pending = false;
+        spinlock_release(&thread->lock);
+    } else {
+        thread->state = THREAD_BLOCKED;
+        spinlock_release(&thread->lock);
+        schedule();
+    }
+
+    interrupts_restore(flags);
+}
+
+/* make a blocked thread runnable again, on the CPU it last ran on. this doesn't switch by itself */
+void thread_wake(struct thread *thread) {
+    uint32_t flags = interrupts_save_disable();
+
+    spinlock_acquire(&thread->lock);
+    if (thread->state == THREAD_BLOCKED) {
+        enqueue(&cpus[thread->cpu], thread);
+    } else if (thread->state != THREAD_DEAD) {
+        thread->wake_pending = true;
+    }
+    spinlock_release(&thread->lock);
+
+    interrupts_restore(flags);
+}
+
+/* the stack and thread are freed by finish_switch on whichever thread runs next here */
+void thread_exit() {
+    interrupts_save_disable();
+
+    struct thread *thread = this_cpu_read(current_thread);
+
+    spinlock_acquire(&thread->lock);
+    thread->state = THREAD_DEAD;
+    spinlock_release(&thread->lock);
+
+    schedule();
+
+    /* a dead thread is never picked again */
+    while (true) {
+        __asm__ volatile ("hlt");
+    }
+}
+
+void thread_print_statistics() {
+    kprintf_begin_batch();
+    kprintf("threads: %u created\n", next_thread_id);
+
+    for (uint32_t index = 0; index < online_cpu_count; index++) {
+        kprintf("  cpu %u: %u context switches, %u of them preemptions, %u threads stolen\n",
+            index, cpus[index].switch_count, cpus[index].preemption_count, cpus[index].steal_count);
+    }
+
+    kprintf_end_batch();
+}
+
+static volatile bool self_test_stop;
+static volatile uint32_t self_test_counters[2];
+static volatile uint32_t self_test_finished;
+
+/* spin without ever yielding, so only the timer can take the CPU away */
+static void self_test_spinner(void *argument) {
+    volatile uint32_t *counter = argument;
+
+    while (!self_test_stop) {
+        (*counter)++;
+    }
+
+    __atomic_fetch_add(&self_test_finished, 1, __ATOMIC_RELAXED);
+}
+
+/* two spinning threads at the caller's priority both make progress while the caller busy waits, which needs preemption */
+bool thread_self_test() {
+    self_test_stop = false;
+    self_test_finished = 0;
+    self_test_counters[0] = 0;
+    self_test_counters[1] = 0;
+
+    for (unsigned int index = 0; index < 2; index++) {
+        if (!thread_create("spinner", thread_current()->priority, self_test_spinner, (void *)&self_test_counters[index])) {
+            return false;
+        }
+    }
+
+    uint64_t until = timer_ticks + THREAD_SELF_TEST_TICKS;
+    while (timer_ticks < until) {
+    }
+    self_test_stop = true;
+
+    while (self_test_finished < 2) {
+        thread_yield();
+    }
+
+    kprintf("thread self-test: spinners counted to %u and %u\n", self_test_counters[0], self_test_counters[1]);
+
+    return self_test_counters[0] > 0 && self_test_counters[1] > 0;
+}
@@ -0,0 +1,50 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kernel/interrupts.h>
+#include <kernel/intel.h>
+#include <kernel/pit.h>
+#include <kernel/timer.h>
+
+volatile uint64_t timer_ticks = 0;
+
+static timer_callback callbacks[TIMER_CALLBACK_LIMIT];
+static unsigned int callback_count = 0;
+
+/* IRQ 0. the callbacks get the interrupted frame, so they can see where the CPU was */
+static void timer_interrupt(struct interrupt_frame *frame) {
+    timer_ticks++;
+
+    for (unsigned int index = 0; index < callback_count; index++) {
+        callbacks[index](frame);
+    }
+}
+
+/* run PIT channel 0 as a rate generator at roughly the given frequency, and route IRQ 0 to the callbacks */
+void setup_timer(uint32_t frequency) {
+    uint32_t divisor = PIT_FREQUENCY / frequency;
+
+    if (divisor > 0xFFFF) {
+        divisor = 0xFFFF;
+    }
+
+    outb(PIT_COMMAND, PIT_SELECT_CHANNEL_0 | PIT_ACCESS_LOW_HIGH | PIT_MODE_RATE_GENERATOR);
+    outb(PIT_CHANNEL_0, divisor & 0xFF);
+    outb(PIT_CHANNEL_0, (divisor >> 8) & 0xFF);
+
+    register_interrupt_handler(IRQ_VECTOR(TIMER_IRQ), timer_interrupt);
+}
+
+/* call the given function on every tick, from interrupt context */
+bool timer_register_callback(timer_callback callback) {
+    uint32_t flags = interrupts_save_disable();
+    bool registered = callback_count < TIMER_CALLBACK_LIMIT;
+
+    if (registered) {
+        callbacks[callback_count++] = callback;
+    }
+
+    interrupts_restore(flags);
+
+    return registered;
+}
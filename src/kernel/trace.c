@@ -0,0 +1,195 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kernel/intel.h>
+#include <kernel/kprintf.h>
+#include <kernel/trace.h>
+#include <kernel/tsc.h>
+
+#include <klegit/string.h>
+
+static struct trace_event events[TRACE_EVENT_COUNT];
+static struct trace_counters counters[TRACE_SUBSYSTEM_COUNT];
+
+static uint32_t head = 0; /* next sequence number to hand out */
+static bool paused = false; /* set while dumping, so the buffer holds still */
+
+static const char *subsystem_names[TRACE_SUBSYSTEM_COUNT] = {"boot", "cpu", "terminal", "memory"};
+
+/* the binary dump, all little endian. a header, the subsystem names, the event names, then the events */
+struct __attribute__((__packed__)) trace_binary_header {
+    char magic[4];
+    uint16_t version;
+    uint8_t subsystem_count;
+    uint8_t reserved;
+    uint32_t tsc_frequency_khz;
+    uint16_t name_count;
+    uint16_t reserved_2;
+    uint32_t event_count;
+};
+
+struct __attribute__((__packed__)) trace_binary_event {
+    uint64_t timestamp;
+    uint8_t type;
+    uint8_t subsystem;
+    uint16_t name_index;
+};
+
+/*
+Claim a slot in the ring and fill it in, the same lock-free scheme as klog_record. The oldest events are overwritten.
+paused is checked after claiming, against trace_dump_binary setting it before reading head, so either the dump sees
+this sequence in head and leaves its slot out, or this sees the pause and leaves the slot alone.
+*/
+void trace_record(uint8_t subsystem, uint8_t type, const char *name, uint64_t timestamp) {
+    uint32_t sequence = __atomic_fetch_add(&head, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&paused, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+
+    struct trace_event *event = &events[sequence & (TRACE_EVENT_COUNT - 1)];
+
+    __atomic_store_n(&event->committed, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    event->type = type;
+    event->subsystem = subsystem;
+    event->name = name;
+    event->timestamp = timestamp;
+
+    __atomic_store_n(&event->committed, sequence + 1, __ATOMIC_RELEASE);
+}
+
+struct trace_scope trace_scope_begin(uint8_t subsystem, const char *name) {
+    struct trace_scope scope = {subsystem, name, read_tsc()};
+
+    trace_record(subsystem, TRACE_EVENT_BEGIN, name, scope.start);
+
+    return scope;
+}
+
+void trace_scope_end(struct trace_scope *scope) {
+    uint64_t end = read_tsc();
+    uint32_t cycles = end - scope->start;
+
+    trace_record(scope->subsystem, TRACE_EVENT_END, scope->name, end);
+
+    uint32_t flags = interrupts_save_disable();
+    struct trace_counters *subsystem_counters = &counters[scope->subsystem];
+    subsystem_counters->scopes++;
+    subsystem_counters->total_cycles += cycles;
+    if (cycles > subsystem_counters->maximum_cycles) {
+        subsystem_counters->maximum_cycles = cycles;
+    }
+    interrupts_restore(flags);
+}
+
+/* per subsystem scope counts and times */
+void trace_print_summary() {
+    kprintf_begin_batch();
+    kprintf("Trace: subsystem, scopes, total us, average us, maximum us\n");
+
+    for (unsigned int subsystem = 0; subsystem < TRACE_SUBSYSTEM_COUNT; subsystem++) {
+        uint32_t flags = interrupts_save_disable();
+        struct trace_counters subsystem_counters = counters[subsystem];
+        interrupts_restore(flags);
+
+        if (subsystem_counters.scopes == 0) {
+            continue;
+        }
+
+        uint32_t total = tsc_cycles_to_microseconds(subsystem_counters.total_cycles);
+        kprintf("  %-8s %8u %10u %10u %10u\n", subsystem_names[subsystem], subsystem_counters.scopes, total,
+            total / subsystem_counters.scopes, tsc_cycles_to_microseconds(subsystem_counters.maximum_cycles));
+    }
+
+    uint32_t recorded = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    kprintf("  %u events recorded, the last %u are kept\n", recorded, TRACE_EVENT_COUNT);
+
+    kprintf_end_batch();
+}
+
+/* true if the event with this sequence number is fully written and no write over it has started since */
+static bool event_is_valid(uint32_t sequence) {
+    return __atomic_load_n(&events[sequence & (TRACE_EVENT_COUNT - 1)].committed, __ATOMIC_ACQUIRE) == sequence + 1;
+}
+
+static uint16_t name_index(const char **names, uint16_t *name_count, const char *name) {
+    for (uint16_t index = 0; index < *name_count; index++) {
+        if (names[index] == name) {
+            return index;
+        }
+    }
+
+    if (*name_count == TRACE_NAME_LIMIT) {
+        return 0xFFFF;
+    }
+
+    names[*name_count] = name;
+    return (*name_count)++;
+}
+
+static void write_name(void (*write)(const char *data, unsigned int length), const char *name) {
+    size_t length = strlen(name);
+    uint8_t length_byte = length > 255 ? 255 : length;
+
+    write((const char *)&length_byte, 1);
+    write(name, length_byte);
+}
+
+/*
+Write the trace buffer through write() in the compact binary format above, for tools/trace-to-json.py. Recording is
+paused for the duration so the header counts match what follows. The magic lets the script find the dump in a serial
+capture which also holds ordinary console text.
+*/
+void trace_dump_binary(void (*write)(const char *data, unsigned int length)) {
+    static const char *names[TRACE_NAME_LIMIT];
+    static uint32_t included[TRACE_EVENT_COUNT / 32]; /* by slot, the events counted in the header */
+    uint16_t name_count = 0;
+    uint32_t event_count = 0;
+
+    __atomic_store_n(&paused, true, __ATOMIC_SEQ_CST);
+
+    uint32_t end = __atomic_load_n(&head, __ATOMIC_SEQ_CST);
+    uint32_t start = end > TRACE_EVENT_COUNT ? end - TRACE_EVENT_COUNT : 0;
+
+    /*
+    Nothing in [start, end) can be overwritten now, see trace_record, but events still in progress may finish while
+    dumping. They are left out of both passes, so the header counts and names cover exactly what follows.
+    */
+    memset(included, 0, sizeof(included));
+    for (uint32_t sequence = start; sequence != end; sequence++) {
+        if (event_is_valid(sequence)) {
+            uint32_t slot = sequence & (TRACE_EVENT_COUNT - 1);
+            included[slot / 32] |= 1u << (slot % 32);
+            name_index(names, &name_count, events[slot].name);
+            event_count++;
+        }
+    }
+
+    struct trace_binary_header header = {
+        TRACE_BINARY_MAGIC, TRACE_BINARY_VERSION, TRACE_SUBSYSTEM_COUNT, 0, tsc_frequency_khz, name_count, 0, event_count
+    };
+    write((const char *)&header, sizeof(header));
+
+    for (unsigned int subsystem = 0; subsystem < TRACE_SUBSYSTEM_COUNT; subsystem++) {
+        write_name(write, subsystem_names[subsystem]);
+    }
+    for (uint16_t index = 0; index < name_count; index++) {
+        write_name(write, names[index]);
+    }
+
+    for (uint32_t sequence = start; sequence != end; sequence++) {
+        uint32_t slot = sequence & (TRACE_EVENT_COUNT - 1);
+        if (!(included[slot / 32] & (1u << (slot % 32)))) {
+            continue;
+        }
+
+        struct trace_event *event = &events[slot];
+        struct trace_binary_event binary_event = {
+            event->timestamp, event->type, event->subsystem, name_index(names, &name_count, event->name)
+        };
+        write((const char *)&binary_event, sizeof(binary_event));
+    }
+
+    __atomic_store_n(&paused, false, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,80 @@
+#include <stdint.h>
+
+#include <kernel/boot.h>
+#include <kernel/intel.h>
+#include <kernel/kprintf.h>
+#include <kernel/pit.h>
+#include <kernel/tsc.h>
+
+/* cycles per millisecond. 0 until setup_tsc has run */
+uint32_t tsc_frequency_khz = 0;
+
+/* time one run of PIT channel 2 counting down TSC_CALIBRATION_MILLISECONDS, polling its output through the speaker port */
+static uint32_t time_pit_countdown() {
+    uint32_t count = PIT_FREQUENCY / 1000 * TSC_CALIBRATION_MILLISECONDS;
+
+    /* gate channel 2 on with the speaker itself kept off */
+    outb(PIT_SPEAKER_CONTROL, (inb(PIT_SPEAKER_CONTROL) & ~PIT_SPEAKER_CONTROL_SPEAKER) | PIT_SPEAKER_CONTROL_GATE_2);
+
+    outb(PIT_COMMAND, PIT_SELECT_CHANNEL_2 | PIT_ACCESS_LOW_HIGH | PIT_MODE_TERMINAL_COUNT);
+    outb(PIT_CHANNEL_2, count & 0xFF);
+    outb(PIT_CHANNEL_2, (count >> 8) & 0xFF); /* counting starts from here */
+
+    uint64_t start = read_tsc();
+    while (!(inb(PIT_SPEAKER_CONTROL) & PIT_SPEAKER_CONTROL_OUTPUT_2)) {
+    }
+
+    return (uint32_t)(read_tsc() - start);
+}
+
+/* measure the TSC frequency against the PIT. the shortest of a few runs is kept, as anything else was interrupted or slowed */
+void setup_tsc() {
+    uint32_t flags = interrupts_save_disable();
+    uint32_t shortest = 0xFFFFFFFF;
+
+    for (unsigned int run = 0; run < TSC_CALIBRATION_RUNS; run++) {
+        uint32_t cycles = time_pit_countdown();
+
+        if (cycles < shortest) {
+            shortest = cycles;
+        }
+    }
+
+    interrupts_restore(flags);
+
+    tsc_frequency_khz = shortest / TSC_CALIBRATION_MILLISECONDS;
+    if (tsc_frequency_khz == 0) {
+        tsc_frequency_khz = 1;
+    }
+
+    if (!boot_fast) {
+        kprintf("TSC runs at %u.%03u MHz\n", tsc_frequency_khz / 1000, tsc_frequency_khz % 1000);
+    }
+}
+
+/* convert a cycle count to microseconds with one divl, saturating if the result doesn't fit in 32 bits */
+uint32_t tsc_cycles_to_microseconds(uint64_t cycles) {
+    uint64_t scaled = cycles * 1000;
+    uint32_t low = (uint32_t)scaled;
+    uint32_t high = (uint32_t)(scaled >> 32);
+    uint32_t quotient, remainder;
+
+    if (tsc_frequency_khz == 0 || high >= tsc_frequency_khz) {
+        return 0xFFFFFFFF;
+    }
+
+    __asm__ ("divl %4" : "=a"(quotient), "=d"(remainder) : "a"(low), "d"(high), "rm"(tsc_frequency_khz));
+    (void)remainder;
+
+    return quotient;
+}
+
+/* busy wait. the comparison is scaled up rather than the cycle count down, to stay clear of 64 bit division */
+void tsc_delay_microseconds(uint32_t microseconds) {
+    uint64_t target = (uint64_t)tsc_frequency_khz * microseconds;
+    uint64_t start = read_tsc();
+
+    while ((read_tsc() - start) * 1000 < target) {
+        __asm__ volatile ("pause");
+    }
+}
@@ -0,0 +1,338 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kernel/intel.h>
+#include <kernel/interrupts.h>
+#include <kernel/kprintf.h>
+#include <kernel/paging.h>
+#include <kernel/pmm.h>
+#include <kernel/process.h>
+#include <kernel/slab.h>
+#include <kernel/spinlock.h>
+#include <kernel/trace.h>
+#include <kernel/tsc.h>
+#include <kernel/vm.h>
+
+#include <klegit/string.h>
+
+#define INTERRUPT_VECTOR_PAGE_FAULT 14
+#define VM_GUARD_SIZE PAGE_SIZE /* left unmapped after each region, so running off the end faults */
+#define VM_SELF_TEST_SIZE (16 * 1024 * 1024)
+
+/*
+
+Demand paging for anonymous memory. vm_reserve only records a range of addresses: no frames and no page tables, so a
+large reservation costs the same as a small one. The first read of a page maps the shared zero page read only, and the
+first write, whether to an untouched page or one showing the zero page, gets a freshly zeroed frame of its own. Memory
+is only committed as it is written.
+
+A write fault zeroes its frame before taking vm_lock, so CPUs faulting at the same time only serialise on the page
+table update. If another CPU got to the page first, the frame goes back. Page tables are shared by every CPU, and a
+CPU which faults on an entry that has already been fixed up only has a stale TLB entry to drop.
+
+vm_release only flushes the calling CPU's TLB, as unmap_range does, so nothing may still be using a region on any other
+CPU when it is released.
+
+This is also the one page fault handler, so faults in the process window are passed on to process_fault.
+
+*/
+
+struct vm_statistics vm_statistics;
+
+static LOCK_STATISTICS(vm_lock_statistics, "vm");
+static struct spinlock vm_lock = SPINLOCK_INIT_WITH_STATISTICS(&vm_lock_statistics);
+
+static struct vm_region *regions; /* sorted by address */
+static struct vm_region *last_region; /* where the last fault was, as faults tend to come in runs */
+
+static physical_address zero_page;
+
+/* the region containing address, or 0. vm_lock must be held */
+static struct vm_region *find_region(uint32_t address) {
+    if (last_region && address >= last_region->start && address < last_region->end) {
+        return last_region;
+    }
+
+    for (struct vm_region *region = regions; region && region->start <= address; region = region->next) {
+        if (address < region->end) {
+            last_region = region;
+            return region;
+        }
+    }
+
+    return 0;
+}
+
+/*
+Point the entry for page at the zero page or at frame, a zeroed frame for a write fault. Returns false if the fault
+isn't one demand paging can deal with. *frame_used says whether the frame was put in the page table.
+*/
+static bool resolve_fault(uint32_t page, uint32_t error_code, physical_address frame, bool *frame_used) {
+    struct vm_region *region = find_region(page);
+    bool write = error_code & PAGE_FAULT_WRITE;
+
+    if (!region || (write && !(region->flags & PAGE_WRITABLE)) || ((error_code & PAGE_FAULT_USER) && !(region->flags & PAGE_USER))) {
+        return false;
+    }
+
+    uint32_t *entry = paging_entry(page, true);
+    if (!entry) {
+        return false;
+    }
+
+    uint32_t flags = PAGE_PRESENT | (region->flags & PAGE_USER);
+
+    if ((*entry & PAGE_PRESENT) && (!write || (*entry & PAGE_WRITABLE))) {
+        vm_statistics.spurious++;
+        paging_invalidate(page);
+        return true;
+    }
+
+    if (!write) {
+        *entry = zero_page | flags;
+        vm_statistics.zero_page_maps++;
+        return true;
+    }
+
+    bool was_present = *entry & PAGE_PRESENT;
+    *entry = frame | flags | PAGE_WRITABLE;
+    if (was_present) {
+        paging_invalidate(page);
+    }
+    *frame_used = true;
+    vm_statistics.zero_fills++;
+    vm_statistics.committed_pages++;
+
+    return true;
+}
+
+/* a fault anywhere outside the process window, which only demand paging can resolve */
+static bool anonymous_fault(uint32_t page, uint32_t error_code) {
+    uint64_t start = read_tsc();
+    physical_address new_frame = 0;
+    bool frame_used = false;
+
+    if (error_code & PAGE_FAULT_WRITE) {
+        new_frame = pmm_alloc_frame();
+        if (new_frame) {
+            memset((void*)new_frame, 0, PAGE_SIZE);
+        }
+    }
+
+    spinlock_acquire(&vm_lock);
+    bool resolved = (new_frame || !(error_code & PAGE_FAULT_WRITE)) && resolve_fault(page, error_code, new_frame, &frame_used);
+
+    uint32_t cycles = read_tsc() - start;
+    vm_statistics.faults++;
+    vm_statistics.fault_cycles += cycles;
+    if (cycles > vm_statistics.maximum_fault_cycles) {
+        vm_statistics.maximum_fault_cycles = cycles;
+    }
+    spinlock_release(&vm_lock);
+
+    if (new_frame && !frame_used) {
+        pmm_free_frame(new_frame);
+    }
+
+    return resolved;
+}
+
+/* interrupts are off throughout, as the IDT only has interrupt gates */
+static void page_fault(struct interrupt_frame *frame) {
+    uint32_t address = read_cr2();
+    uint32_t page = address & ~(PAGE_SIZE - 1);
+    bool resolved;
+
+    if (page >= PAGING_USER_BASE && page < PAGING_USER_END) {
+        resolved = process_fault(page, frame->error_code);
+    } else {
+        resolved = anonymous_fault(page, frame->error_code);
+    }
+
+    if (!resolved) {
+        kprintf("\npage fault: %s of 0x%08x from ring %u%s\n", (frame->error_code & PAGE_FAULT_WRITE) ? "write" : "read", address,
+            (frame->error_code & PAGE_FAULT_USER) ? 3 : 0, (frame->error_code & PAGE_FAULT_PRESENT) ? ", page present" : "");
+        unhandled_exception(frame);
+    }
+}
+
+/* the shared zero page and the page fault handler. needs setup_paging */
+void setup_vm() {
+    zero_page = pmm_alloc_frame();
+    if (!zero_page) {
+        kprintf("vm: no frame for the zero page\n");
+        halt();
+    }
+    memset((void*)zero_page, 0, PAGE_SIZE);
+
+    if (pmm_highest_address() > VM_KERNEL_BASE) {
+        kprintf("vm: RAM reaches past 0x%08x, the identity map overlaps the demand paged region\n", VM_KERNEL_BASE);
+        halt();
+    }
+
+    register_interrupt_handler(INTERRUPT_VECTOR_PAGE_FAULT, page_fault);
+}
+
+/* the frame every untouched page reads from, which is never written and never freed */
+physical_address vm_zero_page() {
+    return zero_page;
+}
+
+/*
+Reserve length bytes of addresses, rounded up to whole pages, which read as zero and are backed by memory when written.
+Returns the start, or 0 if there is no gap big enough. Nothing is allocated apart from the region record.
+*/
+uint32_t vm_reserve(uint32_t length, uint32_t flags) {
+    struct vm_region *region = kmalloc(sizeof(struct vm_region));
+    if (!region || length == 0) {
+        kfree(region);
+        return 0;
+    }
+
+    length = (length + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    region->flags = flags & (PAGE_WRITABLE | PAGE_USER);
+
+    uint32_t irq_flags = spinlock_acquire_irqsave(&vm_lock);
+
+    /* first fit, with a guard page after every region */
+    uint32_t start = VM_KERNEL_BASE;
+    struct vm_region **link = &regions;
+    for (; *link; link = &(*link)->next) {
+        if ((*link)->start - start >= length + VM_GUARD_SIZE) {
+            break;
+        }
+        start = (*link)->end + VM_GUARD_SIZE;
+    }
+
+    if (VM_KERNEL_END - start < length + VM_GUARD_SIZE) {
+        spinlock_release_irqrestore(&vm_lock, irq_flags);
+        kfree(region);
+        return 0;
+    }
+
+    region->start = start;
+    region->end = start + length;
+    region->next = *link;
+    *link = region;
+
+    spinlock_release_irqrestore(&vm_lock, irq_flags);
+
+    return start;
+}
+
+/* give back a region from vm_reserve and every frame committed to it. the page tables are kept for the next region */
+bool vm_release(uint32_t start) {
+    uint32_t irq_flags = spinlock_acquire_irqsave(&vm_lock);
+
+    struct vm_region **link = &regions;
+    while (*link && (*link)->start != start) {
+        link = &(*link)->next;
+    }
+
+    struct vm_region *region = *link;
+    if (!region) {
+        spinlock_release_irqrestore(&vm_lock, irq_flags);
+        return false;
+    }
+    *link = region->next;
+    if (last_region == region) {
+        last_region = 0;
+    }
+
+    uint32_t page_count = (region->end - region->start) / PAGE_SIZE;
+    for (uint32_t page = region->start; page < region->end;) {
+        uint32_t *entry = paging_entry(page, false);
+
+        if (!entry) {
+            /* no table here, so nothing was ever touched in this 4M slot */
+            page = (page + LARGE_PAGE_SIZE) & ~(LARGE_PAGE_SIZE - 1);
+            continue;
+        }
+
+        if (*entry & PAGE_PRESENT) {
+            physical_address frame = *entry & ~PAGE_FLAGS_MASK;
+
+            if (frame != zero_page) {
+                pmm_free_frame(frame);
+                vm_statistics.committed_pages--;
+            }
+            *entry = 0;
+            if (page_count <= PAGING_INVLPG_LIMIT) {
+                paging_invalidate(page);
+            }
+        }
+        page += PAGE_SIZE;
+    }
+    if (page_count > PAGING_INVLPG_LIMIT) {
+        paging_flush_tlb();
+    }
+
+    spinlock_release_irqrestore(&vm_lock, irq_flags);
+    kfree(region);
+
+    return true;
+}
+
+void vm_print_statistics() {
+    uint32_t flags = spinlock_acquire_irqsave(&vm_lock);
+    struct vm_statistics copy = vm_statistics;
+    spinlock_release_irqrestore(&vm_lock, flags);
+
+    kprintf("vm: %u faults (%u zero page, %u zero fill, %u spurious), %u pages committed, %u cycles average, %u maximum\n",
+        copy.faults, copy.zero_page_maps, copy.zero_fills, copy.spurious, copy.committed_pages,
+        tsc_average_cycles(copy.fault_cycles, copy.faults), copy.maximum_fault_cycles);
+}
+
+/*
+Reserve a large region and check it takes no memory, that untouched pages read as zero without taking any either, that
+written pages keep what was written while their neighbours stay zero, and that releasing it gives every frame back.
+*/
+bool vm_self_test() {
+    uint32_t free_before = pmm_statistics.free_frames;
+    uint32_t committed_before = vm_statistics.committed_pages;
+    bool passed = true;
+
+    uint32_t start = vm_reserve(VM_SELF_TEST_SIZE, PAGE_WRITABLE);
+    if (!start) {
+        kprintf("vm self-test: could not reserve %u MB\n", VM_SELF_TEST_SIZE >> 20);
+        return false;
+    }
+    if (pmm_statistics.free_frames != free_before) {
+        kprintf("vm self-test: reserving took %u frames\n", free_before - pmm_statistics.free_frames);
+        passed = false;
+    }
+
+    /* one read and one write in every 4M, so the page tables come and go with the test's own frames counted apart */
+    volatile uint32_t *words = (volatile uint32_t*)start;
+    uint32_t words_per_slot = LARGE_PAGE_SIZE / sizeof(uint32_t);
+    uint32_t slots = VM_SELF_TEST_SIZE / LARGE_PAGE_SIZE;
+
+    for (uint32_t slot = 0; slot < slots; slot++) {
+        if (words[slot * words_per_slot] != 0) {
+            passed = false;
+        }
+    }
+    uint32_t after_reads = pmm_statistics.free_frames;
+    for (uint32_t slot = 0; slot < slots; slot++) {
+        words[slot * words_per_slot + 1] = 0xC0DE0000 | slot;
+    }
+
+    if (vm_statistics.committed_pages - committed_before != slots || after_reads - pmm_statistics.free_frames != slots) {
+        kprintf("vm self-test: %u writes committed %u pages\n", slots, vm_statistics.committed_pages - committed_before);
+        passed = false;
+    }
+    for (uint32_t slot = 0; slot < slots; slot++) {
+        if (words[slot * words_per_slot + 1] != (0xC0DE0000 | slot) || words[slot * words_per_slot + 1024] != 0) {
+            kprintf("vm self-test: wrong contents in slot %u\n", slot);
+            passed = false;
+        }
+    }
+
+    if (!vm_release(start) || vm_statistics.committed_pages != committed_before || pmm_statistics.free_frames != after_reads) {
+        kprintf("vm self-test: release left %u frames out\n", after_reads - pmm_statistics.free_frames);
+        passed = false;
+    }
+
+    return passed;
+}
@@ -39,11 +39,33 @@
  * Wasting nearly 24kB of memory just for snprintf() on
  * a chip with 32kB flash is crazy. Use mini_snprintf() instead.
  *
+ * In this tree the parser has been split out in to mini_vformat(),
+ * which streams its output to an emit callback, so the kernel's
+ * kprintf() can format straight to its output devices. On top of
+ * the original %d %u %x %X %c %s it understands %o, %p, the ll length
+ * modifier, field widths (including '*') and '-' left justification.
+ * Integer conversion avoids division: hex and octal are shifted out
+ * through a digit table, and decimal goes two digits at a time.
+ *
  */
 
 #include <stdarg.h>
 #include <klegit/mini-printf.h>
 
+/* Formatting flags collected between the '%' and the conversion */
+#define FLAG_LEFT_JUSTIFY   1
+#define FLAG_ZERO_PAD       2
+#define FLAG_LONG_LONG      4
+
+static const char padding_spaces[] = "                ";
+static const char padding_zeros[]  = "0000000000000000";
+
+struct snprintf_context {
+    char *buffer;
+    unsigned int buffer_len;
+    unsigned int position;
+};
+
 static unsigned int
 mini_strlen(const char *s)
 {
@@ -52,136 +74,316 @@ mini_strlen(const char *s)
     return len;
 }
 
+static const char lower_digits[] = "0123456789abcdef";
+static const char upper_digits[] = "0123456789ABCDEF";
+
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/* Decimal, two digits at a time. Dividing by 100 is done as a multiply
+ * by its reciprocal: (n * 0x51EB851F) >> 37 == n / 100 for any 32 bit n. */
+static char *
+mini_utoa_decimal32(unsigned int value, char *end)
+{
+    while (value >= 100) {
+        unsigned int quotient = ((unsigned long long)value * 0x51EB851FU) >> 37;
+        unsigned int pair = (value - quotient * 100) * 2;
+
+        *(--end) = digit_pairs[pair + 1];
+        *(--end) = digit_pairs[pair];
+        value = quotient;
+    }
+
+    if (value >= 10) {
+        *(--end) = digit_pairs[value * 2 + 1];
+        *(--end) = digit_pairs[value * 2];
+    } else {
+        *(--end) = '0' + value;
+    }
+
+    return end;
+}
+
+/* Divide a 64 bit value by 10^9 in place and return the remainder. On
+ * i386 this is two divl instructions rather than a call to libgcc's
+ * __udivdi3/__umoddi3. The second divl cannot overflow because the
+ * high word's remainder is already less than the divisor. */
 static unsigned int
-mini_itoa(int value, unsigned int radix, unsigned int uppercase, unsigned int unsig,
-     char *buffer, unsigned int zero_pad)
+mini_divide_billion(unsigned long long *value)
 {
-    char    *pbuffer = buffer;
-    int negative = 0;
-    unsigned int    i, len;
+#if defined(__i386__)
+    unsigned int high = *value >> 32;
+    unsigned int low = (unsigned int)*value;
+    unsigned int high_quotient = high / 1000000000U;
+    unsigned int remainder = high % 1000000000U;
+    unsigned int low_quotient;
 
-    /* No support for unusual radixes. */
-    if (radix > 16)
-        return 0;
+    __asm__ ("divl %4" : "=a"(low_quotient), "=d"(remainder) : "a"(low), "d"(remainder), "rm"(1000000000U));
+
+    *value = ((unsigned long long)high_quotient << 32) | low_quotient;
+    return remainder;
+#else
+    unsigned int remainder = *value % 1000000000ULL;
+    *value /= 1000000000ULL;
+    return remainder;
+#endif
+}
+
+/* 64 bit decimal: peel off nine digit chunks until what is left fits in
+ * 32 bits, then finish with the 32 bit converter */
+static char *
+mini_utoa_decimal(unsigned long long value, char *end)
+{
+    while (value >> 32) {
+        char *chunk_end = end;
 
-    if (value < 0 && !unsig) {
-        negative = 1;
-        value = -value;
+        end = mini_utoa_decimal32(mini_divide_billion(&value), end);
+
+        /* Chunks below the top one keep their leading zeros */
+        while (end > chunk_end - 9)
+            *(--end) = '0';
     }
 
-    /* This builds the string back to front ... */
+    return mini_utoa_decimal32((unsigned int)value, end);
+}
+
+/* Hex and octal by shift and mask, using the 32 bit loop once the
+ * value is small enough to avoid 64 bit shifts */
+static char *
+mini_utoa_shift(unsigned long long value, unsigned int shift, const char *digits, char *end)
+{
+    unsigned int mask = (1 << shift) - 1;
+    unsigned int low;
+
+    while (value >> 32) {
+        *(--end) = digits[(unsigned int)value & mask];
+        value >>= shift;
+    }
+
+    low = (unsigned int)value;
     do {
-        int digit = value % radix;
-        *(pbuffer++) = (digit < 10 ? '0' + digit : (uppercase ? 'A' : 'a') + digit - 10);
-        value /= radix;
-    } while (value > 0);
-
-    for (i = (pbuffer - buffer); i < zero_pad; i++)
-        *(pbuffer++) = '0';
-
-    if (negative)
-        *(pbuffer++) = '-';
-
-    *(pbuffer) = '\0';
-
-    /* ... now we reverse it (could do it recursively but will
-     * conserve the stack space) */
-    len = (pbuffer - buffer);
-    for (i = 0; i < len / 2; i++) {
-        char j = buffer[i];
-        buffer[i] = buffer[len-i-1];
-        buffer[len-i-1] = j;
+        *(--end) = digits[low & mask];
+        low >>= shift;
+    } while (low);
+
+    return end;
+}
+
+/* Convert value to digits in the given radix (8, 10 or 16), writing them
+ * backwards so they finish just before end, and return a pointer to the
+ * first digit. Nothing needs reversing afterwards, and a 64 bit value
+ * needs at most 22 characters of space. */
+char *
+mini_utoa(unsigned long long value, unsigned int radix, unsigned int uppercase, char *end)
+{
+    switch (radix) {
+        case 10:
+            return mini_utoa_decimal(value, end);
+        case 16:
+            return mini_utoa_shift(value, 4, uppercase ? upper_digits : lower_digits, end);
+        case 8:
+            return mini_utoa_shift(value, 3, lower_digits, end);
+        default:
+            /* No support for unusual radixes. */
+            return end;
     }
+}
 
-    return len;
+/* Emit count copies of a padding character, in runs */
+static void
+mini_pad(mini_printf_emit emit, void *context, const char *padding, unsigned int count)
+{
+    while (count > 0) {
+        unsigned int run = count < sizeof(padding_spaces) - 1 ? count : sizeof(padding_spaces) - 1;
+        emit(padding, run, context);
+        count -= run;
+    }
 }
 
+/* Emit a converted field, padded out to width. Zero padding goes
+ * between the sign and the digits. */
+static unsigned int
+mini_emit_field(mini_printf_emit emit, void *context, char *prefix, unsigned int prefix_len,
+     char *s, unsigned int len, unsigned int width, unsigned int flags)
+{
+    unsigned int total = prefix_len + len;
+    unsigned int padding = width > total ? width - total : 0;
+
+    if (padding && !(flags & (FLAG_LEFT_JUSTIFY | FLAG_ZERO_PAD)))
+        mini_pad(emit, context, padding_spaces, padding);
+    if (prefix_len)
+        emit(prefix, prefix_len, context);
+    if (padding && (flags & FLAG_ZERO_PAD) && !(flags & FLAG_LEFT_JUSTIFY))
+        mini_pad(emit, context, padding_zeros, padding);
+    if (len)
+        emit(s, len, context);
+    if (padding && (flags & FLAG_LEFT_JUSTIFY))
+        mini_pad(emit, context, padding_spaces, padding);
+
+    return total + padding;
+}
+
+/* The formatter proper. Literal text is handed to emit in runs straight
+ * out of fmt, and each conversion is emitted from a small stack buffer,
+ * so nothing is ever copied in to an intermediate output buffer. */
 int
-mini_vsnprintf(char *buffer, unsigned int buffer_len, char *fmt, va_list va)
+mini_vformat(mini_printf_emit emit, void *context, char *fmt, va_list va)
 {
-    char *pbuffer = buffer;
     char bf[24];
+    char *bf_end = bf + sizeof(bf);
     char ch;
+    unsigned int count = 0;
 
-    int _putc(char ch)
-    {
-        if ((unsigned int)((pbuffer - buffer) + 1) >= buffer_len)
-            return 0;
-        *(pbuffer++) = ch;
-        *(pbuffer) = '\0';
-        return 1;
-    }
+    while (*fmt) {
+        char *run = fmt;
+        unsigned int flags = 0;
+        unsigned int width = 0;
+        unsigned long long value;
+        char *ptr;
+        char *digits;
 
-    int _puts(char *s, unsigned int len)
-    {
-        unsigned int i;
-
-        if (buffer_len - (pbuffer - buffer) - 1 < len)
-            len = buffer_len - (pbuffer - buffer) - 1;
+        while (*fmt && *fmt != '%')
+            fmt++;
+        if (fmt != run) {
+            emit(run, fmt - run, context);
+            count += fmt - run;
+        }
+        if (*fmt == '\0')
+            break;
 
-        /* Copy to buffer */
-        for (i = 0; i < len; i++)
-            *(pbuffer++) = s[i];
-        *(pbuffer) = '\0';
+        fmt++;
 
-        return len;
-    }
+        /* Flags */
+        for (;;) {
+            if (*fmt == '-')
+                flags |= FLAG_LEFT_JUSTIFY;
+            else if (*fmt == '0')
+                flags |= FLAG_ZERO_PAD;
+            else
+                break;
+            fmt++;
+        }
 
-    while ((ch=*(fmt++))) {
-        if ((unsigned int)((pbuffer - buffer) + 1) >= buffer_len)
-            break;
-        if (ch!='%')
-            _putc(ch);
-        else {
-            char zero_pad = 0;
-            char *ptr;
-            unsigned int len;
-
-            ch=*(fmt++);
-
-            /* Zero padding requested */
-            if (ch=='0') {
-                ch=*(fmt++);
-                if (ch == '\0')
-                    goto end;
-                if (ch >= '0' && ch <= '9')
-                    zero_pad = ch - '0';
-                ch=*(fmt++);
+        /* Field width, either inline or taken from the arguments */
+        if (*fmt == '*') {
+            int star = va_arg(va, int);
+            if (star < 0) {
+                flags |= FLAG_LEFT_JUSTIFY;
+                star = -star;
             }
+            width = star;
+            fmt++;
+        } else {
+            while (*fmt >= '0' && *fmt <= '9')
+                width = width * 10 + (*(fmt++) - '0');
+        }
 
-            switch (ch) {
-                case 0:
-                    goto end;
-
-                case 'u':
-                case 'd':
-                    len = mini_itoa(va_arg(va, unsigned int), 10, 0, (ch=='u'), bf, zero_pad);
-                    _puts(bf, len);
-                    break;
-
-                case 'x':
-                case 'X':
-                    len = mini_itoa(va_arg(va, unsigned int), 16, (ch=='X'), 1, bf, zero_pad);
-                    _puts(bf, len);
-                    break;
-
-                case 'c' :
-                    _putc((char)(va_arg(va, int)));
-                    break;
-
-                case 's' :
-                    ptr = va_arg(va, char*);
-                    _puts(ptr, mini_strlen(ptr));
-                    break;
-
-                default:
-                    _putc(ch);
-                    break;
+        /* Length modifiers. long is the same size as int here, so only
+         * ll changes anything. */
+        while (*fmt == 'l') {
+            if (fmt[1] == 'l') {
+                flags |= FLAG_LONG_LONG;
+                fmt++;
             }
+            fmt++;
+        }
+
+        ch = *(fmt++);
+
+        switch (ch) {
+            case 0:
+                goto end;
+
+            case 'd':
+                if (flags & FLAG_LONG_LONG) {
+                    long long signed_value = va_arg(va, long long);
+                    value = signed_value < 0 ? -(unsigned long long)signed_value : (unsigned long long)signed_value;
+                    ptr = signed_value < 0 ? "-" : "";
+                } else {
+                    int signed_value = va_arg(va, int);
+                    value = signed_value < 0 ? -(unsigned int)signed_value : (unsigned int)signed_value;
+                    ptr = signed_value < 0 ? "-" : "";
+                }
+                digits = mini_utoa(value, 10, 0, bf_end);
+                count += mini_emit_field(emit, context, ptr, mini_strlen(ptr), digits, bf_end - digits, width, flags);
+                break;
+
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                if (flags & FLAG_LONG_LONG)
+                    value = va_arg(va, unsigned long long);
+                else
+                    value = va_arg(va, unsigned int);
+                digits = mini_utoa(value, (ch == 'u') ? 10 : (ch == 'o') ? 8 : 16, (ch == 'X'), bf_end);
+                count += mini_emit_field(emit, context, "", 0, digits, bf_end - digits, width, flags);
+                break;
+
+            case 'p':
+                digits = mini_utoa((unsigned int)va_arg(va, void*), 16, 0, bf_end);
+                count += mini_emit_field(emit, context, "0x", 2, digits, bf_end - digits, 10, FLAG_ZERO_PAD);
+                break;
+
+            case 'c' :
+                bf[0] = (char)(va_arg(va, int));
+                count += mini_emit_field(emit, context, "", 0, bf, 1, width, flags & ~FLAG_ZERO_PAD);
+                break;
+
+            case 's' :
+                ptr = va_arg(va, char*);
+                count += mini_emit_field(emit, context, "", 0, ptr, mini_strlen(ptr), width, flags & ~FLAG_ZERO_PAD);
+                break;
+
+            default:
+                emit(&ch, 1, context);
+                count++;
+                break;
         }
     }
 end:
-    return pbuffer - buffer;
+    return count;
+}
+
+
+/* Sink which copies in to a fixed size buffer, truncating and always
+ * leaving it null terminated */
+static void
+mini_snprintf_emit(const char *s, unsigned int len, void *context)
+{
+    struct snprintf_context *snprintf_context = context;
+    unsigned int i;
+
+    if (snprintf_context->buffer_len - snprintf_context->position - 1 < len)
+        len = snprintf_context->buffer_len - snprintf_context->position - 1;
+
+    /* Copy to buffer */
+    for (i = 0; i < len; i++)
+        snprintf_context->buffer[snprintf_context->position++] = s[i];
+    snprintf_context->buffer[snprintf_context->position] = '\0';
+}
+
+int
+mini_vsnprintf(char *buffer, unsigned int buffer_len, char *fmt, va_list va)
+{
+    struct snprintf_context context = { buffer, buffer_len, 0 };
+
+    if (buffer_len == 0)
+        return 0;
+
+    buffer[0] = '\0';
+    mini_vformat(mini_snprintf_emit, &context, fmt, va);
+
+    return context.position;
 }
 
 
@@ -1,22 +1,254 @@
 #include <stddef.h>
+#include <stdint.h>
 
-void* memcpy(void* destination_pointer, const void *source_pointer, size_t length) {
+#include <klegit/string.h>
+
+/* below this many bytes the head/body/tail split costs more than it saves */
+#define STRING_WORD_THRESHOLD 16
+
+/* copies and fills at least this large are handed to the large implementations, which may use SSE2 */
+#define STRING_LARGE_THRESHOLD 256
+
+/* a 32 bit word which may live at any address and alias any other type */
+typedef uint32_t __attribute__((__may_alias__, __aligned__(1))) unaligned_word;
+
+static void* (*large_copy)(void*, const void*, size_t) = 0;
+static void* (*large_fill)(void*, unsigned char, size_t) = 0;
+
+/* copy from low to high addresses. the destination is aligned to a word boundary first so the rep movsl body only ever does aligned stores */
+static inline void copy_forward(unsigned char* destination, const unsigned char* source, size_t length) {
+    if (length >= STRING_WORD_THRESHOLD) {
+        size_t head = (-(uintptr_t)destination) & 3;
+        size_t words = (length - head) >> 2;
+
+        length = (length - head) & 3;
+
+        __asm__ volatile ("rep movsb" : "+D"(destination), "+S"(source), "+c"(head) : : "memory");
+        __asm__ volatile ("rep movsl" : "+D"(destination), "+S"(source), "+c"(words) : : "memory");
+    }
+
+    __asm__ volatile ("rep movsb" : "+D"(destination), "+S"(source), "+c"(length) : : "memory");
+}
+
+/* copy from high to low addresses, for overlapping moves where the destination is above the source */
+static inline void copy_backward(unsigned char* destination, const unsigned char* source, size_t length) {
+    /* peel off the odd trailing bytes so what remains is a whole number of words */
+    while (length & 3) {
+        length--;
+        destination[length] = source[length];
+    }
+
+    size_t words = length >> 2;
+    if (words) {
+        unsigned char* last_destination_word = destination + length - 4;
+        const unsigned char* last_source_word = source + length - 4;
+
+        __asm__ volatile (
+            "std\n\t"
+            "rep movsl\n\t"
+            "cld"
+            : "+D"(last_destination_word), "+S"(last_source_word), "+c"(words)
+            :
+            : "memory"
+        );
+    }
+}
+
+/* fill with a byte value, using rep stosl for the aligned body */
+static inline void fill_forward(unsigned char* destination, unsigned char character_to_write, size_t length) {
+    if (length >= STRING_WORD_THRESHOLD) {
+        uint32_t pattern = character_to_write * 0x01010101u;
+        size_t head = (-(uintptr_t)destination) & 3;
+        size_t words = (length - head) >> 2;
+
+        length = (length - head) & 3;
+
+        __asm__ volatile ("rep stosb" : "+D"(destination), "+c"(head) : "a"(pattern) : "memory");
+        __asm__ volatile ("rep stosl" : "+D"(destination), "+c"(words) : "a"(pattern) : "memory");
+    }
+
+    __asm__ volatile ("rep stosb" : "+D"(destination), "+c"(length) : "a"(character_to_write) : "memory");
+}
+
+void* memcpy(void* destination_pointer, const void* source_pointer, size_t length) {
+    if (length >= STRING_LARGE_THRESHOLD && large_copy) {
+        return large_copy(destination_pointer, source_pointer, length);
+    }
+
+    copy_forward((unsigned char*)destination_pointer, (const unsigned char*)source_pointer, length);
+
+    return destination_pointer;
+}
+
+void* memmove(void* destination_pointer, const void* source_pointer, size_t length) {
     unsigned char* destination = (unsigned char*)destination_pointer;
     const unsigned char* source = (const unsigned char*)source_pointer;
 
-    for (size_t index = 0; index < length; index++) {
-        destination[index] = source[index];
+    /* only a destination which starts inside the source needs copying backwards */
+    if (destination > source && destination < source + length) {
+        copy_backward(destination, source, length);
+    } else {
+        copy_forward(destination, source, length);
     }
 
     return destination_pointer;
 }
 
 void* memset(void* destination_pointer, unsigned char character_to_write, size_t length) {
-    unsigned char* destination = (unsigned char*)destination_pointer;
+    if (length >= STRING_LARGE_THRESHOLD && large_fill) {
+        return large_fill(destination_pointer, character_to_write, length);
+    }
+
+    fill_forward((unsigned char*)destination_pointer, character_to_write, length);
+
+    return destination_pointer;
+}
+
+int memcmp(const void* first_pointer, const void* second_pointer, size_t length) {
+    const unsigned char* first = (const unsigned char*)first_pointer;
+    const unsigned char* second = (const unsigned char*)second_pointer;
+
+    /* skip over equal words, then let the byte loop find the first difference */
+    while (length >= 4 && *(const unaligned_word*)first == *(const unaligned_word*)second) {
+        first += 4;
+        second += 4;
+        length -= 4;
+    }
 
     for (size_t index = 0; index < length; index++) {
-        destination[index] = character_to_write;
+        if (first[index] != second[index]) {
+            return first[index] - second[index];
+        }
+    }
+
+    return 0;
+}
+
+size_t strlen(const char* string) {
+    const char* character = string;
+
+    /* walk bytes up to a word boundary so the word loop never reads across a page it shouldn't */
+    while ((uintptr_t)character & 3) {
+        if (*character == 0) {
+            return character - string;
+        }
+        character++;
+    }
+
+    /* a word contains a zero byte if subtracting 1 from each byte borrows in to its top bit */
+    const uint32_t* word = (const uint32_t*)character;
+    while (((*word - 0x01010101u) & ~*word & 0x80808080u) == 0) {
+        word++;
+    }
+
+    character = (const char*)word;
+    while (*character != 0) {
+        character++;
+    }
+
+    return character - string;
+}
+
+int strcmp(const char* first, const char* second) {
+    while (*first && *first == *second) {
+        first++;
+        second++;
     }
 
+    return (unsigned char)*first - (unsigned char)*second;
+}
+
+/* SSE2 copy: align the destination to 16 bytes, then move 64 bytes per iteration with unaligned loads and aligned stores */
+__attribute__((__target__("sse2")))
+void* memcpy_sse2(void* destination_pointer, const void* source_pointer, size_t length) {
+    unsigned char* destination = (unsigned char*)destination_pointer;
+    const unsigned char* source = (const unsigned char*)source_pointer;
+
+    size_t head = (-(uintptr_t)destination) & 15;
+    if (head > length) {
+        head = length;
+    }
+    copy_forward(destination, source, head);
+    destination += head;
+    source += head;
+    length -= head;
+
+    for (; length >= 64; length -= 64) {
+        __asm__ volatile (
+            "movdqu 0(%1), %%xmm0\n\t"
+            "movdqu 16(%1), %%xmm1\n\t"
+            "movdqu 32(%1), %%xmm2\n\t"
+            "movdqu 48(%1), %%xmm3\n\t"
+            "movdqa %%xmm0, 0(%0)\n\t"
+            "movdqa %%xmm1, 16(%0)\n\t"
+            "movdqa %%xmm2, 32(%0)\n\t"
+            "movdqa %%xmm3, 48(%0)"
+            :
+            : "r"(destination), "r"(source)
+            : "memory", "xmm0", "xmm1", "xmm2", "xmm3"
+        );
+        destination += 64;
+        source += 64;
+    }
+
+    copy_forward(destination, source, length);
+
     return destination_pointer;
 }
+
+/* SSE2 fill: broadcast the byte across xmm0 and store 64 bytes per iteration */
+__attribute__((__target__("sse2")))
+void* memset_sse2(void* destination_pointer, unsigned char character_to_write, size_t length) {
+    unsigned char* destination = (unsigned char*)destination_pointer;
+
+    size_t head = (-(uintptr_t)destination) & 15;
+    if (head > length) {
+        head = length;
+    }
+    fill_forward(destination, character_to_write, head);
+    destination += head;
+    length -= head;
+
+    size_t blocks = length >> 6;
+    if (blocks) {
+        __asm__ volatile (
+            "movd %2, %%xmm0\n\t"
+            "pshufd $0, %%xmm0, %%xmm0\n"
+            "1:\n\t"
+            "movdqa %%xmm0, 0(%0)\n\t"
+            "movdqa %%xmm0, 16(%0)\n\t"
+            "movdqa %%xmm0, 32(%0)\n\t"
+            "movdqa %%xmm0, 48(%0)\n\t"
+            "add $64, %0\n\t"
+            "dec %1\n\t"
+            "jnz 1b"
+            : "+r"(destination), "+r"(blocks)
+            : "r"(character_to_write * 0x01010101u)
+            : "memory", "cc", "xmm0"
+        );
+        length &= 63;
+    }
+
+    fill_forward(destination, character_to_write, length);
+
+    return destination_pointer;
+}
+
+/* the rep string versions, which never go through the large implementations. for those to fall back on */
+void* memcpy_rep(void* destination_pointer, const void* source_pointer, size_t length) {
+    copy_forward((unsigned char*)destination_pointer, (const unsigned char*)source_pointer, length);
+
+    return destination_pointer;
+}
+
+void* memset_rep(void* destination_pointer, unsigned char character_to_write, size_t length) {
+    fill_forward((unsigned char*)destination_pointer, character_to_write, length);
+
+    return destination_pointer;
+}
+
+/* route large memcpy/memset calls through the given implementations. pass 0 to go back to the rep string versions */
+void string_set_large_implementations(void* (*copy)(void*, const void*, size_t), void* (*fill)(void*, unsigned char, size_t)) {
+    large_copy = copy;
+    large_fill = fill;
+}
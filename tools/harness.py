@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""
+Boot the kernel headless under qemu, collect the "BENCH name value" lines the benchmarks write to COM1
+(benchmark_result in src/kernel/benchmark.c) and compare them with a stored baseline.
+
+The iso must boot the kernel with "exit" on its command line, so it leaves through qemu's isa-debug-exit device once
+boot is over: qemu then exits with 1 if every self-test passed and 3 if any failed. Anything else means the kernel
+crashed, hung until the timeout, or was built without the device.
+
+Every value is a cost in cycles, so a result counts as a regression when it is more than --threshold percent and more
+than --minimum cycles above the baseline. --update-baseline writes this run's results as the new baseline instead.
+
+usage: harness.py [--qemu QEMU] [--smp N] [--timeout SECONDS] [--log LOG] [--threshold PERCENT] [--minimum CYCLES]
+                  [--update-baseline] iso baseline
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+
+EXIT_SUCCESS = 1
+EXIT_FAILURE = 3
+
+
+def run_qemu(arguments):
+    command = [
+        arguments.qemu,
+        "-nographic",
+        "-monitor", "none",
+        "-serial", "file:" + arguments.log,
+        "-device", "isa-debug-exit,iobase=0xf4,iosize=0x04",
+        "-no-reboot",
+        "-m", "256",
+        "-smp", str(arguments.smp),
+        "-cdrom", arguments.iso,
+        "-boot", "d",
+    ]
+
+    try:
+        return subprocess.run(command, stdin=subprocess.DEVNULL, timeout=arguments.timeout).returncode
+    except subprocess.TimeoutExpired:
+        return None
+
+
+def read_results(log):
+    with open(log, "rb") as log_file:
+        lines = log_file.read().decode("latin-1").splitlines()
+
+    results = {}
+    for line in lines:
+        fields = line.split()
+        if len(fields) == 3 and fields[0] == "BENCH":
+            results[fields[1]] = int(fields[2])
+
+    return results
+
+
+def read_baseline(path):
+    baseline = {}
+    if not os.path.exists(path):
+        return baseline
+
+    with open(path) as baseline_file:
+        for line in baseline_file:
+            fields = line.split()
+            if len(fields) == 2 and not line.startswith("#"):
+                baseline[fields[0]] = int(fields[1])
+
+    return baseline
+
+
+def write_baseline(path, results):
+    with open(path, "w") as baseline_file:
+        baseline_file.write("# benchmark baseline for tools/harness.py: name, cycles\n")
+        for name in sorted(results):
+            baseline_file.write("%s %u\n" % (name, results[name]))
+
+
+def report(results, baseline, threshold, minimum):
+    regressions = 0
+
+    print("%-32s %10s %10s %8s" % ("benchmark", "baseline", "current", "change"))
+    for name in sorted(set(results) | set(baseline)):
+        if name not in results:
+            print("%-32s %10u %10s %8s  missing" % (name, baseline[name], "-", "-"))
+            continue
+        if name not in baseline:
+            print("%-32s %10s %10u %8s  new" % (name, "-", results[name], "-"))
+            continue
+
+        old, new = baseline[name], results[name]
+        change = 100.0 * (new - old) / old if old else 0.0
+        flag = ""
+        if new - old > minimum and change > threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        elif old - new > minimum and -change > threshold:
+            flag = "  improved"
+        print("%-32s %10u %10u %+7.1f%%%s" % (name, old, new, change, flag))
+
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description="headless boot, benchmark report and regression check")
+    parser.add_argument("--qemu", default="qemu-system-i386")
+    parser.add_argument("--smp", type=int, default=2)
+    parser.add_argument("--timeout", type=int, default=300)
+    parser.add_argument("--log", default="build/harness.log")
+    parser.add_argument("--threshold", type=float, default=25.0)
+    parser.add_argument("--minimum", type=int, default=10)
+    parser.add_argument("--update-baseline", action="store_true")
+    parser.add_argument("iso")
+    parser.add_argument("baseline")
+    arguments = parser.parse_args()
+
+    status = run_qemu(arguments)
+    if status is None:
+        sys.exit("harness: no exit after %u seconds, see %s" % (arguments.timeout, arguments.log))
+    if status not in (EXIT_SUCCESS, EXIT_FAILURE):
+        sys.exit("harness: qemu exited with %d, the kernel did not finish booting, see %s" % (status, arguments.log))
+
+    results = read_results(arguments.log)
+    if not results:
+        sys.exit("harness: no benchmark results in %s" % arguments.log)
+
+    if arguments.update_baseline:
+        write_baseline(arguments.baseline, results)
+        print("harness: wrote %u results to %s" % (len(results), arguments.baseline))
+        sys.exit(0 if status == EXIT_SUCCESS else 1)
+
+    baseline = read_baseline(arguments.baseline)
+    if not baseline:
+        print("harness: no baseline in %s yet, make harness-baseline records one" % arguments.baseline)
+
+    regressions = report(results, baseline, arguments.threshold, arguments.minimum)
+
+    print()
+    print("self-tests: %s" % ("passed" if status == EXIT_SUCCESS else "FAILED"))
+    print("regressions: %u of %u results over %.0f%%" % (regressions, len(results), arguments.threshold))
+
+    sys.exit(0 if status == EXIT_SUCCESS and regressions == 0 else 1)
+
+
+if __name__ == "__main__":
+    main()
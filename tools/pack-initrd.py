@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+"""
+Pack one or more directories in to a single ustar archive for the initrd (src/kernel/initrd.c), with every file's data
+starting on a 4K boundary of the archive.
+
+GRUB loads modules page aligned and the kernel serves the archive in place, so aligned data means a file's pages can be
+mapped straight in to an address space, which is how the process loader (src/kernel/process.c) gets ELF segments in
+without copying them. Plain tar only aligns to 512 bytes, so each file that would otherwise start part way through a
+page is preceded by a pax extended header holding just a comment, sized to push the data on to the next page. Readers
+skip pax comments, and the kernel's index skips every entry which isn't a regular file.
+
+Later directories win where two hold the same path, as the kernel indexes the last copy of a path in the archive.
+
+usage: pack-initrd.py archive directory...
+"""
+
+import os
+import sys
+import tarfile
+
+PAGE_SIZE = 4096
+BLOCK_SIZE = tarfile.BLOCKSIZE
+
+
+def padding_comment(offset):
+    """a pax comment which puts the data of a member whose headers start at offset on a page boundary, or None"""
+    if (offset + BLOCK_SIZE) % PAGE_SIZE == 0:
+        return None
+
+    # the pax header block, its records rounded up to whole blocks, then the member's own header block
+    records = -(offset + 2 * BLOCK_SIZE) % PAGE_SIZE or PAGE_SIZE
+
+    # a record is "<length> comment=<value>\n", where the length counts its own digits
+    return "x" * (records - len(str(records)) - len(" comment=\n"))
+
+
+def add_file(archive, path, name):
+    info = archive.gettarinfo(path, name)
+    info.mtime = int(info.mtime)
+    info.uid = info.gid = 0
+    info.uname = info.gname = ""
+
+    comment = padding_comment(archive.offset)
+    if comment is not None:
+        info.pax_headers = {"comment": comment}
+
+    with open(path, "rb") as data:
+        archive.addfile(info, data)
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit(__doc__.strip().splitlines()[-1])
+
+    with tarfile.open(sys.argv[1], "w", format=tarfile.PAX_FORMAT) as archive:
+        for root in sys.argv[2:]:
+            for directory, directories, files in os.walk(root):
+                directories.sort()
+                for file_name in sorted(files):
+                    path = os.path.join(directory, file_name)
+                    add_file(archive, path, os.path.relpath(path, root))
+
+    with tarfile.open(sys.argv[1]) as archive:
+        for member in archive.getmembers():
+            if member.isfile() and member.offset_data % PAGE_SIZE:
+                sys.exit("pack-initrd: %s starts at %u, not on a page" % (member.name, member.offset_data))
+
+
+if __name__ == "__main__":
+    main()
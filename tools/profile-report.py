@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+"""
+Print a flat profile from the histogram written by profile_dump (src/kernel/profile.c), resolving each bucket against
+the kernel's symbol table. The capture can be from COM1 or the 0xE9 debug port, and may hold other output too. If it
+holds more than one dump the last one is used.
+
+usage: profile-report.py [--nm NM] [--top N] kernel capture
+"""
+
+import argparse
+import bisect
+import subprocess
+import sys
+
+
+def read_symbols(nm, kernel):
+    output = subprocess.run([nm, "-n", "--defined-only", kernel], check=True, capture_output=True, text=True).stdout
+    addresses = []
+    names = []
+
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) != 3 or fields[1] not in "tTwW":
+            continue
+        addresses.append(int(fields[0], 16))
+        names.append(fields[2])
+
+    return addresses, names
+
+
+def read_histogram(capture):
+    with open(capture, "rb") as capture_file:
+        lines = capture_file.read().decode("latin-1").splitlines()
+
+    begin = max((index for index, line in enumerate(lines) if line.startswith("PROFILE-BEGIN")), default=None)
+    if begin is None:
+        raise ValueError("no profile dump found")
+
+    fields = lines[begin].split()
+    header = {
+        "text_start": int(fields[1], 16),
+        "bucket_size": int(fields[2]),
+        "samples": int(fields[3]),
+        "user": int(fields[4]),
+        "outside": int(fields[5]),
+    }
+
+    buckets = []
+    for line in lines[begin + 1:]:
+        if line.startswith("PROFILE-END"):
+            break
+        address, count = line.split()
+        buckets.append((int(address, 16), int(count)))
+    else:
+        raise ValueError("profile dump is truncated")
+
+    return header, buckets
+
+
+def main():
+    parser = argparse.ArgumentParser(description="flat profile from a kernel profile dump")
+    parser.add_argument("--nm", default="nm")
+    parser.add_argument("--top", type=int, default=20)
+    parser.add_argument("kernel")
+    parser.add_argument("capture")
+    arguments = parser.parse_args()
+
+    addresses, names = read_symbols(arguments.nm, arguments.kernel)
+    header, buckets = read_histogram(arguments.capture)
+
+    # a bucket is charged to the function containing its first byte
+    totals = {}
+    for address, count in buckets:
+        index = bisect.bisect_right(addresses, address) - 1
+        name = names[index] if index >= 0 else "0x%08x" % address
+        totals[name] = totals.get(name, 0) + count
+
+    samples = header["samples"]
+    if samples == 0:
+        sys.exit("no samples were taken")
+
+    print("%u samples, %u in user mode, %u outside .text, %u byte buckets" % (samples, header["user"], header["outside"], header["bucket_size"]))
+    print("%8s %7s %7s  %s" % ("samples", "self%", "total%", "function"))
+
+    running = 0
+    for name, count in sorted(totals.items(), key=lambda item: item[1], reverse=True)[:arguments.top]:
+        running += count
+        print("%8u %6.2f%% %6.2f%%  %s" % (count, 100.0 * count / samples, 100.0 * running / samples, name))
+
+
+if __name__ == "__main__":
+    main()
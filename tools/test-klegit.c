@@ -0,0 +1,356 @@
+/*
+
+Host side tests for klegit, built and run by "make test-klegit".
+
+The string functions are fuzzed against byte at a time references at every length up to STRING_EXHAUSTIVE_LENGTH and
+every destination and source alignment within 16 bytes, then at random lengths and alignments up to STRING_MAX_LENGTH,
+with guard bytes either side of the destination which must come through untouched. memcpy and memset are fuzzed twice,
+once on the rep string paths and once with the SSE2 versions installed as the large implementations, as the kernel does
+at boot. mini_utoa is checked against the C library's printf in every radix it supports, across the whole 64 bit range.
+
+Then throughput is measured across sizes and alignments, against a byte at a time copy, and mini_utoa is timed against
+the mini_itoa it replaced. klegit's names clash with the C library's, so the makefile renames them with -D on the way
+in, and this file never includes <string.h>.
+
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <klegit/string.h>
+#include <klegit/mini-printf.h>
+
+/* the host's own, for the reference output */
+#undef snprintf
+#undef vsnprintf
+
+#define STRING_EXHAUSTIVE_LENGTH 256
+#define STRING_RANDOM_RUNS 4096
+#define STRING_MAX_LENGTH 16384
+#define STRING_ALIGNMENTS 16
+#define STRING_GUARD 32
+#define STRING_BUFFER_SIZE (STRING_MAX_LENGTH + 2 * STRING_GUARD + STRING_ALIGNMENTS)
+#define STRING_BENCHMARK_BYTES (64 * 1024 * 1024) /* copied per measurement, however it is split up */
+#define FORMAT_TEST_VALUES 200000
+#define FORMAT_BENCHMARK_VALUES 4096
+#define FORMAT_BENCHMARK_ROUNDS 256
+
+static unsigned char source_buffer[STRING_BUFFER_SIZE];
+static unsigned char destination_buffer[STRING_BUFFER_SIZE];
+static unsigned char reference_buffer[STRING_BUFFER_SIZE];
+
+static uint32_t random_state = 0x12345678;
+static unsigned int failures = 0;
+
+/* xorshift, so runs are repeatable */
+static uint32_t random_next() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static void random_fill(unsigned char *buffer, size_t length) {
+    for (size_t index = 0; index < length; index++) {
+        buffer[index] = random_next();
+    }
+}
+
+static void bytewise_copy(unsigned char *destination, const unsigned char *source, size_t length) {
+    for (size_t index = 0; index < length; index++) {
+        destination[index] = source[index];
+    }
+}
+
+static bool buffers_equal(const unsigned char *first, const unsigned char *second, size_t length) {
+    for (size_t index = 0; index < length; index++) {
+        if (first[index] != second[index]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void report_failure(const char *function, size_t length, size_t destination_offset, size_t source_offset) {
+    if (failures++ < 16) {
+        printf("FAIL %s: length %zu, destination offset %zu, source offset %zu\n", function, length, destination_offset, source_offset);
+    }
+}
+
+static double seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* one length at one pair of alignments, for each copy and fill implementation and the rest of the string functions */
+static void fuzz_one(size_t length, size_t destination_offset, size_t source_offset) {
+    static const struct {
+        const char *name;
+        void *(*copy)(void *, const void *, size_t);
+        void *(*fill)(void *, unsigned char, size_t);
+    } implementations[] = {
+        {"memcpy/memset", memcpy, memset},
+        {"memcpy_rep/memset_rep", memcpy_rep, memset_rep},
+        {"memcpy_sse2/memset_sse2", memcpy_sse2, memset_sse2},
+    };
+    unsigned char *destination = destination_buffer + STRING_GUARD + destination_offset;
+    unsigned char *source = source_buffer + STRING_GUARD + source_offset;
+    unsigned char *reference = reference_buffer + STRING_GUARD + destination_offset;
+    size_t span = length + 2 * STRING_GUARD + STRING_ALIGNMENTS; /* all that can be touched, guards included */
+
+    for (size_t index = 0; index < sizeof(implementations) / sizeof(implementations[0]); index++) {
+        random_fill(source_buffer, span);
+        random_fill(destination_buffer, span);
+        bytewise_copy(reference_buffer, destination_buffer, span);
+        bytewise_copy(reference, source, length);
+        if (implementations[index].copy(destination, source, length) != destination || !buffers_equal(destination_buffer, reference_buffer, span)) {
+            report_failure(implementations[index].name, length, destination_offset, source_offset);
+        }
+
+        unsigned char character = random_next();
+        for (size_t offset = 0; offset < length; offset++) {
+            reference[offset] = character;
+        }
+        if (implementations[index].fill(destination, character, length) != destination || !buffers_equal(destination_buffer, reference_buffer, span)) {
+            report_failure(implementations[index].name, length, destination_offset, 0);
+        }
+    }
+
+    /* memmove within one buffer, the source at the source offset and the destination at the destination offset, so they overlap either way round */
+    random_fill(destination_buffer, span);
+    bytewise_copy(reference_buffer, destination_buffer, span);
+    bytewise_copy(source_buffer, destination_buffer + STRING_GUARD + source_offset, length);
+    bytewise_copy(reference, source_buffer, length);
+    if (memmove(destination, destination_buffer + STRING_GUARD + source_offset, length) != destination || !buffers_equal(destination_buffer, reference_buffer, span)) {
+        report_failure("memmove", length, destination_offset, source_offset);
+    }
+
+    /* memcmp agrees on equality, and on the sign of the first difference */
+    bytewise_copy(destination, source, length);
+    if (memcmp(destination, source, length) != 0) {
+        report_failure("memcmp", length, destination_offset, source_offset);
+    }
+    if (length > 0) {
+        size_t difference = random_next() % length;
+        destination[difference] = source[difference] + 1 + random_next() % 255;
+        int expected = destination[difference] - source[difference];
+        int result = memcmp(destination, source, length);
+        if (result == 0 || (result < 0) != (expected < 0)) {
+            report_failure("memcmp", length, destination_offset, source_offset);
+        }
+    }
+
+    /* strlen and strcmp on a string with no zero bytes before its end */
+    for (size_t index = 0; index < length; index++) {
+        destination[index] = 'a' + index % 26;
+        source[index] = 'a' + index % 26;
+    }
+    destination[length] = 0;
+    source[length] = 0;
+    if (strlen((char *)destination) != length) {
+        report_failure("strlen", length, destination_offset, 0);
+    }
+    if (strcmp((char *)destination, (char *)source) != 0) {
+        report_failure("strcmp", length, destination_offset, source_offset);
+    }
+}
+
+static void fuzz_lengths(const char *pass) {
+    unsigned int before = failures;
+
+    for (size_t length = 0; length <= STRING_EXHAUSTIVE_LENGTH; length++) {
+        for (size_t destination_offset = 0; destination_offset < STRING_ALIGNMENTS; destination_offset++) {
+            for (size_t source_offset = 0; source_offset < STRING_ALIGNMENTS; source_offset++) {
+                fuzz_one(length, destination_offset, source_offset);
+            }
+        }
+    }
+    for (unsigned int run = 0; run < STRING_RANDOM_RUNS; run++) {
+        fuzz_one(random_next() % (STRING_MAX_LENGTH + 1), random_next() % STRING_ALIGNMENTS, random_next() % STRING_ALIGNMENTS);
+    }
+
+    printf("string fuzz (%s): %s\n", pass, failures == before ? "passed" : "FAILED");
+}
+
+static void *bytewise_copy_function(void *destination, const void *source, size_t length) {
+    bytewise_copy(destination, source, length);
+    return destination;
+}
+
+/* megabytes per second for one implementation copying length bytes at a time at the given alignments, or filling if copy is 0 */
+static double throughput(void *(*copy)(void *, const void *, size_t), void *(*fill)(void *, unsigned char, size_t), size_t length, size_t destination_offset, size_t source_offset) {
+    unsigned char *destination = destination_buffer + STRING_GUARD + destination_offset;
+    unsigned char *source = source_buffer + STRING_GUARD + source_offset;
+    size_t calls = STRING_BENCHMARK_BYTES / length;
+
+    double start = seconds();
+    for (size_t call = 0; call < calls; call++) {
+        if (copy) {
+            copy(destination, source, length);
+        } else {
+            fill(destination, call, length);
+        }
+        __asm__ volatile ("" : : : "memory");
+    }
+
+    return calls * length / (seconds() - start) / 1e6;
+}
+
+static void benchmark_string() {
+    static const size_t lengths[] = {16, 64, 256, 1024, 4096, 16384};
+    static const size_t offsets[][2] = {{0, 0}, {1, 0}, {0, 3}, {5, 7}};
+
+    printf("\n  bytes  dst/src  bytewise      memcpy  memcpy_sse2      memset  memset_sse2 (MB/s)\n");
+    for (size_t length_index = 0; length_index < sizeof(lengths) / sizeof(lengths[0]); length_index++) {
+        for (size_t offset_index = 0; offset_index < sizeof(offsets) / sizeof(offsets[0]); offset_index++) {
+            size_t length = lengths[length_index];
+            size_t destination_offset = offsets[offset_index][0];
+            size_t source_offset = offsets[offset_index][1];
+
+            printf("  %5zu  %zu/%zu  %10.0f  %10.0f  %11.0f  %10.0f  %11.0f\n", length, destination_offset, source_offset,
+                throughput(bytewise_copy_function, 0, length, destination_offset, source_offset),
+                throughput(memcpy_rep, 0, length, destination_offset, source_offset),
+                throughput(memcpy_sse2, 0, length, destination_offset, source_offset),
+                throughput(0, memset_rep, length, destination_offset, 0),
+                throughput(0, memset_sse2, length, destination_offset, 0));
+        }
+    }
+}
+
+/* the original mini_itoa from mini-printf, the baseline for mini_utoa */
+static unsigned int reference_itoa(int value, unsigned int radix, unsigned int uppercase, unsigned int unsig, char *buffer, unsigned int zero_pad) {
+    char *pbuffer = buffer;
+    int negative = 0;
+    unsigned int i, len;
+
+    if (radix > 16) {
+        return 0;
+    }
+
+    if (value < 0 && !unsig) {
+        negative = 1;
+        value = -value;
+    }
+
+    do {
+        int digit = value % radix;
+        *(pbuffer++) = (digit < 10 ? '0' + digit : (uppercase ? 'A' : 'a') + digit - 10);
+        value /= radix;
+    } while (value > 0);
+
+    for (i = (pbuffer - buffer); i < zero_pad; i++) {
+        *(pbuffer++) = '0';
+    }
+
+    if (negative) {
+        *(pbuffer++) = '-';
+    }
+
+    *(pbuffer) = '\0';
+
+    len = (pbuffer - buffer);
+    for (i = 0; i < len / 2; i++) {
+        char j = buffer[i];
+        buffer[i] = buffer[len - i - 1];
+        buffer[len - i - 1] = j;
+    }
+
+    return len;
+}
+
+/* a value with a random number of significant bits, so every digit count comes up */
+static unsigned long long random_value() {
+    unsigned long long value = ((unsigned long long)random_next() << 32) | random_next();
+    unsigned int bits = random_next() % 65;
+
+    return bits == 64 ? value : value & ((1ULL << bits) - 1);
+}
+
+static void test_format() {
+    static const struct {
+        unsigned int radix;
+        unsigned int uppercase;
+        const char *format;
+    } radixes[] = {{8, 0, "%llo"}, {10, 0, "%llu"}, {16, 0, "%llx"}, {16, 1, "%llX"}};
+    unsigned int before = failures;
+    char expected[32];
+    char buffer[32];
+
+    for (unsigned int index = 0; index < FORMAT_TEST_VALUES; index++) {
+        unsigned long long value = index < 2 ? (index ? ~0ULL : 0) : random_value();
+
+        for (unsigned int radix = 0; radix < sizeof(radixes) / sizeof(radixes[0]); radix++) {
+            char *end = buffer + sizeof(buffer) - 1;
+            *end = 0;
+            char *digits = mini_utoa(value, radixes[radix].radix, radixes[radix].uppercase, end);
+
+            snprintf(expected, sizeof(expected), radixes[radix].format, value);
+            if (!buffers_equal((unsigned char *)digits, (unsigned char *)expected, strlen(expected) + 1)) {
+                if (failures++ < 16) {
+                    printf("FAIL mini_utoa: %s radix %u, expected %s\n", digits, radixes[radix].radix, expected);
+                }
+            }
+        }
+    }
+
+    printf("mini_utoa against printf: %s\n", failures == before ? "passed" : "FAILED");
+}
+
+/* nanoseconds per conversion for the old and new converters, on values the old one can handle, and for mini_utoa on 64 bit values */
+static void benchmark_format() {
+    static unsigned int small_values[FORMAT_BENCHMARK_VALUES];
+    static unsigned long long large_values[FORMAT_BENCHMARK_VALUES];
+    static const unsigned int radixes[] = {8, 10, 16};
+    volatile unsigned int sink = 0;
+    char buffer[32];
+
+    for (unsigned int index = 0; index < FORMAT_BENCHMARK_VALUES; index++) {
+        small_values[index] = random_value() & 0x7FFFFFFF;
+        large_values[index] = random_value();
+    }
+
+    printf("\n  radix  mini_itoa  mini_utoa  mini_utoa 64 bit (ns per conversion)\n");
+    for (unsigned int radix = 0; radix < sizeof(radixes) / sizeof(radixes[0]); radix++) {
+        double timings[3];
+
+        for (unsigned int kind = 0; kind < 3; kind++) {
+            double start = seconds();
+            for (unsigned int round = 0; round < FORMAT_BENCHMARK_ROUNDS; round++) {
+                for (unsigned int index = 0; index < FORMAT_BENCHMARK_VALUES; index++) {
+                    if (kind == 0) {
+                        sink += reference_itoa(small_values[index], radixes[radix], 0, 1, buffer, 0);
+                    } else {
+                        unsigned long long value = kind == 1 ? small_values[index] : large_values[index];
+                        sink += *mini_utoa(value, radixes[radix], 0, buffer + sizeof(buffer));
+                    }
+                }
+            }
+            timings[kind] = (seconds() - start) * 1e9 / (FORMAT_BENCHMARK_ROUNDS * FORMAT_BENCHMARK_VALUES);
+        }
+
+        printf("  %5u  %9.1f  %9.1f  %16.1f\n", radixes[radix], timings[0], timings[1], timings[2]);
+    }
+}
+
+int main() {
+    fuzz_lengths("rep string");
+    string_set_large_implementations(memcpy_sse2, memset_sse2);
+    fuzz_lengths("SSE2 for large sizes");
+    string_set_large_implementations(0, 0);
+    test_format();
+
+    if (failures) {
+        printf("%u failures\n", failures);
+        return 1;
+    }
+
+    benchmark_string();
+    benchmark_format();
+
+    return 0;
+}
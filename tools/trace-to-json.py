@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+"""
+Convert the binary trace written by trace_dump_binary (src/kernel/trace.c) in to Chrome trace event JSON, which loads
+in chrome://tracing or ui.perfetto.dev.
+
+The input is a capture of COM1, so the dump is found by its magic among the ordinary console text. The magic bytes can
+also turn up inside a dump's events or in console text, so the capture is scanned forward from the first magic and a
+candidate only counts as a dump if its header is sane and everything it promises fits in the capture, with every event
+naming a known subsystem and name. Scanning carries on after the end of each dump found, and if the capture holds more
+than one the last one is used.
+
+usage: trace-to-json.py serial.log trace.json
+"""
+
+import json
+import struct
+import sys
+
+MAGIC = b"VTRC"
+VERSION = 1
+HEADER = struct.Struct("<4sHBBIHHI")
+EVENT = struct.Struct("<QBBH")
+PHASES = {0: "B", 1: "E", 2: "i"}
+UNKNOWN_NAME = 0xFFFF  # names past TRACE_NAME_LIMIT
+
+
+def read_name(data, offset):
+    length = data[offset]
+    return data[offset + 1:offset + 1 + length].decode("ascii", "replace"), offset + 1 + length
+
+
+def read_dump(data, start):
+    """the dump whose header is at start as (subsystems, names, tsc_khz, events offset, event count, end), or None"""
+    if start + HEADER.size > len(data):
+        return None
+
+    magic, version, subsystem_count, reserved, tsc_khz, name_count, reserved_2, event_count = HEADER.unpack_from(data, start)
+    if magic != MAGIC or version != VERSION or reserved or reserved_2 or subsystem_count == 0 or tsc_khz == 0:
+        return None
+
+    offset = start + HEADER.size
+    subsystems = []
+    names = []
+    for count, found in ((subsystem_count, subsystems), (name_count, names)):
+        for _ in range(count):
+            if offset >= len(data) or offset + 1 + data[offset] > len(data):
+                return None
+            name, offset = read_name(data, offset)
+            found.append(name)
+
+    end = offset + event_count * EVENT.size
+    if end > len(data):
+        return None
+
+    for index in range(event_count):
+        _, event_type, subsystem, name_index = EVENT.unpack_from(data, offset + index * EVENT.size)
+        if event_type not in PHASES or subsystem >= subsystem_count or (name_index >= name_count and name_index != UNKNOWN_NAME):
+            return None
+
+    return subsystems, names, tsc_khz, offset, event_count, end
+
+
+def find_dump(data):
+    """the last valid dump in the capture"""
+    dump = None
+    start = data.find(MAGIC)
+    while start >= 0:
+        candidate = read_dump(data, start)
+        if candidate is not None:
+            dump = candidate
+            start = data.find(MAGIC, candidate[-1])
+        else:
+            start = data.find(MAGIC, start + 1)
+
+    if dump is None:
+        raise ValueError("no trace dump found" if MAGIC not in data else "no valid trace dump found")
+    return dump
+
+
+def parse(data):
+    subsystems, names, tsc_khz, offset, event_count, _ = find_dump(data)
+
+    events = []
+    first_timestamp = None
+    for index in range(event_count):
+        timestamp, event_type, subsystem, name_index = EVENT.unpack_from(data, offset + index * EVENT.size)
+        if first_timestamp is None:
+            first_timestamp = timestamp
+
+        event = {
+            "name": names[name_index] if name_index < len(names) else "unknown",
+            "cat": subsystems[subsystem],
+            "ph": PHASES[event_type],
+            "ts": (timestamp - first_timestamp) * 1000.0 / tsc_khz,
+            "pid": 1,
+            "tid": 1,
+        }
+        if event["ph"] == "i":
+            event["s"] = "g"
+        events.append(event)
+
+    return {"traceEvents": events, "displayTimeUnit": "ns", "otherData": {"tsc_khz": tsc_khz}}
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__.strip().splitlines()[-1])
+
+    with open(sys.argv[1], "rb") as capture:
+        trace = parse(capture.read())
+
+    with open(sys.argv[2], "w") as output:
+        json.dump(trace, output, indent=1)
+
+    print("%u events written to %s" % (len(trace["traceEvents"]), sys.argv[2]))
+
+
+if __name__ == "__main__":
+    main()